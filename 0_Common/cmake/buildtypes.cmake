@@ -0,0 +1,78 @@
+# Build types shared by every project, chosen with -DCMAKE_BUILD_TYPE.
+# Release is -O3 with link time optimization. Binaries run on any cpu of
+# the target architecture unless CALC_MARCH names one: configure with
+# -DCALC_MARCH=native for a build tuned to, and only runnable on, this
+# machine, or a baseline such as x86-64-v3 to share it across a fleet.
+# Profile optimizes like a release but keeps every frame pointer and debug
+# info, so threadcalc -p and perf can walk whole stacks.
+# CALC_PGO selects the stage of a profile guided build, see pgo.sh:
+# GENERATE instruments the binaries to write profiles into CALC_PGO_DIR,
+# USE rebuilds from them.
+
+include_guard(GLOBAL)
+include(CheckCCompilerFlag)
+include(CheckIPOSupported)
+
+# an unset build type used to mean no optimization at all
+if (NOT CMAKE_BUILD_TYPE AND NOT CMAKE_CONFIGURATION_TYPES)
+    if (DEBUG EQUAL "1")
+        set(CMAKE_BUILD_TYPE Debug CACHE STRING "Build type." FORCE)
+    else()
+        set(CMAKE_BUILD_TYPE Release CACHE STRING "Build type." FORCE)
+    endif()
+endif()
+set_property(CACHE CMAKE_BUILD_TYPE PROPERTY STRINGS Debug Release RelWithDebInfo MinSizeRel Profile)
+
+# project() already made empty cache entries for an unknown build type, so
+# they are filled in only while still empty to keep a user's own flags
+if (NOT CMAKE_C_FLAGS_PROFILE)
+    set(CMAKE_C_FLAGS_PROFILE "-O2 -g -fno-omit-frame-pointer -mno-omit-leaf-frame-pointer"
+        CACHE STRING "Flags used by the C compiler for Profile builds." FORCE)
+endif()
+set(CMAKE_EXE_LINKER_FLAGS_PROFILE "" CACHE STRING "Flags used by the linker for Profile builds.")
+set(CMAKE_SHARED_LINKER_FLAGS_PROFILE "" CACHE STRING "Flags used by the linker for Profile shared libraries.")
+mark_as_advanced(CMAKE_C_FLAGS_PROFILE CMAKE_EXE_LINKER_FLAGS_PROFILE CMAKE_SHARED_LINKER_FLAGS_PROFILE)
+
+# CMake's Release flags are already -O3 -DNDEBUG
+option(CALC_LTO "Link time optimization in Release builds." ON)
+set(lto_flag "")
+if (CALC_LTO)
+    if (NOT DEFINED CALC_LTO_SUPPORTED)
+        check_ipo_supported(RESULT lto_supported OUTPUT lto_error LANGUAGES C)
+        set(CALC_LTO_SUPPORTED ${lto_supported} CACHE INTERNAL "")
+    endif()
+    if (CALC_LTO_SUPPORTED)
+        set(CMAKE_INTERPROCEDURAL_OPTIMIZATION_RELEASE ON)
+        set(lto_flag "lto")
+    endif()
+endif()
+
+set(CALC_MARCH "" CACHE STRING "-march used by Release builds, e.g. native or x86-64-v3. Empty for the compiler's default.")
+set(march_flag "")
+if (CALC_MARCH)
+    string(MAKE_C_IDENTIFIER "HAVE_MARCH_${CALC_MARCH}" march_supported)
+    check_c_compiler_flag(-march=${CALC_MARCH} ${march_supported})
+    if (${march_supported})
+        set(march_flag "-march=${CALC_MARCH}")
+        add_compile_options($<$<CONFIG:Release>:${march_flag}>)
+    endif()
+endif()
+
+set(CALC_PGO "" CACHE STRING "Profile guided optimization stage: empty, GENERATE or USE.")
+set_property(CACHE CALC_PGO PROPERTY STRINGS "" GENERATE USE)
+set(CALC_PGO_DIR "${CMAKE_BINARY_DIR}/pgo" CACHE PATH "Directory the GENERATE stage writes profiles to.")
+if (CALC_PGO AND NOT CMAKE_C_COMPILER_ID STREQUAL "GNU")
+    message(WARNING "CALC_PGO needs gcc, ignored for ${CMAKE_C_COMPILER_ID}")
+elseif (CALC_PGO STREQUAL "GENERATE")
+    # threads share the counters, so they are updated atomically
+    add_compile_options(-fprofile-generate=${CALC_PGO_DIR} -fprofile-update=atomic)
+    add_link_options(-fprofile-generate=${CALC_PGO_DIR})
+elseif (CALC_PGO STREQUAL "USE")
+    # code the training run never reached is still optimized as usual
+    add_compile_options(-fprofile-use=${CALC_PGO_DIR} -fprofile-partial-training -fprofile-correction
+        -Wno-missing-profile)
+elseif (CALC_PGO)
+    message(FATAL_ERROR "CALC_PGO must be empty, GENERATE or USE, not ${CALC_PGO}")
+endif()
+
+message("build type: ${CMAKE_BUILD_TYPE} ${lto_flag} ${march_flag} ${CALC_PGO}")
@@ -0,0 +1,31 @@
+# Optional decompressors for .equ inputs read through eqstream.c. Each codec
+# is compiled in only when both its header and library are found.
+# Sets EQSTREAM_SOURCES, EQSTREAM_DEFINITIONS and EQSTREAM_LIBRARIES.
+
+set(EQSTREAM_SOURCES ${CMAKE_CURRENT_LIST_DIR}/../src/eqstream.c)
+set(EQSTREAM_DEFINITIONS "")
+set(EQSTREAM_LIBRARIES "")
+
+find_package(ZLIB QUIET)
+if (ZLIB_FOUND)
+    list(APPEND EQSTREAM_DEFINITIONS HAVE_ZLIB)
+    list(APPEND EQSTREAM_LIBRARIES ZLIB::ZLIB)
+endif()
+
+find_path(ZSTD_INCLUDE_DIR zstd.h)
+find_library(ZSTD_LIBRARY zstd)
+if (ZSTD_INCLUDE_DIR AND ZSTD_LIBRARY)
+    list(APPEND EQSTREAM_DEFINITIONS HAVE_ZSTD)
+    list(APPEND EQSTREAM_LIBRARIES ${ZSTD_LIBRARY})
+    include_directories(${ZSTD_INCLUDE_DIR})
+endif()
+
+find_path(LZ4_INCLUDE_DIR lz4frame.h)
+find_library(LZ4_LIBRARY lz4)
+if (LZ4_INCLUDE_DIR AND LZ4_LIBRARY)
+    list(APPEND EQSTREAM_DEFINITIONS HAVE_LZ4)
+    list(APPEND EQSTREAM_LIBRARIES ${LZ4_LIBRARY})
+    include_directories(${LZ4_INCLUDE_DIR})
+endif()
+
+message("eqstream codecs: raw ${EQSTREAM_DEFINITIONS}")
@@ -0,0 +1,15 @@
+# USDT probes for perf and bpftrace. They are compiled in only when the
+# systemtap sys/sdt.h header is found, otherwise the PROBE macros in
+# probes.h expand to nothing.
+# Sets PROBES_DEFINITIONS.
+
+include(CheckIncludeFile)
+
+set(PROBES_DEFINITIONS "")
+
+check_include_file(sys/sdt.h HAVE_SYS_SDT_H)
+if (HAVE_SYS_SDT_H)
+    list(APPEND PROBES_DEFINITIONS HAVE_SDT)
+endif()
+
+message("usdt probes: ${PROBES_DEFINITIONS}")
@@ -0,0 +1,91 @@
+#ifndef _EQSTREAM_H
+#define _EQSTREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * @brief size of the compressed input buffer kept by a stream
+ * 
+ */
+#define EQSTREAM_CHUNK 65536
+
+/**
+ * @brief codecs an eqstream can detect. Compressed codecs are only
+ * decoded when the build found their library (HAVE_ZLIB, HAVE_ZSTD,
+ * HAVE_LZ4)
+ * 
+ */
+enum eqstream_codec
+{
+    EQSTREAM_RAW = 0,
+    EQSTREAM_GZIP,
+    EQSTREAM_ZSTD,
+    EQSTREAM_LZ4
+};
+
+typedef struct eqstream eqstream_t;
+
+/**
+ * @brief sniffs the first bytes of fd for a gzip, zstd or lz4 frame magic
+ * and opens a stream that reads .equ bytes through the matching decoder.
+ * Anything else is passed through raw. Works on pipes and sockets, nothing
+ * is ever seeked
+ * 
+ * @param fd file descriptor positioned at the start of the .equ data
+ * @return eqstream_t* stream on success, NULL if fd could not be read or
+ * the codec is not compiled in
+ */
+eqstream_t *eqstream_open(int fd);
+
+/**
+ * @brief opens a stream over a .equ file already held in memory, such as a
+ * NetCalc upload. buf is not copied and must outlive the stream
+ * 
+ * @param buf raw or compressed .equ bytes
+ * @param len size of buf
+ * @return eqstream_t* stream on success, NULL if the codec is not compiled
+ * in
+ */
+eqstream_t *eqstream_open_mem(const void *buf, size_t len);
+
+/**
+ * @brief reads up to len decompressed bytes straight into buf, retrying
+ * until len bytes are read or the input ends
+ * 
+ * @param stream stream to read from
+ * @param buf destination, typically the equation parser's buffer
+ * @param len bytes wanted
+ * @return ssize_t bytes read, 0 at end of input, -1 on a corrupt frame or
+ * read error
+ */
+ssize_t eqstream_read(eqstream_t *stream, void *buf, size_t len);
+
+/**
+ * @brief discards count decompressed bytes. Used in place of lseek to reach
+ * the header's equation offset
+ * 
+ * @param stream stream to skip in
+ * @param count bytes to discard
+ * @return int 1 if all bytes were skipped, 0 otherwise
+ */
+int eqstream_skip(eqstream_t *stream, uint64_t count);
+
+/**
+ * @brief returns the codec detected when the stream was opened
+ * 
+ * @param stream stream to query
+ * @return enum eqstream_codec codec in use
+ */
+enum eqstream_codec eqstream_codec(eqstream_t *stream);
+
+/**
+ * @brief frees the stream and its decoder. Does not close the fd or free
+ * the buffer of a memory stream
+ * 
+ * @param stream stream to free
+ */
+void eqstream_close(eqstream_t *stream);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef _PROBES_H
+#define _PROBES_H
+
+/**
+ * @brief USDT probes. With HAVE_SDT each PROBEn is a STAP_PROBEn from
+ * sys/sdt.h: a single nop at the probe site plus a .note.stapsdt entry
+ * naming it, so a probe costs nothing until perf or bpftrace attaches, e.g.
+ *
+ *     bpftrace -e 'usdt:./threadcalc:threadcalc:file__done { @[arg1] = count(); }'
+ *
+ * Without HAVE_SDT the probes compile away. Their arguments are only cast
+ * to void to keep variables used, so they must not have side effects.
+ * Probes and their arguments:
+ *
+ * threadcalc:file__start(file id, file name)
+ * threadcalc:file__done(file id, equations solved)
+ * equation:batch__start(equations, count)
+ * equation:batch__done(count, equations solved)
+ * threadpool:push__work(item, node, items queued in the pool)
+ * threadpool:pull__work(item, node, nanoseconds it waited)
+ * netcalc:conn__accept(fd, client IPv4 address, shard)
+ * netcalc:request__header(fd, request id, msgtype, payload bytes, status)
+ * netcalc:response__sent(fd, request id, status, bytes, nanoseconds since
+ * the header began)
+ */
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+#define PROBE2(provider, name, a, b) STAP_PROBE2(provider, name, a, b)
+#define PROBE3(provider, name, a, b, c) STAP_PROBE3(provider, name, a, b, c)
+#define PROBE5(provider, name, a, b, c, d, e) STAP_PROBE5(provider, name, a, b, c, d, e)
+#else
+#define PROBE2(provider, name, a, b) ((void)(a), (void)(b))
+#define PROBE3(provider, name, a, b, c) ((void)(a), (void)(b), (void)(c))
+#define PROBE5(provider, name, a, b, c, d, e) ((void)(a), (void)(b), (void)(c), (void)(d), (void)(e))
+#endif
+
+#endif
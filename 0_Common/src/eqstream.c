@@ -0,0 +1,386 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../include/eqstream.h"
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+#define GZIP_MAGIC 0x8b1f
+#define ZSTD_MAGIC 0xfd2fb528
+#define LZ4_MAGIC 0x184d2204
+
+static const char *codec_names[] = {"raw", "gzip", "zstd", "lz4"};
+
+/**
+ * @brief a .equ byte stream over a file descriptor or a memory buffer.
+ * Compressed input is buffered in `in` and decoded straight into the
+ * caller's buffer. Memory streams point `in` at the caller's bytes and
+ * have no chunk of their own
+ *
+ */
+struct eqstream
+{
+    int fd;
+    enum eqstream_codec codec;
+    int eof;
+    int midframe;
+    size_t inpos;
+    size_t inlen;
+#ifdef HAVE_ZLIB
+    z_stream z;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_DStream *zstd;
+#endif
+#ifdef HAVE_LZ4
+    LZ4F_dctx *lz4;
+#endif
+    uint8_t *in;
+    uint8_t chunk[];
+};
+
+/**
+ * @brief compacts the input buffer and reads from fd until at least want
+ * bytes are buffered or the fd reaches end of file
+ *
+ * @param stream stream to fill
+ * @param want bytes wanted in the buffer
+ * @return ssize_t bytes buffered, -1 on read error
+ */
+static ssize_t fill_input(eqstream_t *stream, size_t want)
+{
+    if (stream->eof)
+    {
+        return stream->inlen - stream->inpos;
+    }
+    if (stream->inpos > 0)
+    {
+        memmove(stream->in, stream->in + stream->inpos, stream->inlen - stream->inpos);
+        stream->inlen -= stream->inpos;
+        stream->inpos = 0;
+    }
+    while (stream->inlen < want && !stream->eof)
+    {
+        ssize_t rv = read(stream->fd, stream->in + stream->inlen, EQSTREAM_CHUNK - stream->inlen);
+        if (rv < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (rv < 0)
+        {
+            return -1;
+        }
+        if (rv == 0)
+        {
+            stream->eof = 1;
+        }
+        stream->inlen += rv;
+    }
+    return stream->inlen;
+}
+
+/**
+ * @brief passes buffered bytes then reads fd directly into buf
+ *
+ */
+static ssize_t read_raw(eqstream_t *stream, uint8_t *buf, size_t len)
+{
+    size_t produced = stream->inlen - stream->inpos;
+    if (produced > len)
+    {
+        produced = len;
+    }
+    memcpy(buf, stream->in + stream->inpos, produced);
+    stream->inpos += produced;
+    while (produced < len && !stream->eof)
+    {
+        ssize_t rv = read(stream->fd, buf + produced, len - produced);
+        if (rv < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (rv < 0)
+        {
+            return -1;
+        }
+        if (rv == 0)
+        {
+            stream->eof = 1;
+        }
+        produced += rv;
+    }
+    return produced;
+}
+
+/**
+ * @brief runs one step of the stream's decoder over the buffered input
+ *
+ * @param stream stream to decode
+ * @param buf output buffer
+ * @param len space left in buf
+ * @param consumed set to the input bytes the decoder used
+ * @return ssize_t bytes written to buf, -1 on a corrupt frame
+ */
+static ssize_t decode_step(eqstream_t *stream, uint8_t *buf, size_t len, size_t *consumed)
+{
+    uint8_t *src = stream->in + stream->inpos;
+    size_t srclen = stream->inlen - stream->inpos;
+    ssize_t produced = -1;
+    *consumed = 0;
+    switch (stream->codec)
+    {
+#ifdef HAVE_ZLIB
+    case EQSTREAM_GZIP:
+    {
+        stream->z.next_in = src;
+        stream->z.avail_in = srclen;
+        stream->z.next_out = buf;
+        stream->z.avail_out = len;
+        int rv = inflate(&stream->z, Z_NO_FLUSH);
+        *consumed = srclen - stream->z.avail_in;
+        if (rv == Z_STREAM_END)
+        {
+            // concatenated gzip members decode as one stream
+            inflateReset(&stream->z);
+            stream->midframe = 0;
+            produced = len - stream->z.avail_out;
+        }
+        else if (rv == Z_OK || rv == Z_BUF_ERROR)
+        {
+            stream->midframe |= *consumed > 0;
+            produced = len - stream->z.avail_out;
+        }
+        break;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    case EQSTREAM_ZSTD:
+    {
+        ZSTD_inBuffer input = {src, srclen, 0};
+        ZSTD_outBuffer output = {buf, len, 0};
+        size_t rv = ZSTD_decompressStream(stream->zstd, &output, &input);
+        *consumed = input.pos;
+        if (!ZSTD_isError(rv))
+        {
+            stream->midframe = rv != 0;
+            produced = output.pos;
+        }
+        break;
+    }
+#endif
+#ifdef HAVE_LZ4
+    case EQSTREAM_LZ4:
+    {
+        size_t dstlen = len;
+        size_t srcused = srclen;
+        size_t rv = LZ4F_decompress(stream->lz4, buf, &dstlen, src, &srcused, NULL);
+        *consumed = srcused;
+        if (!LZ4F_isError(rv))
+        {
+            stream->midframe = rv != 0;
+            produced = dstlen;
+        }
+        break;
+    }
+#endif
+    default:
+        break;
+    }
+    return produced;
+}
+
+/**
+ * @brief decodes compressed input into buf until it is full or the input
+ * ends. Input is only read once the decoder stops making progress, so
+ * output the decoder is still holding is never dropped
+ *
+ */
+static ssize_t read_compressed(eqstream_t *stream, uint8_t *buf, size_t len)
+{
+    size_t produced = 0;
+    while (produced < len)
+    {
+        size_t consumed = 0;
+        ssize_t rv = decode_step(stream, buf + produced, len - produced, &consumed);
+        if (rv < 0)
+        {
+            printf("Corrupt compressed equation stream!\n");
+            return -1;
+        }
+        stream->inpos += consumed;
+        produced += rv;
+        if (rv == 0 && consumed == 0)
+        {
+            size_t buffered = stream->inlen - stream->inpos;
+            if (stream->eof || buffered == EQSTREAM_CHUNK)
+            {
+                break;
+            }
+            if (fill_input(stream, buffered + 1) < 0)
+            {
+                return -1;
+            }
+        }
+    }
+    if (produced == 0 && stream->midframe)
+    {
+        printf("Truncated compressed equation stream!\n");
+        return -1;
+    }
+    return produced;
+}
+
+/**
+ * @brief sniffs the buffered input for a frame magic and sets up the
+ * matching decoder. Frees the stream if the codec is not compiled in
+ *
+ */
+static eqstream_t *open_codec(eqstream_t *stream)
+{
+    uint32_t magic = 0;
+    if (stream->inlen >= sizeof(magic))
+    {
+        magic = (uint32_t)stream->in[0] | (uint32_t)stream->in[1] << 8 |
+                (uint32_t)stream->in[2] << 16 | (uint32_t)stream->in[3] << 24;
+    }
+
+    int supported = 1;
+    if ((magic & 0xffff) == GZIP_MAGIC)
+    {
+        stream->codec = EQSTREAM_GZIP;
+#ifdef HAVE_ZLIB
+        supported = inflateInit2(&stream->z, 16 + MAX_WBITS) == Z_OK;
+#else
+        supported = 0;
+#endif
+    }
+    else if (magic == ZSTD_MAGIC)
+    {
+        stream->codec = EQSTREAM_ZSTD;
+#ifdef HAVE_ZSTD
+        stream->zstd = ZSTD_createDStream();
+        supported = NULL != stream->zstd && !ZSTD_isError(ZSTD_initDStream(stream->zstd));
+#else
+        supported = 0;
+#endif
+    }
+    else if (magic == LZ4_MAGIC)
+    {
+        stream->codec = EQSTREAM_LZ4;
+#ifdef HAVE_LZ4
+        supported = !LZ4F_isError(LZ4F_createDecompressionContext(&stream->lz4, LZ4F_VERSION));
+#else
+        supported = 0;
+#endif
+    }
+
+    if (!supported)
+    {
+        printf("Compressed input is not supported by this build! %s\n", codec_names[stream->codec]);
+        eqstream_close(stream);
+        stream = NULL;
+    }
+    return stream;
+}
+
+eqstream_t *eqstream_open(int fd)
+{
+    eqstream_t *stream = calloc(1, sizeof(eqstream_t) + EQSTREAM_CHUNK);
+    if (NULL == stream)
+    {
+        return NULL;
+    }
+    stream->fd = fd;
+    stream->in = stream->chunk;
+    if (fill_input(stream, sizeof(uint32_t)) < 0)
+    {
+        free(stream);
+        return NULL;
+    }
+    return open_codec(stream);
+}
+
+eqstream_t *eqstream_open_mem(const void *buf, size_t len)
+{
+    eqstream_t *stream = calloc(1, sizeof(eqstream_t));
+    if (NULL == stream || NULL == buf)
+    {
+        free(stream);
+        return NULL;
+    }
+    stream->fd = -1;
+    stream->eof = 1;
+    stream->in = (uint8_t *)buf;
+    stream->inlen = len;
+    return open_codec(stream);
+}
+
+ssize_t eqstream_read(eqstream_t *stream, void *buf, size_t len)
+{
+    if (NULL == stream || NULL == buf)
+    {
+        return -1;
+    }
+    if (stream->codec == EQSTREAM_RAW)
+    {
+        return read_raw(stream, buf, len);
+    }
+    return read_compressed(stream, buf, len);
+}
+
+int eqstream_skip(eqstream_t *stream, uint64_t count)
+{
+    uint8_t discard[4096];
+    while (count > 0)
+    {
+        size_t want = count < sizeof(discard) ? count : sizeof(discard);
+        ssize_t rv = eqstream_read(stream, discard, want);
+        if (rv <= 0)
+        {
+            return 0;
+        }
+        count -= rv;
+    }
+    return 1;
+}
+
+enum eqstream_codec eqstream_codec(eqstream_t *stream)
+{
+    return stream->codec;
+}
+
+void eqstream_close(eqstream_t *stream)
+{
+    if (NULL == stream)
+    {
+        return;
+    }
+#ifdef HAVE_ZLIB
+    if (stream->codec == EQSTREAM_GZIP && NULL != stream->z.state)
+    {
+        inflateEnd(&stream->z);
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (NULL != stream->zstd)
+    {
+        ZSTD_freeDStream(stream->zstd);
+    }
+#endif
+#ifdef HAVE_LZ4
+    if (NULL != stream->lz4)
+    {
+        LZ4F_freeDecompressionContext(stream->lz4);
+    }
+#endif
+    free(stream);
+}
@@ -205,7 +205,7 @@ int unsigned_value_check64(long operand)
  */
 int signedcalc(int64_t operand1, uint8_t operator, int64_t operand2, int64_t * write_result)
 {
-    int64_t result;
+    int64_t result = 0;
     int pass = 0;
     if (signed_value_check64(operand1) && signed_value_check64(operand2))
     {
@@ -274,7 +274,7 @@ int signedcalc(int64_t operand1, uint8_t operator, int64_t operand2, int64_t * w
  */
 int unsignedcalc(uint64_t operand1, uint8_t operator, uint64_t operand2, int64_t * write_result)
 {
-    uint64_t result;
+    uint64_t result = 0;
     int pass = 0;
     if (unsigned_value_check64(operand1) && unsigned_value_check64(operand1))
     {
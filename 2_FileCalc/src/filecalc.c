@@ -1,4 +1,5 @@
 #include "../../0_Common/include/common.h"
+#include "../../0_Common/include/eqstream.h"
 
 /**
  * @brief holds header information for files
@@ -107,7 +108,10 @@ void parse_file(char upath[], char spath[])
     }
     else
     {
-        if (read(ufd, &headerbuff, sizeof(headerbuff)) != sizeof(headerbuff))
+        eqstream_t *ustream = eqstream_open(ufd);
+        if (NULL == ustream || eqstream_read(ustream, &headerbuff, sizeof(headerbuff)) != sizeof(headerbuff) ||
+            le32toh(headerbuff.offset) < sizeof(headerbuff) ||
+            !eqstream_skip(ustream, le32toh(headerbuff.offset) - sizeof(headerbuff)))
         {
             printf("Malformed file. Due to header.\n");
         }
@@ -115,12 +119,11 @@ void parse_file(char upath[], char spath[])
         {
             headerbuff.flags = 1;
             write_header(sfd, &headerbuff);
-            lseek(ufd, le32toh(headerbuff.offset), SEEK_SET);
             for (int i = 0; i < le64toh(headerbuff.numeq); i++)
             {
                 struct unsolved_equation unsolveq;
                 struct solved_equation solveq;
-                if (read(ufd, &unsolveq, sizeof(struct unsolved_equation)) != sizeof(unsolveq))
+                if (eqstream_read(ustream, &unsolveq, sizeof(struct unsolved_equation)) != sizeof(unsolveq))
                 {
                     printf("Malformed file due to equation buffer\n");
                 }
@@ -177,6 +180,7 @@ void parse_file(char upath[], char spath[])
                 }
             }
         }
+        eqstream_close(ustream);
         close(ufd);
         close(sfd);
     }
@@ -48,6 +48,26 @@ typedef void *(*CMP_F)(const void *, const void *);
  */
 typedef void (*ACT_F)(void *);
 
+/**
+ * @brief A pointer to a user-defined function for ordering two data values.
+ *        Follows qsort() semantics: returns a negative value if the first
+ *        argument sorts before the second, 0 if they are equal and a positive
+ *        value if it sorts after.
+ *
+ */
+typedef int (*SORT_F)(const void *, const void *);
+
+/**
+ * @brief minimum number of nodes before list_sort_parallel() splits the list
+ *        across threads. Shorter lists are sorted on the calling thread.
+ */
+#define LIST_SORT_PARALLEL_MIN 65536
+
+/**
+ * @brief upper bound on the threads list_sort_parallel() will start
+ */
+#define LIST_SORT_MAX_THREADS 64
+
 /**
  * @brief structure of a list object
  *
@@ -190,13 +210,42 @@ list_node_t *list_find_first_occurrence(list_t *list, void **search_data);
 list_t *list_find_all_occurrences(list_t *list, void **search_data);
 
 /**
- * @brief sort list as per user defined compare function
+ * @brief sort list in ascending order of the int values its nodes point to
  *
  * @param list pointer to list to be sorted
  * @return 0 on success, non-zero value on failure
  */
 int list_sort(list_t *list);
 
+/**
+ * @brief stable O(n log n) merge sort of list as per user defined sort function
+ *
+ * @param list pointer to list to be sorted
+ * @param sort_function pointer to user defined ordering function
+ * @return 0 on success, non-zero value on failure
+ */
+int list_sort_by(list_t *list, SORT_F sort_function);
+
+/**
+ * @brief merge sort list using up to threadcount threads. Lists shorter than
+ *        LIST_SORT_PARALLEL_MIN are sorted on the calling thread
+ *
+ * @param list pointer to list to be sorted
+ * @param sort_function pointer to user defined ordering function
+ * @param threadcount max number of threads to sort with
+ * @return 0 on success, non-zero value on failure
+ */
+int list_sort_parallel(list_t *list, SORT_F sort_function, uint32_t threadcount);
+
+/**
+ * @brief Default Sort Function. Orders nodes by the int their data points to
+ *
+ * @param data1
+ * @param data2
+ * @return int
+ */
+int default_sort(const void *data1, const void *data2);
+
 /**
  * @brief clear all nodes out of a list
  *
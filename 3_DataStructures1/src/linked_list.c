@@ -1,5 +1,6 @@
 #include "../include/linked_list.h"
 #include <errno.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -355,66 +356,289 @@ list_t *list_find_all_occurrences(list_t *list, void **search_data)
 }
 
 /**
- * @brief sort list as per user defined compare function
+ * @brief Default Sort Function. Orders nodes by the int their data points to
+ *
+ * @param data1
+ * @param data2
+ * @return int
+ */
+int default_sort(const void *data1, const void *data2)
+{
+    int value1 = *(const int *)data1;
+    int value2 = *(const int *)data2;
+    return (value1 > value2) - (value1 < value2);
+}
+
+/**
+ * @brief merges two NULL terminated runs linked through next. Ties are taken
+ *        from left first so the sort stays stable
+ *
+ * @param left run holding the earlier nodes
+ * @param right run holding the later nodes
+ * @param sort_function pointer to user defined ordering function
+ * @return head of the merged run
+ */
+static list_node_t *merge_runs(list_node_t *left, list_node_t *right, SORT_F sort_function)
+{
+    list_node_t merged = {0};
+    list_node_t *tail = &merged;
+    while (NULL != left && NULL != right)
+    {
+        if (sort_function(left->data, right->data) <= 0)
+        {
+            tail->next = left;
+            left = left->next;
+        }
+        else
+        {
+            tail->next = right;
+            right = right->next;
+        }
+        tail = tail->next;
+    }
+    tail->next = (NULL != left) ? left : right;
+    return merged.next;
+}
+
+/**
+ * @brief bottom-up merge sort of a NULL terminated run. bins[i] holds a sorted
+ *        run of 2^i nodes, so each node is merged at most log2(size) times
+ *
+ * @param head first node of the run
+ * @param sort_function pointer to user defined ordering function
+ * @return head of the sorted run
+ */
+static list_node_t *merge_sort_run(list_node_t *head, SORT_F sort_function)
+{
+    list_node_t *bins[33] = {0};
+    list_node_t *sorted = NULL;
+    while (NULL != head)
+    {
+        list_node_t *carry = head;
+        head = head->next;
+        carry->next = NULL;
+        int bin = 0;
+        for (; NULL != bins[bin]; bin++)
+        {
+            carry = merge_runs(bins[bin], carry, sort_function);
+            bins[bin] = NULL;
+        }
+        bins[bin] = carry;
+    }
+    for (int bin = 0; bin < 33; bin++)
+    {
+        if (NULL != bins[bin])
+        {
+            sorted = merge_runs(bins[bin], sorted, sort_function);
+        }
+    }
+    return sorted;
+}
+
+/**
+ * @brief breaks the circular link so the list can be sorted as a NULL
+ *        terminated run
+ *
+ * @param list list to detach the nodes of
+ * @return head of the run
+ */
+static list_node_t *unlink_list(list_t *list)
+{
+    list->tail->next = NULL;
+    return list->head;
+}
+
+/**
+ * @brief rebuilds prev pointers, positions and the circular link of list
+ *        after its nodes have been rearranged through next
+ *
+ * @param list list to relink
+ * @param head first node of the sorted run
+ */
+static void relink_list(list_t *list, list_node_t *head)
+{
+    list_node_t *prev = NULL;
+    uint32_t position = 0;
+    list->head = head;
+    for (list_node_t *node = head; NULL != node; node = node->next)
+    {
+        node->prev = prev;
+        node->position = position++;
+        prev = node;
+    }
+    list->tail = prev;
+    list->tail->next = list->head;
+    list->head->prev = list->tail;
+}
+
+/**
+ * @brief sort list in ascending order of the int values its nodes point to
  *
  * @param list pointer to list to be sorted
  * @return 0 on success, non-zero value on failure
  */
 int list_sort(list_t *list)
 {
-    if (NULL != list)
-    {
-        list_node_t *travnode = list->head;
-        list_node_t *nexttrav = list->head->next;
+    return list_sort_by(list, default_sort);
+}
 
-        for (int moresort = 0; moresort < list->size; moresort++)
+/**
+ * @brief stable O(n log n) merge sort of list as per user defined sort function
+ *
+ * @param list pointer to list to be sorted
+ * @param sort_function pointer to user defined ordering function
+ * @return 0 on success, non-zero value on failure
+ */
+int list_sort_by(list_t *list, SORT_F sort_function)
+{
+    if (NULL != list && NULL != sort_function)
+    {
+        if (list->size > 1)
         {
-            travnode = list->head;
-            for (int listindex = 0; listindex < list->size; listindex++)
-            {
-                nexttrav = travnode->next;
-                if (*(int *)travnode->data > *(int *)nexttrav->data)
-                {
-                    if (list->head == travnode)
-                    {
-                        list->head = nexttrav;
-                        travnode->prev = nexttrav;
-                        nexttrav->prev = list->tail;
-                        travnode->next = nexttrav->next;
-                        nexttrav->next = travnode;
-                    }
-                    else if (list->tail == nexttrav)
-                    {
-                        list->tail = travnode;
-                        nexttrav->prev = travnode->prev;
-                        nexttrav->next = travnode;
-                        travnode->prev->next = nexttrav;
-                        travnode->prev = nexttrav;
-                        travnode->next = list->head;
-                        break;
-                    }
-                    else
-                    {
-                        travnode->prev->next = nexttrav;
-                        nexttrav->next->prev = travnode;
-                        nexttrav->prev = travnode->prev;
-                        travnode->next = nexttrav->next;
-                        travnode->prev = nexttrav;
-                        nexttrav->next = travnode;
-                    }
-                }
-                else
-                {
-                    travnode = travnode->next;
-                    break;
-                }
-            }
+            relink_list(list, merge_sort_run(unlink_list(list), sort_function));
         }
         return 0;
     }
     return -1;
 }
 
+/**
+ * @brief a slice of the list handed to a sorting thread
+ *
+ * @param head first node of the slice, replaced by the sorted head
+ * @param merge_with second slice to merge into head, NULL when sorting
+ * @param sort_function pointer to user defined ordering function
+ */
+typedef struct sort_slice_t
+{
+    list_node_t *head;
+    list_node_t *merge_with;
+    SORT_F sort_function;
+} sort_slice_t;
+
+/**
+ * @brief thread entry. Sorts a slice, or merges two sorted slices
+ *
+ * @param param pointer to sort_slice_t
+ * @return NULL
+ */
+static void *sort_slice(void *param)
+{
+    sort_slice_t *slice = param;
+    if (NULL == slice->merge_with)
+    {
+        slice->head = merge_sort_run(slice->head, slice->sort_function);
+    }
+    else
+    {
+        slice->head = merge_runs(slice->head, slice->merge_with, slice->sort_function);
+        slice->merge_with = NULL;
+    }
+    return NULL;
+}
+
+/**
+ * @brief runs sort_slice on each slice, one thread per slice. A slice whose
+ *        thread could not be started is handled on the calling thread
+ *
+ * @param slices array of slices to process
+ * @param count number of slices
+ */
+static void run_slices(sort_slice_t *slices, uint32_t count)
+{
+    pthread_t threads[count];
+    int started[count];
+    for (uint32_t index = 0; index < count; index++)
+    {
+        started[index] = (0 == pthread_create(&threads[index], NULL, sort_slice, &slices[index]));
+        if (!started[index])
+        {
+            sort_slice(&slices[index]);
+        }
+    }
+    for (uint32_t index = 0; index < count; index++)
+    {
+        if (started[index])
+        {
+            pthread_join(threads[index], NULL);
+        }
+    }
+}
+
+/**
+ * @brief merge sort list using up to threadcount threads. Lists shorter than
+ *        LIST_SORT_PARALLEL_MIN are sorted on the calling thread
+ *
+ * @param list pointer to list to be sorted
+ * @param sort_function pointer to user defined ordering function
+ * @param threadcount max number of threads to sort with
+ * @return 0 on success, non-zero value on failure
+ */
+int list_sort_parallel(list_t *list, SORT_F sort_function, uint32_t threadcount)
+{
+    if (NULL == list || NULL == sort_function)
+    {
+        return -1;
+    }
+    if (threadcount < 2 || list->size < LIST_SORT_PARALLEL_MIN)
+    {
+        return list_sort_by(list, sort_function);
+    }
+    if (threadcount > LIST_SORT_MAX_THREADS)
+    {
+        threadcount = LIST_SORT_MAX_THREADS;
+    }
+
+    sort_slice_t *slices = calloc(threadcount, sizeof(sort_slice_t));
+    if (NULL == slices)
+    {
+        return list_sort_by(list, sort_function);
+    }
+
+    // Cut the list into threadcount NULL terminated slices of near equal size
+    list_node_t *node = unlink_list(list);
+    uint32_t remaining = list->size;
+    for (uint32_t index = 0; index < threadcount; index++)
+    {
+        uint32_t slicesz = remaining / (threadcount - index);
+        slices[index].head = node;
+        slices[index].sort_function = sort_function;
+        for (uint32_t count = 1; count < slicesz; count++)
+        {
+            node = node->next;
+        }
+        list_node_t *next = node->next;
+        node->next = NULL;
+        node = next;
+        remaining -= slicesz;
+    }
+    run_slices(slices, threadcount);
+
+    // Merge neighbouring slices pairwise until one run is left. Slice order is
+    // kept so the result is as stable as the serial sort
+    uint32_t count = threadcount;
+    while (count > 1)
+    {
+        uint32_t pairs = count / 2;
+        for (uint32_t index = 0; index < pairs; index++)
+        {
+            slices[index] = slices[index * 2];
+            slices[index].merge_with = slices[index * 2 + 1].head;
+        }
+        run_slices(slices, pairs);
+        if (count % 2)
+        {
+            slices[pairs] = slices[count - 1];
+        }
+        count = pairs + (count % 2);
+    }
+
+    relink_list(list, slices[0].head);
+    free(slices);
+    slices = NULL;
+    return 0;
+}
+
 /**
  * @brief clear all nodes out of a list
  *
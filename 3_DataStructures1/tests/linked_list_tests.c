@@ -220,6 +220,83 @@ void test_list_sort()
     }
 }
 
+int test_sort_descending(const void *data1, const void *data2)
+{
+    return *(const int *)data2 - *(const int *)data1;
+}
+
+static void check_sorted(list_t *sorted_list, SORT_F sort_function)
+{
+    list_node_t *node = sorted_list->head;
+    for (uint32_t i = 0; i < sorted_list->size; i++)
+    {
+        // Nodes should be in order with positions and back links rebuilt
+        CU_ASSERT(i == node->position);
+        CU_ASSERT(node->next->prev == node);
+        if (i + 1 < sorted_list->size)
+        {
+            CU_ASSERT(0 >= sort_function(node->data, node->next->data));
+        }
+        node = node->next;
+    }
+    // NOLINTNEXTLINE
+    CU_ASSERT(sorted_list->tail->next == sorted_list->head);
+}
+
+void test_list_sort_by()
+{
+    int values[7] = {4, 1, 7, 1, 3, 9, 2};
+    list_t *sort_list = list_new(NULL, NULL);
+    int i = 0;
+
+    CU_ASSERT_FATAL(NULL != sort_list);
+    // Should catch a missing sort function
+    CU_ASSERT(0 != list_sort_by(sort_list, NULL));
+    // Sorting an empty list is a no-op
+    CU_ASSERT(0 == list_sort_by(sort_list, test_sort_descending));
+
+    while (i < 7)
+    {
+        list_push_tail(sort_list, &values[i]);
+        i++;
+    }
+
+    CU_ASSERT(0 == list_sort_by(sort_list, test_sort_descending));
+    CU_ASSERT(7 == sort_list->size);
+    // NOLINTNEXTLINE
+    CU_ASSERT(9 == *(int *)sort_list->head->data);
+    // NOLINTNEXTLINE
+    CU_ASSERT(1 == *(int *)sort_list->tail->data);
+    check_sorted(sort_list, test_sort_descending);
+
+    list_delete(&sort_list);
+}
+
+void test_list_sort_parallel()
+{
+    uint32_t count = LIST_SORT_PARALLEL_MIN + 1000;
+    int *values = calloc(count, sizeof(int));
+    list_t *sort_list = list_new(NULL, NULL);
+    uint32_t seed = 12345;
+
+    CU_ASSERT_FATAL(NULL != values && NULL != sort_list);
+    CU_ASSERT(0 != list_sort_parallel(NULL, default_sort, 4));
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        values[i] = (int)(seed >> 8) % 100000;
+        list_push_tail(sort_list, &values[i]);
+    }
+
+    CU_ASSERT(0 == list_sort_parallel(sort_list, default_sort, 3));
+    CU_ASSERT(count == sort_list->size);
+    check_sorted(sort_list, default_sort);
+
+    list_delete(&sort_list);
+    free(values);
+}
+
 void test_list_pop_tail()
 {
     int exit_code = 0;
@@ -489,6 +566,10 @@ int main(void)
 
         {"Testing list_sort():", test_list_sort},
 
+        {"Testing list_sort_by():", test_list_sort_by},
+
+        {"Testing list_sort_parallel():", test_list_sort_parallel},
+
         {"Testing list_pop_tail():", test_list_pop_tail},
 
         {"Testing list_peek_head():", test_list_peek_head},
@@ -0,0 +1,26 @@
+# The threadpool, its queue and the per thread stage timers it records
+# queue waits in. NUMA aware placement is compiled in only
+# when both the libnuma header and library are found, and its USDT probes
+# when sys/sdt.h is.
+# Sets THREADPOOL_SOURCES, THREADPOOL_DEFINITIONS and THREADPOOL_LIBRARIES.
+
+include(${CMAKE_CURRENT_LIST_DIR}/../../0_Common/cmake/probes.cmake)
+
+set(THREADPOOL_SOURCES
+    ${CMAKE_CURRENT_LIST_DIR}/../src/threadpool.c
+    ${CMAKE_CURRENT_LIST_DIR}/../src/eventcount.c
+    ${CMAKE_CURRENT_LIST_DIR}/../src/stagestats.c
+    ${CMAKE_CURRENT_LIST_DIR}/../../3_DataStructures1/src/queue.c)
+set(THREADPOOL_DEFINITIONS "")
+set(THREADPOOL_LIBRARIES pthread)
+
+find_path(NUMA_INCLUDE_DIR numa.h)
+find_library(NUMA_LIBRARY numa)
+if (NUMA_INCLUDE_DIR AND NUMA_LIBRARY)
+    list(APPEND THREADPOOL_DEFINITIONS HAVE_NUMA)
+    list(APPEND THREADPOOL_LIBRARIES ${NUMA_LIBRARY})
+    include_directories(${NUMA_INCLUDE_DIR})
+endif()
+
+message("threadpool placement: cores ${THREADPOOL_DEFINITIONS}")
+list(APPEND THREADPOOL_DEFINITIONS ${PROBES_DEFINITIONS})
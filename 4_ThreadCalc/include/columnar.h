@@ -0,0 +1,177 @@
+#ifndef _COLUMNAR_H
+#define _COLUMNAR_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "equation.h"
+
+/**
+ * @brief bit set in header.optheaders of a solved file written in columnar
+ *        blocks instead of packed rows
+ */
+#define SOLVED_OPT_COLUMNAR 0x4000
+
+/**
+ * @brief magic number at the start of the columnar footer ("EQCL")
+ */
+#define COLUMNAR_MAGIC 0x4c435145
+
+/**
+ * @brief number of records per columnar block
+ */
+#define COLUMNAR_BLOCK 1024
+
+/**
+ * @brief bytes of zero padding after each block's payload so the decoder can
+ *        always load a whole 64 bit word
+ */
+#define COLUMNAR_PAD 8
+
+/**
+ * @brief header of one columnar block. It is followed by four bit packed
+ *        columns, each padded to a multiple of 8 bytes: zigzag encoded eqid
+ *        deltas, flags, types and solutions minus solutionbase. Signed (type
+ *        1) solutions are zigzag encoded before the frame of reference is
+ *        taken so small negative values stay small
+ *
+ * @param count number of records in the block
+ * @param firsteqid eqid the deltas are applied to
+ * @param solutionbase frame of reference subtracted from every solution
+ * @param deltabits bits per eqid delta
+ * @param flagbits bits per flags value
+ * @param typebits bits per type value
+ * @param solutionbits bits per solution
+ * @param size bytes of column data following this header, padding included
+ */
+struct column_block
+{
+    uint32_t count;
+    uint32_t firsteqid;
+    uint64_t solutionbase;
+    uint8_t deltabits;
+    uint8_t flagbits;
+    uint8_t typebits;
+    uint8_t solutionbits;
+    uint32_t size;
+}__attribute__((packed));
+
+/**
+ * @brief one entry of the block index written after the last block
+ *
+ * @param offset file offset of the block
+ * @param first index of the block's first record in the file
+ */
+struct column_index_entry
+{
+    uint64_t offset;
+    uint64_t first;
+}__attribute__((packed));
+
+/**
+ * @brief last bytes of a columnar solved file
+ *
+ * @param magic COLUMNAR_MAGIC
+ * @param blockcount number of blocks and block index entries
+ * @param indexoffset file offset of the block index
+ * @param records total number of records in all blocks
+ */
+struct column_footer
+{
+    uint32_t magic;
+    uint32_t blockcount;
+    uint64_t indexoffset;
+    uint64_t records;
+}__attribute__((packed));
+
+/**
+ * @brief structure of a columnar writer. Buffers up to COLUMNAR_BLOCK solved
+ *        equations, encodes each full block and appends it to fd
+ *
+ * @param fd file descriptor blocks are written to
+ * @param offset file offset the next block is written at
+ * @param records number of records written so far
+ * @param count number of records buffered for the next block
+ * @param pending records buffered for the next block
+ * @param index block index entries
+ * @param blockcount number of blocks written
+ * @param indexcapacity number of slots in index
+ */
+typedef struct columnar_writer_t
+{
+    int fd;
+    uint64_t offset;
+    uint64_t records;
+    uint32_t count;
+    struct solved_equation pending[COLUMNAR_BLOCK];
+    struct column_index_entry *index;
+    uint32_t blockcount;
+    uint32_t indexcapacity;
+} columnar_writer_t;
+
+/**
+ * @brief initializes a columnar writer that appends blocks at fd's current
+ *        offset
+ *
+ * @param writer writer to initialize
+ * @param fd file descriptor positioned after the solved header
+ * @return 1 if successful, 0 on error
+ */
+int columnar_writer_init(columnar_writer_t *writer, int fd);
+
+/**
+ * @brief EMIT_F that adds solved equations to a columnar writer
+ *
+ * @param sink pointer to columnar_writer_t
+ * @param sequ array of solved equations
+ * @param count number of equations in sequ
+ * @return 1 if successful, 0 on error
+ */
+int columnar_writer_add(void *sink, struct solved_equation *sequ, size_t count);
+
+/**
+ * @brief encodes the last partial block and writes the block index and
+ *        footer. Releases the writer's index
+ *
+ * @param writer writer to finish
+ * @return 1 if successful, 0 on error
+ */
+int columnar_writer_finish(columnar_writer_t *writer);
+
+/**
+ * @brief locates the footer and block index of a mapped columnar file
+ *
+ * @param map mapped solved file
+ * @param mapsz size of the mapping
+ * @param footer set to the footer
+ * @param index set to the first block index entry
+ * @return 1 if the file is a valid columnar file, 0 if not
+ */
+int columnar_locate(const uint8_t *map, size_t mapsz, const struct column_footer **footer,
+                    const struct column_index_entry **index);
+
+/**
+ * @brief decodes one block back into packed rows
+ *
+ * @param block pointer to the block header
+ * @param avail bytes readable from block onwards
+ * @param sequ array of at least COLUMNAR_BLOCK records to decode into
+ * @return number of records decoded, -1 if the block is malformed
+ */
+int columnar_decode_block(const uint8_t *block, size_t avail, struct solved_equation *sequ);
+
+/**
+ * @brief decodes blocks [firstblock, lastblock) of a mapped columnar file
+ *        into rows. Ranges that do not overlap may be decoded concurrently
+ *
+ * @param map mapped solved file
+ * @param mapsz size of the mapping
+ * @param firstblock first block to decode
+ * @param lastblock block after the last to decode
+ * @param sequ array of footer->records records to decode into
+ * @return 1 if successful, 0 on error
+ */
+int columnar_decode_blocks(const uint8_t *map, size_t mapsz, uint32_t firstblock, uint32_t lastblock,
+                           struct solved_equation *sequ);
+
+#endif
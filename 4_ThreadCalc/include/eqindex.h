@@ -0,0 +1,118 @@
+#ifndef _EQINDEX_H
+#define _EQINDEX_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "equation.h"
+
+/**
+ * @brief bit set in header.optheaders of a solved file that carries an
+ *        index trailer
+ */
+#define SOLVED_OPT_INDEX 0x8000
+
+/**
+ * @brief magic number at the start of the index footer ("EQIX")
+ */
+#define SOLVED_INDEX_MAGIC 0x58495145
+
+/**
+ * @brief average number of entries per bucket the directory aims for
+ */
+#define INDEX_BUCKET_LOAD 4
+
+/**
+ * @brief largest bucket directory, in bits of eqid used to pick a bucket
+ */
+#define INDEX_MAX_BUCKET_BITS 20
+
+/**
+ * @brief one entry of the index table. Entries are sorted by eqid
+ *
+ * @param eqid little endian eqid of the record
+ * @param offset little endian file offset of the record
+ */
+struct index_entry
+{
+    uint32_t eqid;
+    uint64_t offset;
+}__attribute__((packed));
+
+/**
+ * @brief last bytes of an indexed solved file. The trailer is laid out as
+ *        [index_entry x count][uint32 directory x (2^bucketbits + 1)][footer].
+ *        directory[b] is the first entry whose eqid has b in its top
+ *        bucketbits bits, so a lookup binary searches one small bucket
+ *
+ * @param magic SOLVED_INDEX_MAGIC
+ * @param bucketbits number of top eqid bits that select a bucket
+ * @param count number of index entries
+ * @param tableoffset file offset of the first index entry
+ * @param diroffset file offset of the bucket directory
+ */
+struct index_footer
+{
+    uint32_t magic;
+    uint8_t bucketbits;
+    uint64_t count;
+    uint64_t tableoffset;
+    uint64_t diroffset;
+}__attribute__((packed));
+
+/**
+ * @brief a solved file mapped for lookups
+ *
+ * @param map the mapped file
+ * @param mapsz size of the mapping
+ * @param hdr the file's header
+ * @param footer the index footer, NULL if the file has no index
+ * @param table the index entries
+ * @param directory the bucket directory
+ */
+typedef struct eqindex_t
+{
+    const uint8_t *map;
+    size_t mapsz;
+    const struct header *hdr;
+    const struct index_footer *footer;
+    const struct index_entry *table;
+    const uint32_t *directory;
+} eqindex_t;
+
+/**
+ * @brief appends an index trailer to a fully written solved file
+ *
+ * @param sfd solved file descriptor opened for reading and writing
+ * @param hdr header written at the start of the solved file
+ * @return 1 if successful, 0 on error
+ */
+int eqindex_append(int sfd, struct header *hdr);
+
+/**
+ * @brief maps a solved file for lookups
+ *
+ * @param path path to the solved file
+ * @return pointer to eqindex_t, NULL on failure
+ */
+eqindex_t *eqindex_open(const char *path);
+
+/**
+ * @brief finds the solved equation with eqid. Uses the index trailer when
+ *        the file has one and scans every record when it does not
+ *
+ * @param index mapped solved file
+ * @param eqid eqid to look up, in host byte order
+ * @param sequ filled in with the record when found
+ * @return 1 if found, 0 if not
+ */
+int eqindex_lookup(const eqindex_t *index, uint32_t eqid, struct solved_equation *sequ);
+
+/**
+ * @brief unmaps a solved file
+ *
+ * @param index pointer to the eqindex_t pointer to release
+ */
+void eqindex_close(eqindex_t **index);
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef _EQSORT_H
+#define _EQSORT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <linux/limits.h>
+#include "equation.h"
+
+/**
+ * @brief default memory budget in bytes for sorting one solved file
+ */
+#define SORT_MEMORY_DEFAULT (64 * 1024 * 1024)
+
+/**
+ * @brief number of records each spilled run buffers while merging
+ */
+#define SORT_RUN_BUFFER 4096
+
+/**
+ * @brief structure of a sorted writer. Collects solved equations and emits
+ *        them ordered by eqid. Records are radix sorted in memory and,
+ *        once more than capacity have been added, spilled to sorted runs in
+ *        tmpdir that are k-way merged by sorted_writer_finish
+ *
+ * @param emit function sorted records are emitted through
+ * @param sink output state handed to emit
+ * @param capacity max number of records held in memory
+ * @param count number of records currently held in memory
+ * @param records buffer of records not yet sorted
+ * @param scratch radix sort scratch buffer, same size as records
+ * @param runs file descriptors of the spilled runs
+ * @param runcount number of spilled runs
+ * @param runcapacity number of slots in runs
+ * @param tmpdir directory spilled runs are created in
+ */
+typedef struct sorted_writer_t
+{
+    EMIT_F emit;
+    void *sink;
+    size_t capacity;
+    size_t count;
+    struct solved_equation *records;
+    struct solved_equation *scratch;
+    int *runs;
+    uint32_t runcount;
+    uint32_t runcapacity;
+    char tmpdir[PATH_MAX];
+} sorted_writer_t;
+
+/**
+ * @brief stable LSD radix sort of fixed size items by a little endian uint32
+ *        key stored inside each item
+ *
+ * @param items items to sort. holds the sorted items on return
+ * @param scratch buffer of at least count items
+ * @param count number of items
+ * @param itemsz size in bytes of one item
+ * @param keyoffset byte offset of the key within an item
+ */
+void radix_sort_u32(void *items, void *scratch, size_t count, size_t itemsz, size_t keyoffset);
+
+/**
+ * @brief stable LSD radix sort of solved equations by little endian eqid
+ *
+ * @param records records to sort. holds the sorted records on return
+ * @param scratch buffer of at least count records
+ * @param count number of records
+ */
+void eqsort_radix(struct solved_equation *records, struct solved_equation *scratch, size_t count);
+
+/**
+ * @brief initializes a sorted writer
+ *
+ * @param writer writer to initialize
+ * @param emit function sorted records are emitted through
+ * @param sink output state handed to emit
+ * @param numeq number of records that will be added. used to size buffers
+ * @param memlimit memory budget in bytes for the in memory buffers
+ * @param tmpdir directory to spill sorted runs into
+ * @return 1 if successful, 0 on error
+ */
+int sorted_writer_init(sorted_writer_t *writer, EMIT_F emit, void *sink, uint64_t numeq, size_t memlimit,
+                       const char *tmpdir);
+
+/**
+ * @brief adds solved equations to the writer, spilling a sorted run when the
+ *        in memory buffer fills
+ *
+ * @param writer writer to add to
+ * @param sequ array of solved equations
+ * @param count number of equations in sequ
+ * @return 1 if successful, 0 on error
+ */
+int sorted_writer_add(sorted_writer_t *writer, const struct solved_equation *sequ, size_t count);
+
+/**
+ * @brief sorts what is left in memory, merges it with any spilled runs and
+ *        emits the result. Releases the writer's buffers
+ *
+ * @param writer writer to finish
+ * @return 1 if successful, 0 on error
+ */
+int sorted_writer_finish(sorted_writer_t *writer);
+
+/**
+ * @brief releases a writer's buffers and spilled runs without writing
+ *
+ * @param writer writer to release
+ */
+void sorted_writer_free(sorted_writer_t *writer);
+
+#endif
@@ -4,6 +4,9 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include "../../0_Common/include/eqstream.h"
+
+#define EQU_MAGIC 0xdd77bb55
 
 struct header
 {
@@ -33,7 +36,27 @@ struct solved_equation
     uint64_t solution;
 }__attribute__((packed));
 
+/**
+ * @brief number of equations read, solved and written per batch
+ */
+#define EQ_BATCH 256
+
+/**
+ * @brief A pointer to a function that consumes solved equations in output
+ *        order. sink is the state of the output being written, such as the
+ *        file descriptor for emit_rows. Returns 1 if successful, 0 on error
+ *
+ */
+typedef int (*EMIT_F)(void *sink, struct solved_equation *sequ, size_t count);
+
 int write_equation(int fd, struct solved_equation *sequ);
 int write_header(int fd, struct header *hdr);
+int write_all(int fd, const void *buffer, size_t size);
+int write_equations(int fd, struct solved_equation *sequ, size_t count);
+int copy_optheaders(eqstream_t *stream, int fd, uint64_t size);
+int emit_rows(void *sink, struct solved_equation *sequ, size_t count);
+size_t read_equations(eqstream_t *stream, struct unsolved_equation *uequ, size_t count);
+int solve_equation(const struct unsolved_equation *uequ, struct solved_equation *sequ);
+size_t solve_batch(const struct unsolved_equation *uequ, struct solved_equation *sequ, size_t count);
 
 #endif
@@ -0,0 +1,75 @@
+#ifndef _EVENTCOUNT_H
+#define _EVENTCOUNT_H
+
+#include <stdint.h>
+
+/**
+ * @brief lets threads sleep until a condition they check themselves turns
+ * true, without a mutex. A waiter takes a key with eventcount_prepare,
+ * rechecks its condition, and only then sleeps in eventcount_wait. A
+ * notifier makes the condition true before calling eventcount_notify, so
+ * either the waiter sees the change or its key is stale and the futex
+ * wait returns at once. Notifying with nobody prepared costs one atomic
+ * read and no syscall
+ *
+ * @param seq bumped by every notify that finds waiters, the futex word
+ * @param waiters threads between prepare and the end of wait or cancel
+ */
+typedef struct eventcount_t
+{
+    uint32_t seq;
+    uint32_t waiters;
+} eventcount_t;
+
+/**
+ * @brief initializes an eventcount with no waiters
+ *
+ * @param ec eventcount to initialize
+ */
+void eventcount_init(eventcount_t *ec);
+
+/**
+ * @brief announces a waiter. Must be followed by eventcount_wait or
+ * eventcount_cancel
+ *
+ * @param ec eventcount to wait on
+ * @return uint32_t key for eventcount_wait
+ */
+uint32_t eventcount_prepare(eventcount_t *ec);
+
+/**
+ * @brief withdraws a waiter whose condition turned true after prepare
+ *
+ * @param ec eventcount prepared on
+ */
+void eventcount_cancel(eventcount_t *ec);
+
+/**
+ * @brief sleeps unless a notify came after the key was taken. May return
+ * spuriously, callers recheck their condition
+ *
+ * @param ec eventcount prepared on
+ * @param key key from eventcount_prepare
+ */
+void eventcount_wait(eventcount_t *ec, uint32_t key);
+
+/**
+ * @brief eventcount_wait that gives up after a timeout
+ *
+ * @param ec eventcount prepared on
+ * @param key key from eventcount_prepare
+ * @param ms longest to sleep in milliseconds
+ * @return int 0 if the timeout expired, 1 otherwise
+ */
+int eventcount_timedwait(eventcount_t *ec, uint32_t key, uint32_t ms);
+
+/**
+ * @brief wakes one sleeping waiter, or every waiter when all is set
+ *
+ * @param ec eventcount to notify
+ * @param all wake every waiter rather than one
+ * @return int 1 if anyone was waiting, 0 otherwise
+ */
+int eventcount_notify(eventcount_t *ec, int all);
+
+#endif
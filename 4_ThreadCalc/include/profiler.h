@@ -0,0 +1,99 @@
+#ifndef _PROFILER_H
+#define _PROFILER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define PROFILER_HZ 997
+#define PROFILER_DEPTH 64
+#define PROFILER_STACKS 1024
+
+/**
+ * @brief one distinct stack sampled on a thread
+ *
+ * @param hash hash of pcs, 0 for an empty slot
+ * @param count times the stack was sampled
+ * @param depth frames in pcs
+ * @param pcs interrupted pc followed by return addresses, leaf first
+ */
+typedef struct profiler_stack_t
+{
+    uint64_t hash;
+    uint64_t count;
+    uint32_t depth;
+    void *pcs[PROFILER_DEPTH];
+} profiler_stack_t;
+
+/**
+ * @brief one sampled thread. Its SIGPROF timer counts the thread's own
+ * cpu time, and the signal handler running on the thread is the only
+ * writer of stacks, so sampling takes no lock. Stacks are kept in a fixed
+ * open addressed table since the handler may not allocate; samples of
+ * new stacks once it is full are counted as dropped
+ *
+ * @param next next sampled thread
+ * @param timer the thread's SIGPROF timer
+ * @param timed timer is armed, under the registry lock
+ * @param stacklo lowest address of the thread's stack
+ * @param stackhi end of the thread's stack
+ * @param samples signals handled
+ * @param dropped samples that found the table full
+ * @param stacks distinct stacks seen
+ */
+typedef struct profiler_thread_t
+{
+    struct profiler_thread_t *next;
+    timer_t timer;
+    int timed;
+    uintptr_t stacklo;
+    uintptr_t stackhi;
+    uint64_t samples;
+    uint64_t dropped;
+    profiler_stack_t stacks[PROFILER_STACKS];
+} profiler_thread_t;
+
+/**
+ * @brief starts sampling. Installs the SIGPROF handler and samples the
+ * calling thread; other threads join with profiler_attach. Stacks are
+ * walked through frame pointers, so build with the Profile configuration
+ * or -fno-omit-frame-pointer for whole stacks
+ *
+ * @param hz samples per second of cpu time on each thread
+ * @return int 1 if started, 0 if unsupported or on error
+ */
+int profiler_start(uint32_t hz);
+
+/**
+ * @brief samples the calling thread from now on. Does nothing when the
+ * profiler is off or the thread is already sampled, so it is cheap to call
+ * at the start of every task. The thread's timer is deleted when it exits
+ *
+ * @return int 1 if the thread is sampled or profiling is off, 0 on error
+ */
+int profiler_attach(void);
+
+/**
+ * @brief stops sampling on every thread
+ *
+ */
+void profiler_stop(void);
+
+/**
+ * @brief writes the samples as folded stacks, one "root;...;leaf count"
+ * line per distinct stack, as read by flamegraph.pl and inferno. Frames
+ * are named from the executable's symbol table, then from the dynamic
+ * symbols of shared libraries
+ *
+ * @param out stream to write to
+ * @return int 1 if written, 0 on a write error
+ */
+int profiler_write(FILE *out);
+
+/**
+ * @brief frees every sampled thread's stacks. Sampling must be stopped
+ *
+ */
+void profiler_free(void);
+
+#endif
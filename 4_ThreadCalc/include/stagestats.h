@@ -0,0 +1,118 @@
+#ifndef _STAGESTATS_H
+#define _STAGESTATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/**
+ * @brief stages of solving a file that are timed
+ *
+ * STAGE_OPEN: opening the unsolved and solved files
+ * STAGE_HEADER: reading, checking and writing the file header
+ * STAGE_READ: reading and decoding a batch of equations
+ * STAGE_SOLVE: solving a batch
+ * STAGE_WRITE: writing a batch, and sorted, columnar or index trailers
+ * STAGE_CLOSE: closing both files
+ * STAGE_QUEUE_WAIT: time a task sat in the threadpool queue
+ */
+enum stage
+{
+    STAGE_OPEN = 0,
+    STAGE_HEADER,
+    STAGE_READ,
+    STAGE_SOLVE,
+    STAGE_WRITE,
+    STAGE_CLOSE,
+    STAGE_QUEUE_WAIT,
+    STAGE_COUNT
+};
+
+/**
+ * @brief totals of one stage
+ *
+ * @param calls times the stage ran
+ * @param ns nanoseconds spent in it
+ * @param maxns longest single run
+ * @param units equations for read, solve and write, files for open,
+ * header and close, tasks for queue wait
+ */
+typedef struct stage_total_t
+{
+    uint64_t calls;
+    uint64_t ns;
+    uint64_t maxns;
+    uint64_t units;
+} stage_total_t;
+
+/**
+ * @brief one thread's stage totals. Only the owning thread writes them,
+ * with relaxed atomic stores, so recording takes no lock and a reader on
+ * another thread sees whole values. Threads register on first use and
+ * their totals outlive them until stagestats_free
+ *
+ * @param next next registered thread
+ * @param id order the thread registered in
+ * @param stages totals per enum stage
+ */
+typedef struct stage_thread_t
+{
+    struct stage_thread_t *next;
+    uint32_t id;
+    stage_total_t stages[STAGE_COUNT];
+} stage_thread_t;
+
+/**
+ * @brief monotonic clock in nanoseconds. clock_gettime goes through the
+ * vDSO, so it costs about as much as reading the TSC and needs no
+ * calibration
+ *
+ * @return uint64_t now
+ */
+static inline uint64_t stage_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * @brief records a run of a stage on the calling thread
+ *
+ * @param stage enum stage
+ * @param start stage_now when the run began
+ * @param units equations, files or tasks the run covered
+ * @return uint64_t now, to start timing the next stage
+ */
+uint64_t stage_add(int stage, uint64_t start, uint64_t units);
+
+/**
+ * @brief sums every thread's totals
+ *
+ * @param total filled with the sum per stage
+ */
+void stagestats_sum(stage_total_t total[STAGE_COUNT]);
+
+/**
+ * @brief prints a table of each thread's stages and the totals
+ *
+ * @param out stream to print to
+ */
+void stagestats_print(FILE *out);
+
+/**
+ * @brief writes the per thread and total stages as JSON
+ *
+ * @param out stream to write to
+ * @return int 1 if written, 0 on a write error
+ */
+int stagestats_json(FILE *out);
+
+/**
+ * @brief frees every registered thread's totals. Threads that recorded
+ * must have exited
+ *
+ */
+void stagestats_free(void);
+
+#endif
@@ -6,6 +6,61 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include "../../3_DataStructures1/include/queue.h"
+#include "eventcount.h"
+
+#define THREADPOOL_SPIN_MIN 16
+#define THREADPOOL_SPIN_MAX 4096
+
+/**
+ * @brief placement flags for threadpool_create_placed
+ *
+ * THREADPOOL_PIN_CORES: pin each worker to one online cpu, round robin
+ * THREADPOOL_NUMA: bind workers to NUMA nodes round robin, allocate their
+ * memory on that node and keep a queue per node. Tasks go on the queue of
+ * the node that submits them and idle workers take from their own node
+ * before any other. Needs libnuma (HAVE_NUMA), otherwise ignored
+ */
+#define THREADPOOL_PIN_CORES 0x1
+#define THREADPOOL_NUMA 0x2
+
+/**
+ * @brief states of a worker slot. A retired worker has left the pool but
+ * is only joined when its slot is reused or the pool terminates
+ *
+ */
+#define THREADPOOL_SLOT_FREE 0
+#define THREADPOOL_SLOT_RUNNING 1
+#define THREADPOOL_SLOT_RETIRED 2
+
+/**
+ * @brief shutdown modes for threadpool_shutdown
+ *
+ * THREADPOOL_DRAIN: run everything queued, then stop
+ * THREADPOOL_ABORT: drop everything queued, let running tasks finish
+ * THREADPOOL_DEADLINE: drain until the deadline, then abort
+ */
+#define THREADPOOL_DRAIN 0
+#define THREADPOOL_ABORT 1
+#define THREADPOOL_DEADLINE 2
+
+/**
+ * @brief what a shutdown did
+ *
+ * @param completed tasks and work items finished over the pool's life
+ * @param drained of those, the ones finished during the shutdown
+ * @param dropped queued items discarded without running
+ * @param overran tasks still running when the queue was aborted. They run
+ * to the end; threadpool_cancelled tells them to return early
+ * @param elapsed_ms time the shutdown took
+ */
+typedef struct threadpool_stats_t
+{
+    uint64_t completed;
+    uint64_t drained;
+    uint64_t dropped;
+    uint64_t overran;
+    uint32_t elapsed_ms;
+} threadpool_stats_t;
 
 
 
@@ -19,27 +74,141 @@
  */
 typedef void (*FREE_F)(void *);
 
+/**
+ * @brief a task run by a pool thread. The return value is handed to the
+ * task's future, if it has one
+ *
+ */
+typedef void *(*TASK_F)(void *arg);
+
+/**
+ * @brief completion handle of a submitted task. Every future is released
+ * exactly once, by threadpool_future_wait or threadpool_future_detach
+ *
+ * @param pool pool the task runs on
+ * @param done the task has returned
+ * @param detached nobody will wait; the pool frees it on completion
+ * @param result value the task returned
+ */
+typedef struct threadpool_future_t
+{
+    struct threadpool_t *pool;
+    int done;
+    int detached;
+    void *result;
+} threadpool_future_t;
+
+/**
+ * @brief the work queue of one NUMA node. Pools without NUMA placement
+ * have a single node
+ *
+ * @param pool pool the node belongs to
+ * @param queue tasks submitted on this node
+ * @param mutex guards queue
+ * @param queued items in queue, readable without the mutex
+ * @param work idle workers of the node park on it, woken one at a time
+ * @param space producers blocked on a full queue park on it
+ */
+typedef struct threadpool_node_t
+{
+    struct threadpool_t *pool;
+    queue_t *queue;
+    pthread_mutex_t mutex;
+    uint32_t queued;
+    eventcount_t work;
+    eventcount_t space;
+} threadpool_node_t;
+
+/**
+ * @brief one pool thread and where it runs
+ *
+ * @param pool pool the thread belongs to
+ * @param thread the thread
+ * @param node index of the node whose queue it serves first
+ * @param cpu cpu it is pinned to, -1 if not pinned to one
+ * @param state THREADPOOL_SLOT_FREE, _RUNNING or _RETIRED, under resize
+ * @param workfunction thread function
+ * @param param argument for workfunction
+ */
+typedef struct threadpool_worker_t
+{
+    struct threadpool_t *pool;
+    pthread_t thread;
+    uint32_t node;
+    int cpu;
+    int state;
+    void *(*workfunction)(void *);
+    void *param;
+} threadpool_worker_t;
+
 /**
  * @brief structure of a threadpool object
  *
- * @param capacity is the number of nodes the queue can hold
- * @param currentsz is the number of nodes the queue is currently storing
- * @param customfree is a FREE_F pointer to a user defined free function
- * @param arr is the array containing the queue node pointers
+ * @param threadcapacity most threads the pool runs at once
+ * @param minthreads fewest threads an elastic pool shrinks to, equal to
+ * threadcapacity for a fixed pool
+ * @param idletimeout milliseconds a worker above minthreads idles before
+ * it retires, 0 for a fixed pool
+ * @param live threads running
+ * @param idle threads waiting for work
+ * @param resize guards the worker slots while threads start and retire
+ * @param workcapacity number of items each node's queue holds
+ * @param terminate set once the pool is shutting down
+ * @param workers a slot for each of threadcapacity threads
+ * @param nodecount number of node queues, 1 without NUMA placement
+ * @param nodes node queues indexed by NUMA node
+ * @param queued items queued on every node, readable without a mutex
+ * @param spin polls an idle worker makes before parking. Doubled when a
+ * spin finds work and halved when it parks, within THREADPOOL_SPIN_MIN
+ * and THREADPOOL_SPIN_MAX
+ * @param mutex guards task completion: futures, groups and pending
+ * @param done signalled whenever a submitted task finishes
+ * @param pending submitted tasks queued or running
+ * @param placement THREADPOOL_PIN_CORES and THREADPOOL_NUMA flags in effect
+ * @param completed tasks and work items finished
+ * @param cancel set when queued work is aborted; no more is taken or
+ * accepted
+ * @param customfree called on the argument of every task or work item
+ * dropped at shutdown, NULL to leave them to their owner
  *
  */
 typedef struct threadpool_t
 {
     uint32_t threadcapacity;
+    uint32_t minthreads;
+    uint32_t idletimeout;
+    uint32_t live;
+    uint32_t idle;
+    pthread_mutex_t resize;
     uint32_t workcapacity;
     uint16_t terminate;
-    queue_t *queue;
-    pthread_t **pool;
+    threadpool_worker_t *workers;
+    uint32_t nodecount;
+    threadpool_node_t *nodes;
+    uint32_t queued;
+    uint32_t spin;
     pthread_mutex_t mutex;
-    pthread_cond_t cond;
+    pthread_cond_t done;
+    uint64_t pending;
+    int placement;
+    uint64_t completed;
+    uint16_t cancel;
     FREE_F customfree;
 } threadpool_t;
 
+/**
+ * @brief tasks that are waited on together, such as every file of one
+ * directory. Groups share their pool's threads with every other task
+ *
+ * @param pool pool the group's tasks run on
+ * @param pending tasks of the group submitted and not yet finished
+ */
+typedef struct threadpool_group_t
+{
+    threadpool_t *pool;
+    uint64_t pending;
+} threadpool_group_t;
+
 
 /*
  * @brief creates a new queue
@@ -51,8 +220,148 @@ typedef struct threadpool_t
  */
 threadpool_t *threadpool_init(uint32_t threadcapacity, uint32_t workcapacity, void *workfunction(void *param), void *param);
 
+/**
+ * @brief creates a threadpool whose threads run submitted tasks
+ *
+ * @param threadcapacity number of threads
+ * @param workcapacity number of tasks queued before submitters block
+ * @return threadpool_t* pool, NULL on failure
+ */
+threadpool_t *threadpool_create(uint32_t threadcapacity, uint32_t workcapacity);
+
+/**
+ * @brief creates a task threadpool with its workers placed on cpus and
+ * NUMA nodes. Workers allocate on their own node, so buffers a task
+ * touches first stay local to the node solving it
+ *
+ * @param threadcapacity number of threads
+ * @param workcapacity number of tasks each node queues before submitters
+ * block
+ * @param placement THREADPOOL_PIN_CORES and/or THREADPOOL_NUMA, 0 for none
+ * @return threadpool_t* pool, NULL on failure
+ */
+threadpool_t *threadpool_create_placed(uint32_t threadcapacity, uint32_t workcapacity, int placement);
+
+/**
+ * @brief creates a task threadpool that sizes itself to the load. It
+ * starts minthreads workers and adds one, up to maxthreads, whenever a
+ * task is queued while no worker is idle and the backlog is at least one
+ * task per worker, which covers both a rising queue delay and workers
+ * stuck in blocking I/O. Workers above minthreads retire after idling for
+ * idletimeout milliseconds
+ *
+ * @param minthreads threads kept while idle, at least 1
+ * @param maxthreads most threads at once
+ * @param workcapacity number of tasks each node queues before submitters
+ * block
+ * @param placement THREADPOOL_PIN_CORES and/or THREADPOOL_NUMA, 0 for none
+ * @param idletimeout milliseconds of idling before a worker retires
+ * @return threadpool_t* pool, NULL on failure
+ */
+threadpool_t *threadpool_create_elastic(uint32_t minthreads, uint32_t maxthreads, uint32_t workcapacity,
+                                        int placement, uint32_t idletimeout);
+
+/**
+ * @brief parses a placement name given on a command line
+ *
+ * @param name "cores", "nodes" or "both"
+ * @return int THREADPOOL_PIN_CORES and THREADPOOL_NUMA flags, -1 if unknown
+ */
+int threadpool_placement(const char *name);
+
+/**
+ * @brief queues fn(arg) and returns a handle to its result. Blocks while
+ * the queue is full, so tasks must not submit to their own pool and wait
+ * on the result
+ *
+ * @param pool pool to run on
+ * @param fn task function
+ * @param arg argument for fn
+ * @return threadpool_future_t* future, NULL if out of memory
+ */
+threadpool_future_t *threadpool_submit(threadpool_t *pool, TASK_F fn, void *arg);
+
+/**
+ * @brief queues fn(arg) with no future. The task is still counted by
+ * threadpool_wait_all
+ *
+ * @param pool pool to run on
+ * @param fn task function
+ * @param arg argument for fn
+ * @return int 1 if queued, 0 if out of memory
+ */
+int threadpool_post(threadpool_t *pool, TASK_F fn, void *arg);
+
+/**
+ * @brief waits for a task to finish and frees its future. A future
+ * resolved by threadpool_shutdown may still be waited on after it returns
+ *
+ * @param future future from threadpool_submit
+ * @return void* value the task returned, NULL if it was dropped
+ */
+void *threadpool_future_wait(threadpool_future_t *future);
+
+/**
+ * @brief gives up a future without waiting. It is freed when the task
+ * finishes, or at once if it already has
+ *
+ * @param future future from threadpool_submit
+ */
+void threadpool_future_detach(threadpool_future_t *future);
+
+/**
+ * @brief waits until every task submitted to the pool has finished. Work
+ * queued with push_work is not counted, since the caller's work function
+ * decides when that is done
+ *
+ * @param pool pool to wait on
+ */
+void threadpool_wait_all(threadpool_t *pool);
+
+/**
+ * @brief creates an empty task group
+ *
+ * @param pool pool the group's tasks run on
+ * @return threadpool_group_t* group, NULL if out of memory
+ */
+threadpool_group_t *threadpool_group_create(threadpool_t *pool);
+
+/**
+ * @brief queues fn(arg) as part of a group, with no future
+ *
+ * @param group group the task counts toward
+ * @param fn task function
+ * @param arg argument for fn
+ * @return int 1 if queued, 0 if out of memory
+ */
+int threadpool_group_submit(threadpool_group_t *group, TASK_F fn, void *arg);
+
+/**
+ * @brief waits until every task of the group has finished
+ *
+ * @param group group to wait on
+ */
+void threadpool_group_wait(threadpool_group_t *group);
+
+/**
+ * @brief frees a group whose tasks have all finished
+ *
+ * @param group group to free
+ */
+void threadpool_group_free(threadpool_group_t *group);
+
+/**
+ * @brief compatibility interface for pools made by threadpool_init, whose
+ * threads run a caller supplied loop. Queues a bare work item
+ *
+ */
 void push_work(threadpool_t *threadpool, void *data);
 
+/**
+ * @brief hands a bare work item to the caller's work function. Submitted
+ * tasks met on the way are run by the calling thread
+ *
+ */
 void * pull_work(threadpool_t *threadpool);
 
 int join_threads(threadpool_t *threadpool);
@@ -66,7 +375,33 @@ int join_threads(threadpool_t *threadpool);
  */
 void threadpool_free(threadpool_t *threadpool);
 
+/**
+ * @brief drains the pool, joins its threads and frees it
+ *
+ */
 void terminate_threadpool(threadpool_t * threadpool);
 
+/**
+ * @brief stops the pool, joins its threads and frees it. Dropped tasks
+ * never run: their futures resolve to NULL, their groups count them as
+ * finished and their argument goes to the pool's customfree. Anything
+ * queued after the threads have exited is dropped the same way
+ *
+ * @param threadpool pool to stop
+ * @param mode THREADPOOL_DRAIN, THREADPOOL_ABORT or THREADPOOL_DEADLINE
+ * @param deadline_ms how long THREADPOOL_DEADLINE drains before aborting
+ * @param stats filled with what the shutdown did, may be NULL
+ * @return int 1 if nothing was dropped, 0 otherwise
+ */
+int threadpool_shutdown(threadpool_t *threadpool, int mode, uint32_t deadline_ms, threadpool_stats_t *stats);
+
+/**
+ * @brief whether queued work has been aborted. Long tasks may poll it to
+ * give up early during a shutdown
+ *
+ * @return int 1 once aborted, 0 otherwise
+ */
+int threadpool_cancelled(threadpool_t *threadpool);
+
 
 #endif
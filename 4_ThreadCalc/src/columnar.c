@@ -0,0 +1,419 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <endian.h>
+#include "../include/columnar.h"
+
+/**
+ * @brief bytes a column of count values of bits each takes, padded to whole
+ *        64 bit words
+ */
+static inline size_t column_bytes(uint32_t count, uint8_t bits)
+{
+    return (((uint64_t)count * bits + 63) / 64) * 8;
+}
+
+/**
+ * @brief number of bits needed to hold value
+ */
+static inline uint8_t bit_width(uint64_t value)
+{
+    return value ? 64 - __builtin_clzll(value) : 0;
+}
+
+static inline uint64_t zigzag_encode(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t zigzag_decode(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+/**
+ * @brief solution of a record in the order preserving form that is stored
+ */
+static inline uint64_t solution_key(const struct solved_equation *sequ)
+{
+    uint64_t solution = le64toh(sequ->solution);
+    return sequ->type == 1 ? zigzag_encode((int64_t)solution) : solution;
+}
+
+/**
+ * @brief loads 8 little endian bytes from any alignment
+ */
+static inline uint64_t load64(const uint8_t *src)
+{
+    uint64_t value;
+    memcpy(&value, src, sizeof(value));
+    return le64toh(value);
+}
+
+/**
+ * @brief ors value into the 8 little endian bytes at dst, at any alignment
+ */
+static inline void or64(uint8_t *dst, uint64_t value)
+{
+    value = htole64(load64(dst) | value);
+    memcpy(dst, &value, sizeof(value));
+}
+
+/**
+ * @brief bit packs count values of bits each into the zeroed column as
+ *        little endian 64 bit words. The column is padded to whole words, so
+ *        a value straddling two words never stores past its end
+ */
+static void pack_column(uint8_t *column, const uint64_t *values, uint32_t count, uint8_t bits)
+{
+    uint64_t bitpos = 0;
+    for (uint32_t i = 0; i < count && bits > 0; i++, bitpos += bits)
+    {
+        uint8_t *word = column + (bitpos / 64) * 8;
+        uint32_t shift = bitpos % 64;
+        or64(word, values[i] << shift);
+        if (shift + bits > 64)
+        {
+            or64(word + 8, values[i] >> (64 - shift));
+        }
+    }
+}
+
+/**
+ * @brief unpacks count values of bits each. Every value is one unaligned load,
+ *        shift and mask with no data dependent branches, which the compiler
+ *        can vectorize. Widths over 56 bits can straddle 9 bytes and take a
+ *        second load
+ */
+static void unpack_column(const uint8_t *column, uint64_t *values, uint32_t count, uint8_t bits)
+{
+    if (bits == 0)
+    {
+        memset(values, 0, count * sizeof(uint64_t));
+        return;
+    }
+    uint64_t mask = bits == 64 ? UINT64_MAX : (((uint64_t)1 << bits) - 1);
+    if (bits <= 56)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint64_t bitpos = (uint64_t)i * bits;
+            values[i] = (load64(column + (bitpos >> 3)) >> (bitpos & 7)) & mask;
+        }
+    }
+    else
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint64_t bitpos = (uint64_t)i * bits;
+            uint32_t shift = bitpos & 7;
+            uint64_t value = load64(column + (bitpos >> 3)) >> shift;
+            if (shift)
+            {
+                value |= load64(column + (bitpos >> 3) + 8) << (64 - shift);
+            }
+            values[i] = value & mask;
+        }
+    }
+}
+
+/**
+ * @brief initializes a columnar writer that appends blocks at fd's current
+ *        offset
+ *
+ * @param writer writer to initialize
+ * @param fd file descriptor positioned after the solved header
+ * @return 1 if successful, 0 on error
+ */
+int columnar_writer_init(columnar_writer_t *writer, int fd)
+{
+    if (NULL == writer)
+    {
+        return 0;
+    }
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    if (offset < 0)
+    {
+        return 0;
+    }
+    memset(writer, 0, sizeof(columnar_writer_t));
+    writer->fd = fd;
+    writer->offset = offset;
+    return 1;
+}
+
+/**
+ * @brief encodes the buffered records as one block and writes it
+ *
+ * @param writer writer holding at least one pending record
+ * @return 1 if successful, 0 on error
+ */
+static int flush_block(columnar_writer_t *writer)
+{
+    uint32_t count = writer->count;
+    uint64_t *columns[4];
+    struct column_block block = {0};
+    int success = 0;
+
+    if (writer->blockcount == writer->indexcapacity)
+    {
+        uint32_t newcapacity = writer->indexcapacity ? writer->indexcapacity * 2 : 64;
+        struct column_index_entry *index = realloc(writer->index, newcapacity * sizeof(struct column_index_entry));
+        if (NULL == index)
+        {
+            return 0;
+        }
+        writer->index = index;
+        writer->indexcapacity = newcapacity;
+    }
+
+    columns[0] = malloc(4 * count * sizeof(uint64_t));
+    if (NULL != columns[0])
+    {
+        for (int column = 1; column < 4; column++)
+        {
+            columns[column] = columns[column - 1] + count;
+        }
+        uint64_t maxdelta = 0, maxflags = 0, maxtype = 0, maxsolution = 0;
+        uint64_t minsolution = UINT64_MAX;
+        uint32_t previd = le32toh(writer->pending[0].eqid);
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint32_t eqid = le32toh(writer->pending[i].eqid);
+            uint64_t solution = solution_key(&writer->pending[i]);
+            columns[0][i] = zigzag_encode((int32_t)(eqid - previd));
+            columns[1][i] = writer->pending[i].flags;
+            columns[2][i] = writer->pending[i].type;
+            columns[3][i] = solution;
+            previd = eqid;
+            maxdelta |= columns[0][i];
+            maxflags |= columns[1][i];
+            maxtype |= columns[2][i];
+            minsolution = solution < minsolution ? solution : minsolution;
+            maxsolution = solution > maxsolution ? solution : maxsolution;
+        }
+        for (uint32_t i = 0; i < count; i++)
+        {
+            columns[3][i] -= minsolution;
+        }
+
+        block.count = htole32(count);
+        block.firsteqid = writer->pending[0].eqid;
+        block.solutionbase = htole64(minsolution);
+        block.deltabits = bit_width(maxdelta);
+        block.flagbits = bit_width(maxflags);
+        block.typebits = bit_width(maxtype);
+        block.solutionbits = bit_width(maxsolution - minsolution);
+
+        uint8_t widths[4] = {block.deltabits, block.flagbits, block.typebits, block.solutionbits};
+        size_t size = COLUMNAR_PAD;
+        for (int column = 0; column < 4; column++)
+        {
+            size += column_bytes(count, widths[column]);
+        }
+        block.size = htole32(size);
+
+        uint8_t *payload = calloc(1, size);
+        if (NULL != payload)
+        {
+            uint8_t *column = payload;
+            for (int i = 0; i < 4; i++)
+            {
+                pack_column(column, columns[i], count, widths[i]);
+                column += column_bytes(count, widths[i]);
+            }
+            writer->index[writer->blockcount].offset = htole64(writer->offset);
+            writer->index[writer->blockcount].first = htole64(writer->records);
+            success = write_all(writer->fd, &block, sizeof(block)) && write_all(writer->fd, payload, size);
+            if (success)
+            {
+                writer->blockcount++;
+                writer->records += count;
+                writer->offset += sizeof(block) + size;
+                writer->count = 0;
+            }
+            free(payload);
+        }
+    }
+    free(columns[0]);
+    return success;
+}
+
+/**
+ * @brief EMIT_F that adds solved equations to a columnar writer
+ *
+ * @param sink pointer to columnar_writer_t
+ * @param sequ array of solved equations
+ * @param count number of equations in sequ
+ * @return 1 if successful, 0 on error
+ */
+int columnar_writer_add(void *sink, struct solved_equation *sequ, size_t count)
+{
+    columnar_writer_t *writer = sink;
+    while (count > 0)
+    {
+        size_t space = COLUMNAR_BLOCK - writer->count;
+        size_t copy = count < space ? count : space;
+        memcpy(&writer->pending[writer->count], sequ, copy * sizeof(struct solved_equation));
+        writer->count += copy;
+        sequ += copy;
+        count -= copy;
+        if (writer->count == COLUMNAR_BLOCK && !flush_block(writer))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief encodes the last partial block and writes the block index and
+ *        footer. Releases the writer's index
+ *
+ * @param writer writer to finish
+ * @return 1 if successful, 0 on error
+ */
+int columnar_writer_finish(columnar_writer_t *writer)
+{
+    int success = 0;
+    if (NULL != writer && (writer->count == 0 || flush_block(writer)))
+    {
+        struct column_footer footer = {0};
+        footer.magic = htole32(COLUMNAR_MAGIC);
+        footer.blockcount = htole32(writer->blockcount);
+        footer.indexoffset = htole64(writer->offset);
+        footer.records = htole64(writer->records);
+        success = write_all(writer->fd, writer->index, writer->blockcount * sizeof(struct column_index_entry)) &&
+                  write_all(writer->fd, &footer, sizeof(footer));
+    }
+    if (NULL != writer)
+    {
+        free(writer->index);
+        writer->index = NULL;
+    }
+    return success;
+}
+
+/**
+ * @brief locates the footer and block index of a mapped columnar file
+ *
+ * @param map mapped solved file
+ * @param mapsz size of the mapping
+ * @param footer set to the footer
+ * @param index set to the first block index entry
+ * @return 1 if the file is a valid columnar file, 0 if not
+ */
+int columnar_locate(const uint8_t *map, size_t mapsz, const struct column_footer **footer,
+                    const struct column_index_entry **index)
+{
+    if (NULL == map || mapsz < sizeof(struct header) + sizeof(struct column_footer))
+    {
+        return 0;
+    }
+    const struct header *hdr = (const struct header *)map;
+    const struct column_footer *foot = (const struct column_footer *)(map + mapsz - sizeof(struct column_footer));
+    uint64_t indexoffset = le64toh(foot->indexoffset);
+    uint64_t blockcount = le32toh(foot->blockcount);
+    if (!(le16toh(hdr->optheaders) & SOLVED_OPT_COLUMNAR) || le32toh(foot->magic) != COLUMNAR_MAGIC ||
+        indexoffset < sizeof(struct header) ||
+        indexoffset + (blockcount * sizeof(struct column_index_entry)) != mapsz - sizeof(struct column_footer))
+    {
+        return 0;
+    }
+    *footer = foot;
+    *index = (const struct column_index_entry *)(map + indexoffset);
+    return 1;
+}
+
+/**
+ * @brief decodes one block back into packed rows
+ *
+ * @param block pointer to the block header
+ * @param avail bytes readable from block onwards
+ * @param sequ array of at least COLUMNAR_BLOCK records to decode into
+ * @return number of records decoded, -1 if the block is malformed
+ */
+int columnar_decode_block(const uint8_t *block, size_t avail, struct solved_equation *sequ)
+{
+    struct column_block hdr;
+    uint64_t columns[4][COLUMNAR_BLOCK];
+    if (avail < sizeof(hdr))
+    {
+        return -1;
+    }
+    memcpy(&hdr, block, sizeof(hdr));
+
+    uint32_t count = le32toh(hdr.count);
+    uint8_t widths[4] = {hdr.deltabits, hdr.flagbits, hdr.typebits, hdr.solutionbits};
+    size_t size = COLUMNAR_PAD;
+    for (int column = 0; column < 4; column++)
+    {
+        if (widths[column] > 64)
+        {
+            return -1;
+        }
+        size += column_bytes(count, widths[column]);
+    }
+    if (count > COLUMNAR_BLOCK || size != le32toh(hdr.size) || sizeof(hdr) + size > avail)
+    {
+        return -1;
+    }
+
+    const uint8_t *column = block + sizeof(hdr);
+    for (int i = 0; i < 4; i++)
+    {
+        unpack_column(column, columns[i], count, widths[i]);
+        column += column_bytes(count, widths[i]);
+    }
+
+    uint32_t eqid = le32toh(hdr.firsteqid);
+    uint64_t base = le64toh(hdr.solutionbase);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint64_t solution = columns[3][i] + base;
+        eqid += (uint32_t)zigzag_decode(columns[0][i]);
+        sequ[i].eqid = htole32(eqid);
+        sequ[i].flags = columns[1][i];
+        sequ[i].type = columns[2][i];
+        sequ[i].solution = htole64(sequ[i].type == 1 ? (uint64_t)zigzag_decode(solution) : solution);
+    }
+    return count;
+}
+
+int columnar_decode_blocks(const uint8_t *map, size_t mapsz, uint32_t firstblock, uint32_t lastblock,
+                           struct solved_equation *sequ)
+{
+    const struct column_footer *footer = NULL;
+    const struct column_index_entry *index = NULL;
+    if (!columnar_locate(map, mapsz, &footer, &index) || NULL == sequ || lastblock > le32toh(footer->blockcount))
+    {
+        return 0;
+    }
+
+    uint64_t records = le64toh(footer->records);
+    int success = 1;
+    for (uint32_t block = firstblock; block < lastblock && success; block++)
+    {
+        uint64_t offset = le64toh(index[block].offset);
+        uint64_t first = le64toh(index[block].first);
+        int count = -1;
+        if (offset < mapsz && first <= records)
+        {
+            struct solved_equation rows[COLUMNAR_BLOCK];
+            count = columnar_decode_block(map + offset, mapsz - offset, rows);
+            if (count >= 0 && first + count <= records)
+            {
+                memcpy(&sequ[first], rows, count * sizeof(struct solved_equation));
+            }
+            else
+            {
+                count = -1;
+            }
+        }
+        success = count >= 0;
+    }
+    return success;
+}
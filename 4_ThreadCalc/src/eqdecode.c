@@ -0,0 +1,189 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/equation.h"
+#include "../include/columnar.h"
+#include "../include/threadpool.h"
+#include "../include/stagestats.h"
+
+#define QUEUE_CAPACITY 64
+
+/**
+ * @brief print usage statement
+ * 
+ */
+void print_usage()
+{
+    printf("\n\nUsage: ./eqdecode <columnar_file> <solved_file> (optional -n <threadcount>)\n\n");
+}
+
+/**
+ * @brief a range of blocks decoded by one task
+ */
+typedef struct decode_range_t
+{
+    const uint8_t *map;
+    size_t mapsz;
+    uint32_t firstblock;
+    uint32_t lastblock;
+    struct solved_equation *sequ;
+} decode_range_t;
+
+/**
+ * @brief task function. Decodes the blocks of a decode_range_t into place
+ *
+ * @return void* the range if it decoded, NULL on error
+ */
+static void *decode_range(void *param)
+{
+    decode_range_t *range = param;
+    return columnar_decode_blocks(range->map, range->mapsz, range->firstblock, range->lastblock, range->sequ)
+               ? range
+               : NULL;
+}
+
+/**
+ * @brief decodes every block of a mapped columnar file, submitting a range
+ * of blocks per thread to a threadpool and waiting on their futures
+ *
+ * @param map mapped solved file
+ * @param mapsz size of the mapping
+ * @param blockcount blocks in the file
+ * @param sequ array of every record to decode into
+ * @param threadcount number of decoding threads
+ * @return int 1 if successful, 0 on error
+ */
+static int decode_file(const uint8_t *map, size_t mapsz, uint32_t blockcount, struct solved_equation *sequ,
+                       uint32_t threadcount)
+{
+    if (threadcount < 1)
+    {
+        threadcount = 1;
+    }
+    if (threadcount > blockcount)
+    {
+        threadcount = blockcount ? blockcount : 1;
+    }
+
+    threadpool_t *pool = threadpool_create(threadcount, QUEUE_CAPACITY);
+    decode_range_t *ranges = calloc(threadcount, sizeof(decode_range_t));
+    threadpool_future_t **futures = calloc(threadcount, sizeof(threadpool_future_t *));
+    int success = NULL != pool && NULL != ranges && NULL != futures;
+    for (uint32_t i = 0; success && i < threadcount; i++)
+    {
+        ranges[i].map = map;
+        ranges[i].mapsz = mapsz;
+        ranges[i].firstblock = (uint64_t)blockcount * i / threadcount;
+        ranges[i].lastblock = (uint64_t)blockcount * (i + 1) / threadcount;
+        ranges[i].sequ = sequ;
+        futures[i] = threadpool_submit(pool, decode_range, &ranges[i]);
+        if (NULL == futures[i])
+        {
+            success = NULL != decode_range(&ranges[i]);
+        }
+    }
+    for (uint32_t i = 0; NULL != futures && i < threadcount; i++)
+    {
+        if (NULL != futures[i])
+        {
+            success = NULL != threadpool_future_wait(futures[i]) && success;
+        }
+    }
+
+    if (NULL != pool)
+    {
+        terminate_threadpool(pool);
+    }
+    free(ranges);
+    free(futures);
+    return success;
+}
+
+/**
+ * @brief eqdecode converts a solved file written with threadcalc -c back to
+ * packed rows, decoding its blocks in parallel.
+ * 
+ * @param argc arg count
+ * @param argv argv[1] = <path to columnar solved file>
+ * argv[2] = <path to row solved file to write>
+ * 
+ * optional -n <threadcount>
+ * 
+ * @return int 0 if successful, 1 on error
+ */
+int main(int argc, char *argv[])
+{
+    int threadcount = 4;
+    int opt;
+    int success = 0;
+    while ((opt = getopt(argc, argv, "n:")) != -1)
+    {
+        if (opt == 'n')
+        {
+            threadcount = atoi(optarg);
+        }
+    }
+    if (argc - optind < 2)
+    {
+        print_usage();
+        return 1;
+    }
+
+    struct stat st;
+    int cfd = open(argv[optind], O_RDONLY);
+    if (cfd == -1 || fstat(cfd, &st) != 0)
+    {
+        printf("Could not open columnar file! %s\n", argv[optind]);
+        return 1;
+    }
+    uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, cfd, 0);
+    close(cfd);
+    if (map == MAP_FAILED)
+    {
+        printf("Could not map columnar file! %s\n", argv[optind]);
+        return 1;
+    }
+
+    const struct column_footer *footer = NULL;
+    const struct column_index_entry *index = NULL;
+    if (!columnar_locate(map, st.st_size, &footer, &index))
+    {
+        printf("Not a columnar solved file! %s\n", argv[optind]);
+    }
+    else
+    {
+        uint64_t records = le64toh(footer->records);
+        struct solved_equation *sequ = calloc(records ? records : 1, sizeof(struct solved_equation));
+        int sfd = open(argv[optind + 1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        struct header hdr = *(const struct header *)map;
+        size_t offset = le32toh(hdr.offset);
+        if (NULL != sequ && sfd != -1 && offset >= sizeof(hdr) && offset <= (size_t)st.st_size &&
+            decode_file(map, st.st_size, le32toh(footer->blockcount), sequ, threadcount))
+        {
+            // the optional headers are kept so the rows start at the header's offset
+            hdr.optheaders = htole16(le16toh(hdr.optheaders) & ~SOLVED_OPT_COLUMNAR);
+            success = write_header(sfd, &hdr) &&
+                      write(sfd, map + sizeof(hdr), offset - sizeof(hdr)) == (ssize_t)(offset - sizeof(hdr)) &&
+                      write_equations(sfd, sequ, records);
+        }
+        if (!success)
+        {
+            printf("Could not decode columnar file! %s\n", argv[optind]);
+        }
+        if (sfd != -1)
+        {
+            close(sfd);
+        }
+        free(sequ);
+    }
+
+    munmap(map, st.st_size);
+    stagestats_free();
+    return !success;
+}
@@ -0,0 +1,265 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/eqindex.h"
+#include "../include/eqsort.h"
+
+/**
+ * @brief bucket an eqid falls into for a directory of bucketbits bits
+ */
+static inline uint32_t eqid_bucket(uint32_t eqid, uint8_t bucketbits)
+{
+    return bucketbits ? eqid >> (32 - bucketbits) : 0;
+}
+
+/**
+ * @brief reads the records of a solved file back into index entries
+ *
+ * @param sfd solved file descriptor
+ * @param entries array of count entries to fill in
+ * @param start file offset of the first record, the header's offset
+ * @param count number of records from start
+ * @return 1 if successful, 0 on error
+ */
+static int read_entries(int sfd, struct index_entry *entries, off_t start, size_t count)
+{
+    struct solved_equation records[EQ_BATCH];
+    off_t offset = start;
+    size_t done = 0;
+    while (done < count)
+    {
+        size_t batch = (count - done) < EQ_BATCH ? (count - done) : EQ_BATCH;
+        ssize_t bytes = pread(sfd, records, batch * sizeof(struct solved_equation), offset);
+        if (bytes != (ssize_t)(batch * sizeof(struct solved_equation)))
+        {
+            return 0;
+        }
+        for (size_t i = 0; i < batch; i++)
+        {
+            entries[done + i].eqid = records[i].eqid;
+            entries[done + i].offset = htole64(offset + (i * sizeof(struct solved_equation)));
+        }
+        offset += bytes;
+        done += batch;
+    }
+    return 1;
+}
+
+/**
+ * @brief appends an index trailer to a fully written solved file
+ *
+ * @param sfd solved file descriptor opened for reading and writing
+ * @param hdr header written at the start of the solved file
+ * @return 1 if successful, 0 on error
+ */
+int eqindex_append(int sfd, struct header *hdr)
+{
+    int success = 0;
+    off_t end = lseek(sfd, 0, SEEK_END);
+    // records start after any optional headers, at the header's offset
+    off_t start = NULL != hdr ? (off_t)le32toh(hdr->offset) : 0;
+    if (NULL == hdr || start < (off_t)sizeof(struct header) || end < start)
+    {
+        return 0;
+    }
+
+    size_t count = (end - start) / sizeof(struct solved_equation);
+    uint8_t bucketbits = 0;
+    while (bucketbits < INDEX_MAX_BUCKET_BITS && (count >> bucketbits) > INDEX_BUCKET_LOAD)
+    {
+        bucketbits++;
+    }
+    size_t buckets = (size_t)1 << bucketbits;
+
+    struct index_entry *entries = calloc(count ? count : 1, sizeof(struct index_entry));
+    struct index_entry *scratch = calloc(count ? count : 1, sizeof(struct index_entry));
+    uint32_t *directory = calloc(buckets + 1, sizeof(uint32_t));
+    if (NULL != entries && NULL != scratch && NULL != directory && count <= UINT32_MAX &&
+        read_entries(sfd, entries, start, count))
+    {
+        radix_sort_u32(entries, scratch, count, sizeof(struct index_entry), offsetof(struct index_entry, eqid));
+
+        size_t entry = 0;
+        for (size_t bucket = 0; bucket < buckets; bucket++)
+        {
+            while (entry < count && eqid_bucket(le32toh(entries[entry].eqid), bucketbits) < bucket)
+            {
+                entry++;
+            }
+            directory[bucket] = htole32(entry);
+        }
+        directory[buckets] = htole32(count);
+
+        struct index_footer footer = {0};
+        footer.magic = htole32(SOLVED_INDEX_MAGIC);
+        footer.bucketbits = bucketbits;
+        footer.count = htole64(count);
+        footer.tableoffset = htole64(end);
+        footer.diroffset = htole64(end + (count * sizeof(struct index_entry)));
+
+        success = write_all(sfd, entries, count * sizeof(struct index_entry)) &&
+                  write_all(sfd, directory, (buckets + 1) * sizeof(uint32_t)) &&
+                  write_all(sfd, &footer, sizeof(footer));
+    }
+
+    free(entries);
+    free(scratch);
+    free(directory);
+    return success;
+}
+
+/**
+ * @brief checks that the index trailer of a mapped file is in bounds
+ *
+ * @param index mapped solved file with footer set
+ * @return 1 if the trailer can be used, 0 if not
+ */
+static int validate_trailer(eqindex_t *index)
+{
+    const struct index_footer *footer = index->footer;
+    uint64_t count = le64toh(footer->count);
+    uint64_t tableoffset = le64toh(footer->tableoffset);
+    uint64_t diroffset = le64toh(footer->diroffset);
+    uint64_t footeroffset = index->mapsz - sizeof(struct index_footer);
+    uint64_t dirsz = (((uint64_t)1 << footer->bucketbits) + 1) * sizeof(uint32_t);
+
+    if (le32toh(footer->magic) != SOLVED_INDEX_MAGIC || footer->bucketbits > INDEX_MAX_BUCKET_BITS ||
+        tableoffset < le32toh(index->hdr->offset) || count > (footeroffset - tableoffset) / sizeof(struct index_entry) ||
+        diroffset != tableoffset + (count * sizeof(struct index_entry)) || diroffset + dirsz != footeroffset)
+    {
+        return 0;
+    }
+    index->table = (const struct index_entry *)(index->map + tableoffset);
+    index->directory = (const uint32_t *)(index->map + diroffset);
+    return 1;
+}
+
+/**
+ * @brief maps a solved file for lookups
+ *
+ * @param path path to the solved file
+ * @return pointer to eqindex_t, NULL on failure
+ */
+eqindex_t *eqindex_open(const char *path)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct header))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    eqindex_t *index = calloc(1, sizeof(eqindex_t));
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (NULL == index || map == MAP_FAILED)
+    {
+        free(index);
+        if (map != MAP_FAILED)
+        {
+            munmap(map, st.st_size);
+        }
+        return NULL;
+    }
+
+    index->map = map;
+    index->mapsz = st.st_size;
+    index->hdr = map;
+    if ((le16toh(index->hdr->optheaders) & SOLVED_OPT_INDEX) &&
+        index->mapsz >= sizeof(struct header) + sizeof(struct index_footer))
+    {
+        index->footer = (const struct index_footer *)(index->map + index->mapsz - sizeof(struct index_footer));
+        if (!validate_trailer(index))
+        {
+            index->footer = NULL;
+        }
+    }
+    return index;
+}
+
+/**
+ * @brief finds the solved equation with eqid. Uses the index trailer when
+ *        the file has one and scans every record when it does not
+ *
+ * @param index mapped solved file
+ * @param eqid eqid to look up, in host byte order
+ * @param sequ filled in with the record when found
+ * @return 1 if found, 0 if not
+ */
+int eqindex_lookup(const eqindex_t *index, uint32_t eqid, struct solved_equation *sequ)
+{
+    if (NULL == index || NULL == sequ)
+    {
+        return 0;
+    }
+
+    if (NULL != index->footer)
+    {
+        uint32_t bucket = eqid_bucket(eqid, index->footer->bucketbits);
+        uint32_t low = le32toh(index->directory[bucket]);
+        uint32_t high = le32toh(index->directory[bucket + 1]);
+        while (low < high)
+        {
+            uint32_t mid = low + ((high - low) / 2);
+            if (le32toh(index->table[mid].eqid) < eqid)
+            {
+                low = mid + 1;
+            }
+            else
+            {
+                high = mid;
+            }
+        }
+        if (low < le64toh(index->footer->count) && le32toh(index->table[low].eqid) == eqid)
+        {
+            uint64_t offset = le64toh(index->table[low].offset);
+            if (offset + sizeof(struct solved_equation) <= index->mapsz)
+            {
+                memcpy(sequ, index->map + offset, sizeof(struct solved_equation));
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    size_t end = index->mapsz;
+    size_t start = le32toh(index->hdr->offset);
+    for (size_t offset = start > sizeof(struct header) ? start : sizeof(struct header); offset + sizeof(struct solved_equation) <= end;
+         offset += sizeof(struct solved_equation))
+    {
+        const struct solved_equation *record = (const struct solved_equation *)(index->map + offset);
+        if (le32toh(record->eqid) == eqid)
+        {
+            memcpy(sequ, record, sizeof(struct solved_equation));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief unmaps a solved file
+ *
+ * @param index pointer to the eqindex_t pointer to release
+ */
+void eqindex_close(eqindex_t **index)
+{
+    if (NULL != index && NULL != *index)
+    {
+        munmap((void *)(*index)->map, (*index)->mapsz);
+        free(*index);
+        *index = NULL;
+    }
+}
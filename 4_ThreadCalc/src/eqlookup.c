@@ -0,0 +1,71 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <endian.h>
+#include "../include/equation.h"
+#include "../include/eqindex.h"
+
+/**
+ * @brief print usage statement
+ * 
+ */
+void print_usage()
+{
+    printf("\n\nUsage: ./eqlookup <solved_file> <eqid> [eqid ...]\n\n");
+}
+
+/**
+ * @brief eqlookup maps a solved file and prints the solved equation for each
+ * eqid given. Files written with threadcalc -i are searched through their
+ * index trailer, other solved files are scanned.
+ * 
+ * @param argc arg count
+ * @param argv argv[1] = <path to solved file>
+ * argv[2..] = <eqid to look up>
+ * 
+ * @return int 0 if every eqid was found, 1 otherwise
+ */
+int main(int argc, char *argv[])
+{
+    int missing = 0;
+    if (argc < 3)
+    {
+        print_usage();
+        return 1;
+    }
+
+    eqindex_t *index = eqindex_open(argv[1]);
+    if (NULL == index)
+    {
+        printf("Could not open solved file! %s\n", argv[1]);
+        return 1;
+    }
+
+    for (int i = 2; i < argc; i++)
+    {
+        struct solved_equation sequ;
+        uint32_t eqid = strtoul(argv[i], NULL, 0);
+        if (eqindex_lookup(index, eqid, &sequ))
+        {
+            if (sequ.type == 1)
+            {
+                printf("%" PRIu32 " flags=%u type=%u solution=%" PRId64 "\n", eqid, sequ.flags, sequ.type,
+                       (int64_t)le64toh(sequ.solution));
+            }
+            else
+            {
+                printf("%" PRIu32 " flags=%u type=%u solution=%" PRIu64 "\n", eqid, sequ.flags, sequ.type,
+                       (uint64_t)le64toh(sequ.solution));
+            }
+        }
+        else
+        {
+            printf("%" PRIu32 " not found\n", eqid);
+            missing = 1;
+        }
+    }
+
+    eqindex_close(&index);
+    return missing;
+}
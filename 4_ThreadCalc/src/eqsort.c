@@ -0,0 +1,422 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <endian.h>
+#include "../include/eqsort.h"
+
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_PASSES (32 / RADIX_BITS)
+
+/**
+ * @brief a run being merged. Either a spilled run read back through fd, or the
+ *        last in memory run when fd is -1
+ *
+ * @param fd file descriptor of the spilled run, -1 for the in memory run
+ * @param buffer records read from the run
+ * @param buffersz number of records buffer holds
+ * @param count number of valid records in buffer
+ * @param next index of the next record to merge
+ */
+typedef struct run_cursor_t
+{
+    int fd;
+    struct solved_equation *buffer;
+    size_t buffersz;
+    size_t count;
+    size_t next;
+} run_cursor_t;
+
+/**
+ * @brief reads the little endian uint32 key of an item
+ */
+static inline uint32_t item_key(const char *item, size_t keyoffset)
+{
+    uint32_t key;
+    memcpy(&key, item + keyoffset, sizeof(key));
+    return le32toh(key);
+}
+
+/**
+ * @brief stable LSD radix sort of fixed size items by a little endian uint32
+ *        key stored inside each item
+ *
+ * @param items items to sort. holds the sorted items on return
+ * @param scratch buffer of at least count items
+ * @param count number of items
+ * @param itemsz size in bytes of one item
+ * @param keyoffset byte offset of the key within an item
+ */
+void radix_sort_u32(void *items, void *scratch, size_t count, size_t itemsz, size_t keyoffset)
+{
+    size_t histogram[RADIX_PASSES][RADIX_BUCKETS] = {0};
+    char *src = items;
+    char *dst = scratch;
+
+    if (count < 2)
+    {
+        return;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t key = item_key(src + (i * itemsz), keyoffset);
+        for (int pass = 0; pass < RADIX_PASSES; pass++)
+        {
+            histogram[pass][(key >> (pass * RADIX_BITS)) & (RADIX_BUCKETS - 1)]++;
+        }
+    }
+
+    for (int pass = 0; pass < RADIX_PASSES; pass++)
+    {
+        size_t *buckets = histogram[pass];
+        int shift = pass * RADIX_BITS;
+        size_t offset = 0;
+
+        // every key shares this digit, so the pass would not move anything
+        if (buckets[(item_key(src, keyoffset) >> shift) & (RADIX_BUCKETS - 1)] == count)
+        {
+            continue;
+        }
+        for (int bucket = 0; bucket < RADIX_BUCKETS; bucket++)
+        {
+            size_t bucketsz = buckets[bucket];
+            buckets[bucket] = offset;
+            offset += bucketsz;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            const char *item = src + (i * itemsz);
+            uint32_t digit = (item_key(item, keyoffset) >> shift) & (RADIX_BUCKETS - 1);
+            memcpy(dst + (buckets[digit]++ * itemsz), item, itemsz);
+        }
+        char *swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != (char *)items)
+    {
+        memcpy(items, src, count * itemsz);
+    }
+}
+
+/**
+ * @brief stable LSD radix sort of solved equations by little endian eqid
+ *
+ * @param records records to sort. holds the sorted records on return
+ * @param scratch buffer of at least count records
+ * @param count number of records
+ */
+void eqsort_radix(struct solved_equation *records, struct solved_equation *scratch, size_t count)
+{
+    radix_sort_u32(records, scratch, count, sizeof(struct solved_equation), offsetof(struct solved_equation, eqid));
+}
+
+/**
+ * @brief initializes a sorted writer
+ *
+ * @param writer writer to initialize
+ * @param emit function sorted records are emitted through
+ * @param sink output state handed to emit
+ * @param numeq number of records that will be added. used to size buffers
+ * @param memlimit memory budget in bytes for the in memory buffers
+ * @param tmpdir directory to spill sorted runs into
+ * @return 1 if successful, 0 on error
+ */
+int sorted_writer_init(sorted_writer_t *writer, EMIT_F emit, void *sink, uint64_t numeq, size_t memlimit,
+                       const char *tmpdir)
+{
+    int success = 0;
+    if (NULL != writer && NULL != emit && NULL != tmpdir)
+    {
+        memset(writer, 0, sizeof(sorted_writer_t));
+        writer->emit = emit;
+        writer->sink = sink;
+        writer->capacity = memlimit / (2 * sizeof(struct solved_equation));
+        if (writer->capacity < SORT_RUN_BUFFER)
+        {
+            writer->capacity = SORT_RUN_BUFFER;
+        }
+        if (numeq < writer->capacity)
+        {
+            writer->capacity = numeq > 0 ? numeq : 1;
+        }
+        snprintf(writer->tmpdir, sizeof(writer->tmpdir), "%s", tmpdir);
+        writer->records = calloc(writer->capacity, sizeof(struct solved_equation));
+        writer->scratch = calloc(writer->capacity, sizeof(struct solved_equation));
+        if (NULL != writer->records && NULL != writer->scratch)
+        {
+            success = 1;
+        }
+        else
+        {
+            sorted_writer_free(writer);
+        }
+    }
+    return success;
+}
+
+/**
+ * @brief sorts the in memory buffer and writes it to an unlinked temp file
+ *
+ * @param writer writer to spill
+ * @return 1 if successful, 0 on error
+ */
+static int spill_run(sorted_writer_t *writer)
+{
+    char template[PATH_MAX] = {0};
+    if (writer->runcount == writer->runcapacity)
+    {
+        uint32_t newcapacity = writer->runcapacity ? writer->runcapacity * 2 : 8;
+        int *runs = realloc(writer->runs, newcapacity * sizeof(int));
+        if (NULL == runs)
+        {
+            return 0;
+        }
+        writer->runs = runs;
+        writer->runcapacity = newcapacity;
+    }
+
+    int n = snprintf(template, sizeof(template), "%s/.eqsort.XXXXXX", writer->tmpdir);
+    if (n < 0 || (size_t)n >= sizeof(template))
+    {
+        return 0;
+    }
+    int runfd = mkstemp(template);
+    if (runfd == -1)
+    {
+        printf("Could not create sort run in %s\n", writer->tmpdir);
+        return 0;
+    }
+    unlink(template);
+
+    eqsort_radix(writer->records, writer->scratch, writer->count);
+    if (!write_equations(runfd, writer->records, writer->count) || lseek(runfd, 0, SEEK_SET) != 0)
+    {
+        close(runfd);
+        return 0;
+    }
+    writer->runs[writer->runcount++] = runfd;
+    writer->count = 0;
+    return 1;
+}
+
+/**
+ * @brief adds solved equations to the writer, spilling a sorted run when the
+ *        in memory buffer fills
+ *
+ * @param writer writer to add to
+ * @param sequ array of solved equations
+ * @param count number of equations in sequ
+ * @return 1 if successful, 0 on error
+ */
+int sorted_writer_add(sorted_writer_t *writer, const struct solved_equation *sequ, size_t count)
+{
+    while (count > 0)
+    {
+        if (writer->count == writer->capacity && !spill_run(writer))
+        {
+            return 0;
+        }
+        size_t space = writer->capacity - writer->count;
+        size_t copy = count < space ? count : space;
+        memcpy(&writer->records[writer->count], sequ, copy * sizeof(struct solved_equation));
+        writer->count += copy;
+        sequ += copy;
+        count -= copy;
+    }
+    return 1;
+}
+
+/**
+ * @brief refills a spilled run's buffer once it has been merged
+ *
+ * @param cursor cursor to refill
+ * @return number of records now buffered
+ */
+static size_t refill_cursor(run_cursor_t *cursor)
+{
+    cursor->count = 0;
+    cursor->next = 0;
+    if (cursor->fd != -1)
+    {
+        ssize_t bytes = read(cursor->fd, cursor->buffer, cursor->buffersz * sizeof(struct solved_equation));
+        if (bytes > 0)
+        {
+            cursor->count = bytes / sizeof(struct solved_equation);
+        }
+    }
+    return cursor->count;
+}
+
+/**
+ * @brief eqid of the record a cursor will merge next
+ */
+static uint32_t cursor_key(const run_cursor_t *cursor)
+{
+    return le32toh(cursor->buffer[cursor->next].eqid);
+}
+
+/**
+ * @brief restores the min heap property from index down
+ *
+ * @param heap array of cursors ordered as a binary min heap
+ * @param heapsz number of cursors in heap
+ * @param index index to sift down from
+ */
+static void sift_down(run_cursor_t **heap, uint32_t heapsz, uint32_t index)
+{
+    for (;;)
+    {
+        uint32_t smallest = index;
+        uint32_t left = index * 2 + 1;
+        uint32_t right = left + 1;
+        if (left < heapsz && cursor_key(heap[left]) < cursor_key(heap[smallest]))
+        {
+            smallest = left;
+        }
+        if (right < heapsz && cursor_key(heap[right]) < cursor_key(heap[smallest]))
+        {
+            smallest = right;
+        }
+        if (smallest == index)
+        {
+            return;
+        }
+        run_cursor_t *swap = heap[index];
+        heap[index] = heap[smallest];
+        heap[smallest] = swap;
+        index = smallest;
+    }
+}
+
+/**
+ * @brief k-way merges the spilled runs and the sorted in memory run into the
+ *        writer's output.
+ *        The scratch buffer is carved up into per run read buffers and an
+ *        output buffer so the merge stays inside the memory budget
+ *
+ * @param writer writer to merge
+ * @return 1 if successful, 0 on error
+ */
+static int merge_runs(sorted_writer_t *writer)
+{
+    int success = 1;
+    uint32_t cursorcount = writer->runcount + 1;
+    run_cursor_t *cursors = calloc(cursorcount, sizeof(run_cursor_t));
+    run_cursor_t **heap = calloc(cursorcount, sizeof(run_cursor_t *));
+    size_t buffersz = writer->capacity / (cursorcount);
+    uint32_t heapsz = 0;
+
+    if (NULL == cursors || NULL == heap || buffersz == 0)
+    {
+        free(cursors);
+        free(heap);
+        return 0;
+    }
+
+    struct solved_equation *output = writer->scratch + (buffersz * writer->runcount);
+    size_t outputsz = writer->capacity - (buffersz * writer->runcount);
+    size_t outputcount = 0;
+
+    for (uint32_t i = 0; i < writer->runcount; i++)
+    {
+        cursors[i].fd = writer->runs[i];
+        cursors[i].buffer = writer->scratch + (buffersz * i);
+        cursors[i].buffersz = buffersz;
+        if (refill_cursor(&cursors[i]))
+        {
+            heap[heapsz++] = &cursors[i];
+        }
+    }
+    cursors[writer->runcount].fd = -1;
+    cursors[writer->runcount].buffer = writer->records;
+    cursors[writer->runcount].count = writer->count;
+    if (writer->count > 0)
+    {
+        heap[heapsz++] = &cursors[writer->runcount];
+    }
+
+    for (int64_t i = (int64_t)heapsz / 2 - 1; i >= 0; i--)
+    {
+        sift_down(heap, heapsz, i);
+    }
+
+    while (heapsz > 0 && success)
+    {
+        run_cursor_t *top = heap[0];
+        output[outputcount++] = top->buffer[top->next++];
+        if (outputcount == outputsz)
+        {
+            success = writer->emit(writer->sink, output, outputcount);
+            outputcount = 0;
+        }
+        if (top->next == top->count && !refill_cursor(top))
+        {
+            heap[0] = heap[--heapsz];
+        }
+        sift_down(heap, heapsz, 0);
+    }
+    if (success && outputcount > 0)
+    {
+        success = writer->emit(writer->sink, output, outputcount);
+    }
+
+    free(cursors);
+    free(heap);
+    return success;
+}
+
+/**
+ * @brief sorts what is left in memory, merges it with any spilled runs and
+ *        emits the result. Releases the writer's buffers
+ *
+ * @param writer writer to finish
+ * @return 1 if successful, 0 on error
+ */
+int sorted_writer_finish(sorted_writer_t *writer)
+{
+    int success = 0;
+    if (NULL != writer && NULL != writer->records)
+    {
+        eqsort_radix(writer->records, writer->scratch, writer->count);
+        if (writer->runcount == 0)
+        {
+            success = writer->emit(writer->sink, writer->records, writer->count);
+        }
+        else
+        {
+            success = merge_runs(writer);
+        }
+        sorted_writer_free(writer);
+    }
+    return success;
+}
+
+/**
+ * @brief releases a writer's buffers and spilled runs without writing
+ *
+ * @param writer writer to release
+ */
+void sorted_writer_free(sorted_writer_t *writer)
+{
+    if (NULL != writer)
+    {
+        for (uint32_t i = 0; i < writer->runcount; i++)
+        {
+            close(writer->runs[i]);
+        }
+        free(writer->runs);
+        writer->runs = NULL;
+        writer->runcount = 0;
+        writer->runcapacity = 0;
+        free(writer->records);
+        writer->records = NULL;
+        free(writer->scratch);
+        writer->scratch = NULL;
+        writer->count = 0;
+    }
+}
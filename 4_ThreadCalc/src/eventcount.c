@@ -0,0 +1,62 @@
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "../include/eventcount.h"
+
+void eventcount_init(eventcount_t *ec)
+{
+    ec->seq = 0;
+    ec->waiters = 0;
+}
+
+uint32_t eventcount_prepare(eventcount_t *ec)
+{
+    __atomic_add_fetch(&ec->waiters, 1, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&ec->seq, __ATOMIC_SEQ_CST);
+}
+
+void eventcount_cancel(eventcount_t *ec)
+{
+    __atomic_sub_fetch(&ec->waiters, 1, __ATOMIC_RELAXED);
+}
+
+void eventcount_wait(eventcount_t *ec, uint32_t key)
+{
+    if (__atomic_load_n(&ec->seq, __ATOMIC_SEQ_CST) == key)
+    {
+        syscall(SYS_futex, &ec->seq, FUTEX_WAIT_PRIVATE, key, NULL, NULL, 0);
+    }
+    __atomic_sub_fetch(&ec->waiters, 1, __ATOMIC_RELAXED);
+}
+
+int eventcount_timedwait(eventcount_t *ec, uint32_t key, uint32_t ms)
+{
+    int woken = 1;
+    if (__atomic_load_n(&ec->seq, __ATOMIC_SEQ_CST) == key)
+    {
+        struct timespec timeout = {ms / 1000, (ms % 1000) * 1000000L};
+        if (syscall(SYS_futex, &ec->seq, FUTEX_WAIT_PRIVATE, key, &timeout, NULL, 0) != 0 &&
+            ETIMEDOUT == errno)
+        {
+            woken = 0;
+        }
+    }
+    __atomic_sub_fetch(&ec->waiters, 1, __ATOMIC_RELAXED);
+    return woken;
+}
+
+int eventcount_notify(eventcount_t *ec, int all)
+{
+    // a full barrier read, paired with the increment in prepare: either the
+    // waiter's recheck sees the caller's change or this sees the waiter
+    if (0 == __atomic_fetch_add(&ec->waiters, 0, __ATOMIC_SEQ_CST))
+    {
+        return 0;
+    }
+    __atomic_add_fetch(&ec->seq, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &ec->seq, FUTEX_WAKE_PRIVATE, all ? INT_MAX : 1, NULL, NULL, 0);
+    return 1;
+}
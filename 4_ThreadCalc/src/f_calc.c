@@ -10,6 +10,8 @@
 #include <endian.h>
 #include <linux/limits.h>
 #include "../include/equation.h"
+#include "../../0_Common/include/common.h"
+#include "../../0_Common/include/probes.h"
 
 
 
@@ -31,4 +33,166 @@ int write_equation(int fd, struct solved_equation *sequ)
         success = 1;
     }
     return success;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief writes all of buffer, retrying short writes
+ *
+ * @param fd file descriptor to write to
+ * @param buffer bytes to write
+ * @param size number of bytes in buffer
+ * @return int returns 1 if successful, 0 on error
+ */
+int write_all(int fd, const void *buffer, size_t size)
+{
+    size_t written = 0;
+    while (written < size)
+    {
+        ssize_t rv = write(fd, (const char *)buffer + written, size - written);
+        if (rv <= 0)
+        {
+            return 0;
+        }
+        written += rv;
+    }
+    return 1;
+}
+
+/**
+ * @brief writes an array of solved equations to a solved file in one call
+ *
+ * @param fd file descriptor for solved file to write to
+ * @param sequ array of solved equations
+ * @param count number of equations in sequ
+ * @return int returns 1 if successful, 0 on error
+ */
+int write_equations(int fd, struct solved_equation *sequ, size_t count)
+{
+    return write_all(fd, sequ, count * sizeof(struct solved_equation));
+}
+
+/**
+ * @brief copies the optional headers between the header and the first
+ * equation of an unsolved file into the solved file, so its records start
+ * at the header's offset as well
+ *
+ * @param stream eqstream of unsolved file positioned after the header
+ * @param fd file descriptor for solved file positioned after the header
+ * @param size bytes of optional headers, the header's offset less its size
+ * @return int returns 1 if successful, 0 on a short file or write error
+ */
+int copy_optheaders(eqstream_t *stream, int fd, uint64_t size)
+{
+    uint8_t buffer[4096];
+    while (size > 0)
+    {
+        size_t want = size < sizeof(buffer) ? size : sizeof(buffer);
+        ssize_t rv = eqstream_read(stream, buffer, want);
+        if (rv <= 0 || write(fd, buffer, rv) != rv)
+        {
+            return 0;
+        }
+        size -= rv;
+    }
+    return 1;
+}
+
+/**
+ * @brief EMIT_F that writes solved equations as packed rows
+ *
+ * @param sink pointer to the int file descriptor of the solved file
+ * @param sequ array of solved equations
+ * @param count number of equations in sequ
+ * @return int returns 1 if successful, 0 on error
+ */
+int emit_rows(void *sink, struct solved_equation *sequ, size_t count)
+{
+    return write_equations(*(int *)sink, sequ, count);
+}
+
+/**
+ * @brief reads up to count unsolved equations, decompressing the input
+ * straight into uequ when the file is compressed
+ *
+ * @param stream eqstream of unsolved file positioned at an equation
+ * @param uequ array to read equations into
+ * @param count max number of equations to read
+ * @return number of whole equations read
+ */
+size_t read_equations(eqstream_t *stream, struct unsolved_equation *uequ, size_t count)
+{
+    ssize_t bytesread = eqstream_read(stream, uequ, count * sizeof(struct unsolved_equation));
+    if (bytesread < 0)
+    {
+        return 0;
+    }
+    return bytesread / sizeof(struct unsolved_equation);
+}
+
+/**
+ * @brief solves a single equation into solved file format. An equation
+ * with an unknown operator is still filled in, unsolved with a solution of
+ * 0, so a solved file holds one record per equation of its header's numeq
+ * and the records of sorted, indexed and streamed output line up with it
+ *
+ * @param uequ pointer to unsolved equation
+ * @param sequ pointer to solved equation to fill in
+ * @return int returns 1 if solved, 0 if the equation could not be solved
+ */
+int solve_equation(const struct unsolved_equation *uequ, struct solved_equation *sequ)
+{
+    int solved = 0;
+    int64_t solution = 0;
+    int sign = signage_decider(uequ->operatr);
+
+    sequ->eqid = uequ->eqid;
+    sequ->type = (sign == 1) ? 1 : 0;
+    if (sign == 1)
+    {
+        solved = signedcalc(le64toh(uequ->operand1), uequ->operatr, le64toh(uequ->operand2), &solution);
+    }
+    else if (sign == 0)
+    {
+        solved = unsignedcalc(le64toh(uequ->operand1), uequ->operatr, le64toh(uequ->operand2), &solution);
+    }
+    else
+    {
+        printf("\nOperator error!\n");
+    }
+
+    if (solved)
+    {
+        sequ->flags = 1;
+        sequ->solution = solution;
+    }
+    else
+    {
+        if (sign != -1)
+        {
+            printf("\nUnsolved!!!\n");
+        }
+        sequ->flags = 0;
+        sequ->solution = 0;
+    }
+    return solved;
+}
+
+/**
+ * @brief solves a batch of equations
+ *
+ * @param uequ array of unsolved equations
+ * @param sequ array of at least count solved equations to fill in
+ * @param count number of equations to solve
+ * @return number of equations that were solved
+ */
+size_t solve_batch(const struct unsolved_equation *uequ, struct solved_equation *sequ, size_t count)
+{
+    size_t solved = 0;
+    PROBE2(equation, batch__start, uequ, count);
+    for (size_t i = 0; i < count; i++)
+    {
+        solved += solve_equation(&uequ[i], &sequ[i]);
+    }
+    PROBE2(equation, batch__done, count, solved);
+    return solved;
+}
@@ -0,0 +1,577 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <link.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "../include/profiler.h"
+
+#if defined(__x86_64__) || defined(__aarch64__)
+#define PROFILER_SUPPORTED 1
+#else
+#define PROFILER_SUPPORTED 0
+#endif
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+#define FRAME_NAME_MAX 128
+
+/**
+ * @brief a function symbol of the executable
+ *
+ */
+typedef struct profiler_symbol_t
+{
+    uintptr_t start;
+    uintptr_t size;
+    const char *name;
+} profiler_symbol_t;
+
+/**
+ * @brief the executable's function symbols sorted by address, and the
+ * mapping of the file they point into
+ *
+ */
+typedef struct profiler_symtab_t
+{
+    profiler_symbol_t *symbols;
+    size_t count;
+    void *image;
+    size_t imagesize;
+} profiler_symtab_t;
+
+/**
+ * @brief a symbolized stack while the output is merged
+ *
+ */
+typedef struct profiler_line_t
+{
+    char *stack;
+    uint64_t count;
+} profiler_line_t;
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t registry_once = PTHREAD_ONCE_INIT;
+static pthread_key_t registry_key;
+static profiler_thread_t *registry = NULL;
+static int running = 0;
+static long interval_ns = 0;
+static __thread profiler_thread_t *mine = NULL;
+
+/**
+ * @brief pthread key destructor. Deletes an exiting thread's timer; its
+ * stacks are kept for profiler_write
+ *
+ */
+static void detach_thread(void *voidp)
+{
+    profiler_thread_t *thread = voidp;
+    pthread_mutex_lock(&registry_lock);
+    if (thread->timed)
+    {
+        timer_delete(thread->timer);
+        thread->timed = 0;
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+/**
+ * @brief creates the key whose destructor detaches threads
+ *
+ */
+static void create_key(void)
+{
+    pthread_key_create(&registry_key, detach_thread);
+}
+
+/**
+ * @brief walks the interrupted thread's frame pointer chain. Each frame
+ * holds the caller's frame pointer followed by the return address; the
+ * walk stops at a frame outside the thread's stack or one that does not
+ * move towards its base, so a function built without frame pointers ends
+ * the stack early instead of faulting
+ *
+ * @return uint32_t frames written to pcs
+ */
+static uint32_t walk_stack(const profiler_thread_t *thread, const ucontext_t *uc, void **pcs)
+{
+    uint32_t depth = 0;
+#if defined(__x86_64__)
+    uintptr_t pc = uc->uc_mcontext.gregs[REG_RIP];
+    uintptr_t fp = uc->uc_mcontext.gregs[REG_RBP];
+#elif defined(__aarch64__)
+    uintptr_t pc = uc->uc_mcontext.pc;
+    uintptr_t fp = uc->uc_mcontext.regs[29];
+#else
+    uintptr_t pc = 0;
+    uintptr_t fp = 0;
+#endif
+    pcs[depth++] = (void *)pc;
+    while (depth < PROFILER_DEPTH && fp >= thread->stacklo && fp + 2 * sizeof(uintptr_t) <= thread->stackhi &&
+           0 == fp % sizeof(uintptr_t))
+    {
+        const uintptr_t *frame = (const uintptr_t *)fp;
+        if (0 == frame[1])
+        {
+            break;
+        }
+        // back into the call instruction, so the caller's line is named
+        pcs[depth++] = (void *)(frame[1] - 1);
+        if (frame[0] <= fp)
+        {
+            break;
+        }
+        fp = frame[0];
+    }
+    return depth;
+}
+
+/**
+ * @brief SIGPROF handler. Counts the interrupted stack in the thread's
+ * table. Async signal safe: it touches only the thread's own table
+ *
+ */
+static void on_sigprof(int sig, siginfo_t *info, void *context)
+{
+    (void)sig;
+    (void)info;
+    profiler_thread_t *thread = mine;
+    if (NULL == thread || !__atomic_load_n(&running, __ATOMIC_RELAXED))
+    {
+        return;
+    }
+    int saved = errno;
+    void *pcs[PROFILER_DEPTH];
+    uint32_t depth = walk_stack(thread, context, pcs);
+    // FNV-1a over the frames; 0 marks an empty slot
+    uint64_t hash = 14695981039346656037ull;
+    for (uint32_t i = 0; i < depth; i++)
+    {
+        hash = (hash ^ (uintptr_t)pcs[i]) * 1099511628211ull;
+    }
+    hash |= 1;
+    thread->samples++;
+    for (uint32_t probe = 0; probe < PROFILER_STACKS; probe++)
+    {
+        profiler_stack_t *stack = &thread->stacks[(hash + probe) % PROFILER_STACKS];
+        if (0 == stack->hash)
+        {
+            stack->depth = depth;
+            for (uint32_t i = 0; i < depth; i++)
+            {
+                stack->pcs[i] = pcs[i];
+            }
+            stack->count = 1;
+            stack->hash = hash;
+            errno = saved;
+            return;
+        }
+        if (stack->hash == hash && stack->depth == depth)
+        {
+            uint32_t i = 0;
+            while (i < depth && stack->pcs[i] == pcs[i])
+            {
+                i++;
+            }
+            if (i == depth)
+            {
+                stack->count++;
+                errno = saved;
+                return;
+            }
+        }
+    }
+    thread->dropped++;
+    errno = saved;
+}
+
+int profiler_start(uint32_t hz)
+{
+    if (!PROFILER_SUPPORTED)
+    {
+        printf("Profiling is not supported on this architecture!\n");
+        return 0;
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = on_sigprof;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, NULL) != 0)
+    {
+        printf("Could not install the profiling signal handler!\n");
+        return 0;
+    }
+    interval_ns = 1000000000L / (hz > 0 ? hz : PROFILER_HZ);
+    __atomic_store_n(&running, 1, __ATOMIC_SEQ_CST);
+    return profiler_attach();
+}
+
+int profiler_attach(void)
+{
+    if (NULL != mine || !__atomic_load_n(&running, __ATOMIC_SEQ_CST))
+    {
+        return 1;
+    }
+    pthread_once(&registry_once, create_key);
+    profiler_thread_t *thread = calloc(1, sizeof(profiler_thread_t));
+    if (NULL == thread)
+    {
+        return 0;
+    }
+
+    pthread_attr_t attr;
+    void *stackaddr = NULL;
+    size_t stacksize = 0;
+    if (pthread_getattr_np(pthread_self(), &attr) == 0)
+    {
+        pthread_attr_getstack(&attr, &stackaddr, &stacksize);
+        pthread_attr_destroy(&attr);
+    }
+    thread->stacklo = (uintptr_t)stackaddr;
+    thread->stackhi = (uintptr_t)stackaddr + stacksize;
+
+    struct sigevent event;
+    memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGPROF;
+    event.sigev_notify_thread_id = syscall(SYS_gettid);
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = interval_ns / 1000000000L;
+    spec.it_interval.tv_nsec = interval_ns % 1000000000L;
+    spec.it_value = spec.it_interval;
+
+    pthread_mutex_lock(&registry_lock);
+    thread->next = registry;
+    registry = thread;
+    // published before the timer can fire on this thread
+    mine = thread;
+    pthread_setspecific(registry_key, thread);
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &thread->timer) != 0)
+    {
+        pthread_mutex_unlock(&registry_lock);
+        printf("Could not create a profiling timer!\n");
+        return 0;
+    }
+    thread->timed = 1;
+    if (timer_settime(thread->timer, 0, &spec, NULL) != 0)
+    {
+        pthread_mutex_unlock(&registry_lock);
+        printf("Could not start a profiling timer!\n");
+        return 0;
+    }
+    pthread_mutex_unlock(&registry_lock);
+    return 1;
+}
+
+void profiler_stop(void)
+{
+    __atomic_store_n(&running, 0, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&registry_lock);
+    for (profiler_thread_t *thread = registry; NULL != thread; thread = thread->next)
+    {
+        if (thread->timed)
+        {
+            timer_delete(thread->timer);
+            thread->timed = 0;
+        }
+    }
+    pthread_mutex_unlock(&registry_lock);
+    // a signal already pending is discarded rather than handled late
+    signal(SIGPROF, SIG_IGN);
+}
+
+/**
+ * @brief dl_iterate_phdr callback taking the load bias of the first
+ * object, the executable
+ *
+ */
+static int main_bias(struct dl_phdr_info *info, size_t size, void *data)
+{
+    (void)size;
+    *(uintptr_t *)data = info->dlpi_addr;
+    return 1;
+}
+
+/**
+ * @brief orders symbols by address
+ *
+ */
+static int symbol_compare(const void *a, const void *b)
+{
+    const profiler_symbol_t *left = a;
+    const profiler_symbol_t *right = b;
+    return (left->start > right->start) - (left->start < right->start);
+}
+
+/**
+ * @brief loads the function symbols of the running executable from
+ * /proc/self/exe. The full symbol table names static functions too,
+ * which dladdr cannot; a stripped file falls back to its dynamic symbols
+ *
+ * @return int 1 if any symbols were loaded, 0 otherwise
+ */
+static int load_symbols(profiler_symtab_t *tab)
+{
+    memset(tab, 0, sizeof(*tab));
+    int fd = open("/proc/self/exe", O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ElfW(Ehdr)))
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return 0;
+    }
+    void *image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == image)
+    {
+        return 0;
+    }
+    tab->image = image;
+    tab->imagesize = st.st_size;
+
+    const uint8_t *base = image;
+    const ElfW(Ehdr) *ehdr = image;
+    if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+        ehdr->e_shoff + (size_t)ehdr->e_shnum * sizeof(ElfW(Shdr)) > tab->imagesize)
+    {
+        return 0;
+    }
+    const ElfW(Shdr) *shdr = (const ElfW(Shdr) *)(base + ehdr->e_shoff);
+    const ElfW(Shdr) *symsec = NULL;
+    for (int pass = 0; pass < 2 && NULL == symsec; pass++)
+    {
+        for (uint32_t i = 0; i < ehdr->e_shnum; i++)
+        {
+            if (shdr[i].sh_type == (0 == pass ? SHT_SYMTAB : SHT_DYNSYM))
+            {
+                symsec = &shdr[i];
+                break;
+            }
+        }
+    }
+    if (NULL == symsec || symsec->sh_link >= ehdr->e_shnum ||
+        symsec->sh_offset + symsec->sh_size > tab->imagesize)
+    {
+        return 0;
+    }
+    const ElfW(Shdr) *strsec = &shdr[symsec->sh_link];
+    if (strsec->sh_offset + strsec->sh_size > tab->imagesize)
+    {
+        return 0;
+    }
+    const ElfW(Sym) *syms = (const ElfW(Sym) *)(base + symsec->sh_offset);
+    size_t nsyms = symsec->sh_size / sizeof(ElfW(Sym));
+    const char *strings = (const char *)(base + strsec->sh_offset);
+    uintptr_t bias = 0;
+    dl_iterate_phdr(main_bias, &bias);
+
+    tab->symbols = malloc(nsyms * sizeof(profiler_symbol_t));
+    if (NULL == tab->symbols)
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < nsyms; i++)
+    {
+        if (ELF64_ST_TYPE(syms[i].st_info) == STT_FUNC && 0 != syms[i].st_value && syms[i].st_name < strsec->sh_size)
+        {
+            profiler_symbol_t *symbol = &tab->symbols[tab->count++];
+            symbol->start = bias + syms[i].st_value;
+            symbol->size = syms[i].st_size;
+            symbol->name = strings + syms[i].st_name;
+        }
+    }
+    qsort(tab->symbols, tab->count, sizeof(profiler_symbol_t), symbol_compare);
+    return tab->count > 0;
+}
+
+/**
+ * @brief unmaps the executable and frees its symbols
+ *
+ */
+static void free_symbols(profiler_symtab_t *tab)
+{
+    free(tab->symbols);
+    if (NULL != tab->image)
+    {
+        munmap(tab->image, tab->imagesize);
+    }
+    memset(tab, 0, sizeof(*tab));
+}
+
+/**
+ * @brief names the function a pc is in. Folded stacks use ';' between
+ * frames and ' ' before the count, so neither may appear in a name
+ *
+ * @param name buffer of FRAME_NAME_MAX bytes
+ * @return int 1 if pc is in a loaded object, 0 if it was named by address
+ */
+static int frame_name(const profiler_symtab_t *tab, void *pc, char *name)
+{
+    uintptr_t addr = (uintptr_t)pc;
+    size_t lo = 0;
+    size_t hi = tab->count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (tab->symbols[mid].start <= addr)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    Dl_info info;
+    int found = 0;
+    if (lo > 0 && addr < tab->symbols[lo - 1].start + tab->symbols[lo - 1].size)
+    {
+        snprintf(name, FRAME_NAME_MAX, "%s", tab->symbols[lo - 1].name);
+    }
+    else if ((found = dladdr(pc, &info)) != 0 && NULL != info.dli_sname)
+    {
+        snprintf(name, FRAME_NAME_MAX, "%s", info.dli_sname);
+    }
+    else if (found && NULL != info.dli_fname)
+    {
+        const char *file = strrchr(info.dli_fname, '/');
+        snprintf(name, FRAME_NAME_MAX, "[%s]", NULL != file ? file + 1 : info.dli_fname);
+    }
+    else
+    {
+        snprintf(name, FRAME_NAME_MAX, "0x%" PRIxPTR, addr);
+        return 0;
+    }
+    for (char *c = name; '\0' != *c; c++)
+    {
+        if (';' == *c || ' ' == *c)
+        {
+            *c = '_';
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief orders folded lines by stack so equal ones are adjacent
+ *
+ */
+static int line_compare(const void *a, const void *b)
+{
+    return strcmp(((const profiler_line_t *)a)->stack, ((const profiler_line_t *)b)->stack);
+}
+
+int profiler_write(FILE *out)
+{
+    profiler_symtab_t tab;
+    load_symbols(&tab);
+
+    size_t count = 0;
+    pthread_mutex_lock(&registry_lock);
+    for (profiler_thread_t *thread = registry; NULL != thread; thread = thread->next)
+    {
+        for (uint32_t s = 0; s < PROFILER_STACKS; s++)
+        {
+            count += 0 != thread->stacks[s].hash;
+        }
+    }
+    profiler_line_t *lines = calloc(count > 0 ? count : 1, sizeof(profiler_line_t));
+    int written = NULL != lines;
+    size_t used = 0;
+    uint64_t samples = 0;
+    uint64_t dropped = 0;
+    for (profiler_thread_t *thread = registry; NULL != lines && NULL != thread; thread = thread->next)
+    {
+        samples += thread->samples;
+        dropped += thread->dropped;
+        for (uint32_t s = 0; s < PROFILER_STACKS && used < count; s++)
+        {
+            const profiler_stack_t *stack = &thread->stacks[s];
+            if (0 == stack->hash)
+            {
+                continue;
+            }
+            char *names = malloc((size_t)stack->depth * FRAME_NAME_MAX);
+            char *folded = malloc((size_t)stack->depth * FRAME_NAME_MAX);
+            if (NULL == names || NULL == folded)
+            {
+                free(names);
+                free(folded);
+                continue;
+            }
+            // a frameless function in a library leaves the walk following a
+            // register that was not a frame pointer, so the stack ends at the
+            // first return address outside every loaded object
+            uint32_t depth = 1;
+            frame_name(&tab, stack->pcs[0], names);
+            while (depth < stack->depth && frame_name(&tab, stack->pcs[depth], names + depth * FRAME_NAME_MAX))
+            {
+                depth++;
+            }
+            size_t len = 0;
+            // root first, as flame graphs stack them
+            for (uint32_t f = depth; f > 0; f--)
+            {
+                len += sprintf(folded + len, "%s%s", len > 0 ? ";" : "", names + (f - 1) * FRAME_NAME_MAX);
+            }
+            free(names);
+            lines[used].stack = folded;
+            lines[used].count = stack->count;
+            used++;
+        }
+    }
+    pthread_mutex_unlock(&registry_lock);
+    free_symbols(&tab);
+
+    qsort(lines, used, sizeof(profiler_line_t), line_compare);
+    for (size_t i = 0; i < used; i++)
+    {
+        uint64_t total = lines[i].count;
+        while (i + 1 < used && strcmp(lines[i].stack, lines[i + 1].stack) == 0)
+        {
+            free(lines[i].stack);
+            total += lines[++i].count;
+        }
+        fprintf(out, "%s %" PRIu64 "\n", lines[i].stack, total);
+        free(lines[i].stack);
+    }
+    free(lines);
+    if (dropped > 0)
+    {
+        printf("Profiler dropped %" PRIu64 " of %" PRIu64 " samples, the stack tables were full\n", dropped, samples);
+    }
+    return written && !ferror(out);
+}
+
+void profiler_free(void)
+{
+    pthread_mutex_lock(&registry_lock);
+    while (NULL != registry)
+    {
+        profiler_thread_t *thread = registry;
+        registry = thread->next;
+        free(thread);
+    }
+    pthread_mutex_unlock(&registry_lock);
+    if (NULL != mine)
+    {
+        pthread_setspecific(registry_key, NULL);
+    }
+    mine = NULL;
+}
@@ -0,0 +1,195 @@
+#include <stdlib.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include "../include/stagestats.h"
+
+static const char *stage_names[STAGE_COUNT] = {"open", "header", "read", "solve", "write", "close", "queue_wait"};
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static stage_thread_t *registry = NULL;
+static stage_thread_t **registry_tail = &registry;
+static uint32_t registered = 0;
+static __thread stage_thread_t *mine = NULL;
+
+/**
+ * @brief the calling thread's totals, registered on first use
+ *
+ * @return stage_thread_t* totals, NULL if out of memory
+ */
+static stage_thread_t *stage_thread(void)
+{
+    if (NULL == mine)
+    {
+        stage_thread_t *thread = calloc(1, sizeof(stage_thread_t));
+        if (NULL == thread)
+        {
+            return NULL;
+        }
+        pthread_mutex_lock(&registry_lock);
+        thread->id = registered++;
+        *registry_tail = thread;
+        registry_tail = &thread->next;
+        pthread_mutex_unlock(&registry_lock);
+        mine = thread;
+    }
+    return mine;
+}
+
+uint64_t stage_add(int stage, uint64_t start, uint64_t units)
+{
+    uint64_t now = stage_now();
+    stage_thread_t *thread = stage_thread();
+    if (NULL != thread)
+    {
+        stage_total_t *total = &thread->stages[stage];
+        uint64_t ns = now - start;
+        __atomic_store_n(&total->calls, total->calls + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&total->ns, total->ns + ns, __ATOMIC_RELAXED);
+        __atomic_store_n(&total->units, total->units + units, __ATOMIC_RELAXED);
+        if (ns > total->maxns)
+        {
+            __atomic_store_n(&total->maxns, ns, __ATOMIC_RELAXED);
+        }
+    }
+    return now;
+}
+
+/**
+ * @brief reads one thread's totals of a stage
+ *
+ */
+static void stage_load(const stage_total_t *from, stage_total_t *to)
+{
+    to->calls = __atomic_load_n(&from->calls, __ATOMIC_RELAXED);
+    to->ns = __atomic_load_n(&from->ns, __ATOMIC_RELAXED);
+    to->maxns = __atomic_load_n(&from->maxns, __ATOMIC_RELAXED);
+    to->units = __atomic_load_n(&from->units, __ATOMIC_RELAXED);
+}
+
+void stagestats_sum(stage_total_t total[STAGE_COUNT])
+{
+    for (int s = 0; s < STAGE_COUNT; s++)
+    {
+        total[s] = (stage_total_t){0};
+    }
+    pthread_mutex_lock(&registry_lock);
+    for (stage_thread_t *thread = registry; NULL != thread; thread = thread->next)
+    {
+        for (int s = 0; s < STAGE_COUNT; s++)
+        {
+            stage_total_t one;
+            stage_load(&thread->stages[s], &one);
+            total[s].calls += one.calls;
+            total[s].ns += one.ns;
+            total[s].units += one.units;
+            if (one.maxns > total[s].maxns)
+            {
+                total[s].maxns = one.maxns;
+            }
+        }
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+/**
+ * @brief prints one row of milliseconds per stage
+ *
+ */
+static void print_row(FILE *out, const char *label, const stage_total_t *stages)
+{
+    fprintf(out, "%-8s", label);
+    for (int s = 0; s < STAGE_COUNT; s++)
+    {
+        fprintf(out, " %11.3f", stages[s].ns / 1e6);
+    }
+    fprintf(out, "\n");
+}
+
+void stagestats_print(FILE *out)
+{
+    fprintf(out, "\nStage time in ms\n%-8s", "thread");
+    for (int s = 0; s < STAGE_COUNT; s++)
+    {
+        fprintf(out, " %11s", stage_names[s]);
+    }
+    fprintf(out, "\n");
+    pthread_mutex_lock(&registry_lock);
+    for (stage_thread_t *thread = registry; NULL != thread; thread = thread->next)
+    {
+        stage_total_t stages[STAGE_COUNT];
+        char label[16];
+        for (int s = 0; s < STAGE_COUNT; s++)
+        {
+            stage_load(&thread->stages[s], &stages[s]);
+        }
+        snprintf(label, sizeof(label), "%u", thread->id);
+        print_row(out, label, stages);
+    }
+    pthread_mutex_unlock(&registry_lock);
+
+    stage_total_t total[STAGE_COUNT];
+    stagestats_sum(total);
+    print_row(out, "total", total);
+    fprintf(out, "\n%-11s %10s %12s %12s %12s\n", "stage", "calls", "units", "avg us", "max us");
+    for (int s = 0; s < STAGE_COUNT; s++)
+    {
+        fprintf(out, "%-11s %10" PRIu64 " %12" PRIu64 " %12.2f %12.2f\n", stage_names[s], total[s].calls,
+                total[s].units, total[s].calls > 0 ? total[s].ns / 1e3 / total[s].calls : 0.0, total[s].maxns / 1e3);
+    }
+}
+
+/**
+ * @brief writes a JSON object of the stages
+ *
+ */
+static void json_stages(FILE *out, const stage_total_t *stages)
+{
+    fprintf(out, "{");
+    for (int s = 0; s < STAGE_COUNT; s++)
+    {
+        fprintf(out, "%s\"%s\": {\"calls\": %" PRIu64 ", \"ns\": %" PRIu64 ", \"max_ns\": %" PRIu64
+                     ", \"units\": %" PRIu64 "}",
+                s > 0 ? ", " : "", stage_names[s], stages[s].calls, stages[s].ns, stages[s].maxns, stages[s].units);
+    }
+    fprintf(out, "}");
+}
+
+int stagestats_json(FILE *out)
+{
+    fprintf(out, "{\"threads\": [");
+    pthread_mutex_lock(&registry_lock);
+    for (stage_thread_t *thread = registry; NULL != thread; thread = thread->next)
+    {
+        stage_total_t stages[STAGE_COUNT];
+        for (int s = 0; s < STAGE_COUNT; s++)
+        {
+            stage_load(&thread->stages[s], &stages[s]);
+        }
+        fprintf(out, "%s\n  {\"thread\": %u, \"stages\": ", thread == registry ? "" : ",", thread->id);
+        json_stages(out, stages);
+        fprintf(out, "}");
+    }
+    pthread_mutex_unlock(&registry_lock);
+
+    stage_total_t total[STAGE_COUNT];
+    stagestats_sum(total);
+    fprintf(out, "\n],\n\"total\": ");
+    json_stages(out, total);
+    fprintf(out, "}\n");
+    return !ferror(out);
+}
+
+void stagestats_free(void)
+{
+    pthread_mutex_lock(&registry_lock);
+    while (NULL != registry)
+    {
+        stage_thread_t *thread = registry;
+        registry = thread->next;
+        free(thread);
+    }
+    registry_tail = &registry;
+    registered = 0;
+    pthread_mutex_unlock(&registry_lock);
+    mine = NULL;
+}
@@ -1,6 +1,12 @@
 #include "../include/equation.h"
 #include "../include/threadpool.h"
+#include "../include/eqsort.h"
+#include "../include/eqindex.h"
+#include "../include/columnar.h"
+#include "../include/stagestats.h"
+#include "../include/profiler.h"
 #include "../../0_Common/include/common.h"
+#include "../../0_Common/include/probes.h"
 #include <dirent.h>
 #include <string.h>
 #include <unistd.h>
@@ -18,7 +24,11 @@
 threadpool_t *threadpool;
 char unsolveddir[PATH_MAX] = {0};
 char solveddir[PATH_MAX] = {0};
-int finished = 0;
+int sorted_output = 0;
+int indexed_output = 0;
+int columnar_output = 0;
+size_t sort_memory = SORT_MEMORY_DEFAULT;
+uint64_t files_started = 0;
 
 /**
  * @brief print usage statement
@@ -26,31 +36,127 @@ int finished = 0;
  */
 void print_usage()
 {
-    printf("\n\nUsage: ./threadcalc <unsolved_directory> <solved_directory> (optional -n <threadcount>)\n\nRunning with thread count: 4\n\n");
+    printf("\n\nUsage: ./threadcalc <unsolved_directory> <solved_directory> (optional -n <threadcount>)"
+           "\n\t(optional -s) write solved equations sorted by eqid"
+           "\n\t(optional -m <MiB>) memory per thread for sorting before spilling to disk"
+           "\n\t(optional -i) append an eqid index for ./eqlookup"
+           "\n\t(optional -c) write compressed columnar blocks, read back with ./eqdecode"
+           "\n\t(optional -a <cores|nodes|both>) pin workers to cores and/or keep them, their memory"
+           "\n\t    and their queue on one NUMA node each"
+           "\n\t(optional -t) print time spent per stage and thread at exit"
+           "\n\t(optional -j <file>) write the stage times as JSON to file at exit"
+           "\n\t(optional -p <file>) sample stacks on every thread and write them to file at exit as"
+           "\n\t    folded stacks for flamegraph.pl. Build with -DCMAKE_BUILD_TYPE=Profile for whole stacks"
+           "\n\nRunning with thread count: 4\n\n");
+}
+
+/**
+ * @brief reads, solves and writes the equations of an unsolved file in
+ * batches of EQ_BATCH. Solved equations are emitted as packed rows, or as
+ * columnar blocks when columnar output is on. When sorted output is on they
+ * pass through a sorted writer first
+ * 
+ * @param ustream unsolved file stream positioned at the first equation
+ * @param sfd solved file positioned after the header
+ * @param numeq number of equations the header advertises
+ * @return uint64_t equations solved
+ */
+uint64_t solve_equations(eqstream_t *ustream, int sfd, uint64_t numeq)
+{
+    struct unsolved_equation unsolved[EQ_BATCH];
+    struct solved_equation solved[EQ_BATCH];
+    sorted_writer_t writer;
+    columnar_writer_t *columns = NULL;
+    EMIT_F emit = emit_rows;
+    void *sink = &sfd;
+
+    if (columnar_output)
+    {
+        columns = malloc(sizeof(columnar_writer_t));
+        if (NULL == columns || !columnar_writer_init(columns, sfd))
+        {
+            printf("Could not start columnar output!\n");
+            free(columns);
+            return 0;
+        }
+        emit = columnar_writer_add;
+        sink = columns;
+    }
+
+    int sorting = sorted_output && sorted_writer_init(&writer, emit, sink, numeq, sort_memory, solveddir);
+    if (sorted_output && !sorting)
+    {
+        printf("Could not sort solved file! Writing in input order.\n");
+    }
+
+    uint64_t remaining = numeq;
+    uint64_t t = stage_now();
+    while (remaining > 0)
+    {
+        size_t batch = remaining < EQ_BATCH ? remaining : EQ_BATCH;
+        size_t count = read_equations(ustream, unsolved, batch);
+        t = stage_add(STAGE_READ, t, count);
+        solve_batch(unsolved, solved, count);
+        t = stage_add(STAGE_SOLVE, t, count);
+        if (sorting ? !sorted_writer_add(&writer, solved, count) : !emit(sink, solved, count))
+        {
+            printf("\nWrite failure!\n");
+        }
+        t = stage_add(STAGE_WRITE, t, count);
+        remaining -= count;
+        if (count != batch)
+        {
+            printf("Malformed file due to equation buffer\n");
+            break;
+        }
+    }
+
+    if (sorting && !sorted_writer_finish(&writer))
+    {
+        printf("\nWrite failure!\n");
+    }
+    if (NULL != columns)
+    {
+        if (!columnar_writer_finish(columns))
+        {
+            printf("\nWrite failure!\n");
+        }
+        free(columns);
+    }
+    stage_add(STAGE_WRITE, t, 0);
+    return numeq - remaining;
 }
 
 /**
  * @brief parses files and prints according to filecalc format
  * as provided in the directions. Uses f_calc and s_calc to perform file
- * and mathematic operations
+ * and mathematic operations. Run as a threadpool task, which also
+ * starts sampling the worker when profiling
  * 
- * @param pathname filename to file to parse
+ * @param pathname filename to file to parse, freed when done
+ * @return void* NULL
  */
-void parse_file(void *filename)
+void *parse_file(void *filename)
 {
     char *p_filename = filename;
+    profiler_attach();
     if (NULL != filename)
     {
         struct header headerbuff;
         char upath[PATH_MAX] = {0};
         char spath[PATH_MAX] = {0};
 
+        uint64_t fileid = __atomic_add_fetch(&files_started, 1, __ATOMIC_RELAXED);
+        uint64_t solved = 0;
+        PROBE2(threadcalc, file__start, fileid, p_filename);
+        uint64_t t = stage_now();
         int u = sprintf(upath, "%s%s", unsolveddir, p_filename);
         int s = sprintf(spath, "%s%s", solveddir, p_filename);
 
         int ufd = open(upath, O_RDONLY | O_EXCL);
-        int sfd = open(spath, O_RDWR | O_CREAT);
+        int sfd = open(spath, O_RDWR | O_CREAT | O_TRUNC);
         int rv = fchmod(sfd, 0644);
+        t = stage_add(STAGE_OPEN, t, 1);
         if (u != strlen(upath) || s != strlen(spath) || ufd == -1 || sfd == -1 || rv < 0)
         {
             if (ufd == -1)
@@ -68,89 +174,62 @@ void parse_file(void *filename)
         }
         else
         {
-            if (read(ufd, &headerbuff, sizeof(headerbuff)) != sizeof(headerbuff))
+            eqstream_t *ustream = eqstream_open(ufd);
+            if (NULL == ustream || eqstream_read(ustream, &headerbuff, sizeof(headerbuff)) != sizeof(headerbuff) ||
+                le32toh(headerbuff.offset) < sizeof(headerbuff))
             {
                 printf("Malformed file. Due to header.\n");
             }
             else
             {
                 headerbuff.flags = 1;
+                if (indexed_output)
+                {
+                    headerbuff.optheaders = htole16(le16toh(headerbuff.optheaders) | SOLVED_OPT_INDEX);
+                }
+                if (columnar_output)
+                {
+                    headerbuff.optheaders = htole16(le16toh(headerbuff.optheaders) | SOLVED_OPT_COLUMNAR);
+                }
                 write_header(sfd, &headerbuff);
-                lseek(ufd, le32toh(headerbuff.offset), SEEK_SET);
-                for (int i = 0; i < le64toh(headerbuff.numeq); i++)
+                int copied = copy_optheaders(ustream, sfd, le32toh(headerbuff.offset) - sizeof(headerbuff));
+                stage_add(STAGE_HEADER, t, 1);
+                if (!copied)
                 {
-                    struct unsolved_equation unsolveq;
-                    struct solved_equation solveq;
-                    if (read(ufd, &unsolveq, sizeof(struct unsolved_equation)) != sizeof(unsolveq))
-                    {
-                        printf("Malformed file due to equation buffer\n");
-                    }
-                    else
+                    printf("Malformed file. Due to header.\n");
+                }
+                else
+                {
+                    solved = solve_equations(ustream, sfd, le64toh(headerbuff.numeq));
+                    t = stage_now();
+                    if (indexed_output && !eqindex_append(sfd, &headerbuff))
                     {
-                        if (signage_decider((char)le16toh(unsolveq.operatr)) == 1)
-                        {
-                            int64_t solution;
-                            solveq.eqid = unsolveq.eqid;
-                            solveq.type = 1;
-                            if (signedcalc(le64toh(unsolveq.operand1), unsolveq.operatr, le64toh(unsolveq.operand2), &solution))
-                            {
-                                solveq.flags = 1;
-                                solveq.solution = solution;
-                            }
-                            else
-                            {
-                                printf("\nUnsolved!!!\n");
-                                solveq.flags = 0;
-                            }
-
-                            if (!write_equation(sfd, &solveq))
-                            {
-                                printf("\nWrite failure!\n");
-                            }
-                        }
-                        else if (signage_decider((char)le16toh(unsolveq.operatr)) == 0)
-                        {
-                            uint64_t solution;
-                            solveq.eqid = unsolveq.eqid;
-                            solveq.type = 0;
-                            if (unsignedcalc(le64toh(unsolveq.operand1), unsolveq.operatr, le64toh(unsolveq.operand2), &solution))
-                            {
-                                solveq.flags = 1;
-                                solveq.solution = solution;
-                            }
-                            else
-                            {
-                                printf("\nUnsolved!!!\n");
-                                solveq.flags = 0;
-                            }
-
-                            if (!write_equation(sfd, &solveq))
-                            {
-                                printf("\nWrite failure!\n");
-                            }
-                        }
-                        else
-                        {
-                            printf("\nOperator error!\n");
-                        }
+                        printf("Could not write index! %s\n", spath);
                     }
+                    stage_add(STAGE_WRITE, t, 0);
                 }
             }
+            t = stage_now();
+            eqstream_close(ustream);
         }
+        PROBE2(threadcalc, file__done, fileid, solved);
         free(filename);
         filename = NULL;
         close(ufd);
         close(sfd);
+        stage_add(STAGE_CLOSE, t, 1);
     }
+    return NULL;
 }
 
 /**
- * @brief Parse unsolved directory and pushes files into threadpool.
+ * @brief Lists the unsolved directory, without descending into
+ * subdirectories, and submits a task per file to the group.
  * 
+ * @param files group the file tasks are submitted to
  * @param dirname unsolved dir name
- * @param sdirname solved dir name
  */
-void parse_dir_dfs(char dirname[], char sdirname[])
+void submit_dir(threadpool_group_t *files, char dirname[])
 {
     DIR *folder = opendir(dirname);
     if (folder == NULL)
@@ -171,7 +250,11 @@ void parse_dir_dfs(char dirname[], char sdirname[])
                     break;
                 }
                 strcpy(p_dname, entry->d_name);
-                push_work(threadpool, (void *)p_dname);
+                if (!threadpool_group_submit(files, parse_file, p_dname))
+                {
+                    free(p_dname);
+                    break;
+                }
             }
             entry = readdir(folder);
         }
@@ -180,25 +263,6 @@ void parse_dir_dfs(char dirname[], char sdirname[])
     return;
 }
 
-/**
- * @brief Function to be passed to threads. Loops until all files
- * have been parsed and all work is done. Returns NULL when done
- * 
- */
-void *thread_function(void *voidp)
-{
-    void *filename = pull_work(threadpool);
-    while (!finished || NULL != filename)
-    {
-        if (NULL != filename)
-        {
-            parse_file(filename);
-        }
-        filename = pull_work(threadpool);
-    }
-    return NULL;
-}
-
 /**
  * @brief threadcalc parses unsolved directory full of binary
  * files in filecalc unsolved format, parses the individual 
@@ -211,6 +275,14 @@ void *thread_function(void *voidp)
  * argv[2] = <path to solved directory>
  * 
  * optional -n <threadcount>
+ * optional -s sort solved equations by eqid
+ * optional -m <MiB> sort memory per thread
+ * optional -i append an eqid index trailer
+ * optional -c write columnar compressed blocks
+ * optional -a <cores|nodes|both> worker placement
+ * optional -t print stage timing
+ * optional -j <file> write stage timing as JSON
+ * optional -p <file> write a sampling profile as folded stacks
  * 
  * @return int 
  */
@@ -219,33 +291,131 @@ int main(int argc, char *argv[])
 {
     //Get thread count; defaulting to 4
     int threadcount = 4;
-    int getcount = getopt(argc, argv, "n:");
-    switch (getcount)
+    int threadcount_given = 0;
+    int placement = 0;
+    int print_stages = 0;
+    char *json_path = NULL;
+    char *profile_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:sm:ica:tj:p:")) != -1)
     {
-    case 'n':
-        threadcount = atoi(optarg);
-        break;
-    default:
+        switch (opt)
+        {
+        case 'n':
+            threadcount = atoi(optarg);
+            threadcount_given = 1;
+            break;
+        case 's':
+            sorted_output = 1;
+            break;
+        case 'm':
+            sort_memory = strtoull(optarg, NULL, 10) * 1024 * 1024;
+            break;
+        case 'i':
+            indexed_output = 1;
+            break;
+        case 'c':
+            columnar_output = 1;
+            break;
+        case 'a':
+            placement = threadpool_placement(optarg);
+            if (placement < 0)
+            {
+                printf("Unknown placement %s, running unplaced\n", optarg);
+                placement = 0;
+            }
+            break;
+        case 't':
+            print_stages = 1;
+            break;
+        case 'j':
+            json_path = optarg;
+            break;
+        case 'p':
+            profile_path = optarg;
+            break;
+        default:
+            break;
+        }
+    }
+    if (!threadcount_given)
+    {
+        print_usage();
+    }
+    if (threadcount < 1)
+    {
+        printf("Thread count must be at least 1, not %d\n", threadcount);
         print_usage();
-        break;
+        return 1;
+    }
+    if (columnar_output && indexed_output)
+    {
+        printf("Columnar files carry their own block index. Ignoring -i\n");
+        indexed_output = 0;
+    }
+    char **dirs = &argv[optind];
+    if (NULL != profile_path && !profiler_start(PROFILER_HZ))
+    {
+        profile_path = NULL;
     }
 
     //initialize threapool object
-    threadpool = threadpool_init(threadcount, QUEUE_CAPACITY, thread_function, NULL);
+    threadpool = threadpool_create_placed(threadcount, QUEUE_CAPACITY, placement);
 
     //if directories are supplied in arguments, parse unsolved directory
-    if (NULL != argv[1] && NULL != argv[2] && NULL != threadpool && threadcount > 0)
+    threadpool_group_t *files = NULL != threadpool ? threadpool_group_create(threadpool) : NULL;
+    if (argc - optind >= 2 && NULL != files)
     {
-        int u = sprintf(unsolveddir, "%s/", argv[1]);
-        int s = sprintf(solveddir, "%s/", argv[2]);
+        int u = sprintf(unsolveddir, "%s/", dirs[0]);
+        int s = sprintf(solveddir, "%s/", dirs[1]);
         if (strlen(unsolveddir) == u && strlen(solveddir) == s)
         {
-            parse_dir_dfs(argv[1], argv[2]);
+            submit_dir(files, dirs[0]);
         }
-        finished = 1;
+        threadpool_group_wait(files);
+    }
+    if (NULL != files)
+    {
+        threadpool_group_free(files);
     }
 
     //threadpool cleanup
-    terminate_threadpool(threadpool);
+    if (NULL != threadpool)
+    {
+        terminate_threadpool(threadpool);
+    }
+
+    //the workers have exited, so their stage totals are final
+    if (print_stages)
+    {
+        stagestats_print(stdout);
+    }
+    if (NULL != json_path)
+    {
+        FILE *json = fopen(json_path, "w");
+        if (NULL == json || !stagestats_json(json))
+        {
+            printf("Could not write stage timing! %s\n", json_path);
+        }
+        if (NULL != json)
+        {
+            fclose(json);
+        }
+    }
+    if (NULL != profile_path)
+    {
+        profiler_stop();
+        FILE *profile = fopen(profile_path, "w");
+        if (NULL == profile || !profiler_write(profile))
+        {
+            printf("Could not write profile! %s\n", profile_path);
+        }
+        if (NULL != profile)
+        {
+            fclose(profile);
+        }
+        profiler_free();
+    }
+    stagestats_free();
     return 0;
 }
\ No newline at end of file
@@ -1,97 +1,912 @@
+#define _GNU_SOURCE
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef HAVE_NUMA
+#include <numa.h>
+#endif
 #include "../include/threadpool.h"
+#include "../include/stagestats.h"
+#include "../../0_Common/include/probes.h"
 #include "../../3_DataStructures1/include/queue.h"
 
+/**
+ * @brief an entry of the work queue. Bare work items from push_work have
+ * no function
+ *
+ */
+typedef struct threadpool_task_t
+{
+    TASK_F fn;
+    void *arg;
+    threadpool_future_t *future;
+    threadpool_group_t *group;
+    uint64_t queued_at;
+} threadpool_task_t;
+
+// the pool thread running on this thread, NULL for any other thread
+static __thread threadpool_worker_t *current_worker = NULL;
+
+/**
+ * @brief start routine of every pool thread. Applies the worker's
+ * placement before any of its memory is touched, then runs the pool's
+ * thread function
+ *
+ * @param voidp the threadpool_worker_t to run
+ */
+static void *worker_start(void *voidp)
+{
+    threadpool_worker_t *worker = voidp;
+    current_worker = worker;
+    if (worker->cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(worker->cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#ifdef HAVE_NUMA
+    if (worker->pool->placement & THREADPOOL_NUMA)
+    {
+        if (worker->cpu < 0)
+        {
+            numa_run_on_node(worker->node);
+        }
+        numa_set_localalloc();
+    }
+#endif
+    return worker->workfunction(worker->param);
+}
+
+/**
+ * @brief decides where each worker runs. Cpus are taken round robin from
+ * the ones this process may use, interleaved across nodes under NUMA
+ * placement so a small pool still spreads over every node
+ *
+ * @return int number of node queues the pool needs
+ */
+static int place_workers(threadpool_t *threadpool)
+{
+    int cpus[CPU_SETSIZE];
+    int nodeof[CPU_SETSIZE];
+    int cpucount = 0;
+    int nodecount = 1;
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (0 == sched_getaffinity(0, sizeof(allowed), &allowed))
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &allowed))
+            {
+                nodeof[cpucount] = 0;
+                cpus[cpucount++] = cpu;
+            }
+        }
+    }
+#ifdef HAVE_NUMA
+    if (threadpool->placement & THREADPOOL_NUMA)
+    {
+        nodecount = numa_max_node() + 1;
+        for (int i = 0; i < cpucount; i++)
+        {
+            int node = numa_node_of_cpu(cpus[i]);
+            nodeof[i] = node >= 0 && node < nodecount ? node : 0;
+        }
+        // stable reorder to node 0's first cpu, node 1's first cpu, ...
+        int order[CPU_SETSIZE];
+        int ordered = 0;
+        for (int round = 0; ordered < cpucount; round++)
+        {
+            for (int node = 0; node < nodecount; node++)
+            {
+                int seen = 0;
+                for (int i = 0; i < cpucount; i++)
+                {
+                    if (nodeof[i] == node && seen++ == round)
+                    {
+                        order[ordered++] = i;
+                        break;
+                    }
+                }
+            }
+        }
+        int sorted[CPU_SETSIZE];
+        int sortednode[CPU_SETSIZE];
+        for (int i = 0; i < cpucount; i++)
+        {
+            sorted[i] = cpus[order[i]];
+            sortednode[i] = nodeof[order[i]];
+        }
+        for (int i = 0; i < cpucount; i++)
+        {
+            cpus[i] = sorted[i];
+            nodeof[i] = sortednode[i];
+        }
+    }
+#endif
+    for (uint32_t i = 0; i < threadpool->threadcapacity; i++)
+    {
+        threadpool_worker_t *worker = &threadpool->workers[i];
+        worker->node = 0;
+        worker->cpu = -1;
+        if (cpucount > 0 && (threadpool->placement & (THREADPOOL_PIN_CORES | THREADPOOL_NUMA)))
+        {
+            worker->node = nodeof[i % cpucount];
+            if (threadpool->placement & THREADPOOL_PIN_CORES)
+            {
+                worker->cpu = cpus[i % cpucount];
+            }
+        }
+    }
+    return nodecount;
+}
+
+/**
+ * @brief starts a thread in a free or retired slot, joining the retired
+ * thread first
+ *
+ * @return int 1 if a thread started, 0 if the pool is full or terminating
+ */
+static int start_worker(threadpool_t *threadpool)
+{
+    int started = 0;
+    pthread_mutex_lock(&(threadpool->resize));
+    if (!__atomic_load_n(&threadpool->terminate, __ATOMIC_SEQ_CST) &&
+        __atomic_load_n(&threadpool->live, __ATOMIC_SEQ_CST) < threadpool->threadcapacity)
+    {
+        for (uint32_t i = 0; i < threadpool->threadcapacity; i++)
+        {
+            threadpool_worker_t *worker = &threadpool->workers[i];
+            if (THREADPOOL_SLOT_RUNNING == worker->state)
+            {
+                continue;
+            }
+            if (THREADPOOL_SLOT_RETIRED == worker->state)
+            {
+                pthread_join(worker->thread, NULL);
+            }
+            worker->state = THREADPOOL_SLOT_RUNNING;
+            __atomic_add_fetch(&threadpool->live, 1, __ATOMIC_SEQ_CST);
+            if (pthread_create(&worker->thread, NULL, worker_start, worker) != 0)
+            {
+                printf("Failed to start a pool thread!\n");
+                worker->state = THREADPOOL_SLOT_FREE;
+                __atomic_sub_fetch(&threadpool->live, 1, __ATOMIC_SEQ_CST);
+            }
+            else
+            {
+                started = 1;
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&(threadpool->resize));
+    return started;
+}
+
+/**
+ * @brief retires the calling worker if the pool is above its minimum and
+ * nothing is queued
+ *
+ * @return int 1 if the worker must exit, 0 to keep serving
+ */
+static int retire_worker(threadpool_t *threadpool, threadpool_worker_t *worker)
+{
+    int retired = 0;
+    pthread_mutex_lock(&(threadpool->resize));
+    if (!__atomic_load_n(&threadpool->terminate, __ATOMIC_SEQ_CST) &&
+        __atomic_load_n(&threadpool->live, __ATOMIC_SEQ_CST) > threadpool->minthreads &&
+        0 == __atomic_load_n(&threadpool->queued, __ATOMIC_SEQ_CST))
+    {
+        worker->state = THREADPOOL_SLOT_RETIRED;
+        __atomic_sub_fetch(&threadpool->live, 1, __ATOMIC_SEQ_CST);
+        retired = 1;
+    }
+    pthread_mutex_unlock(&(threadpool->resize));
+    return retired;
+}
+
+/**
+ * @brief adds a worker to an elastic pool when every worker is busy and
+ * at least a task each is waiting. Checked whenever a task is queued and
+ * whenever one is taken, so a backlog queued while the pool was idle
+ * still grows it once the workers wake into it
+ *
+ * @param backlog tasks queued on every node
+ */
+static void maybe_grow(threadpool_t *threadpool, uint32_t backlog)
+{
+    if (threadpool->minthreads < threadpool->threadcapacity && backlog > 0 &&
+        0 == __atomic_load_n(&threadpool->idle, __ATOMIC_SEQ_CST) &&
+        backlog >= __atomic_load_n(&threadpool->live, __ATOMIC_SEQ_CST))
+    {
+        start_worker(threadpool);
+    }
+}
+
+/**
+ * @brief creates the pool, its node queues and its first threads
+ *
+ * @param minthreads threads started now and kept while idle
+ * @param threadcapacity most threads at once
+ * @param idletimeout milliseconds before an idle thread above minthreads
+ * retires, 0 to never retire
+ * @return NULL if failure, threadpool_t * if successful
+ */
+static threadpool_t *threadpool_start(uint32_t minthreads, uint32_t threadcapacity, uint32_t workcapacity,
+                                      int placement, uint32_t idletimeout, void *workfunction(void *param),
+                                      void *param)
+{
+    threadpool_t *threadpool = calloc(1, sizeof(struct threadpool_t));
+    if (NULL == threadpool)
+    {
+        return NULL;
+    }
+#ifdef HAVE_NUMA
+    if ((placement & THREADPOOL_NUMA) && numa_available() < 0)
+    {
+        printf("NUMA is not available, ignoring node placement\n");
+        placement &= ~THREADPOOL_NUMA;
+    }
+#else
+    if (placement & THREADPOOL_NUMA)
+    {
+        printf("Built without libnuma, ignoring node placement\n");
+        placement &= ~THREADPOOL_NUMA;
+    }
+#endif
+    threadpool->threadcapacity = threadcapacity;
+    threadpool->minthreads = minthreads < threadcapacity ? minthreads : threadcapacity;
+    threadpool->idletimeout = idletimeout;
+    threadpool->live = 0;
+    threadpool->idle = 0;
+    threadpool->workcapacity = workcapacity;
+    threadpool->terminate = 0;
+    threadpool->placement = placement;
+    threadpool->workers = calloc(threadcapacity, sizeof(threadpool_worker_t));
+    if (NULL == threadpool->workers)
+    {
+        free(threadpool);
+        return NULL;
+    }
+    threadpool->nodecount = place_workers(threadpool);
+    threadpool->nodes = calloc(threadpool->nodecount, sizeof(threadpool_node_t));
+    if (NULL == threadpool->nodes)
+    {
+        free(threadpool->workers);
+        free(threadpool);
+        return NULL;
+    }
+    for (uint32_t n = 0; n < threadpool->nodecount; n++)
+    {
+        threadpool_node_t *node = &threadpool->nodes[n];
+        node->pool = threadpool;
+        node->queue = queue_init(workcapacity, NULL);
+        if (NULL == node->queue)
+        {
+            while (n-- > 0)
+            {
+                queue_destroy(&threadpool->nodes[n].queue);
+            }
+            free(threadpool->nodes);
+            free(threadpool->workers);
+            free(threadpool);
+            return NULL;
+        }
+        if (pthread_mutex_init(&(node->mutex), NULL) !=0)
+        {
+            printf("\n\nFailed to init mutex\n\n");
+        }
+        eventcount_init(&node->work);
+        eventcount_init(&node->space);
+    }
+    if (pthread_mutex_init(&(threadpool->mutex), NULL) !=0)
+    {
+        printf("\n\nFailed to init mutex\n\n");
+    }
+    if (pthread_mutex_init(&(threadpool->resize), NULL) !=0)
+    {
+        printf("\n\nFailed to init mutex\n\n");
+    }
+    if (pthread_cond_init(&(threadpool->done), NULL) !=0)
+    {
+        printf("\n\nFailed to init cond\n\n");
+    }
+    threadpool->queued = 0;
+    // spinning on a single cpu only delays the thread it waits for
+    threadpool->spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? THREADPOOL_SPIN_MIN : 0;
+    for (uint32_t i = 0; i < threadcapacity; i++)
+    {
+        threadpool_worker_t *worker = &threadpool->workers[i];
+        worker->pool = threadpool;
+        worker->workfunction = workfunction;
+        worker->param = NULL != param ? param : threadpool;
+        worker->state = THREADPOOL_SLOT_FREE;
+    }
+    for (uint32_t i = 0; i < threadpool->minthreads; i++)
+    {
+        start_worker(threadpool);
+    }
+    return threadpool;
+}
+
 /**
  * @brief creates a new threadpool
  *
  * @param threadcapacity number of threads the pool will hold
  * @param workcapacity number of jobs the queue will hold
  * @param workfunction threadfucntion that the user provides; aka jobs for the threads
- * @param param parameter for the work function. can be NULL
+ * @param param parameter for the work function. if NULL the work function is
+ * handed the threadpool itself, which is safe to use before this returns
  * @return NULL if failure, threadpool_t * if successful
  */
 
 threadpool_t *threadpool_init(uint32_t threadcapacity, uint32_t workcapacity, void *workfunction(void *param), void *param)
 {
-    queue_t *queue = queue_init(workcapacity, NULL);
-    threadpool_t *threadpool = calloc(1, sizeof(struct threadpool_t));
-    if (NULL != threadpool && NULL != queue)
+    return threadpool_start(threadcapacity, threadcapacity, workcapacity, 0, 0, workfunction, param);
+}
+
+/**
+ * @brief thread function of pools made by threadpool_create. pull_work
+ * runs every submitted task, so it only returns at termination or for a
+ * bare work item nobody can handle
+ *
+ * @param voidp the threadpool the thread belongs to
+ */
+static void *task_function(void *voidp)
+{
+    threadpool_t *pool = voidp;
+    while (NULL != pull_work(pool))
+    {
+        printf("Dropping work pushed to a task pool!\n");
+    }
+    return NULL;
+}
+
+threadpool_t *threadpool_create(uint32_t threadcapacity, uint32_t workcapacity)
+{
+    return threadpool_start(threadcapacity, threadcapacity, workcapacity, 0, 0, task_function, NULL);
+}
+
+threadpool_t *threadpool_create_placed(uint32_t threadcapacity, uint32_t workcapacity, int placement)
+{
+    return threadpool_start(threadcapacity, threadcapacity, workcapacity, placement, 0, task_function, NULL);
+}
+
+threadpool_t *threadpool_create_elastic(uint32_t minthreads, uint32_t maxthreads, uint32_t workcapacity,
+                                        int placement, uint32_t idletimeout)
+{
+    if (minthreads < 1)
+    {
+        minthreads = 1;
+    }
+    if (maxthreads < minthreads)
+    {
+        maxthreads = minthreads;
+    }
+    return threadpool_start(minthreads, maxthreads, workcapacity, placement, idletimeout, task_function, NULL);
+}
+
+int threadpool_placement(const char *name)
+{
+    if (0 == strcmp(name, "cores"))
+    {
+        return THREADPOOL_PIN_CORES;
+    }
+    if (0 == strcmp(name, "nodes"))
+    {
+        return THREADPOOL_NUMA;
+    }
+    if (0 == strcmp(name, "both"))
+    {
+        return THREADPOOL_PIN_CORES | THREADPOOL_NUMA;
+    }
+    return -1;
+}
+
+/**
+ * @brief hints to the cpu that this is a spin loop
+ *
+ */
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/**
+ * @brief parks on ec until ready returns true. Rechecks after taking the
+ * key, so a notify between the check and the sleep is never lost
+ *
+ * @param ms longest to park in milliseconds, 0 for no limit
+ * @return int 0 if the timeout expired, 1 otherwise
+ */
+static int park(eventcount_t *ec, int (*ready)(void *), void *arg, uint32_t ms)
+{
+    uint32_t key = eventcount_prepare(ec);
+    if (ready(arg))
+    {
+        eventcount_cancel(ec);
+        return 1;
+    }
+    if (0 == ms)
+    {
+        eventcount_wait(ec, key);
+        return 1;
+    }
+    return eventcount_timedwait(ec, key, ms);
+}
+
+/**
+ * @brief whether a worker has something to do on any node
+ *
+ */
+static int work_ready(void *voidp)
+{
+    threadpool_t *threadpool = voidp;
+    return __atomic_load_n(&threadpool->queued, __ATOMIC_SEQ_CST) > 0 ||
+           __atomic_load_n(&threadpool->terminate, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * @brief whether a producer can queue on a node
+ *
+ */
+static int space_ready(void *voidp)
+{
+    threadpool_node_t *node = voidp;
+    return __atomic_load_n(&node->queued, __ATOMIC_SEQ_CST) < node->pool->workcapacity ||
+           __atomic_load_n(&node->pool->terminate, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * @brief node whose queue the calling thread serves or submits to: a pool
+ * thread's own node, else the node of the cpu it is running on
+ *
+ */
+static uint32_t home_node(threadpool_t *threadpool)
+{
+    if (NULL != current_worker && current_worker->pool == threadpool)
+    {
+        return current_worker->node;
+    }
+#ifdef HAVE_NUMA
+    if (threadpool->nodecount > 1)
     {
-        threadpool->pool = calloc(threadcapacity, sizeof(pthread_t *));
-        if (NULL != threadpool->pool)
+        int cpu = sched_getcpu();
+        int node = cpu >= 0 ? numa_node_of_cpu(cpu) : -1;
+        if (node >= 0 && (uint32_t)node < threadpool->nodecount)
         {
-            threadpool->queue = queue;
-            threadpool->threadcapacity = threadcapacity;
-            threadpool->workcapacity = workcapacity;
-            threadpool->terminate = 0;
-            if (pthread_mutex_init(&(threadpool->mutex), NULL) !=0)
-            {
-                printf("\n\nFailed to init mutex\n\n");
-            }
-            if (pthread_cond_init(&(threadpool->cond), NULL) !=0)
+            return node;
+        }
+    }
+#endif
+    return 0;
+}
+
+/**
+ * @brief wakes one idle worker, preferring the given node's. Workers
+ * steal from other nodes when theirs is empty, so any one of them will do
+ * when the node has nobody parked
+ *
+ */
+static void notify_work(threadpool_t *threadpool, uint32_t home)
+{
+    for (uint32_t i = 0; i < threadpool->nodecount; i++)
+    {
+        if (eventcount_notify(&threadpool->nodes[(home + i) % threadpool->nodecount].work, 0))
+        {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief idles a worker until work may be queued. Polls the queue count
+ * without the mutex for the pool's current spin budget, then parks. In an
+ * elastic pool a worker parked past the idle timeout retires
+ *
+ * @return int 0 if the calling worker retired, 1 otherwise
+ */
+static int idle_wait(threadpool_t *threadpool, uint32_t home)
+{
+    int serving = 1;
+    __atomic_add_fetch(&threadpool->idle, 1, __ATOMIC_SEQ_CST);
+    uint32_t spin = __atomic_load_n(&threadpool->spin, __ATOMIC_RELAXED);
+    for (uint32_t i = 0; i < spin; i++)
+    {
+        if (work_ready(threadpool))
+        {
+            if (spin < THREADPOOL_SPIN_MAX)
             {
-                printf("\n\nFailed to init cond\n\n");
+                __atomic_store_n(&threadpool->spin, spin * 2, __ATOMIC_RELAXED);
             }
-            for (int i = 0; i < threadcapacity; i++)
+            __atomic_sub_fetch(&threadpool->idle, 1, __ATOMIC_SEQ_CST);
+            return serving;
+        }
+        cpu_relax();
+    }
+    if (spin > THREADPOOL_SPIN_MIN)
+    {
+        __atomic_store_n(&threadpool->spin, spin / 2, __ATOMIC_RELAXED);
+    }
+    threadpool_worker_t *worker = current_worker;
+    if (NULL != worker && worker->pool == threadpool && threadpool->idletimeout > 0)
+    {
+        if (!park(&threadpool->nodes[home].work, work_ready, threadpool, threadpool->idletimeout))
+        {
+            serving = !retire_worker(threadpool, worker);
+        }
+    }
+    else
+    {
+        park(&threadpool->nodes[home].work, work_ready, threadpool, 0);
+    }
+    __atomic_sub_fetch(&threadpool->idle, 1, __ATOMIC_SEQ_CST);
+    return serving;
+}
+
+/**
+ * @brief queues a task on the submitter's node. Blocks while that queue
+ * is full so producers are held back to the pace of the workers. Only a
+ * push into an empty queue wakes a parked worker; after that each worker
+ * that leaves items behind wakes the next, so a burst fans out without a
+ * wakeup per item. Blocked producers are woken the same way when the
+ * queue stops being full
+ *
+ * @return int 1 if queued, 0 if out of memory or the queue stayed full
+ * after termination began
+ */
+static int enqueue_task(threadpool_t *threadpool, TASK_F fn, void *arg, threadpool_future_t *future,
+                        threadpool_group_t *group)
+{
+    if (__atomic_load_n(&threadpool->cancel, __ATOMIC_SEQ_CST))
+    {
+        return 0;
+    }
+    threadpool_task_t *task = malloc(sizeof(threadpool_task_t));
+    if (NULL == task)
+    {
+        return 0;
+    }
+    task->fn = fn;
+    task->arg = arg;
+    task->future = future;
+    task->group = group;
+    task->queued_at = stage_now();
+    if (NULL != fn)
+    {
+        // counted before a worker can see it, so completion never goes below zero
+        __atomic_add_fetch(&threadpool->pending, 1, __ATOMIC_SEQ_CST);
+        if (NULL != group)
+        {
+            __atomic_add_fetch(&group->pending, 1, __ATOMIC_SEQ_CST);
+        }
+    }
+    uint32_t home = home_node(threadpool);
+    threadpool_node_t *node = &threadpool->nodes[home];
+    pthread_mutex_lock(&(node->mutex));
+    while (queue_fullcheck(node->queue) && !__atomic_load_n(&threadpool->terminate, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_unlock(&(node->mutex));
+        park(&node->space, space_ready, node, 0);
+        pthread_mutex_lock(&(node->mutex));
+    }
+    if (queue_enqueue(node->queue, task) != 0)
+    {
+        pthread_mutex_unlock(&(node->mutex));
+        free(task);
+        if (NULL != fn)
+        {
+            pthread_mutex_lock(&(threadpool->mutex));
+            __atomic_sub_fetch(&threadpool->pending, 1, __ATOMIC_SEQ_CST);
+            if (NULL != group)
             {
-                threadpool->pool[i] = malloc(sizeof(pthread_t));
-                pthread_create(threadpool->pool[i], NULL, workfunction, param);
+                __atomic_sub_fetch(&group->pending, 1, __ATOMIC_SEQ_CST);
             }
-            return threadpool;
+            pthread_mutex_unlock(&(threadpool->mutex));
+            pthread_cond_broadcast(&(threadpool->done));
+        }
+        return 0;
+    }
+    uint32_t queued = __atomic_add_fetch(&node->queued, 1, __ATOMIC_SEQ_CST);
+    uint32_t backlog = __atomic_add_fetch(&threadpool->queued, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&(node->mutex));
+    PROBE3(threadpool, push__work, arg, home, backlog);
+    if (1 == queued)
+    {
+        notify_work(threadpool, home);
+    }
+    if (queued < threadpool->workcapacity)
+    {
+        eventcount_notify(&node->space, 0);
+    }
+    maybe_grow(threadpool, backlog);
+    return 1;
+}
+
+/**
+ * @brief resolves a task's future and group and frees it
+ *
+ * @param result value for the future
+ */
+static void finish_task(threadpool_t *threadpool, threadpool_task_t *task, void *result)
+{
+    pthread_mutex_lock(&(threadpool->mutex));
+    if (NULL != task->future)
+    {
+        if (task->future->detached)
+        {
+            free(task->future);
+        }
+        else
+        {
+            task->future->result = result;
+            __atomic_store_n(&task->future->done, 1, __ATOMIC_RELEASE);
         }
+    }
+    if (NULL != task->group)
+    {
+        __atomic_sub_fetch(&task->group->pending, 1, __ATOMIC_SEQ_CST);
+    }
+    __atomic_sub_fetch(&threadpool->pending, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&(threadpool->mutex));
+    pthread_cond_broadcast(&(threadpool->done));
+    free(task);
+}
+
+/**
+ * @brief runs a task outside the lock and records its completion
+ *
+ */
+static void run_task(threadpool_t *threadpool, threadpool_task_t *task)
+{
+    void *result = task->fn(task->arg);
+    __atomic_add_fetch(&threadpool->completed, 1, __ATOMIC_SEQ_CST);
+    finish_task(threadpool, task, result);
+}
+
+/**
+ * @brief discards a queue entry without running it. A task resolves as if
+ * it returned NULL; its argument, like a bare item, goes to customfree
+ *
+ */
+static void drop_task(threadpool_t *threadpool, threadpool_task_t *task)
+{
+    if (NULL != threadpool->customfree)
+    {
+        threadpool->customfree(task->arg);
+    }
+    if (NULL != task->fn)
+    {
+        finish_task(threadpool, task, NULL);
+    }
+    else
+    {
+        free(task);
+    }
+}
+
+threadpool_future_t *threadpool_submit(threadpool_t *pool, TASK_F fn, void *arg)
+{
+    threadpool_future_t *future = calloc(1, sizeof(threadpool_future_t));
+    if (NULL == future || NULL == fn)
+    {
+        free(future);
         return NULL;
     }
-    return NULL;
+    future->pool = pool;
+    if (!enqueue_task(pool, fn, arg, future, NULL))
+    {
+        free(future);
+        return NULL;
+    }
+    return future;
+}
+
+int threadpool_post(threadpool_t *pool, TASK_F fn, void *arg)
+{
+    return NULL != fn && enqueue_task(pool, fn, arg, NULL, NULL);
+}
+
+void *threadpool_future_wait(threadpool_future_t *future)
+{
+    // a finished future is read without its pool, which may be gone
+    if (!__atomic_load_n(&future->done, __ATOMIC_ACQUIRE))
+    {
+        threadpool_t *pool = future->pool;
+        pthread_mutex_lock(&(pool->mutex));
+        while (!future->done)
+        {
+            pthread_cond_wait(&(pool->done), &(pool->mutex));
+        }
+        pthread_mutex_unlock(&(pool->mutex));
+    }
+    void *result = future->result;
+    free(future);
+    return result;
+}
+
+void threadpool_future_detach(threadpool_future_t *future)
+{
+    threadpool_t *pool = future->pool;
+    pthread_mutex_lock(&(pool->mutex));
+    int done = future->done;
+    future->detached = 1;
+    pthread_mutex_unlock(&(pool->mutex));
+    if (done)
+    {
+        free(future);
+    }
+}
+
+void threadpool_wait_all(threadpool_t *pool)
+{
+    pthread_mutex_lock(&(pool->mutex));
+    while (__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) > 0)
+    {
+        pthread_cond_wait(&(pool->done), &(pool->mutex));
+    }
+    pthread_mutex_unlock(&(pool->mutex));
+}
+
+threadpool_group_t *threadpool_group_create(threadpool_t *pool)
+{
+    threadpool_group_t *group = calloc(1, sizeof(threadpool_group_t));
+    if (NULL != group)
+    {
+        group->pool = pool;
+    }
+    return group;
+}
+
+int threadpool_group_submit(threadpool_group_t *group, TASK_F fn, void *arg)
+{
+    return NULL != fn && enqueue_task(group->pool, fn, arg, NULL, group);
+}
+
+void threadpool_group_wait(threadpool_group_t *group)
+{
+    threadpool_t *pool = group->pool;
+    pthread_mutex_lock(&(pool->mutex));
+    while (__atomic_load_n(&group->pending, __ATOMIC_SEQ_CST) > 0)
+    {
+        pthread_cond_wait(&(pool->done), &(pool->mutex));
+    }
+    pthread_mutex_unlock(&(pool->mutex));
+}
+
+void threadpool_group_free(threadpool_group_t *group)
+{
+    free(group);
 }
 
 /**
- * @brief push work onto workload queue
+ * @brief push work onto workload queue. Blocks while the queue is full so
+ * producers are held back to the pace of the workers
  * 
  * @param threadpool 
  * @param data 
  */
 void push_work(threadpool_t *threadpool, void *data)
 {
-    if (NULL != data && NULL != threadpool)
+    if (NULL != data && NULL != threadpool && !enqueue_task(threadpool, NULL, data, NULL, NULL))
+    {
+        printf("Failed to queue work!\n");
+    }
+}
+
+/**
+ * @brief takes the next entry from one node's queue
+ *
+ * @return threadpool_task_t* the entry, NULL if the queue is empty
+ */
+static threadpool_task_t *take_from(threadpool_t *threadpool, uint32_t index)
+{
+    threadpool_node_t *node = &threadpool->nodes[index];
+    if (0 == __atomic_load_n(&node->queued, __ATOMIC_SEQ_CST))
+    {
+        return NULL;
+    }
+    pthread_mutex_lock(&(node->mutex));
+    if (queue_emptycheck(node->queue))
+    {
+        pthread_mutex_unlock(&(node->mutex));
+        return NULL;
+    }
+    queue_node_t *qnode = queue_dequeue(node->queue);
+    threadpool_task_t *task = qnode->data;
+    free(qnode);
+    qnode = NULL;
+    uint64_t now = stage_add(STAGE_QUEUE_WAIT, task->queued_at, 1);
+    uint32_t queued = __atomic_sub_fetch(&node->queued, 1, __ATOMIC_SEQ_CST);
+    uint32_t backlog = __atomic_sub_fetch(&threadpool->queued, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&(node->mutex));
+    PROBE3(threadpool, pull__work, task->arg, index, now - task->queued_at);
+    if (queued + 1 == threadpool->workcapacity)
+    {
+        eventcount_notify(&node->space, 0);
+    }
+    if (queued > 0)
     {
-        pthread_mutex_lock(&(threadpool->mutex));
-        queue_enqueue(threadpool->queue, data);
-        pthread_mutex_unlock(&(threadpool->mutex));
-        pthread_cond_broadcast(&(threadpool->cond));
+        notify_work(threadpool, index);
+    }
+    maybe_grow(threadpool, backlog);
+    return task;
+}
 
+/**
+ * @brief takes the next queue entry, from the home node first and then
+ * stealing from the others
+ *
+ * @param home node the caller serves
+ * @param task set to the entry, NULL if every queue is empty
+ * @return int 0 once terminating with every queue empty, 1 otherwise
+ */
+static int take_task(threadpool_t *threadpool, uint32_t home, threadpool_task_t **task)
+{
+    // read before scanning, so a pool found empty after termination began stays empty
+    int running = !__atomic_load_n(&threadpool->terminate, __ATOMIC_SEQ_CST);
+    *task = NULL;
+    if (__atomic_load_n(&threadpool->cancel, __ATOMIC_SEQ_CST))
+    {
+        return 0;
+    }
+    for (uint32_t i = 0; i < threadpool->nodecount; i++)
+    {
+        *task = take_from(threadpool, (home + i) % threadpool->nodecount);
+        if (NULL != *task)
+        {
+            return 1;
+        }
     }
+    return running;
 }
 
 /**
- * @brief pull work from the workload queue
+ * @brief pull work from the workload queue. Blocks until work is available
+ * or the threadpool is terminating, spinning briefly before parking.
+ * Submitted tasks are run on the way, so a pool made by threadpool_init
+ * also serves threadpool_submit
  * 
  * @param threadpool 
- * @return void* 
+ * @return void* work item, NULL once terminating and the queue is empty
  */
 void *pull_work(threadpool_t *threadpool)
 {
-    void *data = NULL;
-    pthread_mutex_lock(&(threadpool->mutex));
-    if (!queue_emptycheck(threadpool->queue))
+    uint32_t home = home_node(threadpool);
+    threadpool_task_t *task;
+    while (take_task(threadpool, home, &task))
     {
-        queue_node_t *node = queue_dequeue(threadpool->queue);
-        data = node->data;
-        free(node);
-        node = NULL;
-    }
-    else
-    {
-        if (!threadpool->terminate)
+        if (NULL == task)
+        {
+            if (!idle_wait(threadpool, home))
+            {
+                return NULL;
+            }
+        }
+        else if (NULL == task->fn)
         {
-            pthread_cond_wait(&(threadpool->cond), &(threadpool->mutex));
+            void *data = task->arg;
+            free(task);
+            __atomic_add_fetch(&threadpool->completed, 1, __ATOMIC_SEQ_CST);
+            return data;
+        }
+        else
+        {
+            run_task(threadpool, task);
         }
     }
-    pthread_mutex_unlock(&threadpool->mutex);
-    return data;
+    return NULL;
 }
 
 /**
@@ -106,15 +921,18 @@ int join_threads(threadpool_t *threadpool)
     {
         for (int i = 0; i < threadpool->threadcapacity; i++)
         {
-            pthread_cond_broadcast(&threadpool->cond);
-            if (pthread_join(*(threadpool->pool[i]), NULL))
+            for (uint32_t n = 0; n < threadpool->nodecount; n++)
             {
-                printf("Failed to join on thread: %ld\n", *(threadpool->pool[i]));
+                eventcount_notify(&threadpool->nodes[n].work, 1);
             }
-            else
+            // slots only go from running to retired once terminate is set
+            pthread_mutex_lock(&(threadpool->resize));
+            int state = threadpool->workers[i].state;
+            threadpool->workers[i].state = THREADPOOL_SLOT_FREE;
+            pthread_mutex_unlock(&(threadpool->resize));
+            if (THREADPOOL_SLOT_FREE != state && pthread_join(threadpool->workers[i].thread, NULL))
             {
-                free(threadpool->pool[i]);
-                threadpool->pool[i] = NULL;
+                printf("Failed to join on thread: %ld\n", threadpool->workers[i].thread);
             }
         }
         retval = 1;
@@ -129,12 +947,154 @@ int join_threads(threadpool_t *threadpool)
  */
 void threadpool_free(threadpool_t *threadpool)
 {
-    free(threadpool->pool);
-    threadpool->pool = NULL;
+    for (uint32_t n = 0; n < threadpool->nodecount; n++)
+    {
+        pthread_mutex_destroy(&(threadpool->nodes[n].mutex));
+    }
+    pthread_mutex_destroy(&(threadpool->mutex));
+    pthread_mutex_destroy(&(threadpool->resize));
+    pthread_cond_destroy(&(threadpool->done));
+    free(threadpool->workers);
+    threadpool->workers = NULL;
+    free(threadpool->nodes);
+    threadpool->nodes = NULL;
     free(threadpool);
     threadpool = NULL;
 }
 
+/**
+ * @brief drops every queued entry
+ *
+ * @return uint64_t entries dropped
+ */
+static uint64_t drop_queued(threadpool_t *threadpool)
+{
+    uint64_t dropped = 0;
+    for (uint32_t n = 0; n < threadpool->nodecount; n++)
+    {
+        threadpool_node_t *node = &threadpool->nodes[n];
+        for (;;)
+        {
+            pthread_mutex_lock(&(node->mutex));
+            if (queue_emptycheck(node->queue))
+            {
+                pthread_mutex_unlock(&(node->mutex));
+                break;
+            }
+            queue_node_t *qnode = queue_dequeue(node->queue);
+            threadpool_task_t *task = qnode->data;
+            free(qnode);
+            __atomic_sub_fetch(&node->queued, 1, __ATOMIC_SEQ_CST);
+            __atomic_sub_fetch(&threadpool->queued, 1, __ATOMIC_SEQ_CST);
+            pthread_mutex_unlock(&(node->mutex));
+            drop_task(threadpool, task);
+            dropped++;
+        }
+        eventcount_notify(&node->space, 1);
+    }
+    return dropped;
+}
+
+/**
+ * @brief waits for the queues to empty and every task to finish
+ *
+ * @param ms longest to wait in milliseconds
+ * @return int 1 if the pool went idle, 0 if the time ran out
+ */
+static int wait_idle(threadpool_t *threadpool, uint32_t ms)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ms / 1000;
+    deadline.tv_nsec += (ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    int idle = 0;
+    pthread_mutex_lock(&(threadpool->mutex));
+    for (;;)
+    {
+        idle = 0 == __atomic_load_n(&threadpool->pending, __ATOMIC_SEQ_CST) &&
+               0 == __atomic_load_n(&threadpool->queued, __ATOMIC_SEQ_CST);
+        if (idle)
+        {
+            break;
+        }
+        // bare work items signal nothing when done, so recheck every 10ms
+        struct timespec slice;
+        clock_gettime(CLOCK_REALTIME, &slice);
+        if (slice.tv_sec > deadline.tv_sec || (slice.tv_sec == deadline.tv_sec && slice.tv_nsec >= deadline.tv_nsec))
+        {
+            break;
+        }
+        slice.tv_nsec += 10000000L;
+        if (slice.tv_nsec >= 1000000000L)
+        {
+            slice.tv_sec++;
+            slice.tv_nsec -= 1000000000L;
+        }
+        if (slice.tv_sec > deadline.tv_sec || (slice.tv_sec == deadline.tv_sec && slice.tv_nsec > deadline.tv_nsec))
+        {
+            slice = deadline;
+        }
+        pthread_cond_timedwait(&(threadpool->done), &(threadpool->mutex), &slice);
+    }
+    pthread_mutex_unlock(&(threadpool->mutex));
+    return idle;
+}
+
+int threadpool_cancelled(threadpool_t *threadpool)
+{
+    return __atomic_load_n(&threadpool->cancel, __ATOMIC_SEQ_CST);
+}
+
+int threadpool_shutdown(threadpool_t *threadpool, int mode, uint32_t deadline_ms, threadpool_stats_t *stats)
+{
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t completed = __atomic_load_n(&threadpool->completed, __ATOMIC_SEQ_CST);
+    uint64_t dropped = 0;
+    uint64_t overran = 0;
+    int abort = THREADPOOL_ABORT == mode || (THREADPOOL_DEADLINE == mode && !wait_idle(threadpool, deadline_ms));
+    pthread_mutex_lock(&(threadpool->resize));
+    if (abort)
+    {
+        __atomic_store_n(&threadpool->cancel, 1, __ATOMIC_SEQ_CST);
+    }
+    __atomic_store_n(&threadpool->terminate, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&(threadpool->resize));
+    if (abort)
+    {
+        dropped += drop_queued(threadpool);
+        overran = __atomic_load_n(&threadpool->pending, __ATOMIC_SEQ_CST);
+    }
+    for (uint32_t n = 0; n < threadpool->nodecount; n++)
+    {
+        eventcount_notify(&threadpool->nodes[n].space, 1);
+    }
+    join_threads(threadpool);
+    // anything queued while the threads were exiting
+    dropped += drop_queued(threadpool);
+    for (uint32_t n = 0; n < threadpool->nodecount; n++)
+    {
+        queue_destroy(&threadpool->nodes[n].queue);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (NULL != stats)
+    {
+        stats->completed = __atomic_load_n(&threadpool->completed, __ATOMIC_SEQ_CST);
+        stats->drained = stats->completed - completed;
+        stats->dropped = dropped;
+        stats->overran = overran;
+        stats->elapsed_ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+    }
+    threadpool_free(threadpool);
+    return 0 == dropped;
+}
+
 /**
  * @brief signals threadpool to terminate and cleans up memory allocs
  * 
@@ -142,8 +1102,5 @@ void threadpool_free(threadpool_t *threadpool)
  */
 void terminate_threadpool(threadpool_t *threadpool)
 {
-    threadpool->terminate = 1;
-    join_threads(threadpool);
-    queue_destroy(&threadpool->queue);
-    threadpool_free(threadpool);
-}
\ No newline at end of file
+    threadpool_shutdown(threadpool, THREADPOOL_DRAIN, 0, NULL);
+}
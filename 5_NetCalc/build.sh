@@ -0,0 +1,7 @@
+#!/bin/bash
+
+mkdir -p build
+cd build
+cmake ..
+make -j$(nproc)
+cd ..
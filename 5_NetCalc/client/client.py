@@ -1,70 +1,257 @@
 import socket
-import time
 import os
 import sys
 import getopt
-from  struct import *
-
-PORT = 5555
-FORMAT = 'utf-8'
-SERVER = socket.gethostbyname(socket.gethostname())
-ADDR = (SERVER, PORT)
-SIZE = 1024
-
-
-def ConnectToServer():
-    client = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
-    client.connect(ADDR)
-    data = client.recv(SIZE).decode(FORMAT)
-    print(f"[SERVER] {data}")
-    return client
-
-def ParseDir():
-    for root, dirs, files in os.walk(dir):
-        for filename in files:
-            f = filename
-            path = root + filename
-            SendFileContents(f, path)
-
-
-
-def SendFileContents(f, path):
-    client = ConnectToServer()
-    flen = str(len(f)) + '\n'
-    print(len(f))
-    client.send(flen.encode())
-    client.send(str(f).encode())
-    with open(path, 'rb') as file:
-        print("[CLIENT]: Sending ", f)
-        print("\n\n\n\n")
-
-        headerForm = "4s8s8s1s4s2s"
-        magicNum = file.read(4)
-        print(''.join(format(x, '02x') for x in magicNum))
-        fileID = file.read(8)
-        print(''.join(format(x, '02x') for x in fileID))
-        numOfEq = file.read(8)
-        print(''.join(format(x, '02x') for x in numOfEq))
-        flags = file.read(1)
-        print(''.join(format(x, '02x') for x in flags))
-        equOffset = file.read(4)
-        print(''.join(format(x, '02x') for x in equOffset))
-        numOptHeaders = file.read(2)
-        print(''.join(format(x, '02x') for x in numOptHeaders))
-
-        header = pack(headerForm, magicNum, fileID, numOfEq, flags, equOffset, numOptHeaders)
-        print("Header: ")
-        print(''.join(format(x, '02x') for x in header))
-        print("\n\n\n" + str(len(header)))
-        client.send(header)
+import threading
+from struct import *
 
+PORT = 31337
+SERVER = "127.0.0.1"
+DEPTH = 64
+
+NET_HDR_SZ = 48
+NET_HDR_EXT_SZ = 64
+NET_FNAME_MAX = 24
+NET_MSG_EQU = 0
+NET_MSG_BATCH = 1
+NET_STATUS_OK = 0
+NET_STATUS_BUSY = 3
+NET_BATCH_MAX = 4096
+
+# NetSpec header followed by the pipelining extension: request_id, msgtype,
+# flags, status
+NET_HDR_FORM = "!IIQ32s"
+NET_EXT_FORM = "!QHHI"
+
+# batch payloads are little endian like the .equ format: a count followed by
+# (eqid, operator, operand1, operand2) tuples, answered with (eqid, solved,
+# signed, result) tuples
+BATCH_COUNT_FORM = "<I"
+BATCH_EQU_FORM = "<IBQQ"
+BATCH_SOLVED_FORM = "<IBBQ"
+OPERATORS = ["+", "-", "*", "/", "%", "<<", ">>", "&", "|", "^", "<<<", ">>>"]
+
+
+def usage():
+    print("Usage: client.py -i <unsolved_dir> -o <solved_dir> "
+          "[-s <server>] [-p <port>] [-d <pipeline depth>]")
+    print("       client.py -e \"<operand1> <operator> <operand2>\" [-e ...] "
+          "[-s <server>] [-p <port>]")
+
+
+def RecvExact(client, size):
+    data = b""
+    while len(data) < size:
+        chunk = client.recv(size - len(data))
+        if not chunk:
+            raise ConnectionError("server closed the connection")
+        data += chunk
+    return data
+
+
+def RecvInto(client, size, out):
+    """
+    Copies a reply payload to out as it arrives. Large answers are streamed
+    by the server, so the start of a solved file is written long before the
+    end has been solved.
+    """
+    while size > 0:
+        chunk = client.recv(min(size, 1 << 16))
+        if not chunk:
+            raise ConnectionError("server closed the connection")
+        out.write(chunk)
+        size -= len(chunk)
+
+
+def GenNetHdr(request_id, filename, payload_len, msgtype=NET_MSG_EQU):
+    name = filename.encode()
+    hdr = pack(NET_HDR_FORM, NET_HDR_EXT_SZ, len(name), NET_HDR_EXT_SZ + payload_len, name)
+    hdr += pack(NET_EXT_FORM, request_id, msgtype, 0, 0)
+    return hdr
+
+
+def ParseEquation(text):
+    """
+    Parses "operand1 operator operand2" into (operator code, operand1,
+    operand2). Negative operands are stored two's complement.
+    """
+    operand1, operator, operand2 = text.split()
+    code = OPERATORS.index(operator) + 1
+    return code, int(operand1, 0) & 0xFFFFFFFFFFFFFFFF, int(operand2, 0) & 0xFFFFFFFFFFFFFFFF
+
+
+def SendBatch(equations, server, port):
+    """
+    Sends the equations as one NET_MSG_BATCH request and prints each result.
+    """
+    if len(equations) > NET_BATCH_MAX:
+        print("[CLIENT]: At most", NET_BATCH_MAX, "equations per batch")
+        return 1
+    payload = pack(BATCH_COUNT_FORM, len(equations))
+    for eqid, (code, operand1, operand2) in enumerate(equations):
+        payload += pack(BATCH_EQU_FORM, eqid, code, operand1, operand2)
+
+    with socket.create_connection((server, port)) as client:
+        client.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        client.sendall(GenNetHdr(0, "", len(payload), NET_MSG_BATCH) + payload)
+        hdr_len, _, pkt_len, _ = unpack(NET_HDR_FORM, RecvExact(client, NET_HDR_SZ))
+        _, _, retry_ms, status = unpack(NET_EXT_FORM, RecvExact(client, hdr_len - NET_HDR_SZ))
+        reply = RecvExact(client, pkt_len - hdr_len)
+    if status == NET_STATUS_BUSY:
+        print("[CLIENT]: Server busy, retry after", retry_ms, "ms")
+        return 1
+    if status != NET_STATUS_OK:
+        print("[CLIENT]: Server rejected the batch, status", status)
+        return 1
+
+    count, = unpack_from(BATCH_COUNT_FORM, reply)
+    offset = calcsize(BATCH_COUNT_FORM)
+    for _ in range(count):
+        eqid, solved, signed, result = unpack_from(BATCH_SOLVED_FORM, reply, offset)
+        offset += calcsize(BATCH_SOLVED_FORM)
+        code, operand1, operand2 = equations[eqid]
+        if signed:
+            operand1, operand2, result = (unpack("<q", pack("<Q", value))[0]
+                                          for value in (operand1, operand2, result))
+        if not solved:
+            print(operand1, OPERATORS[code - 1], operand2, "= error")
+        else:
+            print(operand1, OPERATORS[code - 1], operand2, "=", result)
+    return 0
+
+
+def Resend(client, sendlock, message):
+    try:
+        with sendlock:
+            client.sendall(message)
+    except OSError:
+        pass
+
+
+def ReceiveReplies(client, pending, lock, sendlock, window, total, outdir, results):
+    try:
+        answered = 0
+        while answered < total:
+            hdr = RecvExact(client, NET_HDR_SZ)
+            hdr_len, filename_len, pkt_len, _ = unpack(NET_HDR_FORM, hdr)
+            ext = RecvExact(client, hdr_len - NET_HDR_SZ)
+            request_id, _, retry_ms, status = unpack(NET_EXT_FORM, ext)
+            if status == NET_STATUS_OK:
+                with lock:
+                    filename = pending[request_id][0]
+                with open(os.path.join(outdir, filename), "wb") as solved:
+                    RecvInto(client, pkt_len - hdr_len, solved)
+            else:
+                RecvExact(client, pkt_len - hdr_len)
+            if status == NET_STATUS_BUSY:
+                # the server shed the request; send it again once it says to
+                with lock:
+                    message = pending[request_id][1]
+                results["retried"] += 1
+                threading.Timer(retry_ms / 1000, Resend, args=(client, sendlock, message)).start()
+                continue
+            answered += 1
+            with lock:
+                filename = pending.pop(request_id)[0]
+            window.release()
+            if status != NET_STATUS_OK:
+                print("[CLIENT]: Server rejected", filename, "status", status)
+                results["failed"] += 1
+                continue
+            results["solved"] += 1
+    except ConnectionError as err:
+        print("[CLIENT]:", err)
+        results["failed"] = total - results["solved"]
+        results["closed"] = True
+        # wake the sender so it notices the closed connection
+        window.release()
+
+
+def ParseDir(indir):
+    files = []
+    for filename in sorted(os.listdir(indir)):
+        path = os.path.join(indir, filename)
+        if not os.path.isfile(path):
+            continue
+        if len(filename.encode()) > NET_FNAME_MAX:
+            print("[CLIENT]: Skipping", filename, "name longer than", NET_FNAME_MAX)
+            continue
+        files.append((filename, path))
+    return files
+
+
+def SendFiles(files, outdir, server, port, depth):
+    """
+    Sends every file on one connection, keeping up to depth requests in
+    flight. Replies carry the request id and may arrive in any order.
+    """
+    pending = {}
+    lock = threading.Lock()
+    sendlock = threading.Lock()
+    window = threading.Semaphore(depth)
+    results = {"solved": 0, "failed": 0, "retried": 0, "closed": False}
+
+    client = socket.create_connection((server, port))
+    client.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    receiver = threading.Thread(target=ReceiveReplies,
+                                args=(client, pending, lock, sendlock, window, len(files), outdir, results))
+    receiver.start()
+    for request_id, (filename, path) in enumerate(files):
+        with open(path, "rb") as unsolved:
+            data = unsolved.read()
+        window.acquire()
+        if results["closed"]:
+            window.release()
+            break
+        message = GenNetHdr(request_id, filename, len(data)) + data
+        with lock:
+            pending[request_id] = (filename, message)
+        with sendlock:
+            client.sendall(message)
+    receiver.join()
     client.close()
+    print("[CLIENT]: Solved", results["solved"], "failed", results["failed"],
+          "retried busy", results["retried"])
+    return results["failed"]
 
 
 def main():
-    ParseDir()
+    indir = None
+    outdir = None
+    server = SERVER
+    port = PORT
+    depth = DEPTH
+    equations = []
+    try:
+        opts, _ = getopt.getopt(sys.argv[1:], "i:o:s:p:d:e:")
+    except getopt.GetoptError:
+        usage()
+        return 1
+    for opt, arg in opts:
+        if opt == "-i":
+            indir = arg
+        elif opt == "-o":
+            outdir = arg
+        elif opt == "-s":
+            server = arg
+        elif opt == "-p":
+            port = int(arg)
+        elif opt == "-d":
+            depth = max(1, int(arg))
+        elif opt == "-e":
+            try:
+                equations.append(ParseEquation(arg))
+            except ValueError:
+                print("[CLIENT]: Bad equation", arg)
+                return 1
+    if equations:
+        return SendBatch(equations, server, port)
+    if indir is None or outdir is None:
+        usage()
+        return 1
+    os.makedirs(outdir, exist_ok=True)
+    return SendFiles(ParseDir(indir), outdir, server, port, depth)
 
 
 if __name__ == "__main__":
-    dir = sys.argv[1]
-    main()
\ No newline at end of file
+    sys.exit(main())
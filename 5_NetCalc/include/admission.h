@@ -0,0 +1,127 @@
+#ifndef _ADMISSION_H
+#define _ADMISSION_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define ADMIT_BYTES_DEFAULT (256ULL << 20)
+#define ADMIT_EQUATIONS_DEFAULT (1ULL << 24)
+#define ADMIT_BUCKET_BITS 12
+#define ADMIT_BUCKETS (1 << ADMIT_BUCKET_BITS)
+#define ADMIT_PROBE 8
+#define ADMIT_RETRY_MS 20
+#define ADMIT_RETRY_MAX_MS 60000
+
+/**
+ * @brief token bucket of one client address. Buckets live in a fixed table
+ * probed from the slot the address hashes to. A client finding ADMIT_PROBE
+ * slots held by others takes over the least recently used one along with
+ * its tokens, so colliding clients cannot refill each other's bucket
+ *
+ * @param addr client IPv4 address, 0 for an empty slot
+ * @param tokens requests the client may still send right away
+ * @param last when tokens was last refilled, in nanoseconds
+ */
+typedef struct admission_bucket_t
+{
+    uint32_t addr;
+    double tokens;
+    uint64_t last;
+} admission_bucket_t;
+
+/**
+ * @brief limits on work accepted by the server, shared by every shard.
+ * Requests are admitted when their header arrives and hold their share of
+ * the limits until the reply is sent, so overload is answered with an
+ * immediate NET_STATUS_BUSY instead of queueing
+ *
+ * @param max_bytes cap on payload bytes in flight
+ * @param max_equations cap on equations in flight. A request is charged
+ * admission_cost of its payload size when admitted, and the equations its
+ * payload declares once that has arrived
+ * @param rate requests per second allowed per client address, 0 for no limit
+ * @param burst requests a client may send at once
+ * @param inflight_bytes payload bytes admitted and not yet answered
+ * @param inflight_equations equations admitted and not yet answered
+ * @param rejected requests answered with NET_STATUS_BUSY
+ * @param lock guards buckets
+ * @param buckets per client token buckets
+ */
+typedef struct admission_t
+{
+    uint64_t max_bytes;
+    uint64_t max_equations;
+    double rate;
+    double burst;
+    uint64_t inflight_bytes;
+    uint64_t inflight_equations;
+    uint64_t rejected;
+    pthread_mutex_t lock;
+    admission_bucket_t buckets[ADMIT_BUCKETS];
+} admission_t;
+
+/**
+ * @brief initializes admission control
+ *
+ * @param adm admission state to initialize
+ * @param max_bytes cap on payload bytes in flight
+ * @param max_equations cap on equations in flight
+ * @param rate requests per second per client, 0 for no limit
+ * @param burst requests a client may send at once, at least 1
+ */
+void admission_init(admission_t *adm, uint64_t max_bytes, uint64_t max_equations, double rate, double burst);
+
+/**
+ * @brief destroys admission control
+ *
+ */
+void admission_destroy(admission_t *adm);
+
+/**
+ * @brief equations a payload is charged for, one per unsolved equation it
+ * could hold
+ *
+ * @param bytes payload size
+ * @return uint64_t equations
+ */
+uint64_t admission_cost(uint64_t bytes);
+
+/**
+ * @brief admits a request or says how long the client should back off.
+ * A request is always admitted while nothing else is in flight, so one
+ * larger than the caps still makes progress
+ *
+ * @param adm admission state
+ * @param addr client IPv4 address in network order
+ * @param bytes payload size of the request
+ * @param equations equations the request is charged for
+ * @param retry_ms set to the suggested wait when the request is refused
+ * @return int 1 if admitted, 0 if the server is busy
+ */
+int admission_acquire(admission_t *adm, uint32_t addr, uint64_t bytes, uint64_t equations, uint32_t *retry_ms);
+
+/**
+ * @brief raises an admitted request's charge once its payload turns out to
+ * declare more equations than it was admitted for. Like admission_acquire
+ * it succeeds while the request is alone in flight
+ *
+ * @param adm admission state
+ * @param from equations the request holds
+ * @param to equations it needs
+ * @param retry_ms set to the suggested wait when refused
+ * @return int 1 if the request now holds to, 0 if it still holds from and
+ * the server is busy
+ */
+int admission_grow(admission_t *adm, uint64_t from, uint64_t to, uint32_t *retry_ms);
+
+/**
+ * @brief returns an admitted request's share of the caps once answered
+ *
+ * @param adm admission state
+ * @param bytes payload size passed to admission_acquire
+ * @param equations equations the request holds
+ */
+void admission_release(admission_t *adm, uint64_t bytes, uint64_t equations);
+
+#endif
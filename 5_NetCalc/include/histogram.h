@@ -0,0 +1,79 @@
+#ifndef _HISTOGRAM_H
+#define _HISTOGRAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define HIST_SUB_MAGNITUDE 10
+#define HIST_SUB_HALF (1 << HIST_SUB_MAGNITUDE)
+#define HIST_SUB_MASK ((HIST_SUB_HALF << 1) - 1)
+#define HIST_MAX_BITS 40
+#define HIST_MAX_VALUE ((1ULL << HIST_MAX_BITS) - 1)
+#define HIST_COUNTS ((HIST_MAX_BITS - HIST_SUB_MAGNITUDE + 1) * HIST_SUB_HALF)
+
+/**
+ * @brief HDR histogram of nonnegative values with three significant
+ * digits, laid out like HdrHistogram: every power of two range is split
+ * into HIST_SUB_HALF linear sub buckets, so recording is a shift and an
+ * increment. Values above HIST_MAX_VALUE (about 18 minutes of nanoseconds)
+ * are clamped
+ *
+ * @param total values recorded
+ * @param min smallest value recorded
+ * @param max largest value recorded
+ * @param sum sum of values recorded, for the mean
+ * @param counts values per sub bucket
+ */
+typedef struct histogram_t
+{
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    double sum;
+    uint64_t counts[HIST_COUNTS];
+} histogram_t;
+
+/**
+ * @brief allocates an empty histogram
+ *
+ * @return histogram_t* histogram, NULL if out of memory
+ */
+histogram_t *histogram_create();
+
+/**
+ * @brief frees a histogram
+ *
+ */
+void histogram_free(histogram_t *hist);
+
+/**
+ * @brief records one value
+ *
+ * @param hist histogram
+ * @param value value to record
+ */
+void histogram_record(histogram_t *hist, uint64_t value);
+
+/**
+ * @brief adds every value of src to dst
+ *
+ */
+void histogram_merge(histogram_t *dst, const histogram_t *src);
+
+/**
+ * @brief value at a percentile, reported as the highest value equivalent
+ * to the sub bucket it falls in
+ *
+ * @param hist histogram
+ * @param percentile 0 to 100
+ * @return uint64_t value, 0 if the histogram is empty
+ */
+uint64_t histogram_percentile(const histogram_t *hist, double percentile);
+
+/**
+ * @brief mean of the values recorded
+ *
+ */
+double histogram_mean(const histogram_t *hist);
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "admission.h"
+#include "../../4_ThreadCalc/include/equation.h"
+#include "../../4_ThreadCalc/include/threadpool.h"
+
+#define METRICS_MSGTYPES 3
+#define METRICS_OPCODES 13
+#define METRICS_BUCKETS 16
+#define METRICS_REQUEST_MAX 1024
+
+/**
+ * @brief plain counters
+ *
+ * METRIC_BYTES_IN: request bytes received
+ * METRIC_BYTES_OUT: reply bytes sent
+ * METRIC_CACHE_HITS: requests answered from the result cache
+ * METRIC_OPENED: connections accepted
+ * METRIC_CLOSED: connections closed
+ */
+enum metric_counter
+{
+    METRIC_BYTES_IN = 0,
+    METRIC_BYTES_OUT,
+    METRIC_CACHE_HITS,
+    METRIC_OPENED,
+    METRIC_CLOSED,
+    METRIC_COUNTER_COUNT
+};
+
+/**
+ * @brief errors counted by type
+ *
+ * METRIC_ERR_BADHDR: request answered NET_STATUS_BADHDR
+ * METRIC_ERR_BADEQU: request answered NET_STATUS_BADEQU
+ * METRIC_ERR_BUSY: request refused NET_STATUS_BUSY by admission control
+ * METRIC_ERR_RECV: a receive failed and the connection was dropped
+ * METRIC_ERR_SEND: a send failed and the connection's replies were dropped
+ * METRIC_ERR_NOMEM: out of memory answering a request, the connection was
+ * closed
+ */
+enum metric_error
+{
+    METRIC_ERR_BADHDR = 0,
+    METRIC_ERR_BADEQU,
+    METRIC_ERR_BUSY,
+    METRIC_ERR_RECV,
+    METRIC_ERR_SEND,
+    METRIC_ERR_NOMEM,
+    METRIC_ERR_COUNT
+};
+
+/**
+ * @brief one thread's counters. Only the owning thread writes them, with
+ * relaxed atomic stores, so counting takes no lock and a scrape on another
+ * thread sees whole values. A thread's counters are kept when it exits
+ * and taken over by the next thread to register, so the sums never go
+ * backwards while elastic pool workers come and go
+ *
+ * @param next next registered thread
+ * @param owned a running thread is counting into it
+ * @param requests replies sealed per enum net_msgtype, the last slot for
+ * unknown types
+ * @param equations equations solved per operator, slot 0 for invalid ones
+ * @param errors counts per enum metric_error
+ * @param counters counts per enum metric_counter
+ * @param latency replies fully sent per latency bucket, not cumulative
+ * @param latency_ns sum of the latencies in latency
+ */
+typedef struct metrics_thread_t
+{
+    struct metrics_thread_t *next;
+    int owned;
+    uint64_t requests[METRICS_MSGTYPES];
+    uint64_t equations[METRICS_OPCODES];
+    uint64_t errors[METRIC_ERR_COUNT];
+    uint64_t counters[METRIC_COUNTER_COUNT];
+    uint64_t latency[METRICS_BUCKETS + 1];
+    uint64_t latency_ns;
+} metrics_thread_t;
+
+/**
+ * @brief the HTTP listener serving GET /metrics in the Prometheus text
+ * format on the loopback interface
+ *
+ * @param listenfd listening socket, -1 when not started
+ * @param thread thread answering scrapes one at a time
+ * @param pool threadpool whose queue depth and threads are reported
+ * @param admission admission limits whose in-flight work is reported
+ * @param stop set to end the thread
+ */
+typedef struct metrics_server_t
+{
+    int listenfd;
+    pthread_t thread;
+    threadpool_t *pool;
+    admission_t *admission;
+    int stop;
+} metrics_server_t;
+
+/**
+ * @brief adds to one of the calling thread's counters
+ *
+ * @param counter enum metric_counter
+ * @param n amount to add
+ */
+void metrics_count(int counter, uint64_t n);
+
+/**
+ * @brief counts a sealed reply under its request's message type, and its
+ * status when that is an error
+ *
+ * @param msgtype enum net_msgtype of the request
+ * @param status enum net_status of the reply
+ */
+void metrics_reply(uint32_t msgtype, uint32_t status);
+
+/**
+ * @brief counts an error
+ *
+ * @param error enum metric_error
+ */
+void metrics_error(int error);
+
+/**
+ * @brief counts a batch of solved equations by operator
+ *
+ * @param uequ equations that were solved
+ * @param count number of equations
+ */
+void metrics_equations(const struct unsolved_equation *uequ, size_t count);
+
+/**
+ * @brief records how long a request took from its first header byte to
+ * the last byte of its reply
+ *
+ * @param ns latency in nanoseconds
+ */
+void metrics_latency(uint64_t ns);
+
+/**
+ * @brief writes every counter, summed over threads, and the pool and
+ * admission gauges in the Prometheus text format
+ *
+ * @param out stream to write to
+ * @param pool threadpool to report, NULL for none
+ * @param admission admission limits to report, NULL for none
+ */
+void metrics_write(FILE *out, threadpool_t *pool, admission_t *admission);
+
+/**
+ * @brief starts the metrics listener on 127.0.0.1
+ *
+ * @param server zeroed server with pool and admission set
+ * @param port port to listen on
+ * @return int 1 if successful, 0 on error
+ */
+int metrics_start(metrics_server_t *server, uint16_t port);
+
+/**
+ * @brief stops the metrics listener and closes its socket
+ *
+ * @param server started server
+ */
+void metrics_stop(metrics_server_t *server);
+
+/**
+ * @brief frees every registered thread's counters. Threads that counted
+ * must have exited
+ *
+ */
+void metrics_free(void);
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef _NETCACHE_H
+#define _NETCACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <linux/limits.h>
+
+#define NETCACHE_LIMIT_DEFAULT (256ULL << 20)
+#define NETCACHE_LOW_WATER 90
+
+/**
+ * @brief the result cache shared by every shard. Each entry holds the
+ * upload it answers followed by the solved file, so a hit is only served
+ * after the stored upload compares equal to the request's; an entry's
+ * name merely locates it. Hits refresh an entry's mtime, and once the
+ * entries pass limit bytes the least recently used are removed until they
+ * fit in NETCACHE_LOW_WATER percent of it
+ *
+ * @param dir cache directory
+ * @param limit most bytes the entries may take, 0 for no bound
+ * @param size bytes the entries are believed to take, updated atomically
+ * and recounted on every eviction
+ * @param lock held by the thread evicting
+ */
+typedef struct netcache_t
+{
+    const char *dir;
+    uint64_t limit;
+    uint64_t size;
+    pthread_mutex_t lock;
+} netcache_t;
+
+/**
+ * @brief opens the cache, creating its directory and counting the entries
+ * already there
+ *
+ * @param cache cache to initialize
+ * @param dir cache directory
+ * @param limit most bytes the entries may take, 0 for no bound
+ * @return int 1 if successful, 0 if the directory could not be created
+ */
+int netcache_init(netcache_t *cache, const char *dir, uint64_t limit);
+
+/**
+ * @brief destroys the cache. Entries stay on disk for the next run
+ *
+ */
+void netcache_destroy(netcache_t *cache);
+
+/**
+ * @brief hashes an uploaded .equ payload (64-bit FNV-1a). Cache entries
+ * are named by this key and the payload length
+ *
+ * @param payload uploaded bytes
+ * @param len size of payload
+ * @return uint64_t key
+ */
+uint64_t netcache_key(const uint8_t *payload, size_t len);
+
+/**
+ * @brief opens the cached solved file of an upload. The entry is a hit
+ * only if the upload stored in it matches payload byte for byte
+ *
+ * @param cache result cache
+ * @param key netcache_key of the upload
+ * @param payload uploaded bytes
+ * @param len size of the upload. The solved file starts at this offset in
+ * the returned fd
+ * @param size set to the size of the solved file
+ * @return int read only fd, -1 on a miss
+ */
+int netcache_open(netcache_t *cache, uint64_t key, const uint8_t *payload, size_t len, uint64_t *size);
+
+/**
+ * @brief a cache entry being written, kept under a temporary name until it
+ * is committed
+ *
+ * @param cache cache the entry goes into
+ * @param fd temporary file
+ * @param size bytes written so far, the upload included
+ * @param path final name of the entry
+ * @param tmppath temporary name
+ */
+typedef struct netcache_entry_t
+{
+    netcache_t *cache;
+    int fd;
+    uint64_t size;
+    char path[PATH_MAX];
+    char tmppath[PATH_MAX];
+} netcache_entry_t;
+
+/**
+ * @brief starts writing a cache entry, for solved files produced a piece
+ * at a time. The upload is written first
+ *
+ * @param cache result cache
+ * @param key netcache_key of the upload
+ * @param payload uploaded bytes
+ * @param len size of the upload
+ * @return netcache_entry_t* entry to append to, NULL on error
+ */
+netcache_entry_t *netcache_begin(netcache_t *cache, uint64_t key, const uint8_t *payload, size_t len);
+
+/**
+ * @brief appends solved bytes to an entry
+ *
+ * @param entry entry from netcache_begin
+ * @param data bytes to append
+ * @param n size of data
+ * @return int 1 if written, 0 on error
+ */
+int netcache_append(netcache_entry_t *entry, const uint8_t *data, size_t n);
+
+/**
+ * @brief renames a complete entry into place and frees it, evicting old
+ * entries if the cache is now over its limit
+ *
+ * @param entry entry from netcache_begin
+ * @return int 1 if stored, 0 on error
+ */
+int netcache_commit(netcache_entry_t *entry);
+
+/**
+ * @brief discards an unfinished entry and frees it
+ *
+ * @param entry entry from netcache_begin
+ */
+void netcache_abort(netcache_entry_t *entry);
+
+/**
+ * @brief stores a solved file in the cache. The file is written under a
+ * temporary name and renamed, so readers never see a partial entry
+ *
+ * @param cache result cache
+ * @param key netcache_key of the upload
+ * @param payload uploaded bytes
+ * @param len size of the upload
+ * @param solved solved file
+ * @param solvedlen size of solved
+ * @return int 1 if stored, 0 on error
+ */
+int netcache_store(netcache_t *cache, uint64_t key, const uint8_t *payload, size_t len, const uint8_t *solved,
+                   size_t solvedlen);
+
+#endif
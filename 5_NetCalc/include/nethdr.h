@@ -0,0 +1,128 @@
+#ifndef _NETHDR_H
+#define _NETHDR_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define NET_PORT 31337
+#define NET_HDR_SZ 48
+#define NET_HDR_EXT_SZ 64
+#define NET_FNAME_MAX 24
+#define NET_NAME_FIELD_SZ 32
+#define NET_PKT_MAX (64 << 20)
+
+#define NET_BATCH_MAX 4096
+
+/**
+ * @brief message types carried in the extended header. Legacy 48-byte
+ * headers are always NET_MSG_EQU
+ *
+ * NET_MSG_EQU payload is a .equ file, answered with the solved file.
+ * NET_MSG_BATCH payload is a little endian uint32 count followed by count
+ * struct net_batch_equation, answered with the count followed by count
+ * struct solved_equation. FileNameLen may be 0 for a batch
+ *
+ */
+enum net_msgtype
+{
+    NET_MSG_EQU = 0,
+    NET_MSG_BATCH
+};
+
+/**
+ * @brief one equation of a NET_MSG_BATCH request. Fields are little endian
+ * like the .equ format
+ *
+ */
+struct net_batch_equation
+{
+    uint32_t eqid;
+    uint8_t operatr;
+    uint64_t operand1;
+    uint64_t operand2;
+}__attribute__((packed));
+
+/**
+ * @brief status of a reply. Anything other than NET_STATUS_OK is sent with
+ * a FileNameLen of 0 and no payload, as NetSpec describes for errors.
+ * NET_STATUS_BUSY means the request was refused by admission control and
+ * may be sent again after the delay carried in the reply's flags
+ *
+ */
+enum net_status
+{
+    NET_STATUS_OK = 0,
+    NET_STATUS_BADHDR,
+    NET_STATUS_BADEQU,
+    NET_STATUS_BUSY
+};
+
+/**
+ * @brief NET header as specified in ../references/NetSpec.pdf, followed by
+ * the pipelining extension. All fields are big endian on the wire.
+ *
+ * A HeaderSize of 48 is a legacy request: it is answered with a 48-byte
+ * header, in order, before the next request on the connection is read.
+ * A HeaderSize of 64 adds request_id, msgtype, flags and status. Such
+ * requests may be pipelined on one connection and are answered with a
+ * 64-byte header echoing request_id, in whatever order they finish
+ *
+ * @param hdr_len size of this header, 48 or 64
+ * @param filename_len length of filename, at most 24
+ * @param pkt_len size of this header plus the payload
+ * @param filename name of the .equ file, not NUL terminated when full
+ * @param request_id client chosen id echoed in the reply
+ * @param msgtype enum net_msgtype of the payload
+ * @param flags 0 on requests; on a NET_STATUS_BUSY reply, milliseconds to
+ * wait before retrying
+ * @param status enum net_status, set on replies
+ */
+struct net_header
+{
+    uint32_t hdr_len;
+    uint32_t filename_len;
+    uint64_t pkt_len;
+    char filename[NET_NAME_FIELD_SZ];
+    uint64_t request_id;
+    uint16_t msgtype;
+    uint16_t flags;
+    uint32_t status;
+}__attribute__((packed));
+
+/**
+ * @brief converts a received header to host order in place. Extension
+ * fields are zeroed for legacy headers
+ *
+ * @param hdr header as read off the wire
+ */
+void net_header_to_host(struct net_header *hdr);
+
+/**
+ * @brief checks a host order request header against NetSpec
+ *
+ * @param hdr request header
+ * @return int NET_STATUS_OK or NET_STATUS_BADHDR
+ */
+int net_header_validate(const struct net_header *hdr);
+
+/**
+ * @brief returns whether a bad request can be skipped and the connection
+ * kept. Only extended headers with a sane pkt_len can be resynchronised
+ *
+ * @param hdr host order request header
+ * @return int 1 if the payload can be skipped, 0 if the connection must close
+ */
+int net_header_recoverable(const struct net_header *hdr);
+
+/**
+ * @brief builds the reply header for a request in network order
+ *
+ * @param req host order request header
+ * @param status enum net_status of the reply
+ * @param payload_len bytes of solved output following the header
+ * @param reply header to fill in
+ * @return size_t bytes of reply to send, 48 or 64
+ */
+size_t net_header_reply(const struct net_header *req, uint32_t status, uint64_t payload_len, struct net_header *reply);
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef _NETSOCK_H
+#define _NETSOCK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#define NET_LISTEN_BACKLOG 1024
+
+/**
+ * @brief creates a TCP listening socket on every interface
+ *
+ * @param port port to listen on
+ * @param reuseport set SO_REUSEPORT so several sockets can share the port
+ * @return int listening socket, -1 on error
+ */
+int net_listen(uint16_t port, int reuseport);
+
+/**
+ * @brief creates a TCP listening socket reachable only from this host
+ *
+ * @param port port to listen on
+ * @return int listening socket on 127.0.0.1, -1 on error
+ */
+int net_listen_loopback(uint16_t port);
+
+/**
+ * @brief connects to a NetCalc server
+ *
+ * @param host hostname or address
+ * @param port port to connect to
+ * @return int connected socket with TCP_NODELAY set, -1 on error
+ */
+int net_connect(const char *host, uint16_t port);
+
+/**
+ * @brief receives exactly len bytes on a blocking socket
+ *
+ * @return int 1 if all bytes arrived, 0 on close or error
+ */
+int recv_all(int fd, void *buf, size_t len);
+
+/**
+ * @brief sends exactly len bytes on a blocking socket
+ *
+ * @return int 1 if all bytes were sent, 0 on error
+ */
+int send_all(int fd, const void *buf, size_t len);
+
+/**
+ * @brief sends every byte described by iov with writev on a blocking
+ * socket. iov is advanced past what was sent
+ *
+ * @return int 1 if all bytes were sent, 0 on error
+ */
+int writev_all(int fd, struct iovec *iov, int iovcnt);
+
+/**
+ * @brief sends len bytes of a file from its current offset with sendfile,
+ * so the bytes never pass through user space
+ *
+ * @return int 1 if all bytes were sent, 0 on error
+ */
+int sendfile_all(int sockfd, int filefd, uint64_t len);
+
+/**
+ * @brief advances an iovec array past sent bytes
+ *
+ * @param iov array to advance
+ * @param iovcnt entries in iov
+ * @param sent bytes to skip
+ * @return int index of the first entry with bytes left, iovcnt if none
+ */
+int iov_advance(struct iovec *iov, int iovcnt, size_t sent);
+
+/**
+ * @brief reads and throws away len bytes on a blocking socket
+ *
+ * @return int 1 if skipped, 0 on close or error
+ */
+int skip_bytes(int fd, uint64_t len);
+
+#endif
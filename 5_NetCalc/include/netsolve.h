@@ -0,0 +1,148 @@
+#ifndef _NETSOLVE_H
+#define _NETSOLVE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "nethdr.h"
+#include "netcache.h"
+
+/**
+ * @brief largest numeq accepted in an uploaded .equ header. Bounds the
+ * solved buffer a single request can make the server allocate
+ *
+ */
+#define NET_NUMEQ_MAX (1 << 22)
+
+/**
+ * @brief solves an uploaded .equ file, raw or compressed, into a solved
+ * file in memory. Raw files are solved in place in the payload
+ *
+ * @param payload .equ bytes following the net header
+ * @param len size of payload
+ * @param buf caller buffer the solved file is written to if it fits, NULL
+ * for none
+ * @param cap size of buf
+ * @param solved set to buf, or to a malloc'd solved file the caller frees
+ * @param solvedlen set to the size of solved
+ * @return int NET_STATUS_OK, or NET_STATUS_BADEQU if the .equ header could
+ * not be parsed
+ */
+int net_solve(const void *payload, size_t len, uint8_t *buf, size_t cap, uint8_t **solved, size_t *solvedlen);
+
+/**
+ * @brief solves a NET_MSG_BATCH request with the same batch solver used
+ * for files
+ *
+ * @param payload count followed by packed struct net_batch_equation
+ * @param len size of payload, must match the count exactly
+ * @param buf caller buffer the answer is written to if it fits, NULL for
+ * none
+ * @param cap size of buf
+ * @param solved set to buf, or to a malloc'd answer the caller frees. The
+ * answer is the count followed by the solved equations
+ * @param solvedlen set to the size of solved
+ * @return int NET_STATUS_OK, or NET_STATUS_BADEQU if the batch is malformed
+ * or holds more than NET_BATCH_MAX equations
+ */
+int net_solve_batch(const void *payload, size_t len, uint8_t *buf, size_t cap, uint8_t **solved, size_t *solvedlen);
+
+typedef struct net_stream net_stream_t;
+
+/**
+ * @brief the answer to one upload, held in memory, as an open cached file
+ * so it can be sent with writev or sendfile without copying, or streamed.
+ * A streamed answer is solved a chunk at a time into the caller's buffer
+ * with net_result_next, so its memory stays bounded however many
+ * equations the upload holds
+ *
+ * @param status enum net_status of the reply
+ * @param solved solved output, NULL when answered from the cache. The
+ * current chunk when streamed
+ * @param filefd cached solved file, -1 when answered from memory
+ * @param filebase offset of the solved file within filefd
+ * @param len bytes of solved output, known up front even when streamed
+ * @param owned solved was malloc'd rather than written to the caller's
+ * buffer
+ * @param base offset of solved within the output, 0 unless streamed
+ * @param avail bytes held in solved
+ * @param stream solver state of a streamed answer, NULL otherwise
+ */
+typedef struct net_result_t
+{
+    uint32_t status;
+    uint8_t *solved;
+    int filefd;
+    uint64_t filebase;
+    uint64_t len;
+    int owned;
+    uint64_t base;
+    size_t avail;
+    net_stream_t *stream;
+} net_result_t;
+
+/**
+ * @brief returns whether an upload can be streamed: a NET_MSG_EQU request
+ * carrying an uncompressed .equ file
+ *
+ * @param req host order request header
+ * @param payload bytes following the net header
+ * @param len size of payload
+ * @return int 1 if net_answer may stream it, 0 otherwise
+ */
+int net_streamable(const struct net_header *req, const uint8_t *payload, size_t len);
+
+/**
+ * @brief equations an upload declares: a batch's count, or the numeq of an
+ * .equ header, read through the decompressor for a compressed file. A raw
+ * file is held to the equations it actually carries, a compressed one to
+ * NET_NUMEQ_MAX, since more than that is refused
+ *
+ * @param req host order request header
+ * @param payload bytes following the net header
+ * @param len size of payload
+ * @return uint64_t equations, 0 if the header could not be read
+ */
+uint64_t net_declared(const struct net_header *req, const uint8_t *payload, size_t len);
+
+/**
+ * @brief answers an upload from the result cache, or solves it and stores
+ * the solved file in the cache. Batches are always solved. With stream
+ * set, a streamable upload whose solved file does not fit in buf is
+ * answered as a stream whose first chunk is already in buf; the cache
+ * entry is then written as the stream advances
+ *
+ * @param cache result cache, NULL to always solve
+ * @param req host order request header, selects the message type
+ * @param payload bytes following the net header
+ * @param len size of payload
+ * @param buf caller buffer the answer is written to if it fits, NULL for
+ * none
+ * @param cap size of buf
+ * @param stream allow a streamed answer. payload and buf must then outlive
+ * the result
+ * @param result filled in, release with net_result_free
+ */
+void net_answer(netcache_t *cache, const struct net_header *req, const uint8_t *payload, size_t len,
+                uint8_t *buf, size_t cap, int stream, net_result_t *result);
+
+/**
+ * @brief solves the next chunk of a streamed answer into buf once the
+ * previous one has been sent. The cache entry is committed with the last
+ * chunk
+ *
+ * @param result streamed result with output left to produce
+ * @param buf buffer for the chunk, at least one solved equation long
+ * @param cap size of buf
+ * @return int 1 if a chunk was produced, 0 if nothing is left
+ */
+int net_result_next(net_result_t *result, uint8_t *buf, size_t cap);
+
+/**
+ * @brief frees a malloc'd solved buffer, closes the cached file of a
+ * result or ends its stream, discarding an unfinished cache entry
+ *
+ * @param result result to release
+ */
+void net_result_free(net_result_t *result);
+
+#endif
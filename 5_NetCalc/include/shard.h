@@ -0,0 +1,246 @@
+#ifndef _SHARD_H
+#define _SHARD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "nethdr.h"
+#include "netsolve.h"
+#include "admission.h"
+#include "slab.h"
+#include "../../4_ThreadCalc/include/threadpool.h"
+
+#define SHARD_MAX 256
+#define SHARD_INLINE_DEFAULT (64 * 1024)
+#define SHARD_READ_CHUNK (64 * 1024)
+#define SHARD_EVENTS 64
+#define SHARD_BLOCK_SIZE (16 * 1024)
+#define SHARD_SLAB_CONNS 256
+#define SHARD_SLAB_BLOCKS 64
+
+/**
+ * @brief a reply waiting to be written to a connection. The header and an
+ * in-memory answer go out together with writev; a cached answer follows
+ * the header with sendfile. Replies made on the shard thread are
+ * SHARD_BLOCK_SIZE slab blocks, and an answer that fits is written into
+ * data, the rest of the block, so small replies need no malloc. A larger
+ * raw upload is streamed: data holds one chunk of the answer at a time,
+ * solved when the previous chunk has gone out
+ *
+ * @param next next reply in the queue
+ * @param conn connection the reply belongs to, used on the completion list
+ * @param hdr reply header in network order
+ * @param hdrsz bytes of hdr to send
+ * @param result answer following the header
+ * @param off bytes of header and answer already sent
+ * @param admitted payload bytes admitted for the request, released when the
+ * reply is freed
+ * @param equations equations admitted for the request, released with
+ * admitted
+ * @param pooled the reply is a slab block rather than malloc'd by a pool
+ * worker
+ * @param payload upload a streamed answer is solved from, admitted bytes
+ * long. NULL unless streamed
+ * @param started stage_now when the first header byte of the request
+ * arrived, for the latency histogram
+ * @param resumes answers the legacy request its connection paused reading
+ * for
+ * @param data transmit buffer, only present in pooled replies
+ */
+typedef struct shard_reply_t
+{
+    struct shard_reply_t *next;
+    struct shard_conn_t *conn;
+    struct net_header hdr;
+    size_t hdrsz;
+    net_result_t result;
+    uint64_t off;
+    uint64_t admitted;
+    uint64_t equations;
+    int pooled;
+    uint8_t *payload;
+    uint64_t started;
+    int resumes;
+    uint8_t data[];
+} shard_reply_t;
+
+/**
+ * @brief where a connection is in reading its current request
+ *
+ * CONN_HEADER: collecting the 48-byte header and, for extended requests,
+ * the 16 bytes after it
+ * CONN_PAYLOAD: collecting the payload of a valid request
+ * CONN_SKIP: discarding the payload of a rejected request
+ */
+enum shard_conn_state
+{
+    CONN_HEADER = 0,
+    CONN_PAYLOAD,
+    CONN_SKIP
+};
+
+/**
+ * @brief a connection owned by one shard. Only the shard thread touches it;
+ * pool workers hand finished replies back through the shard's completion
+ * list. Reading is a resumable state machine, so a partial header or
+ * payload simply waits in the struct for the next readiness event. An idle
+ * connection holds no buffers. Connections come from the shard's slab and
+ * go back to it on close
+ *
+ * @param fd nonblocking connected socket
+ * @param addr client IPv4 address in network order
+ * @param state enum shard_conn_state
+ * @param req header being collected, host order once complete
+ * @param got bytes of the header or payload collected so far
+ * @param started stage_now when the first byte of the current request
+ * arrived
+ * @param payload payload being collected, NULL outside CONN_PAYLOAD. A slab
+ * block when len fits in one, malloc'd otherwise
+ * @param len size of payload
+ * @param equations equations the current request is admitted for
+ * @param skip payload bytes of a rejected request still to discard
+ * @param head first reply waiting to be sent
+ * @param tail last reply waiting to be sent
+ * @param inflight requests offloaded to the pool and not yet answered
+ * @param paused a legacy request was offloaded; legacy replies carry no
+ * request_id, so nothing more is read until its reply is queued
+ * @param held bytes received behind the paused request, malloc'd, NULL for
+ * none. They are fed in once the connection resumes
+ * @param heldlen size of held
+ * @param closing no more requests will be read; freed once inflight is 0
+ * and every reply is sent
+ * @param failed a send failed, replies still arriving are dropped
+ * @param events epoll events currently armed
+ * @param prev previous connection of the shard
+ * @param next next connection of the shard
+ */
+typedef struct shard_conn_t
+{
+    int fd;
+    uint32_t addr;
+    int state;
+    struct net_header req;
+    size_t got;
+    uint64_t started;
+    uint8_t *payload;
+    size_t len;
+    uint64_t equations;
+    uint64_t skip;
+    shard_reply_t *head;
+    shard_reply_t *tail;
+    uint32_t inflight;
+    int paused;
+    uint8_t *held;
+    size_t heldlen;
+    int closing;
+    int failed;
+    uint32_t events;
+    struct shard_conn_t *prev;
+    struct shard_conn_t *next;
+} shard_conn_t;
+
+/**
+ * @brief one event loop thread with its own SO_REUSEPORT listener. The
+ * kernel spreads incoming connections across the shards' listeners
+ *
+ * @param id shard number, also the core it is pinned to modulo online cpus
+ * @param listenfd this shard's listening socket
+ * @param epfd epoll instance
+ * @param eventfd signalled when pool workers finish a reply or on stop
+ * @param scratch receive buffer shared by the shard's connections. Bytes
+ * are moved out of it into connection state before the next recv
+ * @param thread event loop thread
+ * @param lock guards done
+ * @param done replies finished by pool workers, not yet queued on their
+ * connection
+ * @param conns open connections
+ * @param graveyard connections closed during the current batch of events,
+ * freed once the batch is handled
+ * @param pool threadpool large requests are offloaded to
+ * @param inline_max payloads up to this many bytes are solved on the shard
+ * @param cache result cache, NULL for none
+ * @param admission limits on in-flight work shared by every shard
+ * @param connslab recycled connection objects
+ * @param blocks recycled SHARD_BLOCK_SIZE buffers for payloads being
+ * collected and for replies
+ * @param draining set to stop accepting and close connections as they
+ * fall idle
+ * @param drained set by the shard once draining has closed every
+ * connection
+ * @param stop set to end the event loop
+ */
+typedef struct shard_t
+{
+    uint32_t id;
+    int listenfd;
+    int epfd;
+    int eventfd;
+    uint8_t *scratch;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    shard_reply_t *done;
+    shard_conn_t *conns;
+    shard_conn_t *graveyard;
+    threadpool_t *pool;
+    size_t inline_max;
+    netcache_t *cache;
+    admission_t *admission;
+    slab_t connslab;
+    slab_t blocks;
+    volatile int draining;
+    int drained;
+    volatile int stop;
+} shard_t;
+
+/**
+ * @brief opens the shard's SO_REUSEPORT listener and starts its event loop
+ * pinned to a core
+ *
+ * @param shard zeroed shard with id, pool, inline_max and admission set
+ * @param port port every shard listens on
+ * @return int 1 if successful, 0 on error
+ */
+int shard_start(shard_t *shard, uint16_t port);
+
+/**
+ * @brief starts a graceful drain. The shard stops accepting, answers the
+ * requests it has already begun reading and closes each connection once
+ * it is between requests with nothing left to send
+ *
+ * @param shard running shard
+ */
+void shard_drain(shard_t *shard);
+
+/**
+ * @brief whether a draining shard has closed all its connections
+ *
+ * @param shard draining shard
+ * @return int 1 once drained, 0 otherwise
+ */
+int shard_drained(shard_t *shard);
+
+/**
+ * @brief threadpool customfree for offloaded requests dropped at
+ * shutdown. Releases the request's admission and frees it
+ *
+ * @param voidp job posted by a shard
+ */
+void shard_drop_job(void *voidp);
+
+/**
+ * @brief stops the event loop and joins it. Connections stay open so
+ * replies still being solved by the pool have somewhere to go
+ *
+ * @param shard running shard
+ */
+void shard_stop(shard_t *shard);
+
+/**
+ * @brief closes the shard's connections and sockets and frees undelivered
+ * replies. Pool workers must be finished first
+ *
+ * @param shard stopped shard
+ */
+void shard_free(shard_t *shard);
+
+#endif
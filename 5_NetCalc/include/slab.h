@@ -0,0 +1,76 @@
+#ifndef _SLAB_H
+#define _SLAB_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief a free object, linked through its own first bytes
+ *
+ */
+typedef struct slab_free_t
+{
+    struct slab_free_t *next;
+} slab_free_t;
+
+/**
+ * @brief a block of objects allocated together
+ *
+ */
+typedef struct slab_chunk_t
+{
+    struct slab_chunk_t *next;
+    uint8_t data[];
+} slab_chunk_t;
+
+/**
+ * @brief fixed size objects carved from chunks and recycled through a free
+ * list. Memory is only returned when the slab is destroyed, so steady
+ * state allocation is a list pop. Not thread safe; each shard owns its
+ * slabs
+ *
+ * @param objsize size of each object, rounded up to 16 bytes
+ * @param perchunk objects allocated at a time when the free list is empty
+ * @param free recycled objects
+ * @param chunks every chunk allocated
+ * @param used objects handed out and not yet returned
+ */
+typedef struct slab_t
+{
+    size_t objsize;
+    size_t perchunk;
+    slab_free_t *free;
+    slab_chunk_t *chunks;
+    size_t used;
+} slab_t;
+
+/**
+ * @brief initializes an empty slab
+ *
+ * @param slab slab to initialize
+ * @param objsize size of each object
+ * @param perchunk objects per chunk
+ */
+void slab_init(slab_t *slab, size_t objsize, size_t perchunk);
+
+/**
+ * @brief takes an object, growing the slab by a chunk if none is free
+ *
+ * @param slab slab to take from
+ * @return void* uninitialized object, NULL if out of memory
+ */
+void *slab_get(slab_t *slab);
+
+/**
+ * @brief returns an object to the slab
+ *
+ */
+void slab_put(slab_t *slab, void *obj);
+
+/**
+ * @brief frees every chunk. Objects still handed out become invalid
+ *
+ */
+void slab_destroy(slab_t *slab);
+
+#endif
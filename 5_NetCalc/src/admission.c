@@ -0,0 +1,144 @@
+#include <string.h>
+#include <time.h>
+#include "../include/admission.h"
+#include "../../4_ThreadCalc/include/equation.h"
+
+/**
+ * @brief monotonic clock in nanoseconds
+ *
+ */
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void admission_init(admission_t *adm, uint64_t max_bytes, uint64_t max_equations, double rate, double burst)
+{
+    memset(adm, 0, sizeof(*adm));
+    adm->max_bytes = max_bytes;
+    adm->max_equations = max_equations;
+    adm->rate = rate > 0 ? rate : 0;
+    adm->burst = burst >= 1 ? burst : 1;
+    pthread_mutex_init(&adm->lock, NULL);
+}
+
+void admission_destroy(admission_t *adm)
+{
+    pthread_mutex_destroy(&adm->lock);
+}
+
+uint64_t admission_cost(uint64_t bytes)
+{
+    return bytes / sizeof(struct unsolved_equation) + 1;
+}
+
+/**
+ * @brief finds the client's bucket, claiming an empty slot or the least
+ * recently used one in its probe window. A claimed slot keeps the tokens
+ * of the client it was taken from. Called with adm->lock held
+ *
+ * @return admission_bucket_t* the client's bucket
+ */
+static admission_bucket_t *find_bucket(admission_t *adm, uint32_t addr, uint64_t now)
+{
+    uint32_t home = (addr * 2654435761U) >> (32 - ADMIT_BUCKET_BITS);
+    admission_bucket_t *victim = NULL;
+    for (uint32_t i = 0; i < ADMIT_PROBE; i++)
+    {
+        admission_bucket_t *bucket = &adm->buckets[(home + i) % ADMIT_BUCKETS];
+        if (bucket->addr == addr)
+        {
+            return bucket;
+        }
+        if (bucket->addr == 0)
+        {
+            bucket->addr = addr;
+            bucket->tokens = adm->burst;
+            bucket->last = now;
+            return bucket;
+        }
+        if (NULL == victim || bucket->last < victim->last)
+        {
+            victim = bucket;
+        }
+    }
+    victim->addr = addr;
+    return victim;
+}
+
+/**
+ * @brief takes a token from the client's bucket
+ *
+ * @return uint32_t 0 if a token was taken, otherwise milliseconds until
+ * the next one
+ */
+static uint32_t take_token(admission_t *adm, uint32_t addr)
+{
+    uint32_t retry_ms = 0;
+
+    pthread_mutex_lock(&adm->lock);
+    uint64_t now = now_ns();
+    admission_bucket_t *bucket = find_bucket(adm, addr, now);
+    bucket->tokens += (now - bucket->last) * adm->rate / 1e9;
+    if (bucket->tokens > adm->burst)
+    {
+        bucket->tokens = adm->burst;
+    }
+    bucket->last = now;
+    if (bucket->tokens >= 1)
+    {
+        bucket->tokens -= 1;
+    }
+    else
+    {
+        double wait_ms = (1 - bucket->tokens) * 1000 / adm->rate;
+        retry_ms = wait_ms < ADMIT_RETRY_MAX_MS ? (uint32_t)wait_ms + 1 : ADMIT_RETRY_MAX_MS;
+    }
+    pthread_mutex_unlock(&adm->lock);
+    return retry_ms;
+}
+
+int admission_acquire(admission_t *adm, uint32_t addr, uint64_t bytes, uint64_t equations, uint32_t *retry_ms)
+{
+    *retry_ms = 0;
+    if (adm->rate > 0)
+    {
+        *retry_ms = take_token(adm, addr);
+    }
+    if (*retry_ms == 0)
+    {
+        uint64_t inbytes = __atomic_add_fetch(&adm->inflight_bytes, bytes, __ATOMIC_RELAXED);
+        uint64_t inequations = __atomic_add_fetch(&adm->inflight_equations, equations, __ATOMIC_RELAXED);
+        int alone = inbytes == bytes && inequations == equations;
+        if (alone || (inbytes <= adm->max_bytes && inequations <= adm->max_equations))
+        {
+            return 1;
+        }
+        __atomic_sub_fetch(&adm->inflight_bytes, bytes, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&adm->inflight_equations, equations, __ATOMIC_RELAXED);
+        *retry_ms = ADMIT_RETRY_MS;
+    }
+    __atomic_add_fetch(&adm->rejected, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int admission_grow(admission_t *adm, uint64_t from, uint64_t to, uint32_t *retry_ms)
+{
+    uint64_t inequations = __atomic_add_fetch(&adm->inflight_equations, to - from, __ATOMIC_RELAXED);
+    if (inequations == to || inequations <= adm->max_equations)
+    {
+        return 1;
+    }
+    __atomic_sub_fetch(&adm->inflight_equations, to - from, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&adm->rejected, 1, __ATOMIC_RELAXED);
+    *retry_ms = ADMIT_RETRY_MS;
+    return 0;
+}
+
+void admission_release(admission_t *adm, uint64_t bytes, uint64_t equations)
+{
+    __atomic_sub_fetch(&adm->inflight_bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&adm->inflight_equations, equations, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "../include/histogram.h"
+
+histogram_t *histogram_create()
+{
+    histogram_t *hist = calloc(1, sizeof(histogram_t));
+    if (NULL == hist)
+    {
+        printf("Failed to allocate histogram!\n");
+        return NULL;
+    }
+    hist->min = UINT64_MAX;
+    return hist;
+}
+
+void histogram_free(histogram_t *hist)
+{
+    free(hist);
+}
+
+/**
+ * @brief sub bucket a value is counted in
+ *
+ */
+static size_t counts_index(uint64_t value)
+{
+    int bucket = (64 - __builtin_clzll(value | HIST_SUB_MASK)) - (HIST_SUB_MAGNITUDE + 1);
+    uint64_t sub = value >> bucket;
+    return ((size_t)(bucket + 1) << HIST_SUB_MAGNITUDE) + (sub - HIST_SUB_HALF);
+}
+
+/**
+ * @brief largest value counted in a sub bucket
+ *
+ */
+static uint64_t highest_equivalent(size_t index)
+{
+    int bucket = (int)(index >> HIST_SUB_MAGNITUDE) - 1;
+    uint64_t sub = (index & (HIST_SUB_HALF - 1)) + HIST_SUB_HALF;
+    if (bucket < 0)
+    {
+        bucket = 0;
+        sub -= HIST_SUB_HALF;
+    }
+    return (sub << bucket) + ((1ULL << bucket) - 1);
+}
+
+void histogram_record(histogram_t *hist, uint64_t value)
+{
+    if (value > HIST_MAX_VALUE)
+    {
+        value = HIST_MAX_VALUE;
+    }
+    hist->counts[counts_index(value)]++;
+    hist->total++;
+    hist->sum += value;
+    if (value < hist->min)
+    {
+        hist->min = value;
+    }
+    if (value > hist->max)
+    {
+        hist->max = value;
+    }
+}
+
+void histogram_merge(histogram_t *dst, const histogram_t *src)
+{
+    for (size_t i = 0; i < HIST_COUNTS; i++)
+    {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->total += src->total;
+    dst->sum += src->sum;
+    if (src->min < dst->min)
+    {
+        dst->min = src->min;
+    }
+    if (src->max > dst->max)
+    {
+        dst->max = src->max;
+    }
+}
+
+uint64_t histogram_percentile(const histogram_t *hist, double percentile)
+{
+    if (hist->total == 0)
+    {
+        return 0;
+    }
+    uint64_t target = (uint64_t)ceil(percentile / 100.0 * hist->total);
+    if (target < 1)
+    {
+        target = 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HIST_COUNTS; i++)
+    {
+        seen += hist->counts[i];
+        if (seen >= target)
+        {
+            uint64_t value = highest_equivalent(i);
+            return value < hist->max ? value : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+double histogram_mean(const histogram_t *hist)
+{
+    return hist->total > 0 ? hist->sum / hist->total : 0;
+}
@@ -0,0 +1,898 @@
+#define _GNU_SOURCE
+#include "../include/common.h"
+#include "../include/nethdr.h"
+#include "../include/netsock.h"
+#include "../include/histogram.h"
+#include "../../4_ThreadCalc/include/equation.h"
+#include <endian.h>
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+
+#define LOADGEN_PAYLOADS 64
+#define LOADGEN_EVENTS 64
+#define LOADGEN_READ_CHUNK (64 * 1024)
+#define LOADGEN_TICK_NS 100000
+#define LOADGEN_BACKLOG (1 << 20)
+#define LOADGEN_DRAIN_NS (5 * 1000000000ULL)
+
+/**
+ * @brief how payload sizes are drawn, in equations
+ *
+ */
+enum size_dist
+{
+    DIST_FIXED = 0,
+    DIST_UNIFORM,
+    DIST_EXP
+};
+
+/**
+ * @brief a prebuilt request. Only the request id in the header changes
+ * between sends
+ *
+ * @param hdr network order extended header
+ * @param payload bytes following the header
+ * @param len size of payload
+ * @param numeq equations in the payload
+ */
+typedef struct payload_t
+{
+    struct net_header hdr;
+    uint8_t *payload;
+    size_t len;
+    uint64_t numeq;
+} payload_t;
+
+/**
+ * @brief one request in flight on a connection
+ *
+ * @param hdr header sent for it, carrying the slot as request id
+ * @param payload prebuilt request it sends
+ * @param start when the request was due, in nanoseconds
+ * @param next next free slot, or next slot waiting to be sent
+ */
+typedef struct slot_t
+{
+    struct net_header hdr;
+    const payload_t *payload;
+    uint64_t start;
+    int next;
+} slot_t;
+
+/**
+ * @brief a connection driven by a worker's event loop
+ *
+ * @param fd nonblocking connected socket
+ * @param slots depth request slots, indexed by request id
+ * @param free first free slot, -1 if every slot is in flight
+ * @param sendq first slot waiting to be sent
+ * @param sendtail last slot waiting to be sent
+ * @param sent bytes of the head of sendq already sent
+ * @param inflight requests sent or queued and not yet answered
+ * @param rhdr reply header being received
+ * @param rgot bytes of rhdr received
+ * @param rskip reply payload bytes still to discard
+ * @param events epoll events armed
+ * @param dead the connection failed and is no longer used
+ */
+typedef struct conn_t
+{
+    int fd;
+    slot_t *slots;
+    int free;
+    int sendq;
+    int sendtail;
+    size_t sent;
+    uint32_t inflight;
+    struct net_header rhdr;
+    size_t rgot;
+    uint64_t rskip;
+    uint32_t events;
+    int dead;
+} conn_t;
+
+/**
+ * @brief one load generating thread and the connections it drives
+ *
+ * @param id worker number, seeds its random payload choice
+ * @param thread the worker thread
+ * @param conns connections of this worker
+ * @param conncount number of conns
+ * @param hist latency of answered requests in nanoseconds
+ * @param rng xorshift state
+ * @param backlog open loop: due times of requests waiting for a free slot
+ * @param head first entry of backlog
+ * @param count entries in backlog
+ * @param issued requests started
+ * @param completed requests answered with NET_STATUS_OK
+ * @param busy requests answered with NET_STATUS_BUSY
+ * @param errors requests answered with another status or lost with their
+ * connection
+ * @param dropped open loop requests that found the backlog full
+ * @param equations equations in the answered requests
+ * @param bytes_out request bytes sent
+ * @param bytes_in reply bytes received
+ * @param last when the last reply arrived
+ */
+typedef struct worker_t
+{
+    uint32_t id;
+    pthread_t thread;
+    conn_t *conns;
+    uint32_t conncount;
+    histogram_t *hist;
+    uint64_t rng;
+    uint64_t *backlog;
+    size_t head;
+    size_t count;
+    uint64_t issued;
+    uint64_t completed;
+    uint64_t busy;
+    uint64_t errors;
+    uint64_t dropped;
+    uint64_t equations;
+    uint64_t bytes_out;
+    uint64_t bytes_in;
+    uint64_t last;
+} worker_t;
+
+char *server = "127.0.0.1";
+uint16_t port = NET_PORT;
+uint32_t conncount = 16;
+uint32_t workercount = 1;
+uint32_t depth = 8;
+double duration = 10;
+uint64_t requests = 0;
+double rate = 0;
+int kind = NET_MSG_EQU;
+int dist = DIST_FIXED;
+double dist_a = 1000;
+double dist_b = 0;
+
+payload_t payloads[LOADGEN_PAYLOADS];
+uint64_t start_ns;
+uint64_t end_ns;
+uint64_t issued_total = 0;
+
+/**
+ * @brief print usage statement
+ *
+ */
+void print_usage()
+{
+    printf("\n\nUsage: ./netcalc_loadgen (optional -s <server>) (optional -p <port>)"
+           "\n\t(optional -c <connections>) (optional -T <threads>) (optional -d <pipeline depth>)"
+           "\n\t(optional -t <seconds>) (optional -N <requests>) stop after either, -N 0 for time only"
+           "\n\t(optional -R <requests per second>) open loop at this rate, closed loop if unset"
+           "\n\t(optional -z fixed:<n> | uniform:<min>:<max> | exp:<mean>) equations per request"
+           "\n\t(optional -k equ | batch) send .equ files or raw equation batches\n\n");
+}
+
+/**
+ * @brief monotonic clock in nanoseconds
+ *
+ */
+uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief xorshift64 random numbers
+ *
+ */
+uint64_t next_random(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+/**
+ * @brief draws a payload size in equations from the -z distribution
+ *
+ */
+uint64_t draw_size(uint64_t *rng)
+{
+    double uniform = (next_random(rng) >> 11) * (1.0 / 9007199254740992.0);
+    double size = dist_a;
+    if (dist == DIST_UNIFORM)
+    {
+        size = dist_a + uniform * (dist_b - dist_a + 1);
+    }
+    else if (dist == DIST_EXP)
+    {
+        size = -log(1 - uniform) * dist_a;
+    }
+    uint64_t numeq = size < 1 ? 1 : (uint64_t)size;
+    if (kind == NET_MSG_BATCH && numeq > NET_BATCH_MAX)
+    {
+        numeq = NET_BATCH_MAX;
+    }
+    return numeq;
+}
+
+/**
+ * @brief parses the -z argument
+ *
+ * @return int 1 if valid, 0 otherwise
+ */
+int parse_dist(const char *arg)
+{
+    if (sscanf(arg, "fixed:%lf", &dist_a) == 1)
+    {
+        dist = DIST_FIXED;
+    }
+    else if (sscanf(arg, "uniform:%lf:%lf", &dist_a, &dist_b) == 2 && dist_b >= dist_a)
+    {
+        dist = DIST_UNIFORM;
+    }
+    else if (sscanf(arg, "exp:%lf", &dist_a) == 1)
+    {
+        dist = DIST_EXP;
+    }
+    else
+    {
+        return 0;
+    }
+    return dist_a >= 1;
+}
+
+/**
+ * @brief draws one random equation with operands the solver accepts: a
+ * nonzero divisor and shift counts below 64
+ *
+ */
+void random_equation(uint64_t *rng, struct net_batch_equation *equ)
+{
+    uint8_t operatr = next_random(rng) % 12 + 1;
+    uint64_t operand2 = (next_random(rng) >> (next_random(rng) % 64)) | 1;
+    if (operatr == 6 || operatr == 7 || operatr == 11 || operatr == 12)
+    {
+        operand2 %= 64;
+    }
+    equ->operatr = operatr;
+    equ->operand1 = htole64(next_random(rng) >> (next_random(rng) % 64));
+    equ->operand2 = htole64(operand2);
+}
+
+/**
+ * @brief builds the payload pool, LOADGEN_PAYLOADS requests with sizes
+ * from the -z distribution
+ *
+ * @return int 1 if successful, 0 if out of memory
+ */
+int build_payloads()
+{
+    uint64_t rng = 0x9e3779b97f4a7c15ULL;
+    for (int i = 0; i < LOADGEN_PAYLOADS; i++)
+    {
+        payload_t *pl = &payloads[i];
+        char name[NET_NAME_FIELD_SZ];
+        pl->numeq = draw_size(&rng);
+        if (kind == NET_MSG_BATCH)
+        {
+            pl->len = sizeof(uint32_t) + pl->numeq * sizeof(struct net_batch_equation);
+        }
+        else
+        {
+            pl->len = sizeof(struct header) + pl->numeq * sizeof(struct unsolved_equation);
+        }
+        pl->payload = calloc(1, pl->len);
+        if (NULL == pl->payload)
+        {
+            printf("Failed to allocate payloads!\n");
+            return 0;
+        }
+
+        if (kind == NET_MSG_BATCH)
+        {
+            uint32_t count = htole32(pl->numeq);
+            struct net_batch_equation *bequ = (struct net_batch_equation *)(pl->payload + sizeof(count));
+            memcpy(pl->payload, &count, sizeof(count));
+            for (uint64_t j = 0; j < pl->numeq; j++)
+            {
+                random_equation(&rng, &bequ[j]);
+                bequ[j].eqid = htole32(j);
+            }
+        }
+        else
+        {
+            struct header *hdr = (struct header *)pl->payload;
+            struct unsolved_equation *uequ = (struct unsolved_equation *)(pl->payload + sizeof(*hdr));
+            hdr->magic = htole32(EQU_MAGIC);
+            hdr->fileid = htole64(i);
+            hdr->numeq = htole64(pl->numeq);
+            hdr->offset = htole32(sizeof(*hdr));
+            for (uint64_t j = 0; j < pl->numeq; j++)
+            {
+                struct net_batch_equation equ;
+                random_equation(&rng, &equ);
+                uequ[j].eqid = htole32(j);
+                uequ[j].operatr = equ.operatr;
+                uequ[j].operand1 = equ.operand1;
+                uequ[j].operand2 = equ.operand2;
+            }
+        }
+
+        int namelen = snprintf(name, sizeof(name), "loadgen_%d.equ", i);
+        memset(&pl->hdr, 0, sizeof(pl->hdr));
+        pl->hdr.hdr_len = htobe32(NET_HDR_EXT_SZ);
+        pl->hdr.filename_len = htobe32(namelen);
+        pl->hdr.pkt_len = htobe64(NET_HDR_EXT_SZ + pl->len);
+        memcpy(pl->hdr.filename, name, namelen);
+        pl->hdr.msgtype = htobe16(kind);
+    }
+    return 1;
+}
+
+/**
+ * @brief claims the next request of the run, so -N is shared by workers
+ *
+ * @return int 1 if a request may be started
+ */
+int claim_request()
+{
+    if (requests == 0)
+    {
+        return 1;
+    }
+    return __atomic_add_fetch(&issued_total, 1, __ATOMIC_RELAXED) <= requests;
+}
+
+/**
+ * @brief arms the epoll events a connection needs
+ *
+ */
+void conn_arm(int epfd, conn_t *conn)
+{
+    uint32_t events = EPOLLIN | (conn->sendq >= 0 ? EPOLLOUT : 0);
+    if (events != conn->events && !conn->dead)
+    {
+        struct epoll_event ev = {.events = events, .data.ptr = conn};
+        epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+        conn->events = events;
+    }
+}
+
+/**
+ * @brief queues a request on a free slot of a connection
+ *
+ * @param start when the request was due
+ */
+void conn_start(worker_t *worker, conn_t *conn, uint64_t start)
+{
+    int id = conn->free;
+    slot_t *slot = &conn->slots[id];
+    conn->free = slot->next;
+    slot->payload = &payloads[next_random(&worker->rng) % LOADGEN_PAYLOADS];
+    slot->hdr = slot->payload->hdr;
+    slot->hdr.request_id = htobe64(id);
+    slot->start = start;
+    slot->next = -1;
+    if (conn->sendq < 0)
+    {
+        conn->sendq = id;
+    }
+    else
+    {
+        conn->slots[conn->sendtail].next = id;
+    }
+    conn->sendtail = id;
+    conn->inflight++;
+    worker->issued++;
+}
+
+/**
+ * @brief sends queued requests until the socket would block
+ *
+ */
+void conn_send(worker_t *worker, conn_t *conn)
+{
+    while (conn->sendq >= 0)
+    {
+        slot_t *slot = &conn->slots[conn->sendq];
+        struct iovec iov[2];
+        iov[0].iov_base = &slot->hdr;
+        iov[0].iov_len = NET_HDR_EXT_SZ;
+        iov[1].iov_base = slot->payload->payload;
+        iov[1].iov_len = slot->payload->len;
+        int first = iov_advance(iov, 2, conn->sent);
+        ssize_t rv = writev(conn->fd, iov + first, 2 - first);
+        if (rv < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        {
+            return;
+        }
+        if (rv <= 0)
+        {
+            conn->dead = 1;
+            return;
+        }
+        worker->bytes_out += rv;
+        conn->sent += rv;
+        if (conn->sent == NET_HDR_EXT_SZ + slot->payload->len)
+        {
+            conn->sent = 0;
+            conn->sendq = slot->next;
+            slot->next = -1;
+        }
+    }
+}
+
+/**
+ * @brief records an answered request and frees its slot
+ *
+ */
+void conn_answered(worker_t *worker, conn_t *conn)
+{
+    uint64_t id = be64toh(conn->rhdr.request_id);
+    uint32_t status = be32toh(conn->rhdr.status);
+    if (id >= depth)
+    {
+        conn->dead = 1;
+        return;
+    }
+    slot_t *slot = &conn->slots[id];
+    uint64_t now = now_ns();
+    if (status == NET_STATUS_OK)
+    {
+        histogram_record(worker->hist, now - slot->start);
+        worker->completed++;
+        worker->equations += slot->payload->numeq;
+    }
+    else if (status == NET_STATUS_BUSY)
+    {
+        worker->busy++;
+    }
+    else
+    {
+        worker->errors++;
+    }
+    worker->last = now;
+    slot->next = conn->free;
+    conn->free = id;
+    conn->inflight--;
+}
+
+/**
+ * @brief reads replies, keeping only their headers
+ *
+ */
+void conn_recv(worker_t *worker, conn_t *conn, uint8_t *scratch)
+{
+    ssize_t rv = recv(conn->fd, scratch, LOADGEN_READ_CHUNK, 0);
+    if (rv < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    {
+        return;
+    }
+    if (rv <= 0)
+    {
+        conn->dead = 1;
+        return;
+    }
+    worker->bytes_in += rv;
+    size_t pos = 0;
+    while (pos < (size_t)rv && !conn->dead)
+    {
+        size_t take;
+        if (conn->rskip > 0)
+        {
+            take = conn->rskip < rv - pos ? conn->rskip : rv - pos;
+            conn->rskip -= take;
+            pos += take;
+            if (conn->rskip == 0)
+            {
+                conn_answered(worker, conn);
+            }
+            continue;
+        }
+        take = NET_HDR_EXT_SZ - conn->rgot;
+        take = take < rv - pos ? take : rv - pos;
+        memcpy((uint8_t *)&conn->rhdr + conn->rgot, scratch + pos, take);
+        conn->rgot += take;
+        pos += take;
+        if (conn->rgot == NET_HDR_EXT_SZ)
+        {
+            conn->rgot = 0;
+            conn->rskip = be64toh(conn->rhdr.pkt_len) - NET_HDR_EXT_SZ;
+            if (conn->rskip == 0)
+            {
+                conn_answered(worker, conn);
+            }
+        }
+    }
+}
+
+/**
+ * @brief starts requests on connections with free slots. Closed loop keeps
+ * every slot busy; open loop starts the requests that came due
+ *
+ * @param running new requests may still be started
+ */
+void dispatch(worker_t *worker, int epfd, int running)
+{
+    for (uint32_t i = 0; i < worker->conncount; i++)
+    {
+        conn_t *conn = &worker->conns[i];
+        while (!conn->dead && conn->free >= 0 && running)
+        {
+            uint64_t start;
+            if (rate > 0)
+            {
+                if (worker->count == 0)
+                {
+                    break;
+                }
+                start = worker->backlog[worker->head];
+                worker->head = (worker->head + 1) % LOADGEN_BACKLOG;
+                worker->count--;
+            }
+            else if (claim_request())
+            {
+                start = now_ns();
+            }
+            else
+            {
+                break;
+            }
+            conn_start(worker, conn, start);
+        }
+        if (!conn->dead)
+        {
+            conn_send(worker, conn);
+            conn_arm(epfd, conn);
+        }
+    }
+}
+
+/**
+ * @brief open loop: adds the requests that came due to the backlog. Their
+ * latency is measured from when they were due, not when a slot freed up
+ *
+ * @param next when the next request is due, advanced past now
+ * @param interval nanoseconds between requests of this worker
+ */
+void schedule(worker_t *worker, uint64_t now, double *next, double interval)
+{
+    while (*next <= now && *next < end_ns)
+    {
+        if (worker->count < LOADGEN_BACKLOG && claim_request())
+        {
+            worker->backlog[(worker->head + worker->count) % LOADGEN_BACKLOG] = (uint64_t)*next;
+            worker->count++;
+        }
+        else
+        {
+            worker->dropped++;
+        }
+        *next += interval;
+    }
+}
+
+/**
+ * @brief event loop of one worker. Runs until the test ends and in-flight
+ * requests drain
+ *
+ * @param voidp the worker_t to run
+ */
+void *worker_function(void *voidp)
+{
+    worker_t *worker = voidp;
+    struct epoll_event events[LOADGEN_EVENTS];
+    uint8_t *scratch = malloc(LOADGEN_READ_CHUNK);
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (NULL == scratch || epfd < 0 || tfd < 0)
+    {
+        printf("Failed to start worker %u!\n", worker->id);
+        free(scratch);
+        return NULL;
+    }
+
+    // open loop wakes every tick to start the requests that came due
+    struct itimerspec tick = {.it_interval = {0, LOADGEN_TICK_NS}, .it_value = {0, LOADGEN_TICK_NS}};
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+    if (rate > 0)
+    {
+        timerfd_settime(tfd, 0, &tick, NULL);
+        epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev);
+    }
+    for (uint32_t i = 0; i < worker->conncount; i++)
+    {
+        conn_t *conn = &worker->conns[i];
+        ev.events = EPOLLIN;
+        ev.data.ptr = conn;
+        conn->events = EPOLLIN;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, conn->fd, &ev);
+    }
+
+    double interval = rate > 0 ? 1e9 * workercount / rate : 0;
+    double next = start_ns + interval * worker->id / workercount;
+    uint64_t inflight = 0;
+    int running = 1;
+    dispatch(worker, epfd, running);
+    for (;;)
+    {
+        uint64_t now = now_ns();
+        running = now < end_ns && (requests == 0 || issued_total < requests || worker->count > 0);
+        if (rate > 0 && running)
+        {
+            schedule(worker, now, &next, interval);
+        }
+        inflight = 0;
+        for (uint32_t i = 0; i < worker->conncount; i++)
+        {
+            inflight += worker->conns[i].dead ? 0 : worker->conns[i].inflight;
+        }
+        if (!running && (inflight == 0 || now > end_ns + LOADGEN_DRAIN_NS))
+        {
+            break;
+        }
+        dispatch(worker, epfd, running);
+
+        int n = epoll_wait(epfd, events, LOADGEN_EVENTS, 100);
+        for (int i = 0; i < n; i++)
+        {
+            conn_t *conn = events[i].data.ptr;
+            if (NULL == conn)
+            {
+                uint64_t expirations;
+                while (read(tfd, &expirations, sizeof(expirations)) > 0)
+                {
+                }
+                continue;
+            }
+            if (conn->dead)
+            {
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            {
+                conn_recv(worker, conn, scratch);
+            }
+            if (events[i].events & EPOLLOUT)
+            {
+                conn_send(worker, conn);
+            }
+            if (conn->dead)
+            {
+                printf("Connection lost with %u requests in flight!\n", conn->inflight);
+                worker->errors += conn->inflight;
+                conn->inflight = 0;
+                epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+            }
+        }
+    }
+    worker->errors += inflight;
+
+    close(tfd);
+    close(epfd);
+    free(scratch);
+    return NULL;
+}
+
+/**
+ * @brief connects a worker's connections and allocates their slots
+ *
+ * @return int 1 if successful, 0 on error
+ */
+int worker_init(worker_t *worker, uint32_t id, uint32_t conns)
+{
+    worker->id = id;
+    worker->rng = 0x2545f4914f6cdd1dULL * (id + 1);
+    worker->conncount = conns;
+    worker->conns = calloc(conns, sizeof(conn_t));
+    worker->hist = histogram_create();
+    worker->backlog = rate > 0 ? malloc(LOADGEN_BACKLOG * sizeof(uint64_t)) : NULL;
+    if (NULL == worker->conns || NULL == worker->hist || (rate > 0 && NULL == worker->backlog))
+    {
+        return 0;
+    }
+    for (uint32_t i = 0; i < conns; i++)
+    {
+        conn_t *conn = &worker->conns[i];
+        conn->fd = -1;
+        conn->slots = calloc(depth, sizeof(slot_t));
+        if (NULL == conn->slots)
+        {
+            return 0;
+        }
+        for (uint32_t j = 0; j < depth; j++)
+        {
+            conn->slots[j].next = j + 1 < depth ? (int)j + 1 : -1;
+        }
+        conn->free = 0;
+        conn->sendq = -1;
+        conn->fd = net_connect(server, port);
+        if (conn->fd < 0)
+        {
+            printf("Could not connect to %s:%u!\n", server, port);
+            return 0;
+        }
+        fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) | O_NONBLOCK);
+    }
+    return 1;
+}
+
+/**
+ * @brief closes a worker's connections and frees it
+ *
+ */
+void worker_free(worker_t *worker)
+{
+    for (uint32_t i = 0; NULL != worker->conns && i < worker->conncount; i++)
+    {
+        if (worker->conns[i].fd >= 0)
+        {
+            close(worker->conns[i].fd);
+        }
+        free(worker->conns[i].slots);
+    }
+    free(worker->conns);
+    free(worker->backlog);
+    histogram_free(worker->hist);
+}
+
+/**
+ * @brief prints throughput and the latency distribution of a run
+ *
+ */
+void report(worker_t *workers, histogram_t *hist)
+{
+    worker_t sum = {0};
+    for (uint32_t i = 0; i < workercount; i++)
+    {
+        sum.issued += workers[i].issued;
+        sum.completed += workers[i].completed;
+        sum.busy += workers[i].busy;
+        sum.errors += workers[i].errors;
+        sum.dropped += workers[i].dropped;
+        sum.equations += workers[i].equations;
+        sum.bytes_out += workers[i].bytes_out;
+        sum.bytes_in += workers[i].bytes_in;
+        sum.last = workers[i].last > sum.last ? workers[i].last : sum.last;
+        histogram_merge(hist, workers[i].hist);
+    }
+    double seconds = sum.last > start_ns ? (sum.last - start_ns) / 1e9 : 0;
+    if (seconds <= 0)
+    {
+        seconds = 1e-9;
+    }
+
+    printf("%s loop, %u connections, %u threads, depth %u, %s requests\n", rate > 0 ? "Open" : "Closed",
+           conncount, workercount, depth, kind == NET_MSG_BATCH ? "batch" : "equ");
+    printf("Requests:   %lu issued, %lu ok, %lu busy, %lu errors, %lu dropped\n", (unsigned long)sum.issued,
+           (unsigned long)sum.completed, (unsigned long)sum.busy, (unsigned long)sum.errors,
+           (unsigned long)sum.dropped);
+    printf("Throughput: %.1f requests/s, %.1f equations/s, %.2f MB/s out, %.2f MB/s in over %.3f s\n",
+           sum.completed / seconds, sum.equations / seconds, sum.bytes_out / seconds / 1e6,
+           sum.bytes_in / seconds / 1e6, seconds);
+    printf("Latency us: min %.1f mean %.1f p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f p99.99 %.1f max %.1f\n",
+           hist->total > 0 ? hist->min / 1e3 : 0, histogram_mean(hist) / 1e3, histogram_percentile(hist, 50) / 1e3,
+           histogram_percentile(hist, 90) / 1e3, histogram_percentile(hist, 99) / 1e3,
+           histogram_percentile(hist, 99.9) / 1e3, histogram_percentile(hist, 99.99) / 1e3, hist->max / 1e3);
+}
+
+/**
+ * @brief netcalc_loadgen drives a NetCalc server with pipelined requests
+ * over many connections and reports throughput and an HDR histogram of
+ * latencies
+ *
+ * @param argc arg count
+ * @param argv see print_usage
+ * @return int 0 if every request was answered, 1 otherwise
+ */
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "s:p:c:T:d:t:N:R:z:k:")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            server = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'c':
+            conncount = strtoul(optarg, NULL, 10);
+            break;
+        case 'T':
+            workercount = strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            depth = strtoul(optarg, NULL, 10);
+            break;
+        case 't':
+            duration = strtod(optarg, NULL);
+            break;
+        case 'N':
+            requests = strtoull(optarg, NULL, 10);
+            break;
+        case 'R':
+            rate = strtod(optarg, NULL);
+            break;
+        case 'z':
+            if (!parse_dist(optarg))
+            {
+                print_usage();
+                return 1;
+            }
+            break;
+        case 'k':
+            if (strcmp(optarg, "batch") == 0)
+            {
+                kind = NET_MSG_BATCH;
+            }
+            else if (strcmp(optarg, "equ") != 0)
+            {
+                print_usage();
+                return 1;
+            }
+            break;
+        default:
+            print_usage();
+            return 1;
+        }
+    }
+    if (conncount < 1 || workercount < 1 || depth < 1 || duration <= 0)
+    {
+        print_usage();
+        return 1;
+    }
+    if (workercount > conncount)
+    {
+        workercount = conncount;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    worker_t *workers = calloc(workercount, sizeof(worker_t));
+    histogram_t *hist = histogram_create();
+    int success = NULL != workers && NULL != hist && build_payloads();
+    for (uint32_t i = 0; success && i < workercount; i++)
+    {
+        uint32_t conns = conncount / workercount + (i < conncount % workercount ? 1 : 0);
+        success = worker_init(&workers[i], i, conns);
+    }
+
+    if (success)
+    {
+        start_ns = now_ns();
+        end_ns = start_ns + (uint64_t)(duration * 1e9);
+        for (uint32_t i = 0; i < workercount; i++)
+        {
+            pthread_create(&workers[i].thread, NULL, worker_function, &workers[i]);
+        }
+        for (uint32_t i = 0; i < workercount; i++)
+        {
+            pthread_join(workers[i].thread, NULL);
+        }
+        report(workers, hist);
+    }
+
+    int rv = success ? 0 : 1;
+    for (uint32_t i = 0; NULL != workers && i < workercount; i++)
+    {
+        rv |= workers[i].errors > 0;
+        worker_free(&workers[i]);
+    }
+    for (int i = 0; i < LOADGEN_PAYLOADS; i++)
+    {
+        free(payloads[i].payload);
+    }
+    free(workers);
+    histogram_free(hist);
+    return rv;
+}
@@ -0,0 +1,432 @@
+#define _GNU_SOURCE
+#include "../include/common.h"
+#include "../include/metrics.h"
+#include "../include/nethdr.h"
+#include "../include/netsock.h"
+#include "../../4_ThreadCalc/include/stagestats.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+
+static const char *msgtype_names[METRICS_MSGTYPES] = {"equ", "batch", "unknown"};
+static const char *opcode_names[METRICS_OPCODES] = {"invalid", "add", "sub", "mul", "div", "mod", "shl",
+                                                    "shr", "and", "or", "xor", "rol", "ror"};
+static const char *error_names[METRIC_ERR_COUNT] = {"badhdr", "badequ", "busy", "recv", "send", "nomem"};
+
+// upper bounds of the latency buckets, in nanoseconds and as exported
+static const uint64_t bucket_ns[METRICS_BUCKETS] = {
+    100000ull, 250000ull, 500000ull, 1000000ull, 2500000ull, 5000000ull, 10000000ull, 25000000ull,
+    50000000ull, 100000000ull, 250000000ull, 500000000ull, 1000000000ull, 2500000000ull, 5000000000ull,
+    10000000000ull};
+static const char *bucket_names[METRICS_BUCKETS] = {"0.0001", "0.00025", "0.0005", "0.001", "0.0025", "0.005",
+                                                    "0.01", "0.025", "0.05", "0.1", "0.25", "0.5",
+                                                    "1", "2.5", "5", "10"};
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t registry_once = PTHREAD_ONCE_INIT;
+static pthread_key_t registry_key;
+static metrics_thread_t *registry = NULL;
+static metrics_thread_t **registry_tail = &registry;
+static __thread metrics_thread_t *mine = NULL;
+
+/**
+ * @brief pthread key destructor. Leaves an exiting thread's counters for
+ * the next thread to register
+ *
+ */
+static void release_thread(void *voidp)
+{
+    metrics_thread_t *thread = voidp;
+    __atomic_store_n(&thread->owned, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief creates the key whose destructor releases counters
+ *
+ */
+static void create_key(void)
+{
+    pthread_key_create(&registry_key, release_thread);
+}
+
+/**
+ * @brief the calling thread's counters, registered on first use. Counters
+ * an exited thread left behind are reused before new ones are allocated
+ *
+ * @return metrics_thread_t* counters, NULL if out of memory
+ */
+static metrics_thread_t *metrics_thread(void)
+{
+    if (NULL == mine)
+    {
+        pthread_once(&registry_once, create_key);
+        pthread_mutex_lock(&registry_lock);
+        metrics_thread_t *thread = registry;
+        while (NULL != thread && __atomic_load_n(&thread->owned, __ATOMIC_ACQUIRE))
+        {
+            thread = thread->next;
+        }
+        if (NULL == thread)
+        {
+            thread = calloc(1, sizeof(metrics_thread_t));
+            if (NULL == thread)
+            {
+                pthread_mutex_unlock(&registry_lock);
+                return NULL;
+            }
+            *registry_tail = thread;
+            registry_tail = &thread->next;
+        }
+        thread->owned = 1;
+        pthread_mutex_unlock(&registry_lock);
+        pthread_setspecific(registry_key, thread);
+        mine = thread;
+    }
+    return mine;
+}
+
+/**
+ * @brief adds to a counter of the calling thread's
+ *
+ */
+static inline void add(uint64_t *counter, uint64_t n)
+{
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+void metrics_count(int counter, uint64_t n)
+{
+    metrics_thread_t *thread = metrics_thread();
+    if (NULL != thread)
+    {
+        add(&thread->counters[counter], n);
+    }
+}
+
+void metrics_error(int error)
+{
+    metrics_thread_t *thread = metrics_thread();
+    if (NULL != thread)
+    {
+        add(&thread->errors[error], 1);
+    }
+}
+
+void metrics_reply(uint32_t msgtype, uint32_t status)
+{
+    metrics_thread_t *thread = metrics_thread();
+    if (NULL == thread)
+    {
+        return;
+    }
+    add(&thread->requests[msgtype < METRICS_MSGTYPES - 1 ? msgtype : METRICS_MSGTYPES - 1], 1);
+    if (status == NET_STATUS_BADHDR)
+    {
+        add(&thread->errors[METRIC_ERR_BADHDR], 1);
+    }
+    else if (status == NET_STATUS_BADEQU)
+    {
+        add(&thread->errors[METRIC_ERR_BADEQU], 1);
+    }
+    else if (status == NET_STATUS_BUSY)
+    {
+        add(&thread->errors[METRIC_ERR_BUSY], 1);
+    }
+}
+
+void metrics_equations(const struct unsolved_equation *uequ, size_t count)
+{
+    metrics_thread_t *thread = metrics_thread();
+    if (NULL == thread)
+    {
+        return;
+    }
+    // tallied locally so each counter is stored once per batch
+    uint64_t tally[METRICS_OPCODES] = {0};
+    for (size_t i = 0; i < count; i++)
+    {
+        tally[uequ[i].operatr < METRICS_OPCODES ? uequ[i].operatr : 0]++;
+    }
+    for (int op = 0; op < METRICS_OPCODES; op++)
+    {
+        if (tally[op] > 0)
+        {
+            add(&thread->equations[op], tally[op]);
+        }
+    }
+}
+
+void metrics_latency(uint64_t ns)
+{
+    metrics_thread_t *thread = metrics_thread();
+    if (NULL == thread)
+    {
+        return;
+    }
+    int bucket = 0;
+    while (bucket < METRICS_BUCKETS && ns > bucket_ns[bucket])
+    {
+        bucket++;
+    }
+    add(&thread->latency[bucket], 1);
+    add(&thread->latency_ns, ns);
+}
+
+/**
+ * @brief sums every registered thread's counters
+ *
+ */
+static void metrics_sum(metrics_thread_t *total)
+{
+    memset(total, 0, sizeof(*total));
+    pthread_mutex_lock(&registry_lock);
+    for (metrics_thread_t *thread = registry; NULL != thread; thread = thread->next)
+    {
+        for (int i = 0; i < METRICS_MSGTYPES; i++)
+        {
+            total->requests[i] += __atomic_load_n(&thread->requests[i], __ATOMIC_RELAXED);
+        }
+        for (int i = 0; i < METRICS_OPCODES; i++)
+        {
+            total->equations[i] += __atomic_load_n(&thread->equations[i], __ATOMIC_RELAXED);
+        }
+        for (int i = 0; i < METRIC_ERR_COUNT; i++)
+        {
+            total->errors[i] += __atomic_load_n(&thread->errors[i], __ATOMIC_RELAXED);
+        }
+        for (int i = 0; i < METRIC_COUNTER_COUNT; i++)
+        {
+            total->counters[i] += __atomic_load_n(&thread->counters[i], __ATOMIC_RELAXED);
+        }
+        for (int i = 0; i <= METRICS_BUCKETS; i++)
+        {
+            total->latency[i] += __atomic_load_n(&thread->latency[i], __ATOMIC_RELAXED);
+        }
+        total->latency_ns += __atomic_load_n(&thread->latency_ns, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+/**
+ * @brief writes the HELP and TYPE lines of a metric
+ *
+ */
+static void describe(FILE *out, const char *name, const char *type, const char *help)
+{
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void metrics_write(FILE *out, threadpool_t *pool, admission_t *admission)
+{
+    metrics_thread_t total;
+    metrics_sum(&total);
+
+    describe(out, "netcalc_requests_total", "counter", "Requests answered, by message type.");
+    for (int i = 0; i < METRICS_MSGTYPES; i++)
+    {
+        fprintf(out, "netcalc_requests_total{type=\"%s\"} %" PRIu64 "\n", msgtype_names[i], total.requests[i]);
+    }
+    describe(out, "netcalc_received_bytes_total", "counter", "Request bytes received.");
+    fprintf(out, "netcalc_received_bytes_total %" PRIu64 "\n", total.counters[METRIC_BYTES_IN]);
+    describe(out, "netcalc_sent_bytes_total", "counter", "Reply bytes sent.");
+    fprintf(out, "netcalc_sent_bytes_total %" PRIu64 "\n", total.counters[METRIC_BYTES_OUT]);
+    describe(out, "netcalc_equations_solved_total", "counter", "Equations solved, by operator.");
+    for (int i = 0; i < METRICS_OPCODES; i++)
+    {
+        fprintf(out, "netcalc_equations_solved_total{operator=\"%s\"} %" PRIu64 "\n", opcode_names[i],
+                total.equations[i]);
+    }
+    describe(out, "netcalc_errors_total", "counter", "Failed or refused requests and connections, by type.");
+    for (int i = 0; i < METRIC_ERR_COUNT; i++)
+    {
+        fprintf(out, "netcalc_errors_total{type=\"%s\"} %" PRIu64 "\n", error_names[i], total.errors[i]);
+    }
+    describe(out, "netcalc_cache_hits_total", "counter", "Requests answered from the result cache.");
+    fprintf(out, "netcalc_cache_hits_total %" PRIu64 "\n", total.counters[METRIC_CACHE_HITS]);
+
+    uint64_t opened = total.counters[METRIC_OPENED];
+    uint64_t closed = total.counters[METRIC_CLOSED];
+    describe(out, "netcalc_connections_accepted_total", "counter", "Connections accepted.");
+    fprintf(out, "netcalc_connections_accepted_total %" PRIu64 "\n", opened);
+    describe(out, "netcalc_connections", "gauge", "Connections open.");
+    fprintf(out, "netcalc_connections %" PRIu64 "\n", opened > closed ? opened - closed : 0);
+
+    uint64_t count = 0;
+    describe(out, "netcalc_request_duration_seconds", "histogram",
+             "Time from the first header byte of a request to the last byte of its reply.");
+    for (int i = 0; i < METRICS_BUCKETS; i++)
+    {
+        count += total.latency[i];
+        fprintf(out, "netcalc_request_duration_seconds_bucket{le=\"%s\"} %" PRIu64 "\n", bucket_names[i], count);
+    }
+    count += total.latency[METRICS_BUCKETS];
+    fprintf(out, "netcalc_request_duration_seconds_bucket{le=\"+Inf\"} %" PRIu64 "\n", count);
+    fprintf(out, "netcalc_request_duration_seconds_sum %.9f\n", total.latency_ns / 1e9);
+    fprintf(out, "netcalc_request_duration_seconds_count %" PRIu64 "\n", count);
+
+    if (NULL != pool)
+    {
+        stage_total_t stages[STAGE_COUNT];
+        stagestats_sum(stages);
+        describe(out, "netcalc_queue_depth", "gauge", "Offloaded requests waiting for a pool thread.");
+        fprintf(out, "netcalc_queue_depth %u\n", __atomic_load_n(&pool->queued, __ATOMIC_RELAXED));
+        describe(out, "netcalc_pool_threads", "gauge", "Pool threads running.");
+        fprintf(out, "netcalc_pool_threads %u\n", __atomic_load_n(&pool->live, __ATOMIC_RELAXED));
+        describe(out, "netcalc_pool_idle_threads", "gauge", "Pool threads waiting for work.");
+        fprintf(out, "netcalc_pool_idle_threads %u\n", __atomic_load_n(&pool->idle, __ATOMIC_RELAXED));
+        describe(out, "netcalc_queue_wait_seconds", "summary", "Time offloaded requests waited in the queue.");
+        fprintf(out, "netcalc_queue_wait_seconds_sum %.9f\n", stages[STAGE_QUEUE_WAIT].ns / 1e9);
+        fprintf(out, "netcalc_queue_wait_seconds_count %" PRIu64 "\n", stages[STAGE_QUEUE_WAIT].calls);
+    }
+    if (NULL != admission)
+    {
+        describe(out, "netcalc_inflight_bytes", "gauge", "Payload bytes admitted and not yet answered.");
+        fprintf(out, "netcalc_inflight_bytes %" PRIu64 "\n",
+                __atomic_load_n(&admission->inflight_bytes, __ATOMIC_RELAXED));
+        describe(out, "netcalc_inflight_equations", "gauge", "Equations admitted and not yet answered.");
+        fprintf(out, "netcalc_inflight_equations %" PRIu64 "\n",
+                __atomic_load_n(&admission->inflight_equations, __ATOMIC_RELAXED));
+    }
+}
+
+/**
+ * @brief reads an HTTP request and answers it. GET /metrics gets the
+ * metrics, anything else an error status
+ *
+ * @param fd connected socket with a receive timeout
+ */
+static void serve_scrape(metrics_server_t *server, int fd)
+{
+    char request[METRICS_REQUEST_MAX + 1];
+    size_t got = 0;
+    request[0] = '\0';
+    while (got < METRICS_REQUEST_MAX && NULL == strstr(request, "\r\n\r\n"))
+    {
+        ssize_t rv = recv(fd, request + got, METRICS_REQUEST_MAX - got, 0);
+        if (rv < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (rv <= 0)
+        {
+            return;
+        }
+        got += rv;
+        request[got] = '\0';
+    }
+
+    const char *status = "200 OK";
+    if (strncmp(request, "GET ", 4) != 0)
+    {
+        status = "405 Method Not Allowed";
+    }
+    else if (strncmp(request + 4, "/metrics", 8) != 0 || (request[12] != ' ' && request[12] != '?'))
+    {
+        status = "404 Not Found";
+    }
+
+    char *body = NULL;
+    size_t bodylen = 0;
+    FILE *out = open_memstream(&body, &bodylen);
+    if (NULL == out)
+    {
+        return;
+    }
+    if (status[0] == '2')
+    {
+        metrics_write(out, server->pool, server->admission);
+    }
+    else
+    {
+        fprintf(out, "%s\n", status);
+    }
+    fclose(out);
+
+    char head[256];
+    int headlen = snprintf(head, sizeof(head),
+                           "HTTP/1.1 %s\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                           "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                           status, bodylen);
+    if (send_all(fd, head, headlen))
+    {
+        send_all(fd, body, bodylen);
+    }
+    free(body);
+}
+
+/**
+ * @brief answers scrapes until stopped
+ *
+ * @param voidp the metrics_server_t to run
+ */
+static void *metrics_function(void *voidp)
+{
+    metrics_server_t *server = voidp;
+    while (!__atomic_load_n(&server->stop, __ATOMIC_SEQ_CST))
+    {
+        int fd = accept4(server->listenfd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno != EINTR && !__atomic_load_n(&server->stop, __ATOMIC_SEQ_CST))
+            {
+                // out of descriptors or similar, back off rather than spin
+                struct timespec pause = {0, 10 * 1000000L};
+                nanosleep(&pause, NULL);
+            }
+            continue;
+        }
+        // a client that never finishes its request cannot hold up scrapes
+        struct timeval timeout = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        serve_scrape(server, fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+int metrics_start(metrics_server_t *server, uint16_t port)
+{
+    server->listenfd = net_listen_loopback(port);
+    if (server->listenfd < 0)
+    {
+        printf("Failed to start metrics on port %u!\n", port);
+        return 0;
+    }
+    if (pthread_create(&server->thread, NULL, metrics_function, server) != 0)
+    {
+        printf("Failed to start metrics on port %u!\n", port);
+        close(server->listenfd);
+        server->listenfd = -1;
+        return 0;
+    }
+    return 1;
+}
+
+void metrics_stop(metrics_server_t *server)
+{
+    __atomic_store_n(&server->stop, 1, __ATOMIC_SEQ_CST);
+    // wakes the thread out of accept
+    shutdown(server->listenfd, SHUT_RDWR);
+    pthread_join(server->thread, NULL);
+    close(server->listenfd);
+    server->listenfd = -1;
+}
+
+void metrics_free(void)
+{
+    pthread_mutex_lock(&registry_lock);
+    while (NULL != registry)
+    {
+        metrics_thread_t *thread = registry;
+        registry = thread->next;
+        free(thread);
+    }
+    registry_tail = &registry;
+    pthread_mutex_unlock(&registry_lock);
+    if (NULL != mine)
+    {
+        pthread_setspecific(registry_key, NULL);
+    }
+    mine = NULL;
+}
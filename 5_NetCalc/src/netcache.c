@@ -0,0 +1,297 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include "../include/netcache.h"
+#include "../../4_ThreadCalc/include/equation.h"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+#define COMPARE_CHUNK (64 * 1024)
+
+/**
+ * @brief an entry found while evicting
+ *
+ */
+typedef struct cache_file_t
+{
+    char name[NAME_MAX + 1];
+    struct timespec used;
+    uint64_t size;
+} cache_file_t;
+
+uint64_t netcache_key(const uint8_t *payload, size_t len)
+{
+    uint64_t hash = FNV_OFFSET;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash = (hash ^ payload[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+/**
+ * @brief formats the path of a cache entry
+ *
+ * @return int 1 if the path fit, 0 otherwise
+ */
+static int entry_path(char *path, const char *dir, uint64_t key, size_t len)
+{
+    int n = snprintf(path, PATH_MAX, "%s/%016" PRIx64 "-%zu.equ", dir, key, len);
+    return n > 0 && n < PATH_MAX;
+}
+
+/**
+ * @brief orders entries least recently used first
+ *
+ */
+static int used_compare(const void *a, const void *b)
+{
+    const struct timespec *left = &((const cache_file_t *)a)->used;
+    const struct timespec *right = &((const cache_file_t *)b)->used;
+    if (left->tv_sec != right->tv_sec)
+    {
+        return left->tv_sec < right->tv_sec ? -1 : 1;
+    }
+    return (left->tv_nsec > right->tv_nsec) - (left->tv_nsec < right->tv_nsec);
+}
+
+/**
+ * @brief lists the committed entries of the cache directory. Temporary
+ * entries start with '.' and are skipped
+ *
+ * @param files set to a malloc'd array of entries
+ * @param total set to the bytes they take
+ * @return size_t number of entries
+ */
+static size_t list_entries(const netcache_t *cache, cache_file_t **files, uint64_t *total)
+{
+    size_t count = 0;
+    size_t capacity = 0;
+    *files = NULL;
+    *total = 0;
+    DIR *dir = opendir(cache->dir);
+    if (NULL == dir)
+    {
+        return 0;
+    }
+    struct dirent *entry;
+    while (NULL != (entry = readdir(dir)))
+    {
+        struct stat st;
+        if ('.' == entry->d_name[0] || fstatat(dirfd(dir), entry->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode))
+        {
+            continue;
+        }
+        if (count == capacity)
+        {
+            size_t grown = capacity ? capacity * 2 : 64;
+            cache_file_t *more = realloc(*files, grown * sizeof(cache_file_t));
+            if (NULL == more)
+            {
+                break;
+            }
+            *files = more;
+            capacity = grown;
+        }
+        snprintf((*files)[count].name, sizeof((*files)[count].name), "%s", entry->d_name);
+        (*files)[count].used = st.st_mtim;
+        (*files)[count].size = st.st_size;
+        *total += st.st_size;
+        count++;
+    }
+    closedir(dir);
+    return count;
+}
+
+/**
+ * @brief recounts the entries and, when they are over the limit, removes
+ * the least recently used down to the low water mark. A thread finding
+ * another already evicting leaves it to that one
+ *
+ */
+static void evict(netcache_t *cache)
+{
+    if (pthread_mutex_trylock(&cache->lock) != 0)
+    {
+        return;
+    }
+    cache_file_t *files;
+    uint64_t total;
+    size_t count = list_entries(cache, &files, &total);
+    if (cache->limit > 0 && total > cache->limit)
+    {
+        uint64_t target = cache->limit / 100 * NETCACHE_LOW_WATER;
+        qsort(files, count, sizeof(cache_file_t), used_compare);
+        for (size_t i = 0; i < count && total > target; i++)
+        {
+            char path[PATH_MAX];
+            // an entry still being sent stays readable through its open fd
+            if (snprintf(path, sizeof(path), "%s/%s", cache->dir, files[i].name) < PATH_MAX &&
+                (unlink(path) == 0 || errno == ENOENT))
+            {
+                total -= files[i].size;
+            }
+        }
+    }
+    free(files);
+    __atomic_store_n(&cache->size, total, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+int netcache_init(netcache_t *cache, const char *dir, uint64_t limit)
+{
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+    {
+        return 0;
+    }
+    cache->dir = dir;
+    cache->limit = limit;
+    cache->size = 0;
+    pthread_mutex_init(&cache->lock, NULL);
+    evict(cache);
+    return 1;
+}
+
+void netcache_destroy(netcache_t *cache)
+{
+    pthread_mutex_destroy(&cache->lock);
+}
+
+/**
+ * @brief compares the upload stored at the start of an entry with payload
+ *
+ * @return int 1 if they are equal, 0 otherwise
+ */
+static int same_upload(int fd, const uint8_t *payload, size_t len)
+{
+    uint8_t *chunk = malloc(len < COMPARE_CHUNK ? len + 1 : COMPARE_CHUNK);
+    int same = NULL != chunk;
+    size_t done = 0;
+    while (same && done < len)
+    {
+        size_t want = len - done < COMPARE_CHUNK ? len - done : COMPARE_CHUNK;
+        same = pread(fd, chunk, want, done) == (ssize_t)want && memcmp(chunk, payload + done, want) == 0;
+        done += want;
+    }
+    free(chunk);
+    return same;
+}
+
+int netcache_open(netcache_t *cache, uint64_t key, const uint8_t *payload, size_t len, uint64_t *size)
+{
+    char path[PATH_MAX];
+    struct stat st;
+    if (!entry_path(path, cache->dir, key, len))
+    {
+        return -1;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0 && (fstat(fd, &st) != 0 || (uint64_t)st.st_size < len + sizeof(struct header) ||
+                    !same_upload(fd, payload, len)))
+    {
+        close(fd);
+        fd = -1;
+    }
+    if (fd >= 0)
+    {
+        *size = st.st_size - len;
+        // the mtime orders entries for eviction
+        futimens(fd, NULL);
+    }
+    return fd;
+}
+
+netcache_entry_t *netcache_begin(netcache_t *cache, uint64_t key, const uint8_t *payload, size_t len)
+{
+    netcache_entry_t *entry = malloc(sizeof(netcache_entry_t));
+    if (NULL == entry)
+    {
+        return NULL;
+    }
+    entry->cache = cache;
+    entry->size = 0;
+    if (!entry_path(entry->path, cache->dir, key, len) ||
+        snprintf(entry->tmppath, PATH_MAX, "%s/.cacheXXXXXX", cache->dir) >= PATH_MAX)
+    {
+        free(entry);
+        return NULL;
+    }
+    entry->fd = mkstemp(entry->tmppath);
+    if (entry->fd < 0 || fchmod(entry->fd, 0644) != 0)
+    {
+        if (entry->fd >= 0)
+        {
+            close(entry->fd);
+            unlink(entry->tmppath);
+        }
+        free(entry);
+        return NULL;
+    }
+    if (!netcache_append(entry, payload, len))
+    {
+        netcache_abort(entry);
+        return NULL;
+    }
+    return entry;
+}
+
+int netcache_append(netcache_entry_t *entry, const uint8_t *data, size_t n)
+{
+    size_t written = 0;
+    while (written < n)
+    {
+        ssize_t rv = write(entry->fd, data + written, n - written);
+        if (rv <= 0)
+        {
+            return 0;
+        }
+        written += rv;
+    }
+    entry->size += n;
+    return 1;
+}
+
+int netcache_commit(netcache_entry_t *entry)
+{
+    netcache_t *cache = entry->cache;
+    int success = close(entry->fd) == 0 && rename(entry->tmppath, entry->path) == 0;
+    if (!success)
+    {
+        unlink(entry->tmppath);
+    }
+    else if (__atomic_add_fetch(&cache->size, entry->size, __ATOMIC_RELAXED) > cache->limit && cache->limit > 0)
+    {
+        evict(cache);
+    }
+    free(entry);
+    return success;
+}
+
+void netcache_abort(netcache_entry_t *entry)
+{
+    close(entry->fd);
+    unlink(entry->tmppath);
+    free(entry);
+}
+
+int netcache_store(netcache_t *cache, uint64_t key, const uint8_t *payload, size_t len, const uint8_t *solved,
+                   size_t solvedlen)
+{
+    netcache_entry_t *entry = netcache_begin(cache, key, payload, len);
+    if (NULL == entry)
+    {
+        return 0;
+    }
+    if (!netcache_append(entry, solved, solvedlen))
+    {
+        netcache_abort(entry);
+        return 0;
+    }
+    return netcache_commit(entry);
+}
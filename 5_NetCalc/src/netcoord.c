@@ -0,0 +1,815 @@
+#define _GNU_SOURCE
+#include "../include/common.h"
+#include "../include/nethdr.h"
+#include "../include/netsock.h"
+#include <dirent.h>
+#include <endian.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <linux/limits.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#define COORD_WORKERS_MAX 64
+#define COORD_DEPTH_DEFAULT 16
+#define COORD_BYTES_DEFAULT (64 << 20)
+#define COORD_RETRIES_DEFAULT 3
+#define COORD_RECONNECTS 8
+#define COORD_BACKOFF_MS 100
+#define COORD_BACKOFF_MAX_MS 5000
+#define COORD_EVENTS 64
+#define COORD_READ_CHUNK (64 * 1024)
+
+/**
+ * @brief one unsolved file on its way to a worker
+ *
+ * @param name file name, also sent in the net header
+ * @param data file contents
+ * @param len size of data
+ * @param hdr network order header, request_id set when sent
+ * @param attempts workers that failed while holding the job
+ * @param next next job in a queue
+ */
+typedef struct coord_job_t
+{
+    char name[NET_NAME_FIELD_SZ];
+    uint8_t *data;
+    size_t len;
+    struct net_header hdr;
+    uint32_t attempts;
+    struct coord_job_t *next;
+} coord_job_t;
+
+/**
+ * @brief a queue of jobs
+ *
+ */
+typedef struct coord_queue_t
+{
+    coord_job_t *head;
+    coord_job_t *tail;
+} coord_queue_t;
+
+/**
+ * @brief a NetCalc server jobs are sent to. Request ids index slots, so
+ * replies may come back in any order
+ *
+ * @param host server host
+ * @param port server port
+ * @param fd connected nonblocking socket, -1 while down
+ * @param slots jobs in flight, depth entries
+ * @param sendq jobs waiting to be sent, in order
+ * @param sent bytes of the head of sendq already sent
+ * @param inflight jobs in slots
+ * @param inflight_bytes payload bytes of the jobs in slots
+ * @param rhdr reply header being received
+ * @param rgot bytes of rhdr received
+ * @param rleft reply payload bytes still to receive
+ * @param outfd solved file the reply payload is written to
+ * @param outpath temporary name of outfd, renamed to the solved file once the
+ * whole reply has arrived
+ * @param events epoll events armed
+ * @param resume_at no jobs are sent before this time, in milliseconds, after
+ * a busy reply or while waiting to reconnect
+ * @param failures consecutive failed connections
+ * @param solved files this worker answered
+ * @param dead the worker failed COORD_RECONNECTS times in a row and is not
+ * used again
+ */
+typedef struct coord_worker_t
+{
+    char *host;
+    uint16_t port;
+    int fd;
+    coord_job_t **slots;
+    coord_queue_t sendq;
+    size_t sent;
+    uint32_t inflight;
+    uint64_t inflight_bytes;
+    struct net_header rhdr;
+    size_t rgot;
+    uint64_t rleft;
+    int outfd;
+    char outpath[PATH_MAX];
+    uint32_t events;
+    uint64_t resume_at;
+    uint32_t failures;
+    uint64_t solved;
+    int dead;
+} coord_worker_t;
+
+coord_worker_t workers[COORD_WORKERS_MAX];
+uint32_t workercount = 0;
+uint32_t depth = COORD_DEPTH_DEFAULT;
+uint64_t max_bytes = COORD_BYTES_DEFAULT;
+uint32_t max_retries = COORD_RETRIES_DEFAULT;
+char solveddir[PATH_MAX] = {0};
+char unsolveddir[PATH_MAX] = {0};
+int epfd = -1;
+DIR *folder = NULL;
+coord_queue_t retryq = {NULL, NULL};
+uint64_t outstanding = 0;
+uint64_t solved = 0;
+uint64_t failed = 0;
+
+/**
+ * @brief print usage statement
+ *
+ */
+void print_usage()
+{
+    printf("\n\nUsage: ./netcoord <unsolved_directory> <solved_directory> -w <host:port> (-w <host:port> ...)"
+           "\n\t(optional -d <depth>) requests in flight per worker"
+           "\n\t(optional -b <bytes>) payload bytes in flight per worker"
+           "\n\t(optional -r <retries>) times a file is resent after its worker fails\n\n");
+}
+
+/**
+ * @brief monotonic clock in milliseconds
+ *
+ */
+uint64_t now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief appends a job to a queue
+ *
+ */
+void queue_push(coord_queue_t *queue, coord_job_t *job)
+{
+    job->next = NULL;
+    if (NULL == queue->tail)
+    {
+        queue->head = job;
+    }
+    else
+    {
+        queue->tail->next = job;
+    }
+    queue->tail = job;
+}
+
+/**
+ * @brief removes the first job of a queue
+ *
+ * @return coord_job_t* job, NULL if the queue is empty
+ */
+coord_job_t *queue_pop(coord_queue_t *queue)
+{
+    coord_job_t *job = queue->head;
+    if (NULL != job)
+    {
+        queue->head = job->next;
+        if (NULL == queue->head)
+        {
+            queue->tail = NULL;
+        }
+        job->next = NULL;
+    }
+    return job;
+}
+
+/**
+ * @brief frees a job and its file contents
+ *
+ */
+void free_job(coord_job_t *job)
+{
+    free(job->data);
+    free(job);
+}
+
+/**
+ * @brief reads a whole file
+ *
+ * @return int 1 if len bytes were read, 0 otherwise
+ */
+int read_all(int fd, uint8_t *buf, size_t len)
+{
+    size_t got = 0;
+    while (got < len)
+    {
+        ssize_t rv = read(fd, buf + got, len - got);
+        if (rv < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (rv <= 0)
+        {
+            return 0;
+        }
+        got += rv;
+    }
+    return 1;
+}
+
+/**
+ * @brief reads the next unsolved file of the directory into a job
+ *
+ * @return coord_job_t* job, NULL once the directory is exhausted
+ */
+coord_job_t *next_file()
+{
+    struct dirent *entry;
+    while (NULL != folder && NULL != (entry = readdir(folder)))
+    {
+        char path[PATH_MAX] = {0};
+        struct stat st;
+        size_t namelen = strlen(entry->d_name);
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+        if (snprintf(path, sizeof(path), "%s/%s", unsolveddir, entry->d_name) >= (int)sizeof(path) ||
+            stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            continue;
+        }
+        if (namelen > NET_FNAME_MAX || st.st_size == 0 || (uint64_t)st.st_size > NET_PKT_MAX - NET_HDR_EXT_SZ)
+        {
+            printf("Skipping %s, the net header cannot carry it\n", entry->d_name);
+            failed++;
+            continue;
+        }
+
+        coord_job_t *job = calloc(1, sizeof(coord_job_t));
+        int fd = open(path, O_RDONLY);
+        if (NULL == job || fd < 0 || NULL == (job->data = malloc(st.st_size)))
+        {
+            printf("Could not read %s!\n", path);
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            free(job);
+            failed++;
+            continue;
+        }
+        job->len = st.st_size;
+        if (!read_all(fd, job->data, job->len))
+        {
+            printf("Could not read %s!\n", path);
+            close(fd);
+            free_job(job);
+            failed++;
+            continue;
+        }
+        close(fd);
+
+        memcpy(job->name, entry->d_name, namelen);
+        job->hdr.hdr_len = htobe32(NET_HDR_EXT_SZ);
+        job->hdr.filename_len = htobe32(namelen);
+        job->hdr.pkt_len = htobe64(NET_HDR_EXT_SZ + job->len);
+        memcpy(job->hdr.filename, job->name, namelen);
+        job->hdr.msgtype = htobe16(NET_MSG_EQU);
+        outstanding++;
+        return job;
+    }
+    if (NULL != folder)
+    {
+        closedir(folder);
+        folder = NULL;
+    }
+    return NULL;
+}
+
+/**
+ * @brief gives up on a job, or queues it to be sent again
+ *
+ * @param counted the job was lost with a failed worker and uses a retry
+ */
+void retry_job(coord_job_t *job, int counted)
+{
+    if (counted && ++job->attempts > max_retries)
+    {
+        printf("Giving up on %s after %u failed workers\n", job->name, job->attempts);
+        free_job(job);
+        outstanding--;
+        failed++;
+        return;
+    }
+    queue_push(&retryq, job);
+}
+
+/**
+ * @brief arms the epoll events a worker needs
+ *
+ */
+void worker_arm(coord_worker_t *worker)
+{
+    uint32_t events = EPOLLIN | (NULL != worker->sendq.head ? EPOLLOUT : 0);
+    if (events != worker->events)
+    {
+        struct epoll_event ev = {.events = events, .data.ptr = worker};
+        epoll_ctl(epfd, EPOLL_CTL_MOD, worker->fd, &ev);
+        worker->events = events;
+    }
+}
+
+/**
+ * @brief connects a worker that is down
+ *
+ * @return int 1 if connected
+ */
+int worker_connect(coord_worker_t *worker)
+{
+    worker->fd = net_connect(worker->host, worker->port);
+    if (worker->fd < 0)
+    {
+        uint64_t backoff = (uint64_t)COORD_BACKOFF_MS << (worker->failures < 6 ? worker->failures : 6);
+        worker->resume_at = now_ms() + (backoff < COORD_BACKOFF_MAX_MS ? backoff : COORD_BACKOFF_MAX_MS);
+        if (++worker->failures >= COORD_RECONNECTS)
+        {
+            printf("Worker %s:%u is unreachable, no longer using it\n", worker->host, worker->port);
+            worker->dead = 1;
+        }
+        return 0;
+    }
+    fcntl(worker->fd, F_SETFL, fcntl(worker->fd, F_GETFL) | O_NONBLOCK);
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = worker};
+    epoll_ctl(epfd, EPOLL_CTL_ADD, worker->fd, &ev);
+    worker->events = EPOLLIN;
+    worker->sent = 0;
+    worker->rgot = 0;
+    worker->rleft = 0;
+    return 1;
+}
+
+/**
+ * @brief closes and removes the partial solved file a worker is writing
+ *
+ */
+void worker_discard(coord_worker_t *worker)
+{
+    if (worker->outfd >= 0)
+    {
+        close(worker->outfd);
+        worker->outfd = -1;
+        unlink(worker->outpath);
+    }
+}
+
+/**
+ * @brief drops a failed worker's connection and hands its jobs to the
+ * other workers. It is reconnected after a backoff
+ *
+ */
+void worker_fail(coord_worker_t *worker)
+{
+    printf("Lost worker %s:%u with %u files in flight\n", worker->host, worker->port, worker->inflight);
+    epoll_ctl(epfd, EPOLL_CTL_DEL, worker->fd, NULL);
+    close(worker->fd);
+    worker->fd = -1;
+    worker_discard(worker);
+    worker->sendq.head = NULL;
+    worker->sendq.tail = NULL;
+    for (uint32_t i = 0; i < depth; i++)
+    {
+        if (NULL != worker->slots[i])
+        {
+            retry_job(worker->slots[i], 1);
+            worker->slots[i] = NULL;
+        }
+    }
+    worker->inflight = 0;
+    worker->inflight_bytes = 0;
+    worker->failures++;
+    worker->resume_at = now_ms() + COORD_BACKOFF_MS;
+}
+
+/**
+ * @brief hands a job to a worker, filling a free slot
+ *
+ */
+void worker_assign(coord_worker_t *worker, coord_job_t *job)
+{
+    uint32_t id = 0;
+    while (NULL != worker->slots[id])
+    {
+        id++;
+    }
+    worker->slots[id] = job;
+    job->hdr.request_id = htobe64(id);
+    worker->inflight++;
+    worker->inflight_bytes += job->len;
+    queue_push(&worker->sendq, job);
+}
+
+/**
+ * @brief sends queued jobs until the socket would block
+ *
+ */
+void worker_send(coord_worker_t *worker)
+{
+    while (NULL != worker->sendq.head)
+    {
+        coord_job_t *job = worker->sendq.head;
+        struct iovec iov[2];
+        iov[0].iov_base = &job->hdr;
+        iov[0].iov_len = NET_HDR_EXT_SZ;
+        iov[1].iov_base = job->data;
+        iov[1].iov_len = job->len;
+        int first = iov_advance(iov, 2, worker->sent);
+        ssize_t rv = writev(worker->fd, iov + first, 2 - first);
+        if (rv < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        {
+            return;
+        }
+        if (rv <= 0)
+        {
+            worker_fail(worker);
+            return;
+        }
+        worker->sent += rv;
+        if (worker->sent == NET_HDR_EXT_SZ + job->len)
+        {
+            worker->sent = 0;
+            queue_pop(&worker->sendq);
+        }
+    }
+}
+
+/**
+ * @brief acts on a reply header. A temporary file in solveddir is opened
+ * for the payload that follows, a busy job goes back to the queue and an
+ * error is reported
+ *
+ * @return coord_job_t* job the reply is for, NULL if the worker is broken:
+ * the header is malformed or answers no request in flight
+ */
+coord_job_t *reply_started(coord_worker_t *worker)
+{
+    uint64_t id = be64toh(worker->rhdr.request_id);
+    if (be32toh(worker->rhdr.hdr_len) != NET_HDR_EXT_SZ || be64toh(worker->rhdr.pkt_len) < NET_HDR_EXT_SZ ||
+        id >= depth || NULL == worker->slots[id])
+    {
+        return NULL;
+    }
+    coord_job_t *job = worker->slots[id];
+    uint32_t status = be32toh(worker->rhdr.status);
+    worker->rleft = be64toh(worker->rhdr.pkt_len) - NET_HDR_EXT_SZ;
+    if (status == NET_STATUS_OK)
+    {
+        int n = snprintf(worker->outpath, sizeof(worker->outpath), "%s/.%s.part", solveddir, job->name);
+        if (n >= 0 && (size_t)n < sizeof(worker->outpath))
+        {
+            worker->outfd = open(worker->outpath, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+        }
+        if (worker->outfd < 0)
+        {
+            printf("Could not create a solved file for %s!\n", job->name);
+        }
+    }
+    else if (status == NET_STATUS_BUSY)
+    {
+        worker->resume_at = now_ms() + be16toh(worker->rhdr.flags);
+    }
+    else
+    {
+        printf("Worker %s:%u rejected %s with status %u\n", worker->host, worker->port, job->name, status);
+    }
+    return job;
+}
+
+/**
+ * @brief retires a job whose reply has been received. Only a whole OK
+ * reply is renamed to its solved file, anything else is removed so a
+ * solved file is never partial
+ *
+ */
+void reply_done(coord_worker_t *worker)
+{
+    uint64_t id = be64toh(worker->rhdr.request_id);
+    coord_job_t *job = worker->slots[id];
+    uint32_t status = be32toh(worker->rhdr.status);
+    worker->slots[id] = NULL;
+    worker->inflight--;
+    worker->inflight_bytes -= job->len;
+    if (status == NET_STATUS_BUSY)
+    {
+        retry_job(job, 0);
+        return;
+    }
+    int opened = worker->outfd >= 0;
+    int written = opened && close(worker->outfd) == 0;
+    worker->outfd = -1;
+    char path[PATH_MAX] = {0};
+    int n = snprintf(path, sizeof(path), "%s/%s", solveddir, job->name);
+    if (status == NET_STATUS_OK && written && n >= 0 && (size_t)n < sizeof(path) &&
+        rename(worker->outpath, path) == 0)
+    {
+        solved++;
+        worker->solved++;
+        worker->failures = 0;
+    }
+    else
+    {
+        if (opened)
+        {
+            unlink(worker->outpath);
+        }
+        failed++;
+    }
+    free_job(job);
+    outstanding--;
+}
+
+/**
+ * @brief reads replies and writes solved payloads straight to their files
+ *
+ */
+void worker_recv(coord_worker_t *worker, uint8_t *scratch)
+{
+    ssize_t rv = recv(worker->fd, scratch, COORD_READ_CHUNK, 0);
+    if (rv < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    {
+        return;
+    }
+    if (rv <= 0)
+    {
+        worker_fail(worker);
+        return;
+    }
+    size_t pos = 0;
+    while (pos < (size_t)rv)
+    {
+        size_t take;
+        if (worker->rleft > 0)
+        {
+            take = worker->rleft < rv - pos ? worker->rleft : rv - pos;
+            if (worker->outfd >= 0 && write(worker->outfd, scratch + pos, take) != (ssize_t)take)
+            {
+                printf("Could not write solved file!\n");
+                worker_discard(worker);
+            }
+            worker->rleft -= take;
+            pos += take;
+            if (worker->rleft == 0)
+            {
+                reply_done(worker);
+            }
+            continue;
+        }
+        take = NET_HDR_EXT_SZ - worker->rgot;
+        take = take < rv - pos ? take : rv - pos;
+        memcpy((uint8_t *)&worker->rhdr + worker->rgot, scratch + pos, take);
+        worker->rgot += take;
+        pos += take;
+        if (worker->rgot == NET_HDR_EXT_SZ)
+        {
+            worker->rgot = 0;
+            if (NULL == reply_started(worker))
+            {
+                printf("Worker %s:%u sent a malformed reply\n", worker->host, worker->port);
+                worker_fail(worker);
+                return;
+            }
+            if (worker->rleft == 0)
+            {
+                reply_done(worker);
+            }
+        }
+    }
+}
+
+/**
+ * @brief picks the worker with the fewest bytes in flight that can take a
+ * job of len bytes now
+ *
+ * @return coord_worker_t* worker, NULL if none can
+ */
+coord_worker_t *pick_worker(size_t len, uint64_t now)
+{
+    coord_worker_t *best = NULL;
+    for (uint32_t i = 0; i < workercount; i++)
+    {
+        coord_worker_t *worker = &workers[i];
+        if (worker->dead || worker->fd < 0 || worker->resume_at > now || worker->inflight == depth ||
+            (worker->inflight > 0 && worker->inflight_bytes + len > max_bytes))
+        {
+            continue;
+        }
+        if (NULL == best || worker->inflight_bytes < best->inflight_bytes)
+        {
+            best = worker;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief reconnects workers whose backoff is over, then hands out retried
+ * jobs and new files while some worker has room
+ *
+ * @return int number of workers still usable
+ */
+int dispatch(coord_job_t **held)
+{
+    uint64_t now = now_ms();
+    int usable = 0;
+    for (uint32_t i = 0; i < workercount; i++)
+    {
+        coord_worker_t *worker = &workers[i];
+        if (!worker->dead && worker->fd < 0 && worker->resume_at <= now)
+        {
+            worker_connect(worker);
+        }
+        usable += !worker->dead;
+    }
+
+    for (;;)
+    {
+        if (NULL == *held)
+        {
+            *held = NULL != retryq.head ? queue_pop(&retryq) : next_file();
+        }
+        if (NULL == *held)
+        {
+            break;
+        }
+        coord_worker_t *worker = pick_worker((*held)->len, now);
+        if (NULL == worker)
+        {
+            break;
+        }
+        worker_assign(worker, *held);
+        *held = NULL;
+    }
+
+    for (uint32_t i = 0; i < workercount; i++)
+    {
+        if (workers[i].fd >= 0)
+        {
+            worker_send(&workers[i]);
+        }
+        if (workers[i].fd >= 0)
+        {
+            worker_arm(&workers[i]);
+        }
+    }
+    return usable;
+}
+
+/**
+ * @brief parses a -w host:port argument into the next worker
+ *
+ * @return int 1 if valid
+ */
+int add_worker(char *arg)
+{
+    char *colon = strrchr(arg, ':');
+    if (NULL == colon || workercount == COORD_WORKERS_MAX)
+    {
+        return 0;
+    }
+    *colon = '\0';
+    coord_worker_t *worker = &workers[workercount];
+    worker->host = arg;
+    worker->port = atoi(colon + 1);
+    worker->fd = -1;
+    worker->outfd = -1;
+    workercount++;
+    return worker->port != 0;
+}
+
+/**
+ * @brief netcoord spreads one directory of unsolved files across several
+ * NetCalc servers. Files are streamed with the extended net header,
+ * pipelined up to -d per worker and sent to the worker with the fewest
+ * bytes in flight. Files held by a worker that fails are sent elsewhere,
+ * and solved files are written to the local solved directory
+ *
+ * @param argc arg count
+ * @param argv unsolved and solved directories, one or more -w <host:port>,
+ * optional -d <depth>, -b <bytes> and -r <retries>
+ * @return int 0 if every file was solved, 1 otherwise
+ */
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "w:d:b:r:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'w':
+            if (!add_worker(optarg))
+            {
+                print_usage();
+                return 1;
+            }
+            break;
+        case 'd':
+            depth = strtoul(optarg, NULL, 10);
+            break;
+        case 'b':
+            max_bytes = strtoull(optarg, NULL, 10);
+            break;
+        case 'r':
+            max_retries = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            print_usage();
+            return 1;
+        }
+    }
+    if (argc - optind != 2 || workercount == 0 || depth < 1)
+    {
+        print_usage();
+        return 1;
+    }
+    snprintf(unsolveddir, sizeof(unsolveddir), "%s", argv[optind]);
+    snprintf(solveddir, sizeof(solveddir), "%s", argv[optind + 1]);
+    folder = opendir(unsolveddir);
+    if (NULL == folder || (mkdir(solveddir, 0755) != 0 && errno != EEXIST))
+    {
+        printf("Could not open %s or create %s!\n", unsolveddir, solveddir);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    uint8_t *scratch = malloc(COORD_READ_CHUNK);
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    for (uint32_t i = 0; NULL != scratch && i < workercount; i++)
+    {
+        workers[i].slots = calloc(depth, sizeof(coord_job_t *));
+        if (NULL == workers[i].slots)
+        {
+            free(scratch);
+            scratch = NULL;
+        }
+    }
+    if (NULL == scratch || epfd < 0)
+    {
+        printf("Failed to start coordinator!\n");
+        return 1;
+    }
+
+    struct epoll_event events[COORD_EVENTS];
+    coord_job_t *held = NULL;
+    while (dispatch(&held) > 0 && (NULL != held || NULL != folder || outstanding > 0))
+    {
+        int n = epoll_wait(epfd, events, COORD_EVENTS, COORD_BACKOFF_MS);
+        for (int i = 0; i < n; i++)
+        {
+            coord_worker_t *worker = events[i].data.ptr;
+            if (worker->fd >= 0 && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+            {
+                worker_recv(worker, scratch);
+            }
+            if (worker->fd >= 0 && (events[i].events & EPOLLOUT))
+            {
+                worker_send(worker);
+            }
+        }
+    }
+
+    if (NULL != held || NULL != folder || outstanding > 0)
+    {
+        struct dirent *entry;
+        while (NULL != folder && NULL != (entry = readdir(folder)))
+        {
+            outstanding += strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0;
+        }
+        printf("No workers left with %lu files unsolved!\n", (unsigned long)outstanding);
+        failed += outstanding;
+    }
+    for (uint32_t i = 0; i < workercount; i++)
+    {
+        printf("Worker %s:%u solved %lu files\n", workers[i].host, workers[i].port, (unsigned long)workers[i].solved);
+        if (workers[i].fd >= 0)
+        {
+            close(workers[i].fd);
+        }
+        worker_discard(&workers[i]);
+        for (uint32_t j = 0; j < depth; j++)
+        {
+            if (NULL != workers[i].slots[j])
+            {
+                free_job(workers[i].slots[j]);
+            }
+        }
+        free(workers[i].slots);
+    }
+    while (NULL != retryq.head)
+    {
+        free_job(queue_pop(&retryq));
+    }
+    if (NULL != held)
+    {
+        free_job(held);
+    }
+    if (NULL != folder)
+    {
+        closedir(folder);
+    }
+    printf("Solved %lu files, failed %lu\n", (unsigned long)solved, (unsigned long)failed);
+    close(epfd);
+    free(scratch);
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,76 @@
+#include <string.h>
+#include <endian.h>
+#include "../include/nethdr.h"
+
+void net_header_to_host(struct net_header *hdr)
+{
+    hdr->hdr_len = be32toh(hdr->hdr_len);
+    hdr->filename_len = be32toh(hdr->filename_len);
+    hdr->pkt_len = be64toh(hdr->pkt_len);
+    if (hdr->hdr_len == NET_HDR_EXT_SZ)
+    {
+        hdr->request_id = be64toh(hdr->request_id);
+        hdr->msgtype = be16toh(hdr->msgtype);
+        hdr->flags = be16toh(hdr->flags);
+        hdr->status = be32toh(hdr->status);
+    }
+    else
+    {
+        hdr->request_id = 0;
+        hdr->msgtype = NET_MSG_EQU;
+        hdr->flags = 0;
+        hdr->status = 0;
+    }
+}
+
+int net_header_validate(const struct net_header *hdr)
+{
+    int status = NET_STATUS_OK;
+    if (hdr->hdr_len != NET_HDR_SZ && hdr->hdr_len != NET_HDR_EXT_SZ)
+    {
+        status = NET_STATUS_BADHDR;
+    }
+    else if (hdr->msgtype != NET_MSG_EQU && hdr->msgtype != NET_MSG_BATCH)
+    {
+        status = NET_STATUS_BADHDR;
+    }
+    else if ((hdr->filename_len == 0 && hdr->msgtype == NET_MSG_EQU) || hdr->filename_len > NET_FNAME_MAX ||
+             memchr(hdr->filename, '\0', hdr->filename_len) != NULL)
+    {
+        status = NET_STATUS_BADHDR;
+    }
+    else if (hdr->pkt_len <= hdr->hdr_len || hdr->pkt_len > NET_PKT_MAX)
+    {
+        status = NET_STATUS_BADHDR;
+    }
+    return status;
+}
+
+int net_header_recoverable(const struct net_header *hdr)
+{
+    return hdr->hdr_len == NET_HDR_EXT_SZ && hdr->pkt_len >= NET_HDR_EXT_SZ && hdr->pkt_len <= NET_PKT_MAX;
+}
+
+size_t net_header_reply(const struct net_header *req, uint32_t status, uint64_t payload_len, struct net_header *reply)
+{
+    size_t size = req->hdr_len == NET_HDR_EXT_SZ ? NET_HDR_EXT_SZ : NET_HDR_SZ;
+    memset(reply, 0, sizeof(*reply));
+    if (status != NET_STATUS_OK)
+    {
+        payload_len = 0;
+    }
+    else
+    {
+        reply->filename_len = htobe32(req->filename_len);
+        memcpy(reply->filename, req->filename, req->filename_len);
+    }
+    reply->hdr_len = htobe32(size);
+    reply->pkt_len = htobe64(size + payload_len);
+    if (size == NET_HDR_EXT_SZ)
+    {
+        reply->request_id = htobe64(req->request_id);
+        reply->msgtype = htobe16(req->msgtype);
+        reply->status = htobe32(status);
+    }
+    return size;
+}
@@ -0,0 +1,198 @@
+#include "../include/common.h"
+#include "../include/netsock.h"
+#include <errno.h>
+#include <netinet/tcp.h>
+#include <sys/sendfile.h>
+
+/**
+ * @brief creates a TCP listening socket on one address
+ *
+ * @param addr IPv4 address in host order, INADDR_ANY for every interface
+ * @return int listening socket, -1 on error
+ */
+static int listen_on(uint32_t addr, uint16_t port, int reuseport)
+{
+    struct sockaddr_in servaddr;
+    int listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenfd < 0)
+    {
+        printf("Failed to create socket!\n");
+        return -1;
+    }
+    int on = 1;
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (reuseport && setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+    {
+        printf("Failed to set SO_REUSEPORT!\n");
+        close(listenfd);
+        return -1;
+    }
+    memset(&servaddr, 0, sizeof(servaddr));
+    servaddr.sin_family = AF_INET;
+    servaddr.sin_addr.s_addr = htonl(addr);
+    servaddr.sin_port = htons(port);
+
+    if (bind(listenfd, (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0)
+    {
+        printf("Failed to bind socket!\n");
+        close(listenfd);
+        return -1;
+    }
+    if (listen(listenfd, NET_LISTEN_BACKLOG) < 0)
+    {
+        printf("Failed to listen!\n");
+        close(listenfd);
+        return -1;
+    }
+    return listenfd;
+}
+
+int net_listen(uint16_t port, int reuseport)
+{
+    return listen_on(INADDR_ANY, port, reuseport);
+}
+
+int net_listen_loopback(uint16_t port)
+{
+    return listen_on(INADDR_LOOPBACK, port, 0);
+}
+
+int net_connect(const char *host, uint16_t port)
+{
+    struct addrinfo hints;
+    struct addrinfo *res = NULL;
+    char portstr[8];
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(portstr, sizeof(portstr), "%u", port);
+    if (getaddrinfo(host, portstr, &hints, &res) != 0 || NULL == res)
+    {
+        printf("Could not resolve %s!\n", host);
+        return -1;
+    }
+    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) < 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd >= 0)
+    {
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    return fd;
+}
+
+int recv_all(int fd, void *buf, size_t len)
+{
+    size_t got = 0;
+    while (got < len)
+    {
+        ssize_t rv = recv(fd, (uint8_t *)buf + got, len - got, 0);
+        if (rv < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (rv <= 0)
+        {
+            return 0;
+        }
+        got += rv;
+    }
+    return 1;
+}
+
+int send_all(int fd, const void *buf, size_t len)
+{
+    size_t sent = 0;
+    while (sent < len)
+    {
+        ssize_t rv = send(fd, (const uint8_t *)buf + sent, len - sent, MSG_NOSIGNAL);
+        if (rv < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (rv <= 0)
+        {
+            return 0;
+        }
+        sent += rv;
+    }
+    return 1;
+}
+
+int iov_advance(struct iovec *iov, int iovcnt, size_t sent)
+{
+    int i = 0;
+    while (i < iovcnt && sent >= iov[i].iov_len)
+    {
+        sent -= iov[i].iov_len;
+        iov[i].iov_len = 0;
+        i++;
+    }
+    if (i < iovcnt)
+    {
+        iov[i].iov_base = (uint8_t *)iov[i].iov_base + sent;
+        iov[i].iov_len -= sent;
+    }
+    while (i < iovcnt && iov[i].iov_len == 0)
+    {
+        i++;
+    }
+    return i;
+}
+
+int writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+    int first = iov_advance(iov, iovcnt, 0);
+    while (first < iovcnt)
+    {
+        ssize_t rv = writev(fd, iov + first, iovcnt - first);
+        if (rv < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (rv <= 0)
+        {
+            return 0;
+        }
+        first = iov_advance(iov, iovcnt, rv);
+    }
+    return 1;
+}
+
+int sendfile_all(int sockfd, int filefd, uint64_t len)
+{
+    while (len > 0)
+    {
+        ssize_t rv = sendfile(sockfd, filefd, NULL, len);
+        if (rv < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (rv <= 0)
+        {
+            return 0;
+        }
+        len -= rv;
+    }
+    return 1;
+}
+
+int skip_bytes(int fd, uint64_t len)
+{
+    uint8_t discard[4096];
+    while (len > 0)
+    {
+        size_t chunk = len < sizeof(discard) ? len : sizeof(discard);
+        if (!recv_all(fd, discard, chunk))
+        {
+            return 0;
+        }
+        len -= chunk;
+    }
+    return 1;
+}
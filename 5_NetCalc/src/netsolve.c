@@ -0,0 +1,416 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <endian.h>
+#include "../include/netsolve.h"
+#include "../include/nethdr.h"
+#include "../include/netcache.h"
+#include "../include/metrics.h"
+#include "../../4_ThreadCalc/include/equation.h"
+#include "../../0_Common/include/eqstream.h"
+
+/**
+ * @brief hands out the solved buffer, the caller's when the output fits
+ *
+ */
+static uint8_t *solved_buffer(uint8_t *buf, size_t cap, size_t size)
+{
+    return NULL != buf && size <= cap ? buf : malloc(size);
+}
+
+/**
+ * @brief solves a batch and counts its equations by operator
+ *
+ */
+static size_t solve_counted(const struct unsolved_equation *uequ, struct solved_equation *sequ, size_t count)
+{
+    metrics_equations(uequ, count);
+    return solve_batch(uequ, sequ, count);
+}
+
+/**
+ * @brief incremental solver behind a streamed answer. Equations are solved
+ * where they lie in the upload, one chunk per call to net_result_next
+ *
+ * @param hdr header of the solved file
+ * @param equations unsolved equations in the upload
+ * @param count equations the solved file holds
+ * @param done equations solved so far
+ * @param cache cache entry being written, NULL for none
+ */
+struct net_stream
+{
+    struct header hdr;
+    const struct unsolved_equation *equations;
+    uint64_t count;
+    uint64_t done;
+    netcache_entry_t *cache;
+};
+
+/**
+ * @brief reads and checks the header of an uncompressed upload
+ *
+ * @param hdr set to the upload's header
+ * @param count set to the equations present, at most the header's numeq.
+ * Fewer means the upload is truncated
+ * @return int NET_STATUS_OK, or NET_STATUS_BADEQU if the header is invalid
+ */
+static int raw_header(const uint8_t *payload, size_t len, struct header *hdr, uint64_t *count)
+{
+    memcpy(hdr, payload, sizeof(*hdr));
+    uint32_t offset = le32toh(hdr->offset);
+    uint64_t numeq = le64toh(hdr->numeq);
+    if (offset < sizeof(*hdr) || offset > len || numeq > NET_NUMEQ_MAX)
+    {
+        return NET_STATUS_BADEQU;
+    }
+    *count = (len - offset) / sizeof(struct unsolved_equation);
+    if (*count > numeq)
+    {
+        *count = numeq;
+    }
+    return NET_STATUS_OK;
+}
+
+/**
+ * @brief solves an uncompressed upload where it lies, without copying
+ * equations out of the payload
+ *
+ */
+static int solve_raw(const uint8_t *payload, size_t len, uint8_t *buf, size_t cap, uint8_t **solved, size_t *solvedlen)
+{
+    struct header hdr;
+    uint64_t count;
+    if (raw_header(payload, len, &hdr, &count) != NET_STATUS_OK)
+    {
+        return NET_STATUS_BADEQU;
+    }
+    uint32_t offset = le32toh(hdr.offset);
+    if (count < le64toh(hdr.numeq))
+    {
+        printf("Malformed file due to equation buffer\n");
+    }
+
+    uint8_t *out = solved_buffer(buf, cap, sizeof(hdr) + count * sizeof(struct solved_equation));
+    if (NULL == out)
+    {
+        return NET_STATUS_BADEQU;
+    }
+    solve_counted((const struct unsolved_equation *)(payload + offset), (struct solved_equation *)(out + sizeof(hdr)),
+                  count);
+    hdr.flags = 1;
+    memcpy(out, &hdr, sizeof(hdr));
+    *solved = out;
+    *solvedlen = sizeof(hdr) + count * sizeof(struct solved_equation);
+    return NET_STATUS_OK;
+}
+
+int net_solve(const void *payload, size_t len, uint8_t *buf, size_t cap, uint8_t **solved, size_t *solvedlen)
+{
+    int status = NET_STATUS_BADEQU;
+    struct header hdr;
+    *solved = NULL;
+    *solvedlen = 0;
+
+    if (len >= sizeof(hdr) && le32toh(((const struct header *)payload)->magic) == EQU_MAGIC)
+    {
+        return solve_raw(payload, len, buf, cap, solved, solvedlen);
+    }
+
+    eqstream_t *stream = eqstream_open_mem(payload, len);
+    if (NULL != stream && eqstream_read(stream, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+        le32toh(hdr.magic) == EQU_MAGIC && le32toh(hdr.offset) >= sizeof(hdr) &&
+        le64toh(hdr.numeq) <= NET_NUMEQ_MAX &&
+        eqstream_skip(stream, le32toh(hdr.offset) - sizeof(hdr)))
+    {
+        uint64_t numeq = le64toh(hdr.numeq);
+        // a few compressed bytes can declare NET_NUMEQ_MAX equations, so
+        // past buf the output only grows as equations actually decode
+        int inbuf = NULL != buf && sizeof(hdr) + numeq * sizeof(struct solved_equation) <= cap;
+        uint64_t room = inbuf || numeq < EQ_BATCH ? numeq : EQ_BATCH;
+        uint8_t *out = inbuf ? buf : malloc(sizeof(hdr) + room * sizeof(struct solved_equation));
+        uint64_t done = 0;
+        if (NULL != out)
+        {
+            struct unsolved_equation unsolved[EQ_BATCH];
+            while (done < numeq)
+            {
+                size_t batch = numeq - done < EQ_BATCH ? numeq - done : EQ_BATCH;
+                size_t count = read_equations(stream, unsolved, batch);
+                if (done + count > room)
+                {
+                    uint64_t grown = room * 2 < numeq ? room * 2 : numeq;
+                    uint8_t *more = realloc(out, sizeof(hdr) + grown * sizeof(struct solved_equation));
+                    if (NULL == more)
+                    {
+                        free(out);
+                        out = NULL;
+                        break;
+                    }
+                    out = more;
+                    room = grown;
+                }
+                solve_counted(unsolved, (struct solved_equation *)(out + sizeof(hdr)) + done, count);
+                done += count;
+                if (count != batch)
+                {
+                    printf("Malformed file due to equation buffer\n");
+                    break;
+                }
+            }
+        }
+        if (NULL != out)
+        {
+            hdr.flags = 1;
+            memcpy(out, &hdr, sizeof(hdr));
+            *solved = out;
+            *solvedlen = sizeof(hdr) + done * sizeof(struct solved_equation);
+            status = NET_STATUS_OK;
+        }
+    }
+    eqstream_close(stream);
+    return status;
+}
+
+uint64_t net_declared(const struct net_header *req, const uint8_t *payload, size_t len)
+{
+    struct header hdr;
+    uint64_t count = 0;
+    if (req->msgtype == NET_MSG_BATCH)
+    {
+        uint32_t batch;
+        if (len >= sizeof(batch))
+        {
+            memcpy(&batch, payload, sizeof(batch));
+            count = le32toh(batch);
+        }
+        return count;
+    }
+    if (net_streamable(req, payload, len))
+    {
+        raw_header(payload, len, &hdr, &count);
+        return count;
+    }
+    eqstream_t *stream = eqstream_open_mem(payload, len);
+    if (NULL != stream && eqstream_read(stream, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+        le32toh(hdr.magic) == EQU_MAGIC)
+    {
+        count = le64toh(hdr.numeq) < NET_NUMEQ_MAX ? le64toh(hdr.numeq) : NET_NUMEQ_MAX;
+    }
+    eqstream_close(stream);
+    return count;
+}
+
+int net_solve_batch(const void *payload, size_t len, uint8_t *buf, size_t cap, uint8_t **solved, size_t *solvedlen)
+{
+    uint32_t count;
+    *solved = NULL;
+    *solvedlen = 0;
+    if (len < sizeof(count))
+    {
+        return NET_STATUS_BADEQU;
+    }
+    memcpy(&count, payload, sizeof(count));
+    count = le32toh(count);
+    if (count > NET_BATCH_MAX || len != sizeof(count) + (size_t)count * sizeof(struct net_batch_equation))
+    {
+        return NET_STATUS_BADEQU;
+    }
+
+    uint8_t *out = solved_buffer(buf, cap, sizeof(count) + (size_t)count * sizeof(struct solved_equation));
+    if (NULL == out)
+    {
+        return NET_STATUS_BADEQU;
+    }
+    const struct net_batch_equation *bequ = (const struct net_batch_equation *)((const uint8_t *)payload + sizeof(count));
+    struct solved_equation *sequ = (struct solved_equation *)(out + sizeof(count));
+    struct unsolved_equation unsolved[EQ_BATCH];
+    memset(unsolved, 0, sizeof(unsolved));
+    for (uint32_t done = 0; done < count; done += EQ_BATCH)
+    {
+        uint32_t batch = count - done < EQ_BATCH ? count - done : EQ_BATCH;
+        for (uint32_t i = 0; i < batch; i++)
+        {
+            unsolved[i].eqid = bequ[done + i].eqid;
+            unsolved[i].operatr = bequ[done + i].operatr;
+            unsolved[i].operand1 = bequ[done + i].operand1;
+            unsolved[i].operand2 = bequ[done + i].operand2;
+        }
+        solve_counted(unsolved, sequ + done, batch);
+    }
+    memcpy(out, payload, sizeof(count));
+    *solved = out;
+    *solvedlen = sizeof(count) + (size_t)count * sizeof(struct solved_equation);
+    return NET_STATUS_OK;
+}
+
+int net_streamable(const struct net_header *req, const uint8_t *payload, size_t len)
+{
+    return req->msgtype == NET_MSG_EQU && len >= sizeof(struct header) &&
+           le32toh(((const struct header *)payload)->magic) == EQU_MAGIC;
+}
+
+/**
+ * @brief starts a streamed answer when the solved file will not fit in buf,
+ * and solves its first chunk
+ *
+ * @param key netcache_key of the upload, used when cache is set
+ * @return int 1 if the result is now a stream, 0 to solve it whole
+ */
+static int stream_answer(netcache_t *cache, uint64_t key, const uint8_t *payload, size_t len,
+                         uint8_t *buf, size_t cap, net_result_t *result)
+{
+    struct header hdr;
+    uint64_t count;
+    if (raw_header(payload, len, &hdr, &count) != NET_STATUS_OK ||
+        sizeof(hdr) + count * sizeof(struct solved_equation) <= cap)
+    {
+        return 0;
+    }
+    net_stream_t *stream = malloc(sizeof(net_stream_t));
+    if (NULL == stream)
+    {
+        return 0;
+    }
+    if (count < le64toh(hdr.numeq))
+    {
+        printf("Malformed file due to equation buffer\n");
+    }
+    hdr.flags = 1;
+    stream->hdr = hdr;
+    stream->equations = (const struct unsolved_equation *)(payload + le32toh(hdr.offset));
+    stream->count = count;
+    stream->done = 0;
+    stream->cache = NULL;
+    if (NULL != cache)
+    {
+        stream->cache = netcache_begin(cache, key, payload, len);
+        if (NULL == stream->cache)
+        {
+            printf("Could not cache solved file!\n");
+        }
+    }
+    result->status = NET_STATUS_OK;
+    result->len = sizeof(hdr) + count * sizeof(struct solved_equation);
+    result->stream = stream;
+    net_result_next(result, buf, cap);
+    return 1;
+}
+
+void net_answer(netcache_t *cache, const struct net_header *req, const uint8_t *payload, size_t len,
+                uint8_t *buf, size_t cap, int stream, net_result_t *result)
+{
+    uint64_t key = 0;
+    size_t solvedlen = 0;
+    result->solved = NULL;
+    result->filefd = -1;
+    result->filebase = 0;
+    result->len = 0;
+    result->owned = 0;
+    result->base = 0;
+    result->avail = 0;
+    result->stream = NULL;
+    if (req->msgtype == NET_MSG_BATCH)
+    {
+        result->status = net_solve_batch(payload, len, buf, cap, &result->solved, &solvedlen);
+    }
+    else
+    {
+        if (NULL != cache)
+        {
+            key = netcache_key(payload, len);
+            result->filefd = netcache_open(cache, key, payload, len, &result->len);
+            if (result->filefd >= 0)
+            {
+                result->filebase = len;
+                metrics_count(METRIC_CACHE_HITS, 1);
+                result->status = NET_STATUS_OK;
+                return;
+            }
+        }
+        if (stream && NULL != buf && net_streamable(req, payload, len) &&
+            stream_answer(cache, key, payload, len, buf, cap, result))
+        {
+            return;
+        }
+        result->status = net_solve(payload, len, buf, cap, &result->solved, &solvedlen);
+        if (NULL != cache && result->status == NET_STATUS_OK &&
+            !netcache_store(cache, key, payload, len, result->solved, solvedlen))
+        {
+            printf("Could not cache solved file!\n");
+        }
+    }
+    result->len = solvedlen;
+    result->avail = solvedlen;
+    result->owned = NULL != result->solved && result->solved != buf;
+}
+
+int net_result_next(net_result_t *result, uint8_t *buf, size_t cap)
+{
+    net_stream_t *stream = result->stream;
+    uint64_t pos = result->base + result->avail;
+    size_t used = 0;
+    if (NULL == stream || pos >= result->len)
+    {
+        return 0;
+    }
+    if (0 == pos)
+    {
+        memcpy(buf, &stream->hdr, sizeof(stream->hdr));
+        used = sizeof(stream->hdr);
+    }
+    uint64_t batch = (cap - used) / sizeof(struct solved_equation);
+    if (batch > stream->count - stream->done)
+    {
+        batch = stream->count - stream->done;
+    }
+    solve_counted(stream->equations + stream->done, (struct solved_equation *)(buf + used), batch);
+    stream->done += batch;
+    used += batch * sizeof(struct solved_equation);
+    result->solved = buf;
+    result->base = pos;
+    result->avail = used;
+
+    if (NULL != stream->cache)
+    {
+        if (!netcache_append(stream->cache, buf, used))
+        {
+            printf("Could not cache solved file!\n");
+            netcache_abort(stream->cache);
+            stream->cache = NULL;
+        }
+        else if (stream->done == stream->count)
+        {
+            if (!netcache_commit(stream->cache))
+            {
+                printf("Could not cache solved file!\n");
+            }
+            stream->cache = NULL;
+        }
+    }
+    return 1;
+}
+
+void net_result_free(net_result_t *result)
+{
+    if (result->owned)
+    {
+        free(result->solved);
+    }
+    result->solved = NULL;
+    if (NULL != result->stream)
+    {
+        if (NULL != result->stream->cache)
+        {
+            netcache_abort(result->stream->cache);
+        }
+        free(result->stream);
+        result->stream = NULL;
+    }
+    if (result->filefd >= 0)
+    {
+        close(result->filefd);
+        result->filefd = -1;
+    }
+}
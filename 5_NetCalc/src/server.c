@@ -1,79 +1,317 @@
 #include "../include/common.h"
+#include "../include/nethdr.h"
+#include "../include/shard.h"
+#include "../include/admission.h"
+#include "../include/metrics.h"
 #include "../../4_ThreadCalc/include/threadpool.h"
-#include "../../4_ThreadCalc/include/equation.h"
-#include "../../3_DataStructures1/include/queue.h"
-#include <linux/limits.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <time.h>
 
-int handle_parsing(int connfd)
+#define QUEUE_CAPACITY 256
+#define POOL_IDLE_SECONDS 30
+#define DRAIN_SECONDS 10
+
+threadpool_t *threadpool;
+char *cachedir = NULL;
+netcache_t cache;
+admission_t admission;
+uint16_t metrics_port = 0;
+
+/**
+ * @brief print usage statement
+ *
+ */
+void print_usage()
 {
+    printf("\n\nUsage: ./netcalc (optional -p <port>) (optional -n <threadcount>)"
+           "\n\t(optional -s <shards>) event loop shards sharing the port with SO_REUSEPORT, default one per cpu"
+           "\n\t(optional -l <bytes>) largest upload a shard solves itself, larger compressed ones go to the threadpool"
+           "\n\t(optional -c <dir>) cache solved files in dir and answer repeat uploads from it"
+           "\n\t(optional -C <MiB>) size the cache is trimmed to, least recently used first, default 256. 0 is unbounded"
+           "\n\t(optional -m <bytes>) payload bytes in flight before requests are refused busy"
+           "\n\t(optional -e <equations>) equations in flight before requests are refused busy"
+           "\n\t(optional -r <rate>) requests per second allowed per client address, default unlimited"
+           "\n\t(optional -b <burst>) requests a client may send at once under -r"
+           "\n\t(optional -a <cores|nodes|both>) threadpool placement; with nodes offloads are solved on the"
+           "\n\t    node of the shard that read them"
+           "\n\t(optional -x <threadcount>) grow the threadpool from -n up to this many threads under load"
+           "\n\t(optional -w <seconds>) idle time before threads above -n retire under -x, default 30"
+           "\n\t(optional -g <seconds>) on SIGINT or SIGTERM stop accepting and finish requests already"
+           "\n\t    started for up to this long, default 10. 0 stops at once"
+           "\n\t(optional -M <port>) serve Prometheus metrics at http://127.0.0.1:<port>/metrics\n\n");
 }
 
-int main(int argc, void **args)
+/**
+ * @brief raises the open file limit to its hard limit so a shard can hold
+ * tens of thousands of idle connections
+ *
+ */
+void raise_fd_limit()
 {
-    int listenfd, connfd, n, port;
-    struct sockaddr_in servaddr;
-    port = 5555;
-    if ((listenfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
-    {
-        printf("Failed to create socket!\n");
-        exit(0);
-    }
-    bzero(&servaddr, sizeof(servaddr));
-    servaddr.sin_family = AF_INET;
-    servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
-    servaddr.sin_port = htons(port);
-
-    if ((bind(listenfd, (struct sockaddr *)&servaddr, sizeof(servaddr))) < 0)
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
     {
-        printf("Failed to bind socket!\n");
-        exit(0);
+        limit.rlim_cur = limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &limit) != 0)
+        {
+            printf("Could not raise the open file limit!\n");
+        }
     }
+}
 
-    if ((listen(listenfd, 10)) < 0)
+/**
+ * @brief serves from event loop shards, one SO_REUSEPORT listener each,
+ * until SIGINT or SIGTERM
+ *
+ * @param port port every shard listens on
+ * @param shardcount number of shards
+ * @param threadcount threads solving offloaded requests
+ * @param maxthreads most threads the pool grows to, threadcount for a
+ * fixed pool
+ * @param idle_seconds idle time before threads above threadcount retire
+ * @param inline_max largest payload a shard solves itself
+ * @param placement threadpool placement flags
+ * @param drain_seconds how long shutdown waits for started requests
+ * @return int 0 on clean shutdown, 1 on error
+ */
+int run_shards(uint16_t port, uint32_t shardcount, int threadcount, int maxthreads, uint32_t idle_seconds,
+               size_t inline_max, int placement, uint32_t drain_seconds)
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    if (maxthreads > threadcount)
+    {
+        threadpool = threadpool_create_elastic(threadcount, maxthreads, QUEUE_CAPACITY, placement,
+                                               idle_seconds * 1000);
+    }
+    else
     {
-        printf("Failed to listen!\n");
-        exit(0);
+        threadpool = threadpool_create_placed(threadcount, QUEUE_CAPACITY, placement);
+    }
+    shard_t *shards = calloc(shardcount, sizeof(shard_t));
+    if (NULL == threadpool || NULL == shards)
+    {
+        free(shards);
+        return 1;
+    }
+    threadpool->customfree = shard_drop_job;
+    metrics_server_t metrics = {.listenfd = -1, .pool = threadpool, .admission = &admission};
+    if (metrics_port > 0 && !metrics_start(&metrics, metrics_port))
+    {
+        threadpool_shutdown(threadpool, THREADPOOL_ABORT, 0, NULL);
+        free(shards);
+        return 1;
+    }
+    uint32_t started = 0;
+    while (started < shardcount)
+    {
+        shards[started].id = started;
+        shards[started].pool = threadpool;
+        shards[started].inline_max = inline_max;
+        shards[started].cache = NULL != cachedir ? &cache : NULL;
+        shards[started].admission = &admission;
+        if (!shard_start(&shards[started], port))
+        {
+            break;
+        }
+        started++;
     }
 
-    for (;;)
+    if (started == shardcount)
     {
-        char buffer[1024];
-        printf("Waiting for connection on port %d...\n", port);
+        int sig;
+        printf("Waiting for connections on port %d with %u shards...\n", port, shardcount);
         fflush(stdout);
-        connfd = accept(listenfd, NULL, NULL);
-        printf("[CONNECTED]\n");
-        snprintf(buffer, sizeof(buffer), "You have been connected!\n");
-        send(connfd, buffer, strlen(buffer), 0);
-        memset(buffer, 0, sizeof(buffer));
-    ///////////////////////////////////////
+        sigwait(&set, &sig);
+    }
 
-        int n, filenameLen;
-        char recvline[1024] = {'\0'};
-        n = recv(connfd, recvline, 1024, 0);
-        filenameLen = atoi(recvline);
-        printf("Filenamelen: %d\n", filenameLen);
+    struct timespec begin;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    uint64_t left_ms = (uint64_t)drain_seconds * 1000;
+    if (left_ms > 0)
+    {
+        for (uint32_t i = 0; i < started; i++)
+        {
+            shard_drain(&shards[i]);
+        }
+        uint32_t drained = 0;
+        while (drained < started)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            uint64_t spent = (now.tv_sec - begin.tv_sec) * 1000 + (now.tv_nsec - begin.tv_nsec) / 1000000;
+            if (spent >= left_ms)
+            {
+                break;
+            }
+            struct timespec pause = {0, 10 * 1000000L};
+            nanosleep(&pause, NULL);
+            drained = 0;
+            for (uint32_t i = 0; i < started; i++)
+            {
+                drained += shard_drained(&shards[i]);
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        uint64_t spent = (now.tv_sec - begin.tv_sec) * 1000 + (now.tv_nsec - begin.tv_nsec) / 1000000;
+        left_ms = spent < left_ms ? left_ms - spent : 0;
+    }
+    for (uint32_t i = 0; i < started; i++)
+    {
+        shard_stop(&shards[i]);
+    }
+    // scrapes read the pool, so they end before it is freed
+    if (metrics.listenfd >= 0)
+    {
+        metrics_stop(&metrics);
+    }
+    threadpool_stats_t stats;
+    threadpool_shutdown(threadpool, THREADPOOL_DEADLINE, left_ms, &stats);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    printf("Shut down in %lu ms: %lu offloaded requests solved, %lu finished while draining, %lu dropped\n",
+           (now.tv_sec - begin.tv_sec) * 1000 + (now.tv_nsec - begin.tv_nsec) / 1000000, stats.completed,
+           stats.drained, stats.dropped);
+    for (uint32_t i = 0; i < started; i++)
+    {
+        shard_free(&shards[i]);
+    }
+    free(shards);
+    metrics_free();
+    return started == shardcount ? 0 : 1;
+}
 
-        memset(recvline, '\0', sizeof(recvline));
-        n = recv(connfd, recvline, 1024, 0);
-        char path[PATH_MAX] = {'\0'};
-        printf("Recvline: %s\n", recvline);
-        snprintf(path, PATH_MAX, "/home/jeremiah/Documents/calcproject/5_NetCalc/Test2/%s", recvline);
-        printf("Path: %s\n", path);
-        memset(recvline, '\0', sizeof(recvline));
-        FILE *fp = fopen(path, "w");
-        n = recv(connfd, recvline, sizeof(struct header), 0);
-        int byteswritten = 0;
-        for (int i = 0; i < n; i++)
+/**
+ * @brief netcalc receives .equ files over TCP framed by the NET header in
+ * ../references/NetSpec.pdf and replies with the solved files. Connections
+ * are served by event loop shards and stay open so requests with the
+ * extended header can be pipelined
+ *
+ * @param argc arg count
+ * @param argv optional -p <port>, -n <threadcount>, -s <shards>,
+ * -l <inline bytes>, -c <cache dir>, -m <in-flight bytes>,
+ * -e <in-flight equations>, -r <requests per second per client>,
+ * -b <burst>, -a <placement>, -x <max threads>, -w <idle seconds>,
+ * -g <drain seconds> and -M <metrics port>
+ * @return int 0 on clean shutdown, 1 on error
+ */
+int main(int argc, char *argv[])
+{
+    uint16_t port = NET_PORT;
+    int threadcount = 4;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t shardcount = cpus > 0 ? cpus : 1;
+    size_t inline_max = SHARD_INLINE_DEFAULT;
+    uint64_t max_bytes = ADMIT_BYTES_DEFAULT;
+    uint64_t max_equations = ADMIT_EQUATIONS_DEFAULT;
+    double rate = 0;
+    double burst = 0;
+    int placement = 0;
+    int maxthreads = 0;
+    uint32_t idle_seconds = POOL_IDLE_SECONDS;
+    uint32_t drain_seconds = DRAIN_SECONDS;
+    uint64_t cache_limit = NETCACHE_LIMIT_DEFAULT;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:n:s:l:c:C:m:e:r:b:a:x:w:g:M:")) != -1)
+    {
+        switch (opt)
         {
-            printf("%x", recvline[i]);
-            byteswritten += fprintf(fp, "%c", recvline[i]);
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'n':
+            threadcount = atoi(optarg);
+            break;
+        case 's':
+            shardcount = strtoul(optarg, NULL, 10);
+            break;
+        case 'l':
+            inline_max = strtoull(optarg, NULL, 10);
+            break;
+        case 'c':
+            cachedir = optarg;
+            break;
+        case 'C':
+            cache_limit = strtoull(optarg, NULL, 10) << 20;
+            break;
+        case 'm':
+            max_bytes = strtoull(optarg, NULL, 10);
+            break;
+        case 'e':
+            max_equations = strtoull(optarg, NULL, 10);
+            break;
+        case 'r':
+            rate = strtod(optarg, NULL);
+            break;
+        case 'b':
+            burst = strtod(optarg, NULL);
+            break;
+        case 'a':
+            placement = threadpool_placement(optarg);
+            if (placement < 0)
+            {
+                print_usage();
+                return 1;
+            }
+            break;
+        case 'x':
+            maxthreads = atoi(optarg);
+            break;
+        case 'w':
+            idle_seconds = strtoul(optarg, NULL, 10);
+            break;
+        case 'g':
+            drain_seconds = strtoul(optarg, NULL, 10);
+            break;
+        case 'M':
+            metrics_port = atoi(optarg);
+            break;
+        default:
+            print_usage();
+            return 1;
         }
-        printf("\nByteswritten: %d\n", byteswritten);
-        fclose(fp);
+    }
+    if (threadcount < 1)
+    {
+        threadcount = 1;
+    }
+    if (shardcount < 1)
+    {
+        shardcount = 1;
+    }
+    if (shardcount > SHARD_MAX)
+    {
+        shardcount = SHARD_MAX;
+    }
+    if (NULL != cachedir && !netcache_init(&cache, cachedir, cache_limit))
+    {
+        printf("Could not create cache directory! %s\n", cachedir);
+        return 1;
+    }
+
+    if (burst < 1)
+    {
+        burst = rate > 1 ? rate : 1;
+    }
 
-    //////////////////////////////////////
-        snprintf(buffer, sizeof(buffer), "You have been disconnected!\n");
-        send(connfd, buffer, strlen(buffer), 0);
-        close(connfd);
+    signal(SIGPIPE, SIG_IGN);
+    raise_fd_limit();
+    admission_init(&admission, max_bytes, max_equations, rate, burst);
+    int rv = run_shards(port, shardcount, threadcount, maxthreads, idle_seconds, inline_max, placement, drain_seconds);
+    if (admission.rejected > 0)
+    {
+        printf("Refused %lu requests as busy\n", (unsigned long)admission.rejected);
     }
-}
\ No newline at end of file
+    admission_destroy(&admission);
+    if (NULL != cachedir)
+    {
+        netcache_destroy(&cache);
+    }
+    return rv;
+}
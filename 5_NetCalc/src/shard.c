@@ -0,0 +1,1057 @@
+#define _GNU_SOURCE
+#include "../include/common.h"
+#include "../include/shard.h"
+#include "../include/netsock.h"
+#include "../include/netsolve.h"
+#include "../include/metrics.h"
+#include "../../4_ThreadCalc/include/stagestats.h"
+#include "../../0_Common/include/probes.h"
+#include <endian.h>
+#include <errno.h>
+#include <sched.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+
+#define REPLY_CAP (SHARD_BLOCK_SIZE - sizeof(shard_reply_t))
+
+/**
+ * @brief a large request offloaded from a shard to the threadpool
+ *
+ */
+typedef struct shard_job_t
+{
+    shard_t *shard;
+    shard_conn_t *conn;
+    struct net_header req;
+    uint8_t *payload;
+    size_t len;
+    uint64_t equations;
+    uint64_t started;
+    int ordered;
+} shard_job_t;
+
+/**
+ * @brief allocates an empty reply. On the shard thread it is a slab block
+ * whose remainder is the reply's transmit buffer; pool workers malloc
+ * theirs
+ *
+ * @param onshard called from the shard thread
+ * @return shard_reply_t* reply, NULL if out of memory
+ */
+static shard_reply_t *alloc_reply(shard_t *shard, int onshard)
+{
+    shard_reply_t *reply = onshard ? slab_get(&shard->blocks) : malloc(sizeof(shard_reply_t));
+    if (NULL == reply)
+    {
+        return NULL;
+    }
+    reply->next = NULL;
+    reply->conn = NULL;
+    reply->off = 0;
+    reply->admitted = 0;
+    reply->equations = 0;
+    reply->pooled = onshard;
+    reply->payload = NULL;
+    reply->started = 0;
+    reply->resumes = 0;
+    reply->result.status = NET_STATUS_OK;
+    reply->result.solved = NULL;
+    reply->result.filefd = -1;
+    reply->result.filebase = 0;
+    reply->result.len = 0;
+    reply->result.owned = 0;
+    reply->result.base = 0;
+    reply->result.avail = 0;
+    reply->result.stream = NULL;
+    return reply;
+}
+
+/**
+ * @brief fills in the reply header once the answer is known
+ *
+ */
+static void seal_reply(const struct net_header *req, shard_reply_t *reply)
+{
+    if (reply->result.status != NET_STATUS_OK)
+    {
+        reply->result.len = 0;
+    }
+    reply->hdrsz = net_header_reply(req, reply->result.status, reply->result.len, &reply->hdr);
+    metrics_reply(req->msgtype, reply->result.status);
+}
+
+/**
+ * @brief builds a reply with a status and no payload
+ *
+ * @param onshard called from the shard thread
+ * @param req host order request being answered
+ * @param status enum net_status of the reply
+ * @return shard_reply_t* reply, NULL if out of memory
+ */
+static shard_reply_t *status_reply(shard_t *shard, int onshard, const struct net_header *req, uint32_t status)
+{
+    shard_reply_t *reply = alloc_reply(shard, onshard);
+    if (NULL != reply)
+    {
+        reply->result.status = status;
+        seal_reply(req, reply);
+    }
+    return reply;
+}
+
+/**
+ * @brief gives back the buffer a payload was collected in, a slab block or
+ * a malloc'd buffer for payloads larger than a block
+ *
+ */
+static void put_payload(shard_t *shard, uint8_t *payload, size_t len)
+{
+    if (len <= SHARD_BLOCK_SIZE)
+    {
+        slab_put(&shard->blocks, payload);
+    }
+    else
+    {
+        free(payload);
+    }
+}
+
+/**
+ * @brief frees a reply, its answer and the upload of a streamed answer,
+ * and returns the request's share of the admission limits
+ *
+ */
+static void free_reply(shard_t *shard, shard_reply_t *reply)
+{
+    if (reply->admitted > 0)
+    {
+        admission_release(shard->admission, reply->admitted, reply->equations);
+    }
+    net_result_free(&reply->result);
+    if (NULL != reply->payload)
+    {
+        put_payload(shard, reply->payload, reply->admitted);
+    }
+    if (reply->pooled)
+    {
+        slab_put(&shard->blocks, reply);
+    }
+    else
+    {
+        free(reply);
+    }
+}
+
+/**
+ * @brief builds a NET_STATUS_BUSY reply carrying how long to back off
+ *
+ */
+static shard_reply_t *busy_reply(shard_t *shard, const struct net_header *req, uint32_t retry_ms)
+{
+    shard_reply_t *reply = status_reply(shard, 1, req, NET_STATUS_BUSY);
+    if (NULL != reply && reply->hdrsz == NET_HDR_EXT_SZ)
+    {
+        reply->hdr.flags = htobe16(retry_ms < UINT16_MAX ? retry_ms : UINT16_MAX);
+    }
+    return reply;
+}
+
+/**
+ * @brief answers an admitted request from the cache or by solving it. On
+ * the shard thread an answer that fits is written into the reply's block.
+ * The reply holds the request's admission until it is freed
+ *
+ * @param onshard called from the shard thread
+ * @param stream stream an answer too large for the block. The caller then
+ * hands the payload to the reply
+ */
+static shard_reply_t *solve_reply(shard_t *shard, int onshard, int stream, const struct net_header *req,
+                                  const uint8_t *payload, size_t len, uint64_t equations)
+{
+    shard_reply_t *reply = alloc_reply(shard, onshard);
+    if (NULL == reply)
+    {
+        admission_release(shard->admission, len, equations);
+        return NULL;
+    }
+    size_t cap = onshard ? REPLY_CAP : 0;
+    net_answer(shard->cache, req, payload, len, onshard ? reply->data : NULL, cap, stream, &reply->result);
+    reply->admitted = len;
+    reply->equations = equations;
+    seal_reply(req, reply);
+    return reply;
+}
+
+/**
+ * @brief appends a reply to a connection's send queue. A NULL reply means
+ * the server ran out of memory, and the connection is closed. A reply
+ * made on the shard is timed from the start of the request being read
+ *
+ */
+static void conn_queue(shard_t *shard, shard_conn_t *conn, shard_reply_t *reply)
+{
+    if (NULL == reply || conn->failed)
+    {
+        if (NULL == reply)
+        {
+            metrics_error(METRIC_ERR_NOMEM);
+        }
+        conn->closing = 1;
+        if (NULL != reply)
+        {
+            free_reply(shard, reply);
+        }
+        return;
+    }
+    if (0 == reply->started)
+    {
+        reply->started = conn->started;
+    }
+    reply->next = NULL;
+    if (NULL == conn->tail)
+    {
+        conn->head = reply;
+    }
+    else
+    {
+        conn->tail->next = reply;
+    }
+    conn->tail = reply;
+}
+
+/**
+ * @brief frees every reply queued on a connection
+ *
+ */
+static void conn_drop_replies(shard_t *shard, shard_conn_t *conn)
+{
+    while (NULL != conn->head)
+    {
+        shard_reply_t *reply = conn->head;
+        conn->head = reply->next;
+        free_reply(shard, reply);
+    }
+    conn->tail = NULL;
+}
+
+/**
+ * @brief sends as much of a reply as the socket takes without blocking
+ *
+ * @return ssize_t bytes sent, -1 with errno set on error
+ */
+static ssize_t send_some(int fd, shard_reply_t *reply)
+{
+    if (reply->off < reply->hdrsz || reply->result.filefd < 0)
+    {
+        // solved holds the answer from base on; earlier chunks are sent
+        struct iovec iov[2];
+        iov[0].iov_base = &reply->hdr;
+        iov[0].iov_len = reply->hdrsz;
+        iov[1].iov_base = reply->result.solved;
+        iov[1].iov_len = reply->result.filefd < 0 ? reply->result.avail : 0;
+        int first = iov_advance(iov, 2, reply->off - reply->result.base);
+        return writev(fd, iov + first, 2 - first);
+    }
+    off_t fileoff = reply->result.filebase + reply->off - reply->hdrsz;
+    return sendfile(fd, reply->result.filefd, &fileoff, reply->hdrsz + reply->result.len - reply->off);
+}
+
+/**
+ * @brief sends queued replies until the socket would block. A streamed
+ * answer is solved a chunk at a time, each once the previous one is sent,
+ * so it advances only as fast as the client reads
+ *
+ */
+static void conn_flush(shard_t *shard, shard_conn_t *conn)
+{
+    while (NULL != conn->head)
+    {
+        shard_reply_t *reply = conn->head;
+        net_result_t *result = &reply->result;
+        if (NULL != result->stream && reply->off == reply->hdrsz + result->base + result->avail)
+        {
+            net_result_next(result, reply->data, REPLY_CAP);
+        }
+        ssize_t rv = send_some(conn->fd, reply);
+        if (rv < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (rv < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return;
+        }
+        if (rv <= 0)
+        {
+            metrics_error(METRIC_ERR_SEND);
+            conn->failed = 1;
+            conn->closing = 1;
+            conn_drop_replies(shard, conn);
+            return;
+        }
+        metrics_count(METRIC_BYTES_OUT, rv);
+        reply->off += rv;
+        if (reply->off == reply->hdrsz + reply->result.len)
+        {
+            uint64_t latency = stage_now() - reply->started;
+            metrics_latency(latency);
+            PROBE5(netcalc, response__sent, conn->fd, be64toh(reply->hdr.request_id), reply->result.status,
+                   reply->off, latency);
+            conn->head = reply->next;
+            if (NULL == conn->head)
+            {
+                conn->tail = NULL;
+            }
+            free_reply(shard, reply);
+        }
+    }
+}
+
+/**
+ * @brief closes a connection once it has nothing left to read, solve or
+ * send, otherwise re-arms the epoll events it still needs
+ *
+ */
+static void conn_settle(shard_t *shard, shard_conn_t *conn)
+{
+    if (conn->closing && 0 == conn->inflight && NULL == conn->head)
+    {
+        epoll_ctl(shard->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+        close(conn->fd);
+        conn->fd = -1;
+        metrics_count(METRIC_CLOSED, 1);
+        if (NULL != conn->prev)
+        {
+            conn->prev->next = conn->next;
+        }
+        else
+        {
+            shard->conns = conn->next;
+        }
+        if (NULL != conn->next)
+        {
+            conn->next->prev = conn->prev;
+        }
+        conn->next = shard->graveyard;
+        shard->graveyard = conn;
+        return;
+    }
+    // a connection waiting only on the pool is taken out of epoll, so a
+    // hung up socket does not report EPOLLHUP on every wait
+    uint32_t events = (conn->closing || conn->paused ? 0 : EPOLLIN) | (NULL != conn->head ? EPOLLOUT : 0);
+    if (events != conn->events)
+    {
+        struct epoll_event ev = {.events = events, .data.ptr = conn};
+        int op = 0 == events ? EPOLL_CTL_DEL : 0 == conn->events ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+        epoll_ctl(shard->epfd, op, conn->fd, &ev);
+        conn->events = events;
+    }
+}
+
+/**
+ * @brief threadpool task for an offloaded request. Solves it and posts the
+ * reply back to the owning shard
+ *
+ * @param voidp the shard_job_t to solve, freed along with its payload
+ * @return void* NULL
+ */
+static void *solve_job(void *voidp)
+{
+    shard_job_t *job = voidp;
+    shard_t *shard = job->shard;
+    shard_reply_t *reply = solve_reply(shard, 0, 0, &job->req, job->payload, job->len, job->equations);
+    if (NULL == reply)
+    {
+        reply = status_reply(shard, 0, &job->req, NET_STATUS_BADEQU);
+    }
+    if (NULL != reply)
+    {
+        uint64_t one = 1;
+        reply->conn = job->conn;
+        reply->started = job->started;
+        reply->resumes = job->ordered;
+        pthread_mutex_lock(&shard->lock);
+        reply->next = shard->done;
+        shard->done = reply;
+        pthread_mutex_unlock(&shard->lock);
+        if (write(shard->eventfd, &one, sizeof(one)) < 0)
+        {
+            printf("Failed to wake shard %u!\n", shard->id);
+        }
+    }
+    free(job->payload);
+    free(job);
+    return NULL;
+}
+
+void shard_drop_job(void *voidp)
+{
+    shard_job_t *job = voidp;
+    admission_release(job->shard->admission, job->len, job->equations);
+    free(job->payload);
+    free(job);
+}
+
+/**
+ * @brief hands a large request to the threadpool. The job takes ownership
+ * of the payload. A legacy request pauses the connection until its reply
+ * is queued, since legacy replies are matched to requests by order alone
+ *
+ * @return int 1 if queued, 0 if out of memory
+ */
+static int conn_offload(shard_t *shard, shard_conn_t *conn, uint8_t *payload, size_t len)
+{
+    shard_job_t *job = malloc(sizeof(shard_job_t));
+    if (NULL != job)
+    {
+        int ordered = conn->req.hdr_len == NET_HDR_SZ;
+        job->shard = shard;
+        job->conn = conn;
+        job->req = conn->req;
+        job->payload = payload;
+        job->len = len;
+        job->equations = conn->equations;
+        job->started = conn->started;
+        job->ordered = ordered;
+        if (threadpool_post(shard->pool, solve_job, job))
+        {
+            conn->inflight++;
+            conn->paused = ordered;
+            return 1;
+        }
+    }
+    admission_release(shard->admission, len, conn->equations);
+    free(payload);
+    free(job);
+    return 0;
+}
+
+/**
+ * @brief returns whether the current request is solved on the shard.
+ * Batches, which NET_BATCH_MAX keeps small, and payloads up to inline_max
+ * are; larger requests go to the threadpool unless they can be streamed,
+ * so a big compressed upload never holds up the shard's other connections
+ *
+ */
+static int conn_inline(const shard_t *shard, const shard_conn_t *conn)
+{
+    return conn->req.msgtype == NET_MSG_BATCH || conn->len <= shard->inline_max;
+}
+
+/**
+ * @brief gives back the buffer of the payload being collected
+ *
+ */
+static void conn_put_payload(shard_t *shard, shard_conn_t *conn)
+{
+    put_payload(shard, conn->payload, conn->len);
+    conn->payload = NULL;
+}
+
+/**
+ * @brief returns to CONN_HEADER for the next request
+ *
+ */
+static void conn_next(shard_conn_t *conn)
+{
+    conn->state = CONN_HEADER;
+    conn->got = 0;
+    conn->payload = NULL;
+    conn->len = 0;
+}
+
+/**
+ * @brief charges an admitted request for the equations its payload
+ * declares, which for a compressed upload can be far more than its size
+ * suggested at admission. A request refused the extra equations is
+ * answered NET_STATUS_BUSY and gives back its admission
+ *
+ * @param payload the request's complete payload
+ * @return int 1 if the request goes on to be answered, 0 if refused
+ */
+static int conn_charge(shard_t *shard, shard_conn_t *conn, const uint8_t *payload)
+{
+    uint32_t retry_ms;
+    uint64_t declared = net_declared(&conn->req, payload, conn->len);
+    if (declared <= conn->equations)
+    {
+        return 1;
+    }
+    if (admission_grow(shard->admission, conn->equations, declared, &retry_ms))
+    {
+        conn->equations = declared;
+        return 1;
+    }
+    admission_release(shard->admission, conn->len, conn->equations);
+    conn_queue(shard, conn, busy_reply(shard, &conn->req, retry_ms));
+    return 0;
+}
+
+/**
+ * @brief answers the request whose payload has been collected. Raw uploads
+ * stay on the shard whatever their size, since a streamed answer is
+ * solved in step with sending it and never delays the loop for long.
+ * Other large uploads are offloaded
+ *
+ */
+static void conn_payload_done(shard_t *shard, shard_conn_t *conn)
+{
+    uint8_t *payload = conn->payload;
+    size_t len = conn->len;
+    if (!conn_charge(shard, conn, payload))
+    {
+        conn_put_payload(shard, conn);
+    }
+    else if (conn_inline(shard, conn) || net_streamable(&conn->req, payload, len))
+    {
+        shard_reply_t *reply = solve_reply(shard, 1, 1, &conn->req, payload, len, conn->equations);
+        if (NULL != reply && NULL != reply->result.stream)
+        {
+            reply->payload = payload;
+            conn->payload = NULL;
+        }
+        else
+        {
+            conn_put_payload(shard, conn);
+        }
+        conn_queue(shard, conn, reply);
+    }
+    else
+    {
+        // the job outlives the block, so a payload held in one is copied
+        if (len <= SHARD_BLOCK_SIZE)
+        {
+            payload = malloc(len);
+            if (NULL != payload)
+            {
+                memcpy(payload, conn->payload, len);
+            }
+            conn_put_payload(shard, conn);
+        }
+        if (NULL == payload)
+        {
+            admission_release(shard->admission, len, conn->equations);
+            metrics_error(METRIC_ERR_NOMEM);
+            conn->closing = 1;
+        }
+        else if (!conn_offload(shard, conn, payload, len))
+        {
+            metrics_error(METRIC_ERR_NOMEM);
+            conn->closing = 1;
+        }
+    }
+    conn_next(conn);
+}
+
+/**
+ * @brief acts on a complete header. A valid request is put through
+ * admission control; a refused one is answered NET_STATUS_BUSY at once and
+ * its payload skipped. An admitted request moves on to CONN_PAYLOAD, unless
+ * its whole payload is already in data and it is solved inline, in which
+ * case it is answered straight from data
+ *
+ * @param data bytes received after the header
+ * @param avail size of data
+ * @return size_t bytes of data consumed
+ */
+static size_t conn_header_done(shard_t *shard, shard_conn_t *conn, const uint8_t *data, size_t avail)
+{
+    net_header_to_host(&conn->req);
+    int status = net_header_validate(&conn->req);
+    PROBE5(netcalc, request__header, conn->fd, conn->req.request_id, conn->req.msgtype,
+           conn->req.pkt_len - conn->req.hdr_len, status);
+    if (status != NET_STATUS_OK)
+    {
+        conn_queue(shard, conn, status_reply(shard, 1, &conn->req, NET_STATUS_BADHDR));
+        if (net_header_recoverable(&conn->req))
+        {
+            conn->skip = conn->req.pkt_len - conn->req.hdr_len;
+            conn_next(conn);
+            conn->state = conn->skip > 0 ? CONN_SKIP : CONN_HEADER;
+        }
+        else
+        {
+            conn->closing = 1;
+        }
+        return 0;
+    }
+
+    uint32_t retry_ms;
+    conn->len = conn->req.pkt_len - conn->req.hdr_len;
+    conn->equations = admission_cost(conn->len);
+    if (!admission_acquire(shard->admission, conn->addr, conn->len, conn->equations, &retry_ms))
+    {
+        conn_queue(shard, conn, busy_reply(shard, &conn->req, retry_ms));
+        conn->skip = conn->len;
+        conn_next(conn);
+        conn->state = CONN_SKIP;
+        return 0;
+    }
+    if (avail >= conn->len && conn_inline(shard, conn))
+    {
+        size_t len = conn->len;
+        if (conn_charge(shard, conn, data))
+        {
+            conn_queue(shard, conn, solve_reply(shard, 1, 0, &conn->req, data, len, conn->equations));
+        }
+        conn_next(conn);
+        return len;
+    }
+    conn->payload = conn->len <= SHARD_BLOCK_SIZE ? slab_get(&shard->blocks) : malloc(conn->len);
+    if (NULL == conn->payload)
+    {
+        admission_release(shard->admission, conn->len, conn->equations);
+        metrics_error(METRIC_ERR_NOMEM);
+        conn->closing = 1;
+        return 0;
+    }
+    conn->state = CONN_PAYLOAD;
+    conn->got = 0;
+    return 0;
+}
+
+/**
+ * @brief bytes of header to collect. Only the first 48 bytes say whether
+ * the header is extended
+ *
+ */
+static size_t conn_header_size(const shard_conn_t *conn)
+{
+    if (conn->got < NET_HDR_SZ)
+    {
+        return NET_HDR_SZ;
+    }
+    return be32toh(conn->req.hdr_len) == NET_HDR_EXT_SZ ? NET_HDR_EXT_SZ : NET_HDR_SZ;
+}
+
+/**
+ * @brief advances a connection's state machine over received bytes. Every
+ * state takes as many bytes as it needs and keeps its progress in the
+ * connection, so a request split across any number of reads resumes where
+ * it stopped
+ *
+ * @param data received bytes
+ * @param n size of data
+ */
+static void conn_feed(shard_t *shard, shard_conn_t *conn, const uint8_t *data, size_t n)
+{
+    size_t pos = 0;
+    while (pos < n && !conn->closing && !conn->paused)
+    {
+        size_t take;
+        switch (conn->state)
+        {
+        case CONN_HEADER:
+            if (0 == conn->got)
+            {
+                conn->started = stage_now();
+            }
+            take = conn_header_size(conn) - conn->got;
+            take = take < n - pos ? take : n - pos;
+            memcpy((uint8_t *)&conn->req + conn->got, data + pos, take);
+            conn->got += take;
+            pos += take;
+            if (conn->got == conn_header_size(conn))
+            {
+                pos += conn_header_done(shard, conn, data + pos, n - pos);
+            }
+            break;
+        case CONN_PAYLOAD:
+            take = conn->len - conn->got;
+            take = take < n - pos ? take : n - pos;
+            memcpy(conn->payload + conn->got, data + pos, take);
+            conn->got += take;
+            pos += take;
+            if (conn->got == conn->len)
+            {
+                conn_payload_done(shard, conn);
+            }
+            break;
+        default:
+            take = conn->skip < n - pos ? conn->skip : n - pos;
+            conn->skip -= take;
+            pos += take;
+            if (conn->skip == 0)
+            {
+                conn_next(conn);
+            }
+            break;
+        }
+    }
+    if (conn->paused && pos < n && !conn->closing)
+    {
+        // the scratch buffer is reused by the next read, so bytes behind
+        // the paused request are kept until it is answered
+        conn->held = malloc(n - pos);
+        if (NULL == conn->held)
+        {
+            metrics_error(METRIC_ERR_NOMEM);
+            conn->closing = 1;
+            return;
+        }
+        memcpy(conn->held, data + pos, n - pos);
+        conn->heldlen = n - pos;
+    }
+}
+
+/**
+ * @brief reads what the socket has and advances the connection. A payload
+ * being collected is read into directly; everything else goes through the
+ * shard's scratch buffer
+ *
+ */
+static void conn_read(shard_t *shard, shard_conn_t *conn)
+{
+    ssize_t rv;
+    if (conn->paused)
+    {
+        return;
+    }
+    if (conn->state == CONN_PAYLOAD)
+    {
+        rv = recv(conn->fd, conn->payload + conn->got, conn->len - conn->got, 0);
+    }
+    else
+    {
+        rv = recv(conn->fd, shard->scratch, SHARD_READ_CHUNK, 0);
+    }
+    if (rv < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    {
+        return;
+    }
+    if (rv <= 0)
+    {
+        // the peer is done sending; replies still owed are flushed first
+        conn->closing = 1;
+        if (rv < 0)
+        {
+            metrics_error(METRIC_ERR_RECV);
+            conn->failed = 1;
+            conn_drop_replies(shard, conn);
+        }
+        return;
+    }
+    metrics_count(METRIC_BYTES_IN, rv);
+    if (conn->state == CONN_PAYLOAD)
+    {
+        conn->got += rv;
+        if (conn->got == conn->len)
+        {
+            conn_payload_done(shard, conn);
+        }
+        return;
+    }
+    conn_feed(shard, conn, shard->scratch, rv);
+}
+
+/**
+ * @brief returns a closed connection to the slab along with any payload
+ * it was collecting and that request's admission
+ *
+ */
+static void conn_free(shard_t *shard, shard_conn_t *conn)
+{
+    if (NULL != conn->payload)
+    {
+        admission_release(shard->admission, conn->len, conn->equations);
+        conn_put_payload(shard, conn);
+    }
+    free(conn->held);
+    slab_put(&shard->connslab, conn);
+}
+
+/**
+ * @brief accepts every pending connection on the shard's listener
+ *
+ */
+static void accept_connections(shard_t *shard)
+{
+    for (;;)
+    {
+        struct sockaddr_in peer;
+        socklen_t peerlen = sizeof(peer);
+        int fd = accept4(shard->listenfd, (struct sockaddr *)&peer, &peerlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            return;
+        }
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        shard_conn_t *conn = slab_get(&shard->connslab);
+        if (NULL == conn)
+        {
+            close(fd);
+            continue;
+        }
+        memset(conn, 0, sizeof(*conn));
+        conn->fd = fd;
+        conn->addr = peer.sin_addr.s_addr;
+        conn->state = CONN_HEADER;
+        conn->events = EPOLLIN;
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = conn};
+        if (epoll_ctl(shard->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        {
+            slab_put(&shard->connslab, conn);
+            close(fd);
+            continue;
+        }
+        metrics_count(METRIC_OPENED, 1);
+        PROBE3(netcalc, conn__accept, fd, conn->addr, shard->id);
+        conn->next = shard->conns;
+        if (NULL != shard->conns)
+        {
+            shard->conns->prev = conn;
+        }
+        shard->conns = conn;
+    }
+}
+
+/**
+ * @brief reads on once the legacy request a connection paused for has its
+ * reply queued, starting with the bytes that arrived behind it
+ *
+ */
+static void conn_resume(shard_t *shard, shard_conn_t *conn)
+{
+    uint8_t *held = conn->held;
+    conn->paused = 0;
+    conn->held = NULL;
+    if (NULL != held)
+    {
+        conn_feed(shard, conn, held, conn->heldlen);
+        free(held);
+    }
+}
+
+/**
+ * @brief queues replies finished by pool workers on their connections
+ *
+ */
+static void collect_replies(shard_t *shard)
+{
+    uint64_t count;
+    while (read(shard->eventfd, &count, sizeof(count)) > 0)
+    {
+    }
+    pthread_mutex_lock(&shard->lock);
+    shard_reply_t *done = shard->done;
+    shard->done = NULL;
+    pthread_mutex_unlock(&shard->lock);
+
+    // workers push onto the front, reverse to send in completion order
+    shard_reply_t *ordered = NULL;
+    while (NULL != done)
+    {
+        shard_reply_t *next = done->next;
+        done->next = ordered;
+        ordered = done;
+        done = next;
+    }
+    while (NULL != ordered)
+    {
+        shard_reply_t *reply = ordered;
+        shard_conn_t *conn = reply->conn;
+        ordered = reply->next;
+        conn->inflight--;
+        int resumes = reply->resumes;
+        conn_queue(shard, conn, reply);
+        if (resumes)
+        {
+            conn_resume(shard, conn);
+        }
+        conn_flush(shard, conn);
+        conn_settle(shard, conn);
+    }
+}
+
+/**
+ * @brief one pass of a drain. The first closes the listener after
+ * accepting every connection that completed its handshake, since closing
+ * it would reset them, and reads what those connections have already
+ * sent. Every pass closes connections that sit between requests, so each
+ * keeps only the request it is in the middle of. Marks the shard drained
+ * once it has no connections left
+ *
+ */
+static void drain_step(shard_t *shard)
+{
+    int first = shard->listenfd >= 0;
+    if (first)
+    {
+        accept_connections(shard);
+        epoll_ctl(shard->epfd, EPOLL_CTL_DEL, shard->listenfd, NULL);
+        close(shard->listenfd);
+        shard->listenfd = -1;
+    }
+    shard_conn_t *conn = shard->conns;
+    while (NULL != conn)
+    {
+        shard_conn_t *next = conn->next;
+        if (first && !conn->closing)
+        {
+            conn_read(shard, conn);
+            conn_flush(shard, conn);
+        }
+        if (!conn->closing && CONN_HEADER == conn->state && 0 == conn->got && NULL == conn->held)
+        {
+            conn->closing = 1;
+        }
+        conn_settle(shard, conn);
+        conn = next;
+    }
+    while (NULL != shard->graveyard)
+    {
+        conn = shard->graveyard;
+        shard->graveyard = conn->next;
+        conn_free(shard, conn);
+    }
+    if (NULL == shard->conns)
+    {
+        __atomic_store_n(&shard->drained, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+/**
+ * @brief event loop of one shard
+ *
+ * @param voidp the shard_t to run
+ */
+static void *shard_function(void *voidp)
+{
+    shard_t *shard = voidp;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(shard->id % cpus, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    struct epoll_event events[SHARD_EVENTS];
+    while (!shard->stop)
+    {
+        int n = epoll_wait(shard->epfd, events, SHARD_EVENTS, -1);
+        for (int i = 0; i < n; i++)
+        {
+            if (events[i].data.ptr == &shard->listenfd)
+            {
+                accept_connections(shard);
+                continue;
+            }
+            if (events[i].data.ptr == &shard->eventfd)
+            {
+                collect_replies(shard);
+                continue;
+            }
+            shard_conn_t *conn = events[i].data.ptr;
+            if (conn->fd < 0)
+            {
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            {
+                conn_read(shard, conn);
+            }
+            conn_flush(shard, conn);
+            conn_settle(shard, conn);
+        }
+        while (NULL != shard->graveyard)
+        {
+            shard_conn_t *conn = shard->graveyard;
+            shard->graveyard = conn->next;
+            conn_free(shard, conn);
+        }
+        if (shard->draining)
+        {
+            drain_step(shard);
+        }
+    }
+    return NULL;
+}
+
+int shard_start(shard_t *shard, uint16_t port)
+{
+    shard->listenfd = net_listen(port, 1);
+    shard->epfd = epoll_create1(EPOLL_CLOEXEC);
+    shard->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    shard->scratch = malloc(SHARD_READ_CHUNK);
+    slab_init(&shard->connslab, sizeof(shard_conn_t), SHARD_SLAB_CONNS);
+    slab_init(&shard->blocks, SHARD_BLOCK_SIZE, SHARD_SLAB_BLOCKS);
+    if (shard->listenfd < 0 || shard->epfd < 0 || shard->eventfd < 0 || NULL == shard->scratch)
+    {
+        printf("Failed to start shard %u!\n", shard->id);
+        return 0;
+    }
+    fcntl(shard->listenfd, F_SETFL, fcntl(shard->listenfd, F_GETFL) | O_NONBLOCK);
+    pthread_mutex_init(&shard->lock, NULL);
+
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = &shard->listenfd};
+    epoll_ctl(shard->epfd, EPOLL_CTL_ADD, shard->listenfd, &ev);
+    ev.data.ptr = &shard->eventfd;
+    epoll_ctl(shard->epfd, EPOLL_CTL_ADD, shard->eventfd, &ev);
+
+    if (pthread_create(&shard->thread, NULL, shard_function, shard) != 0)
+    {
+        printf("Failed to start shard %u!\n", shard->id);
+        return 0;
+    }
+    return 1;
+}
+
+void shard_drain(shard_t *shard)
+{
+    uint64_t one = 1;
+    shard->draining = 1;
+    if (write(shard->eventfd, &one, sizeof(one)) < 0)
+    {
+        printf("Failed to wake shard %u!\n", shard->id);
+    }
+}
+
+int shard_drained(shard_t *shard)
+{
+    return __atomic_load_n(&shard->drained, __ATOMIC_SEQ_CST);
+}
+
+void shard_stop(shard_t *shard)
+{
+    uint64_t one = 1;
+    shard->stop = 1;
+    if (write(shard->eventfd, &one, sizeof(one)) < 0)
+    {
+        printf("Failed to wake shard %u!\n", shard->id);
+    }
+    pthread_join(shard->thread, NULL);
+}
+
+void shard_free(shard_t *shard)
+{
+    while (NULL != shard->conns)
+    {
+        shard_conn_t *conn = shard->conns;
+        shard->conns = conn->next;
+        conn_drop_replies(shard, conn);
+        close(conn->fd);
+        conn_free(shard, conn);
+    }
+    while (NULL != shard->done)
+    {
+        shard_reply_t *reply = shard->done;
+        shard->done = reply->next;
+        free_reply(shard, reply);
+    }
+    if (shard->listenfd >= 0)
+    {
+        close(shard->listenfd);
+    }
+    close(shard->epfd);
+    close(shard->eventfd);
+    free(shard->scratch);
+    slab_destroy(&shard->connslab);
+    slab_destroy(&shard->blocks);
+    pthread_mutex_destroy(&shard->lock);
+}
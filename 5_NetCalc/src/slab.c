@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "../include/slab.h"
+
+void slab_init(slab_t *slab, size_t objsize, size_t perchunk)
+{
+    slab->objsize = (objsize + 15) & ~(size_t)15;
+    slab->perchunk = perchunk > 0 ? perchunk : 1;
+    slab->free = NULL;
+    slab->chunks = NULL;
+    slab->used = 0;
+}
+
+void *slab_get(slab_t *slab)
+{
+    if (NULL == slab->free)
+    {
+        slab_chunk_t *chunk = malloc(sizeof(slab_chunk_t) + slab->objsize * slab->perchunk + 15);
+        if (NULL == chunk)
+        {
+            printf("Failed to grow slab!\n");
+            return NULL;
+        }
+        chunk->next = slab->chunks;
+        slab->chunks = chunk;
+        uint8_t *base = (uint8_t *)(((uintptr_t)chunk->data + 15) & ~(uintptr_t)15);
+        for (size_t i = slab->perchunk; i > 0; i--)
+        {
+            slab_free_t *obj = (slab_free_t *)(base + (i - 1) * slab->objsize);
+            obj->next = slab->free;
+            slab->free = obj;
+        }
+    }
+    slab_free_t *obj = slab->free;
+    slab->free = obj->next;
+    slab->used++;
+    return obj;
+}
+
+void slab_put(slab_t *slab, void *obj)
+{
+    slab_free_t *node = obj;
+    node->next = slab->free;
+    slab->free = node;
+    slab->used--;
+}
+
+void slab_destroy(slab_t *slab)
+{
+    while (NULL != slab->chunks)
+    {
+        slab_chunk_t *chunk = slab->chunks;
+        slab->chunks = chunk->next;
+        free(chunk);
+    }
+    slab->free = NULL;
+    slab->used = 0;
+}
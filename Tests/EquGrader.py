@@ -13,6 +13,9 @@ SOLV_EQU_SIZE = 14
 # Magic values
 EQU_HDR_MAGIC = 0xdd77bb55
 
+# Optional header bit of a solved file with an eqid index trailer (threadcalc -i)
+SOLVED_OPT_INDEX = 0x8000
+
 # Assign Operators to Values
 OPERATORS = {
     "ADD":      b"\x01",
@@ -130,7 +133,8 @@ class Equation():
 
         self.flag = struct.unpack_from("<c", bytes, offset=4)[0]
         self.operator = struct.unpack_from("<c", bytes, offset=13)[0]
-        self.op_pos = self.opval.index(self.operator)
+        # an unknown operator is answered with an unsolved record
+        self.op_pos = self.opval.index(self.operator) if self.operator in self.opval else None
 
 
         if int.from_bytes(self.operator, "little") > int.from_bytes(self.operations["MOD"], "little"):
@@ -152,7 +156,7 @@ class Equation():
     def __str__(self):
         try:
             return "\t\t--Equation--\n\tID:\t\t{}\n\tOperand 1:\t{}\n\tOperator:\t{}\n\tOperand 2:\t{}".format(self.id, self.op1, self.opkeys[self.op_pos], self.op2)
-        except KeyError:
+        except (KeyError, TypeError):
             return "\t\t--Equation--\n\tID:\t\t{}\n\tOperand 1:\t{}\n\tOperator:\t{}\n\tOperand 2:\t{}".format(self.id, self.op1, self.operator, self.op2)
 
 class Solution():
@@ -401,7 +405,7 @@ class EquGrader():
             self.inheader.fileid != self.solheader.fileid or
             self.inheader.numequ != self.solheader.numequ or
             self.inheader.offset != self.solheader.offset or
-            self.inheader.numopt != self.solheader.numopt):
+            self.inheader.numopt != (self.solheader.numopt & ~SOLVED_OPT_INDEX)):
             errors.append("[-] File headers don't match.") 
             errors.append("[-] Expected:\n{}\n[-] Got:\n{}".format(self.inheader, self.solheader))
             debug.append("[+] Expected:\n{}\n[-] Got:\n{}".format(self.inheader, self.solheader))
@@ -1,13 +1,37 @@
+import gzip
 import struct
 import os
+import re
+import resource
+import signal
 import socket
+import subprocess
+import tempfile
+import threading
 import time
+import urllib.error
+import urllib.request
 import EquGrader
 
 NET_HDR_SZ = 48
+NET_HDR_EXT_SZ = 64
 NET_FNAME_MAX = 24
 NET_NAME_FIELD_SZ = 32
 
+NET_MSG_BATCH = 1
+NET_BATCH_MAX = 4096
+NET_NUMEQ_MAX = 1 << 22
+
+NET_STATUS_OK = 0
+NET_STATUS_BADEQU = 2
+NET_STATUS_BUSY = 3
+
+# ctest points CALC_BUILD at its build tree; without it build.sh builds every
+# NetCalc binary in 5_NetCalc/build. Absolute, as run_binary changes directory
+CALC_BUILD = os.environ.get("CALC_BUILD")
+NETCALC_BUILD = os.path.abspath(f"{CALC_BUILD}/5_NetCalc" if CALC_BUILD else "./5_NetCalc/build")
+NETCALC_CACHE = os.path.abspath(f"{CALC_BUILD}/CMakeCache.txt" if CALC_BUILD else f"{NETCALC_BUILD}/CMakeCache.txt")
+
 
 def gen_net_hdr(pkt_len, efile_name_len, efile_name):
     hdr = b""
@@ -72,9 +96,10 @@ def check_nethdr_correctness():
         
 def run_binary():
     os.chdir("./5_NetCalc")
-    os.system("./build.sh")
+    if not CALC_BUILD:
+        os.system("./build.sh")
     print("Starting server in background")
-    os.system("./build/netcalc &") # start server in background
+    os.system(f"{NETCALC_BUILD}/netcalc &") # start server in background
     time.sleep(1) #ensure server spinup
     try:
         if check_nethdr_handling() < 0:
@@ -105,6 +130,930 @@ def run_binary():
     os.chdir("../")
 
 
+def gen_ext_hdr(pkt_len, efile_name, request_id, msgtype=0):
+    """64-byte pipelined request header"""
+    return struct.pack("!IIQ32sQHHI", NET_HDR_EXT_SZ, len(efile_name), pkt_len + NET_HDR_EXT_SZ,
+                       efile_name.encode('utf-8'), request_id, msgtype, 0, 0)
+
+
+def recv_exact(s, n):
+    data = bytearray()
+    while len(data) < n:
+        chunk = s.recv(min(n - len(data), 1 << 20))
+        if not chunk:
+            raise ConnectionError("server closed the connection")
+        data += chunk
+    return bytes(data)
+
+
+def recv_reply(s):
+    """Reads one reply. Returns (request_id, status, flags, payload), with
+    request_id None for a legacy reply"""
+    hdr = recv_exact(s, NET_HDR_SZ)
+    hdr_len, _, pkt_len = struct.unpack("!IIQ", hdr[:16])
+    request_id, status, flags = None, NET_STATUS_OK, 0
+    if hdr_len == NET_HDR_EXT_SZ:
+        request_id, _, flags, status = struct.unpack("!QHHI", recv_exact(s, NET_HDR_EXT_SZ - NET_HDR_SZ))
+    return request_id, status, flags, recv_exact(s, pkt_len - hdr_len)
+
+
+def gen_equ(num_equ):
+    """Bytes of a generated unsolved file"""
+    equ_file = EquGrader.EquFile()
+    equ_file.gen_equations(num_equ)
+    with tempfile.TemporaryDirectory() as tmp:
+        equ_file.write_file(f"{tmp}/gen.equ")
+        with open(f"{tmp}/gen.equ", "rb") as ef:
+            return ef.read()
+
+
+def solved_ok(unsolved, solved):
+    """Grades a solved file received for an unsolved one"""
+    with tempfile.TemporaryDirectory() as tmp:
+        with open(f"{tmp}/unsolved.equ", "wb") as uf:
+            uf.write(unsolved)
+        with open(f"{tmp}/solved.equ", "wb") as sf:
+            sf.write(solved)
+        return EquGrader.EquGrader(f"{tmp}/unsolved.equ", f"{tmp}/solved.equ").fail == 0
+
+
+def start_server(port, *options, env=None):
+    """Starts netcalc on port and waits until it accepts connections"""
+    # a file rather than a pipe, which a chatty server could fill and block on
+    output = tempfile.TemporaryFile("w+")
+    server = subprocess.Popen([f"{NETCALC_BUILD}/netcalc", "-p", str(port), *options],
+                              stdout=output, stderr=subprocess.STDOUT, text=True, env=env)
+    server.output = output
+    for _ in range(50):
+        try:
+            socket.create_connection(("127.0.0.1", port)).close()
+            return server
+        except ConnectionRefusedError:
+            time.sleep(0.1)
+    return server
+
+
+def stop_server(server):
+    """Stops a server with SIGINT and returns its output"""
+    server.send_signal(signal.SIGINT)
+    try:
+        server.wait(timeout=30)
+    except subprocess.TimeoutExpired:
+        server.kill()
+        server.wait()
+    server.output.seek(0)
+    output = server.output.read()
+    server.output.close()
+    return output
+
+
+def check_pipelining():
+    """Extended requests pipelined on one connection are each answered once,
+    echoing their request_id; legacy requests after them are answered in
+    order"""
+    tests_passed = 0
+    server = start_server(31340)
+    uploads = {request_id: gen_equ(16 << request_id) for request_id in range(8)}
+    legacy = [gen_equ(32), gen_equ(48)]
+    with socket.create_connection(("127.0.0.1", 31340)) as s:
+        s.sendall(b"".join(gen_ext_hdr(len(u), "pipe.equ", i) + u for i, u in uploads.items()))
+        answered = {}
+        for _ in uploads:
+            request_id, status, _, payload = recv_reply(s)
+            if status == NET_STATUS_OK and request_id in uploads and request_id not in answered:
+                answered[request_id] = payload
+        if len(answered) == len(uploads) and all(solved_ok(uploads[i], answered[i]) for i in answered):
+            tests_passed += 1
+        else:
+            print("Pipelined requests were not each answered correctly")
+
+        s.sendall(b"".join(gen_net_hdr(len(u), 7, "old.equ") + u for u in legacy))
+        replies = [recv_reply(s) for _ in legacy]
+        if all(r[0] is None and solved_ok(u, r[3]) for u, r in zip(legacy, replies)):
+            tests_passed += 1
+        else:
+            print("Legacy requests were not answered in order")
+    stop_server(server)
+
+    return tests_passed - 2
+
+
+def check_sharding():
+    """Four shards answer many concurrent connections. A compressed legacy
+    upload over -l is offloaded to the threadpool, and the small requests
+    pipelined behind it still get their replies after it"""
+    tests_passed = 0
+    server = start_server(31341, "-s", "4", "-l", "4096")
+    failures = []
+
+    def client():
+        try:
+            with socket.create_connection(("127.0.0.1", 31341)) as s:
+                for _ in range(4):
+                    upload = gen_equ(256)
+                    s.sendall(gen_net_hdr(len(upload), 7, "cli.equ") + upload)
+                    if not solved_ok(upload, recv_reply(s)[3]):
+                        failures.append("wrong answer")
+        except (ConnectionError, OSError) as e:
+            failures.append(str(e))
+
+    clients = [threading.Thread(target=client) for _ in range(16)]
+    for c in clients:
+        c.start()
+    for c in clients:
+        c.join()
+    if not failures:
+        tests_passed += 1
+    else:
+        print("Concurrent clients failed:", failures[:4])
+
+    big = gen_equ(20000)
+    small = [gen_equ(10), gen_equ(20)]
+    with socket.create_connection(("127.0.0.1", 31341)) as s:
+        packed = gzip.compress(big)
+        s.sendall(gen_net_hdr(len(packed), 7, "big.equ") + packed +
+                  b"".join(gen_net_hdr(len(u), 7, "sml.equ") + u for u in small))
+        replies = [recv_reply(s)[3] for _ in range(3)]
+    if all(solved_ok(u, r) for u, r in zip([big] + small, replies)):
+        tests_passed += 1
+    else:
+        print("Legacy replies came back out of order")
+    output = stop_server(server)
+    offloaded = re.search(r"(\d+) offloaded", output)
+    if offloaded and int(offloaded.group(1)) >= 1:
+        tests_passed += 1
+    else:
+        print("The large legacy upload was not offloaded:", output)
+
+    return tests_passed - 3
+
+
+def ask(port, upload):
+    """Sends one legacy upload on a fresh connection and returns the answer"""
+    with socket.create_connection(("127.0.0.1", port)) as s:
+        s.sendall(gen_net_hdr(len(upload), 7, "ask.equ") + upload)
+        return recv_reply(s)[3]
+
+
+def check_cache():
+    """-c answers a repeated upload from the cache dir, also through sendfile
+    for a streamed answer, but only once the stored upload matches: an
+    entry moved under another upload's name is not served. -C trims the
+    cache to its size limit"""
+    tests_passed = 0
+    with tempfile.TemporaryDirectory() as cachedir:
+        server = start_server(31342, "-c", cachedir, "-C", "1")
+
+        def entry_of(upload):
+            for name in os.listdir(cachedir):
+                with open(f"{cachedir}/{name}", "rb") as cf:
+                    if cf.read(len(upload)) == upload:
+                        return f"{cachedir}/{name}"
+            return None
+
+        first = gen_equ(100)
+        answer = ask(31342, first)
+        # a hit serves the entry as stored, so a marked entry proves one
+        marked = entry_of(first)
+        with open(marked, "r+b") as cf:
+            cf.seek(-1, os.SEEK_END)
+            cf.write(b"\xff")
+        if solved_ok(first, answer) and ask(31342, first) == answer[:-1] + b"\xff":
+            tests_passed += 1
+        else:
+            print("A repeated upload was not answered from the cache")
+
+        other = gen_equ(100)
+        ask(31342, other)
+        os.replace(entry_of(other), marked)
+        if ask(31342, first) == answer:
+            tests_passed += 1
+        else:
+            print("A cache entry of another upload was served")
+
+        big = gen_equ(20000)
+        if solved_ok(big, ask(31342, big)) and solved_ok(big, ask(31342, big)):
+            tests_passed += 1
+        else:
+            print("A cached streamed answer was wrong")
+
+        for _ in range(4):
+            ask(31342, gen_equ(20000))
+        used = sum(os.path.getsize(f"{cachedir}/{name}") for name in os.listdir(cachedir))
+        if used <= 1 << 20:
+            tests_passed += 1
+        else:
+            print("The cache grew past -C to", used)
+        stop_server(server)
+
+    return tests_passed - 4
+
+
+def vm_size_kb(pid, field="VmSize"):
+    with open(f"/proc/{pid}/status") as status:
+        for line in status:
+            if line.startswith(f"{field}:"):
+                return int(line.split()[1])
+    return 0
+
+
+def check_batches():
+    """NET_MSG_BATCH requests of raw equations are answered with a count and
+    solved records; an oversized batch is refused NET_STATUS_BADEQU. A few
+    gzip bytes declaring NET_NUMEQ_MAX equations are answered for the ones
+    they hold, without the server reserving room for the rest"""
+    tests_passed = 0
+    # one malloc arena, so allocations cannot be carved from address space
+    # a thread arena reserved up front, and all count against RLIMIT_AS below
+    server = start_server(31343, env=dict(os.environ, MALLOC_ARENA_MAX="1"))
+    upload = gen_equ(1000)
+    equations = [upload[EquGrader.EQU_HDR_SIZE + i * EquGrader.SER_EQU_SIZE:][:EquGrader.SER_EQU_SIZE]
+                 for i in range(1000)]
+    expected = [EquGrader.Solution(EquGrader.Equation(e)) for e in equations]
+    # eqid, operator, operand1, operand2 as little endian uint32, uint8, uint64, uint64
+    batch = struct.pack("<I", len(equations)) + b"".join(e[0:4] + e[13:14] + e[5:13] + e[14:22] for e in equations)
+    oversized = struct.pack("<I", NET_BATCH_MAX + 1) + bytes(21 * (NET_BATCH_MAX + 1))
+    with socket.create_connection(("127.0.0.1", 31343)) as s:
+        s.sendall(gen_ext_hdr(len(batch), "", 1, NET_MSG_BATCH) + batch)
+        _, status, _, payload = recv_reply(s)
+        count = struct.unpack_from("<I", payload)[0] if len(payload) >= 4 else 0
+        given = [EquGrader.Solution(payload[4 + i * 14:][:14]) for i in range(count)]
+        if status == NET_STATUS_OK and count == len(expected) and \
+                all(g.id == e.id and g.solution == e.solution for g, e in zip(given, expected)):
+            tests_passed += 1
+        else:
+            print("A batch was answered wrongly")
+
+        s.sendall(gen_ext_hdr(len(oversized), "", 2, NET_MSG_BATCH) + oversized)
+        if recv_reply(s)[1] == NET_STATUS_BADEQU:
+            tests_passed += 1
+        else:
+            print("An oversized batch was not refused")
+
+        small = bytearray(gen_equ(10))
+        struct.pack_into("<Q", small, 12, NET_NUMEQ_MAX)
+        bomb = gzip.compress(bytes(small))
+        # untouched allocations never show in the resident set, so instead
+        # the server is held to 16 MiB more address space than it has now
+        limit = (vm_size_kb(server.pid) + (16 << 10)) << 10
+        resource.prlimit(server.pid, resource.RLIMIT_AS, (limit, resource.RLIM_INFINITY))
+        s.sendall(gen_ext_hdr(len(bomb), "bomb.equ", 3) + bomb)
+        _, status, _, payload = recv_reply(s)
+        resource.prlimit(server.pid, resource.RLIMIT_AS, (resource.RLIM_INFINITY, resource.RLIM_INFINITY))
+        if status == NET_STATUS_OK and len(payload) == EquGrader.EQU_HDR_SIZE + 10 * EquGrader.SOLV_EQU_SIZE:
+            tests_passed += 1
+        else:
+            print(f"Overstated numeq got status {status} and {len(payload)} bytes")
+    stop_server(server)
+
+    return tests_passed - 3
+
+
+def check_partial_reads():
+    """A shard keeps serving while a connection is stalled partway through a
+    header, and a request that trickles in a few bytes at a time, split
+    inside both header and payload, is answered as if sent whole"""
+    tests_passed = 0
+    server = start_server(31344, "-s", "1")
+    stalled_upload = gen_equ(64)
+    stalled_pkt = gen_ext_hdr(len(stalled_upload), "slow.equ", 7) + stalled_upload
+    with socket.create_connection(("127.0.0.1", 31344)) as stalled:
+        stalled.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        stalled.sendall(stalled_pkt[:NET_HDR_SZ - 18])
+        with socket.create_connection(("127.0.0.1", 31344)) as other:
+            other.settimeout(5)
+            upload = gen_equ(64)
+            other.sendall(gen_ext_hdr(len(upload), "fast.equ", 1) + upload)
+            try:
+                if solved_ok(upload, recv_reply(other)[3]):
+                    tests_passed += 1
+            except socket.timeout:
+                print("A stalled connection held up the shard")
+
+        # the rest crosses the 48 byte legacy header, the extension and the payload
+        for at in range(NET_HDR_SZ - 18, len(stalled_pkt), 7):
+            stalled.sendall(stalled_pkt[at:at + 7])
+            time.sleep(0.001)
+        request_id, status, _, payload = recv_reply(stalled)
+        if request_id == 7 and status == NET_STATUS_OK and solved_ok(stalled_upload, payload):
+            tests_passed += 1
+        else:
+            print("A request sent a few bytes at a time was answered wrongly")
+    stop_server(server)
+
+    return tests_passed - 2
+
+
+def filler_equ(num_equ, numeq=None):
+    """An unsolved file of num_equ 0 + 0 equations, quicker to make than
+    generated ones when only its size matters"""
+    hdr = struct.pack("<IQQcIH", EquGrader.EQU_HDR_MAGIC, 1, num_equ if numeq is None else numeq, b"\x00",
+                      EquGrader.EQU_HDR_SIZE, 0)
+    equation = bytes(13) + EquGrader.OPERATORS["ADD"] + bytes(EquGrader.SER_EQU_SIZE - 14)
+    return hdr + equation * num_equ
+
+
+def check_admission():
+    """Requests over the in-flight equation cap are refused NET_STATUS_BUSY
+    with a retry delay. A compressed upload is charged the equations it
+    declares, not its size. Under -r a client's second request in a burst
+    of one is refused until the delay it is given has passed, and another
+    client's requests do not refill its bucket"""
+    tests_passed = 0
+    server = start_server(31345, "-e", "1500000")
+    held = filler_equ(1000000)
+    with socket.create_connection(("127.0.0.1", 31345)) as holder, \
+            socket.create_connection(("127.0.0.1", 31345)) as s:
+        # the unread streamed answer keeps a million equations in flight
+        holder.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4096)
+        holder.sendall(gen_ext_hdr(len(held), "held.equ", 1) + held)
+        time.sleep(0.5)
+        packed = gzip.compress(filler_equ(10, 1000000))
+        s.sendall(gen_ext_hdr(len(packed), "many.equ", 2) + packed)
+        _, status, retry_ms, _ = recv_reply(s)
+        if status == NET_STATUS_BUSY and retry_ms > 0:
+            tests_passed += 1
+        else:
+            print(f"An upload declaring a million equations got status {status}, retry {retry_ms}")
+        upload = gen_equ(10)
+        s.sendall(gen_ext_hdr(len(upload), "few.equ", 3) + upload)
+        _, status, _, payload = recv_reply(s)
+        if status == NET_STATUS_OK and solved_ok(upload, payload):
+            tests_passed += 1
+        else:
+            print("A small upload was refused beside the held one")
+    stop_server(server)
+
+    server = start_server(31346, "-r", "1", "-b", "1")
+    upload = gen_equ(10)
+    with socket.create_connection(("127.0.0.1", 31346)) as s:
+        s.sendall(b"".join(gen_ext_hdr(len(upload), "rate.equ", i) + upload for i in (1, 2)))
+        replies = sorted(recv_reply(s)[:3] for _ in range(2))
+        if replies[0][1] == NET_STATUS_OK and replies[1][1] == NET_STATUS_BUSY and 0 < replies[1][2] <= 1000:
+            tests_passed += 1
+            time.sleep(replies[1][2] / 1000)
+            s.sendall(gen_ext_hdr(len(upload), "rate.equ", 3) + upload)
+            if recv_reply(s)[1] == NET_STATUS_OK:
+                tests_passed += 1
+            else:
+                print("A retry after the given delay was refused")
+        else:
+            print("Rate limited replies were", replies)
+    stop_server(server)
+
+    server = start_server(31346, "-r", "1", "-b", "1")
+    statuses = []
+    for source, i in (("127.0.0.1", 1), ("127.0.0.2", 2), ("127.0.0.1", 3)):
+        with socket.create_connection(("127.0.0.1", 31346), source_address=(source, 0)) as s:
+            s.sendall(gen_ext_hdr(len(upload), "rate.equ", i) + upload)
+            statuses.append(recv_reply(s)[1])
+    if statuses == [NET_STATUS_OK, NET_STATUS_OK, NET_STATUS_BUSY]:
+        tests_passed += 1
+    else:
+        print("Two clients taking turns were answered", statuses)
+    stop_server(server)
+
+    return tests_passed - 5
+
+
+def loadgen(port, *options):
+    """Runs netcalc_loadgen against port, returns its exit status and the
+    counts of its Requests line"""
+    run = subprocess.run([f"{NETCALC_BUILD}/netcalc_loadgen", "-p", str(port), *options],
+                         stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True, timeout=60)
+    counts = re.search(r"Requests: +(\d+) issued, (\d+) ok, (\d+) busy, (\d+) errors, (\d+) dropped", run.stdout)
+    if counts is None or "Latency us:" not in run.stdout:
+        return run.returncode, None
+    return run.returncode, tuple(int(c) for c in counts.groups())
+
+
+def check_loadgen():
+    """netcalc_loadgen gets every request it issues answered, closed loop
+    over .equ files and open loop over batches, and counts the refusals of
+    a rate limited server as busy rather than errors. It fails when there
+    is no server"""
+    tests_passed = 0
+    server = start_server(31347)
+    runs = [("-c", "4", "-T", "2", "-d", "4", "-t", "30", "-N", "200", "-z", "uniform:1:64"),
+            ("-c", "2", "-t", "30", "-N", "100", "-R", "500", "-k", "batch")]
+    for options in runs:
+        rv, counts = loadgen(31347, *options)
+        requests = int(options[options.index("-N") + 1])
+        if rv == 0 and counts == (requests, requests, 0, 0, 0):
+            tests_passed += 1
+        else:
+            print("loadgen", *options, "returned", rv, counts)
+    stop_server(server)
+
+    server = start_server(31347, "-r", "50", "-b", "5")
+    rv, counts = loadgen(31347, "-c", "2", "-t", "30", "-N", "100")
+    if rv == 0 and counts is not None and counts[0] == 100 and counts[2] > 0 and counts[1] + counts[2] == 100:
+        tests_passed += 1
+    else:
+        print("loadgen against a rate limited server returned", rv, counts)
+    stop_server(server)
+
+    if loadgen(31347, "-N", "10")[0] != 0:
+        tests_passed += 1
+    else:
+        print("loadgen succeeded without a server")
+
+    return tests_passed - 4
+
+
+def netcoord(tests_base, *workers):
+    """Runs netcoord over tests_base with a -w for each worker port, returns
+    its exit status and output"""
+    options = [arg for port in workers for arg in ("-w", f"127.0.0.1:{port}")]
+    run = subprocess.run([f"{NETCALC_BUILD}/netcoord", f"{tests_base}/unsolved", f"{tests_base}/solved", *options],
+                         stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True, timeout=120)
+    return run.returncode, run.stdout
+
+
+def short_reply_worker(listener):
+    """Plays a worker that answers its first request with a header whose
+    pkt_len is shorter than the header itself, then stops listening"""
+    conn, _ = listener.accept()
+    listener.close()
+    with conn:
+        recv_exact(conn, NET_HDR_EXT_SZ)
+        conn.sendall(struct.pack("!IIQ32sQHHI", NET_HDR_EXT_SZ, 0, NET_HDR_EXT_SZ // 2, b"", 0, 0, 0, 0))
+        # closing with uploads unread would reset the connection before
+        # netcoord read the reply, so wait for netcoord to hang up
+        conn.settimeout(30)
+        while conn.recv(65536):
+            pass
+
+
+def truncated_reply_worker(listener, replies):
+    """Plays a worker that answers each of replies connections with an OK
+    header and part of its payload, then hangs up"""
+    for _ in range(replies):
+        conn, _ = listener.accept()
+        with conn:
+            hdr = recv_exact(conn, NET_HDR_EXT_SZ)
+            hdr_len, _, pkt_len, _, request_id = struct.unpack("!IIQ32sQ", hdr[:56])
+            recv_exact(conn, pkt_len - hdr_len)
+            conn.sendall(struct.pack("!IIQ32sQHHI", NET_HDR_EXT_SZ, 0, NET_HDR_EXT_SZ + 4096, b"", request_id,
+                                     0, 0, NET_STATUS_OK))
+            conn.sendall(bytes(100))
+    listener.close()
+
+
+def check_netcoord():
+    """netcoord spreads a directory over several netcalc workers and every
+    solved file grades. A worker sending a reply shorter than its header is
+    dropped and its files are solved by the others. A reply cut short never
+    leaves a solved file behind"""
+    tests_passed = 0
+    tests_base = "./netcoord_tests/"
+    ports = (31348, 31349, 31350)
+    servers = [start_server(port) for port in ports]
+    EquGrader.setup(tests_base, 48, 256)
+    rv, output = netcoord(tests_base, *ports)
+    per_worker = [int(n) for n in re.findall(r"Worker \S+ solved (\d+) files", output)]
+    if rv == 0 and "Solved 48 files, failed 0" in output and EquGrader.grade_dirs(tests_base) == 0:
+        tests_passed += 1
+    else:
+        print("netcoord over three workers failed:", output)
+    if len(per_worker) == len(ports) and all(n > 0 for n in per_worker):
+        tests_passed += 1
+    else:
+        print("Some workers were given no files:", per_worker)
+    EquGrader.cleanup(tests_base)
+
+    listener = socket.create_server(("127.0.0.1", 31351))
+    fake = threading.Thread(target=short_reply_worker, args=(listener,))
+    fake.start()
+    EquGrader.setup(tests_base, 16, 256)
+    rv, output = netcoord(tests_base, 31351, ports[0])
+    fake.join()
+    if (rv == 0 and "127.0.0.1:31351 sent a malformed reply" in output and "Solved 16 files, failed 0" in output and
+            EquGrader.grade_dirs(tests_base) == 0):
+        tests_passed += 1
+    else:
+        print("netcoord did not recover from a malformed reply:", output)
+    EquGrader.cleanup(tests_base)
+    for server in servers:
+        stop_server(server)
+
+    listener = socket.create_server(("127.0.0.1", 31351))
+    fake = threading.Thread(target=truncated_reply_worker, args=(listener, 4))
+    fake.start()
+    EquGrader.setup(tests_base, 1, 256)
+    rv, output = netcoord(tests_base, 31351)
+    fake.join()
+    leftover = os.listdir(f"{tests_base}/solved")
+    if "Giving up on" in output and "failed 1" in output and not leftover:
+        tests_passed += 1
+    else:
+        print("netcoord left", leftover, "after truncated replies:", output)
+    EquGrader.cleanup(tests_base)
+
+    return tests_passed - 4
+
+
+def connection_round(port, idle, churn):
+    """Holds idle connections part way through a header while churn others
+    each send a request and close, then finishes a request on every held
+    one. Returns the number of requests answered correctly"""
+    upload = gen_equ(8)
+    request = gen_ext_hdr(len(upload), "idle.equ", 1) + upload
+    answered = 0
+    held = [socket.create_connection(("127.0.0.1", port)) for _ in range(idle)]
+    for s in held:
+        s.sendall(request[:NET_HDR_EXT_SZ // 2])
+    for _ in range(churn):
+        with socket.create_connection(("127.0.0.1", port)) as s:
+            s.sendall(request)
+            answered += solved_ok(upload, recv_reply(s)[3])
+    for s in held:
+        s.sendall(request[NET_HDR_EXT_SZ // 2:])
+    for s in held:
+        with s:
+            answered += solved_ok(upload, recv_reply(s)[3])
+    return answered
+
+
+def check_connection_churn():
+    """A shard holds many idle connections while others come and go, and
+    answers all of them. Connection state comes from the shard's slabs, so
+    a second round of the same churn reuses it rather than growing"""
+    tests_passed = 0
+    idle = 1000
+    churn = 500
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    resource.setrlimit(resource.RLIMIT_NOFILE, (min(hard, 4 * idle), hard))
+    server = start_server(31352, "-s", "1")
+    answered = connection_round(31352, idle, churn)
+    first_kb = vm_size_kb(server.pid, "VmRSS")
+    if answered == idle + churn:
+        tests_passed += 1
+    else:
+        print(f"Answered {answered} of {idle + churn} requests")
+    answered = connection_round(31352, idle, churn)
+    grown_kb = vm_size_kb(server.pid, "VmRSS") - first_kb
+    if answered == idle + churn and grown_kb < 4096:
+        tests_passed += 1
+    else:
+        print(f"Second round answered {answered} of {idle + churn} requests, grew {grown_kb} KiB")
+    stop_server(server)
+    resource.setrlimit(resource.RLIMIT_NOFILE, (soft, hard))
+
+    return tests_passed - 2
+
+
+def check_streaming():
+    """Large raw uploads are answered in chunks, each solved as the one
+    before it is sent. The answers grade whether legacy or pipelined
+    between small requests and read slowly, and an answer the client is
+    not reading costs the server a chunk rather than the whole answer"""
+    tests_passed = 0
+    server = start_server(31353)
+    with socket.create_connection(("127.0.0.1", 31353)) as s:
+        upload = gen_equ(100000)
+        s.sendall(gen_net_hdr(len(upload), 7, "big.equ") + upload)
+        if solved_ok(upload, recv_reply(s)[3]):
+            tests_passed += 1
+        else:
+            print("A streamed legacy answer did not grade")
+
+    uploads = {1: gen_equ(60000), 2: gen_equ(10), 3: gen_equ(80000), 4: gen_equ(10)}
+    with socket.create_connection(("127.0.0.1", 31353)) as s:
+        s.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4096)
+        s.sendall(b"".join(gen_ext_hdr(len(u), "mix.equ", i) + u for i, u in uploads.items()))
+        # let the streams stall on a full socket before reading them
+        time.sleep(0.5)
+        answered = {}
+        for _ in uploads:
+            request_id, status, _, payload = recv_reply(s)
+            if status == NET_STATUS_OK and request_id in uploads:
+                answered[request_id] = payload
+        if len(answered) == len(uploads) and all(solved_ok(uploads[i], answered[i]) for i in answered):
+            tests_passed += 1
+        else:
+            print("Pipelined streamed answers were not each answered correctly")
+
+    held = filler_equ(1000000)
+    before_kb = vm_size_kb(server.pid, "VmRSS")
+    with socket.create_connection(("127.0.0.1", 31353)) as s:
+        s.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4096)
+        s.sendall(gen_ext_hdr(len(held), "held.equ", 1) + held)
+        time.sleep(1)
+        # the upload stays in memory, a whole answer would add 13 MiB more
+        grown_kb = vm_size_kb(server.pid, "VmRSS") - before_kb
+        if grown_kb < len(held) // 1024 + 4096:
+            tests_passed += 1
+        else:
+            print(f"An unread answer grew the server by {grown_kb} KiB")
+    stop_server(server)
+
+    return tests_passed - 3
+
+
+def cpu_ticks(pid):
+    """User and system clock ticks a process has used"""
+    with open(f"/proc/{pid}/stat") as stat:
+        fields = stat.read().rsplit(")", 1)[1].split()
+    return int(fields[11]) + int(fields[12])
+
+
+def check_idle_workers():
+    """Idle threadpool workers park on a futex instead of spinning, so an
+    idle server with eight of them uses almost no cpu. Offloaded requests
+    still wake them, and they park again once the burst is solved"""
+    tests_passed = 0
+    idle_ticks = os.sysconf("SC_CLK_TCK") // 10
+    server = start_server(31354, "-n", "8", "-s", "2", "-l", "1024")
+    time.sleep(0.5)
+    before = cpu_ticks(server.pid)
+    time.sleep(2)
+    if cpu_ticks(server.pid) - before < idle_ticks:
+        tests_passed += 1
+    else:
+        print(f"An idle server used {cpu_ticks(server.pid) - before} ticks in 2 s")
+
+    uploads = [gen_equ(4096) for _ in range(16)]
+    sockets = [socket.create_connection(("127.0.0.1", 31354)) for _ in uploads]
+    for s, upload in zip(sockets, uploads):
+        packed = gzip.compress(upload)
+        s.sendall(gen_net_hdr(len(packed), 7, "off.equ") + packed)
+    answered = 0
+    for s, upload in zip(sockets, uploads):
+        with s:
+            answered += solved_ok(upload, recv_reply(s)[3])
+    if answered == len(uploads):
+        tests_passed += 1
+    else:
+        print(f"Parked workers answered {answered} of {len(uploads)} offloaded requests")
+
+    time.sleep(0.5)
+    before = cpu_ticks(server.pid)
+    time.sleep(2)
+    if cpu_ticks(server.pid) - before < idle_ticks:
+        tests_passed += 1
+    else:
+        print(f"Workers did not park again, {cpu_ticks(server.pid) - before} ticks in 2 s")
+    output = stop_server(server)
+    offloaded = re.search(r"(\d+) offloaded", output)
+    if offloaded and int(offloaded.group(1)) == len(uploads):
+        tests_passed += 1
+    else:
+        print("The burst was not offloaded:", output)
+
+    return tests_passed - 4
+
+
+def task_cpus(pid):
+    """Cpus each thread of a process may run on, as sets"""
+    cpus = []
+    for task in os.listdir(f"/proc/{pid}/task"):
+        with open(f"/proc/{pid}/task/{task}/status") as status:
+            for line in status:
+                if line.startswith("Cpus_allowed_list:"):
+                    allowed = set()
+                    for part in line.split(":")[1].strip().split(","):
+                        first, _, last = part.partition("-")
+                        allowed.update(range(int(first), int(last or first) + 1))
+                    cpus.append(allowed)
+    return cpus
+
+
+def check_placement():
+    """Under -a cores each worker is pinned to one cpu, taken round robin
+    from those the server may use; without -a no thread is pinned"""
+    tests_passed = 0
+    threads = 4
+    usable = os.sched_getaffinity(0)
+    server = start_server(31355, "-n", str(threads), "-s", "1", "-a", "cores")
+    pinned = [cpus for cpus in task_cpus(server.pid) if len(cpus) == 1]
+    used = set().union(*pinned)
+    if len(pinned) >= threads and used <= usable and len(used) == min(threads, len(usable)):
+        tests_passed += 1
+    else:
+        print("Workers were not pinned round robin:", task_cpus(server.pid))
+    stop_server(server)
+
+    server = start_server(31355, "-n", str(threads), "-s", "1")
+    if all(cpus == usable for cpus in task_cpus(server.pid)):
+        tests_passed += 1
+    else:
+        print("Threads were pinned without -a:", task_cpus(server.pid))
+    stop_server(server)
+
+    return tests_passed - 2
+
+
+def check_elastic_pool():
+    """With -n 1 -x 4 a backlog of offloaded requests grows the pool past
+    one thread, every request is answered, and the extra threads retire
+    once they have idled for -w seconds"""
+    tests_passed = 0
+    server = start_server(31356, "-n", "1", "-x", "4", "-w", "1", "-s", "1", "-l", "1024")
+    idle_threads = len(os.listdir(f"/proc/{server.pid}/task"))
+    peak = [idle_threads]
+    sampling = threading.Event()
+
+    def sample():
+        while not sampling.is_set():
+            peak[0] = max(peak[0], len(os.listdir(f"/proc/{server.pid}/task")))
+            time.sleep(0.005)
+
+    uploads = [gen_equ(20000) for _ in range(12)]
+    sampler = threading.Thread(target=sample)
+    sampler.start()
+    sockets = [socket.create_connection(("127.0.0.1", 31356)) for _ in uploads]
+    for s, upload in zip(sockets, uploads):
+        packed = gzip.compress(upload)
+        s.sendall(gen_net_hdr(len(packed), 7, "grow.equ") + packed)
+    answered = 0
+    for s, upload in zip(sockets, uploads):
+        with s:
+            answered += solved_ok(upload, recv_reply(s)[3])
+    sampling.set()
+    sampler.join()
+    if answered == len(uploads) and idle_threads < peak[0] <= idle_threads + 3:
+        tests_passed += 1
+    else:
+        print(f"Answered {answered} of {len(uploads)}, threads went from {idle_threads} to {peak[0]}")
+
+    deadline = time.time() + 10
+    while len(os.listdir(f"/proc/{server.pid}/task")) > idle_threads and time.time() < deadline:
+        time.sleep(0.1)
+    if len(os.listdir(f"/proc/{server.pid}/task")) == idle_threads:
+        tests_passed += 1
+    else:
+        print("Threads above -n did not retire:", len(os.listdir(f"/proc/{server.pid}/task")))
+    stop_server(server)
+
+    return tests_passed - 2
+
+
+def skip_reply(s):
+    """Reads one legacy reply without keeping its payload. Returns the
+    payload size"""
+    _, _, pkt_len = struct.unpack("!IIQ", recv_exact(s, NET_HDR_SZ)[:16])
+    left = pkt_len - NET_HDR_SZ
+    while left > 0:
+        left -= len(recv_exact(s, min(left, 1 << 20)))
+    return pkt_len - NET_HDR_SZ
+
+
+def offload_and_stop(server, port, count):
+    """Sends count uploads of the most equations a request may hold, each on
+    its own connection, to a server on port that offloads them, interrupts
+    it while they are being solved and collects the replies. Returns
+    (complete answers, connections closed without an answer, server
+    output)"""
+    answered = []
+    closed = []
+    # grading millions of equations in python takes too long, so the
+    # answers are only sized
+    packed = gzip.compress(filler_equ(NET_NUMEQ_MAX))
+    solved_size = EquGrader.EQU_HDR_SIZE + EquGrader.SOLV_EQU_SIZE * NET_NUMEQ_MAX
+
+    def client(s):
+        with s:
+            try:
+                answered.append(skip_reply(s) == solved_size)
+            except ConnectionError:
+                closed.append(s)
+
+    clients = []
+    for _ in range(count):
+        s = socket.create_connection(("127.0.0.1", port))
+        s.sendall(gen_net_hdr(len(packed), 7, "drn.equ") + packed)
+        clients.append(threading.Thread(target=client, args=(s,)))
+    for c in clients:
+        c.start()
+    output = stop_server(server)
+    for c in clients:
+        c.join()
+    return answered.count(True), len(closed), output
+
+
+def check_drain():
+    """On SIGINT the server stops accepting and, within -g seconds, finishes
+    the offloaded requests it already started and delivers their replies.
+    With -g 0 the queued ones are dropped and their connections closed"""
+    tests_passed = 0
+    count = 8
+    options = ("-n", "1", "-s", "1", "-l", "1024", "-e", str(count * NET_NUMEQ_MAX))
+    shutdown_counts = r"(\d+) offloaded requests solved, (\d+) finished while draining, (\d+) dropped"
+
+    server = start_server(31357, *options, "-g", "30")
+    answered, closed, output = offload_and_stop(server, 31357, count)
+    shutdown = re.search(shutdown_counts, output)
+    if (answered == count and closed == 0 and shutdown and int(shutdown.group(1)) == count and
+            int(shutdown.group(3)) == 0):
+        tests_passed += 1
+    else:
+        print(f"Draining answered {answered}, closed {closed}:", output)
+
+    server = start_server(31357, *options, "-g", "0")
+    answered, closed, output = offload_and_stop(server, 31357, count)
+    shutdown = re.search(shutdown_counts, output)
+    if shutdown and int(shutdown.group(3)) > 0 and closed > 0 and answered + closed == count:
+        tests_passed += 1
+    else:
+        print(f"Stopping at once answered {answered}, closed {closed}:", output)
+
+    return tests_passed - 2
+
+
+def scrape(port, path="/metrics"):
+    """GETs path from a metrics port. Returns (HTTP status, {sample: value},
+    {metric: type}), the samples keyed by name and labels as exported"""
+    try:
+        with urllib.request.urlopen(f"http://127.0.0.1:{port}{path}", timeout=10) as response:
+            status, text = response.status, response.read().decode()
+    except urllib.error.HTTPError as e:
+        return e.code, {}, {}
+    samples = {}
+    types = {}
+    for line in text.splitlines():
+        if line.startswith("# TYPE "):
+            _, _, name, kind = line.split()
+            types[name] = kind
+        elif line and not line.startswith("#"):
+            name, value = line.rsplit(" ", 1)
+            samples[name] = float(value)
+    return status, samples, types
+
+
+def check_metrics():
+    """-M serves Prometheus text at /metrics. Every sample belongs to a
+    described metric, and requests, solved equations by operator, bad
+    headers, connections and the latency histogram count what was sent.
+    Other paths get 404"""
+    tests_passed = 0
+    server = start_server(31358, "-M", "31359", "-n", "2")
+    status, before, types = scrape(31359)
+    described = all(re.sub(r"(_bucket|_sum|_count)$", "", name.split("{")[0]) in types or
+                    name.split("{")[0] in types for name in before)
+    if status == 200 and described and types.get("netcalc_requests_total") == "counter":
+        tests_passed += 1
+    else:
+        print("A first scrape returned", status, types)
+
+    upload = filler_equ(100)
+    with socket.create_connection(("127.0.0.1", 31358)) as s:
+        for i in range(5):
+            s.sendall(gen_ext_hdr(len(upload), "met.equ", i) + upload)
+            recv_reply(s)
+    with socket.create_connection(("127.0.0.1", 31358)) as s:
+        s.sendall(gen_net_hdr(len(upload), 8, "bad.equ") + upload)
+        recv_reply(s)
+
+    def grew(sample):
+        return after.get(sample, 0) - before.get(sample, 0)
+
+    # the bad header is answered too, with a status
+    expected = {
+        'netcalc_requests_total{type="equ"}': 6,
+        'netcalc_equations_solved_total{operator="add"}': 500,
+        'netcalc_errors_total{type="badhdr"}': 1,
+        "netcalc_connections_accepted_total": 2,
+        "netcalc_request_duration_seconds_count": 6,
+    }
+    # a reply is counted once its last byte is sent, which can be just
+    # after the client has read it
+    deadline = time.time() + 5
+    after = scrape(31359)[1]
+    while any(grew(sample) != n for sample, n in expected.items()) and time.time() < deadline:
+        time.sleep(0.05)
+        after = scrape(31359)[1]
+    if all(grew(sample) == n for sample, n in expected.items()) and after["netcalc_received_bytes_total"] > 0:
+        tests_passed += 1
+    else:
+        print("Metrics grew by", {sample: grew(sample) for sample in expected})
+
+    if scrape(31359, "/other")[0] == 404:
+        tests_passed += 1
+    else:
+        print("An unknown path was not refused")
+    stop_server(server)
+
+    return tests_passed - 3
+
+
+def check_probes():
+    """A build with sys/sdt.h carries a .note.stapsdt entry for every
+    netcalc and threadpool probe. Skipped without sys/sdt.h"""
+    with open(NETCALC_CACHE) as cf:
+        if "HAVE_SYS_SDT_H:INTERNAL=1" not in cf.read():
+            print("Built without sys/sdt.h, skipping USDT probes")
+            return 0
+    notes = subprocess.run(["readelf", "-n", f"{NETCALC_BUILD}/netcalc"], stdout=subprocess.PIPE, text=True).stdout
+    probes = set(f"{p}:{n}" for p, n in re.findall(r"Provider: (\S+)\s+Name: (\S+)", notes))
+    expected = {"netcalc:conn__accept", "netcalc:request__header", "netcalc:response__sent",
+                "threadpool:push__work", "threadpool:pull__work"}
+    if expected <= probes:
+        return 0
+    print("netcalc is missing USDT probes:", expected - probes)
+    return -1
+
+
 def main():
     result = 0
     tests_base =  "./netcalc_tests/"
@@ -116,8 +1065,31 @@ def main():
     result = EquGrader.grade_dirs(tests_base)
     EquGrader.cleanup(tests_base)
 
+    checks = [
+        check_pipelining,
+        check_sharding,
+        check_cache,
+        check_batches,
+        check_partial_reads,
+        check_admission,
+        check_loadgen,
+        check_netcoord,
+        check_connection_churn,
+        check_streaming,
+        check_idle_workers,
+        check_placement,
+        check_elastic_pool,
+        check_drain,
+        check_metrics,
+        check_probes,
+    ]
+    for check in checks:
+        passed = check()
+        print(f"{check.__name__}: {'passed' if passed == 0 else 'FAILED'}")
+        result += passed
+
     return result
 
 
 if __name__ == "__main__":
-    main()
+    exit(main())
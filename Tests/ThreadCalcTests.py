@@ -1,9 +1,403 @@
+import gzip
+import json
 import os
+import re
+import shutil
+import subprocess
+import tempfile
 import EquGrader
 
-            
-def run_binary():
-    os.system("../build/4_ThreadCalc/threadcalc ./threadcalc_tests/unsolved ./threadcalc_tests/solved")
+# ctest points CALC_BUILD at its build tree; ./build is where build.sh puts it
+BUILD_DIR = os.environ.get("CALC_BUILD", "./build")
+THREADCALC = f"{BUILD_DIR}/4_ThreadCalc/threadcalc"
+EQLOOKUP = f"{BUILD_DIR}/4_ThreadCalc/eqlookup"
+EQDECODE = f"{BUILD_DIR}/4_ThreadCalc/eqdecode"
+
+
+def run_binary(tests_base="./threadcalc_tests/", *options):
+    """Runs threadcalc over tests_base and returns its output"""
+    run = subprocess.run([THREADCALC, f"{tests_base}/unsolved", f"{tests_base}/solved", *options],
+                         stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+    return run.stdout
+
+
+def expected_solutions(path):
+    """Solutions the grader expects for an unsolved file, in file order"""
+    with open(path, "rb") as ef:
+        buf = ef.read()
+    hdr = EquGrader.UnpackedHeader(buf)
+    solutions = []
+    for i in range(hdr.numequ):
+        start = hdr.offset + i * EquGrader.SER_EQU_SIZE
+        solutions.append(EquGrader.Solution(EquGrader.Equation(buf[start:start + EquGrader.SER_EQU_SIZE])))
+    return hdr, solutions
+
+
+def solved_records(path, count):
+    """First count solved records of a solved file"""
+    with open(path, "rb") as sf:
+        buf = sf.read()
+    hdr = EquGrader.UnpackedHeader(buf)
+    records = []
+    for i in range(count):
+        start = hdr.offset + i * EquGrader.SOLV_EQU_SIZE
+        records.append(EquGrader.Solution(buf[start:start + EquGrader.SOLV_EQU_SIZE]))
+    return hdr, records
+
+
+def file_pairs(tests_base):
+    """(unsolved, solved) paths matched by file id, solved is None when missing"""
+    solved = {}
+    for name in os.listdir(f"{tests_base}/solved"):
+        path = f"{tests_base}/solved/{name}"
+        if EquGrader.checkheader(path) == 1:
+            solved[EquGrader.UnpackedHeader(open(path, "rb").read(27)).fileid] = path
+    pairs = []
+    for name in sorted(os.listdir(f"{tests_base}/unsolved")):
+        path = f"{tests_base}/unsolved/{name}"
+        pairs.append((path, solved.get(EquGrader.UnpackedHeader(open(path, "rb").read(27)).fileid)))
+    return pairs
+
+
+def write_with_optheaders(path, num_equ, optbytes):
+    """Writes an unsolved file whose equations start optbytes past the header"""
+    equ_file = EquGrader.EquFile()
+    equ_file.gen_equations(num_equ)
+    equ_file.equ_offset = EquGrader.EQU_HDR_SIZE + optbytes
+    equ_file.num_opt_hdrs = 1
+    equ_file.equations.insert(0, os.urandom(optbytes))
+    equ_file.write_file(path)
+
+
+def check_indexed_lookup():
+    """-i appends an eqid index that eqlookup answers from, files with
+    optional headers included, and the solved files still grade"""
+    tests_passed = 0
+    tests_total = 1
+    tests_base = "./threadcalc_indexed/"
+    EquGrader.setup(tests_base, 8, 512)
+    write_with_optheaders(f"{tests_base}/unsolved/optheaders.equ", 512, 16)
+    run_binary(tests_base, "-i")
+    if EquGrader.grade_dirs(tests_base) == 0:
+        tests_passed += 1
+
+    for unsolved, solved in file_pairs(tests_base):
+        tests_total += 1
+        if solved is None:
+            continue
+        _, expected = expected_solutions(unsolved)
+        ids = [s.id for s in expected]
+        wanted = {s.id: s for s in expected if ids.count(s.id) == 1}
+        picked = list(wanted)[::64]
+        missing = max(ids) + 1
+        run = subprocess.run([EQLOOKUP, solved] + [str(i) for i in picked + [missing]],
+                             stdout=subprocess.PIPE, text=True)
+        found = {}
+        for line in run.stdout.splitlines():
+            fields = line.split()
+            if len(fields) == 4 and fields[3].startswith("solution="):
+                found[int(fields[0])] = int(fields[3].split("=")[1])
+        if (all(found.get(i) == wanted[i].solution for i in picked) and missing not in found and
+                f"{missing} not found" in run.stdout):
+            tests_passed += 1
+        else:
+            print("eqlookup gave wrong answers for", solved)
+            print(run.stdout)
+    EquGrader.cleanup(tests_base)
+
+    return tests_passed - tests_total
+
+
+def check_columnar_decode():
+    """-c writes compressed columnar blocks; eqdecode turns them back into
+    solved files that grade, whether its futures decode them on one thread,
+    several or more threads than there are blocks"""
+    tests_passed = 0
+    tests_base = "./threadcalc_columnar/"
+    EquGrader.setup(tests_base, 8, 20000)
+    EquGrader.generate_files(4, 64, f"{tests_base}/unsolved")
+    run_binary(tests_base, "-c")
+    os.rename(f"{tests_base}/solved", f"{tests_base}/columnar")
+
+    for threads in ("1", "4", "64"):
+        os.mkdir(f"{tests_base}/solved")
+        for name in os.listdir(f"{tests_base}/columnar"):
+            subprocess.run([EQDECODE, f"{tests_base}/columnar/{name}", f"{tests_base}/solved/{name}", "-n", threads],
+                           stdout=subprocess.DEVNULL)
+        if EquGrader.grade_dirs(tests_base) == 0:
+            tests_passed += 1
+        shutil.rmtree(f"{tests_base}/solved")
+    EquGrader.cleanup(tests_base)
+
+    return tests_passed - 3
+
+
+def compress(path, codec):
+    """Replaces an unsolved file with a compressed copy, returns its bytes"""
+    with open(path, "rb") as ef:
+        raw = ef.read()
+    with open(f"{path}.{codec}", "wb") as cf:
+        if codec == "gzip":
+            cf.write(gzip.compress(raw))
+        else:
+            subprocess.run([codec, "-q", "-c", path], stdout=cf, stderr=subprocess.DEVNULL)
+    os.remove(path)
+    return raw
+
+
+def check_compressed_input():
+    """gzip, zstd and lz4 unsolved files are decompressed as they are read.
+    A codec this build or this machine lacks is skipped"""
+    tests_passed = 0
+    tests_total = 0
+    tests_base = "./threadcalc_compressed/"
+    for codec in ("gzip", "zstd", "lz4"):
+        if codec != "gzip" and shutil.which(codec) is None:
+            print(f"No {codec} tool, skipping {codec} input")
+            continue
+        EquGrader.setup(tests_base, 8, 4096)
+        raws = {}
+        for name in os.listdir(f"{tests_base}/unsolved"):
+            path = f"{tests_base}/unsolved/{name}"
+            raws[path] = compress(path, codec)
+        output = run_binary(tests_base)
+        if "not supported by this build" in output:
+            print(f"Built without {codec}, skipping {codec} input")
+            EquGrader.cleanup(tests_base)
+            continue
+        # the grader reads the equations from uncompressed files
+        shutil.rmtree(f"{tests_base}/unsolved")
+        os.mkdir(f"{tests_base}/unsolved")
+        for path, raw in raws.items():
+            with open(path, "wb") as ef:
+                ef.write(raw)
+        tests_total += 1
+        if EquGrader.grade_dirs(tests_base) == 0:
+            tests_passed += 1
+        else:
+            print(f"{codec} input failed")
+        EquGrader.cleanup(tests_base)
+
+    return tests_passed - tests_total
+
+
+def check_thread_counts():
+    """Every file of the directory is submitted to one task group and
+    threadcalc waits on the group. More files than the queue holds are
+    solved whether one thread or many run them. A count below one is
+    refused"""
+    tests_passed = 0
+    tests_base = "./threadcalc_counts/"
+    EquGrader.setup(tests_base, 120, 64)
+    for threads in ("1", "3", "16"):
+        run_binary(tests_base, "-n", threads)
+        if EquGrader.grade_dirs(tests_base) == 0:
+            tests_passed += 1
+        else:
+            print(f"threadcalc -n {threads} failed")
+        shutil.rmtree(f"{tests_base}/solved")
+        os.mkdir(f"{tests_base}/solved")
+    for threads in ("0", "-3"):
+        run = subprocess.run([THREADCALC, f"{tests_base}/unsolved", f"{tests_base}/solved", "-n", threads],
+                             stdout=subprocess.DEVNULL)
+        if run.returncode == 1 and not os.listdir(f"{tests_base}/solved"):
+            tests_passed += 1
+        else:
+            print(f"threadcalc -n {threads} exited with {run.returncode}")
+    EquGrader.cleanup(tests_base)
+
+    return tests_passed - 5
+
+
+def check_placement():
+    """Files grade with workers pinned to cores, placed on nodes or both,
+    and an unknown placement runs unplaced"""
+    tests_passed = 0
+    tests_base = "./threadcalc_placed/"
+    EquGrader.setup(tests_base, 16, 1024)
+    placements = ("cores", "nodes", "both", "sideways")
+    for placement in placements:
+        output = run_binary(tests_base, "-n", "4", "-a", placement)
+        unknown = f"Unknown placement {placement}, running unplaced" in output
+        if EquGrader.grade_dirs(tests_base) == 0 and unknown == (placement == "sideways"):
+            tests_passed += 1
+        else:
+            print(f"threadcalc -a {placement} failed")
+        shutil.rmtree(f"{tests_base}/solved")
+        os.mkdir(f"{tests_base}/solved")
+    EquGrader.cleanup(tests_base)
+
+    return tests_passed - len(placements)
+
+
+def check_stage_timing():
+    """-t prints the time each stage took per thread and in total, and -j
+    writes the same counts as JSON. Every file is opened once and every
+    equation solved once, and the threads add up to the total"""
+    tests_passed = 0
+    tests_base = "./threadcalc_stages/"
+    num_files = 8
+    num_equ = 512
+    EquGrader.setup(tests_base, num_files, num_equ)
+    output = run_binary(tests_base, "-n", "2", "-t", "-j", f"{tests_base}/stages.json")
+    if EquGrader.grade_dirs(tests_base) == 0:
+        tests_passed += 1
+
+    rows = {}
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) == 5 and fields[1].isdigit():
+            rows[fields[0]] = (int(fields[1]), int(fields[2]))
+    if (rows.get("open") == (num_files, num_files) and rows.get("solve", (0, 0))[1] == num_files * num_equ and
+            "Stage time in ms" in output and re.search(r"^total( +[\d.]+){7}$", output, re.M)):
+        tests_passed += 1
+    else:
+        print("threadcalc -t printed:", output)
+
+    with open(f"{tests_base}/stages.json") as jf:
+        stages = json.load(jf)
+    total = stages["total"]
+    summed = {name: sum(t["stages"][name]["calls"] for t in stages["threads"]) for name in total}
+    if (1 <= len(stages["threads"]) <= 2 and total["open"]["calls"] == num_files and
+            total["solve"]["units"] == num_files * num_equ and
+            all(summed[name] == total[name]["calls"] for name in total)):
+        tests_passed += 1
+    else:
+        print("threadcalc -j wrote:", stages)
+    EquGrader.cleanup(tests_base)
+
+    return tests_passed - 3
+
+
+def usdt_probes(binary, cache):
+    """provider:name of each USDT probe a binary carries, None when the
+    build at cache found no sys/sdt.h"""
+    with open(cache) as cf:
+        if "HAVE_SYS_SDT_H:INTERNAL=1" not in cf.read():
+            return None
+    notes = subprocess.run(["readelf", "-n", binary], stdout=subprocess.PIPE, text=True).stdout
+    return set(f"{p}:{n}" for p, n in re.findall(r"Provider: (\S+)\s+Name: (\S+)", notes))
+
+
+def check_probes():
+    """A build with sys/sdt.h carries a .note.stapsdt entry for every
+    threadcalc, solver and threadpool probe. Skipped without sys/sdt.h"""
+    probes = usdt_probes(THREADCALC, f"{BUILD_DIR}/CMakeCache.txt")
+    if probes is None:
+        print("Built without sys/sdt.h, skipping USDT probes")
+        return 0
+    expected = {"threadcalc:file__start", "threadcalc:file__done", "equation:batch__start",
+                "equation:batch__done", "threadpool:push__work", "threadpool:pull__work"}
+    if expected <= probes:
+        return 0
+    print("threadcalc is missing USDT probes:", expected - probes)
+    return -1
+
+
+def check_profile():
+    """-p samples the workers and writes folded stacks, one "frame;frame
+    count" line per distinct stack, that flamegraph.pl reads, and names the
+    worker frames. The run is long enough to sample only because one file
+    is solved many times over, so its output is counted, not graded"""
+    tests_passed = 0
+    tests_base = "./threadcalc_profiled/"
+    copies = 100
+    EquGrader.setup(tests_base, 1, 20000)
+    original = f"{tests_base}/unsolved/{os.listdir(f'{tests_base}/unsolved')[0]}"
+    for i in range(1, copies):
+        shutil.copyfile(original, f"{original}.{i}")
+    run_binary(tests_base, "-n", "2", "-p", f"{tests_base}/profile.folded")
+    if len(os.listdir(f"{tests_base}/solved")) == copies:
+        tests_passed += 1
+    else:
+        print("threadcalc -p did not solve every file")
+
+    stacks = {}
+    if os.path.exists(f"{tests_base}/profile.folded"):
+        with open(f"{tests_base}/profile.folded") as pf:
+            for line in pf:
+                folded = re.fullmatch(r"([^ ;]+(?:;[^ ;]+)*) (\d+)\n", line)
+                if folded is None:
+                    stacks = None
+                    break
+                stacks[folded.group(1)] = int(folded.group(2))
+    if stacks and all(n > 0 for n in stacks.values()) and any("parse_file" in stack for stack in stacks):
+        tests_passed += 1
+    else:
+        print("threadcalc -p wrote no usable folded stacks:", stacks)
+    EquGrader.cleanup(tests_base)
+
+    return tests_passed - 2
+
+
+def configure(*options):
+    """Configures ThreadCalc in a scratch build tree. Returns cmake's exit
+    status, its output and the compile commands it would run"""
+    with tempfile.TemporaryDirectory() as build:
+        run = subprocess.run(["cmake", "-S", "./4_ThreadCalc", "-B", build, "-DCMAKE_EXPORT_COMPILE_COMMANDS=ON",
+                              *options], stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+        commands = []
+        if os.path.exists(f"{build}/compile_commands.json"):
+            with open(f"{build}/compile_commands.json") as cf:
+                commands = [c["command"] for c in json.load(cf)]
+        return run.returncode, run.stdout, commands
+
+
+def check_build_config():
+    """An unconfigured build is a Release with link time optimization for
+    any cpu of the architecture; -DCALC_MARCH=native adds -march=native to
+    every compile, and an unknown CALC_PGO stage is refused"""
+    tests_passed = 0
+    rv, output, commands = configure()
+    # lto is left out where the compiler cannot do it
+    if rv == 0 and re.search(r"^build type: Release( lto)?\s*$", output, re.M) and commands and \
+            not any("-march" in c for c in commands):
+        tests_passed += 1
+    else:
+        print("The default configure was not a portable Release:", output)
+
+    rv, output, commands = configure("-DCALC_MARCH=native")
+    if rv == 0 and "-march=native" in output and commands and all("-march=native" in c for c in commands):
+        tests_passed += 1
+    else:
+        print("-DCALC_MARCH=native did not reach the compiles:", output)
+
+    if configure("-DCALC_PGO=SIDEWAYS")[0] != 0:
+        tests_passed += 1
+    else:
+        print("An unknown CALC_PGO stage was accepted")
+
+    return tests_passed - 3
+
+
+def check_sorted_output():
+    """-s writes each solved file ordered by eqid. With -m 0 only 4096
+    records are sorted in memory, so the 20000 equation files are spilled
+    in runs and merged back"""
+    tests_passed = 0
+    tests_base = "./threadcalc_sorted/"
+    EquGrader.setup(tests_base, 4, 20000)
+    EquGrader.generate_files(4, 64, f"{tests_base}/unsolved")
+    run_binary(tests_base, "-s", "-m", "0")
+
+    pairs = file_pairs(tests_base)
+    for unsolved, solved in pairs:
+        if solved is None:
+            print("No sorted solution for", unsolved)
+            continue
+        hdr, expected = expected_solutions(unsolved)
+        _, given = solved_records(solved, hdr.numequ)
+        ids = [s.id for s in given]
+        # the grader accepts a matching solution whatever the flags
+        if ids != sorted(ids):
+            print("Solutions are not sorted by eqid:", solved)
+        elif sorted((s.id, s.solution) for s in given) != sorted((s.id, s.solution) for s in expected):
+            print("Sorted solutions differ from the equations:", solved)
+        else:
+            tests_passed += 1
+    EquGrader.cleanup(tests_base)
+
+    return tests_passed - len(pairs)
 
 
 def main():
@@ -13,13 +407,30 @@ def main():
     num_equ = 64
 
     EquGrader.setup(tests_base, num_files, num_equ)
-    run_binary()
+    run_binary(tests_base)
     result = EquGrader.grade_dirs(tests_base)
     EquGrader.cleanup(tests_base)
 
+    checks = [
+        check_thread_counts,
+        check_placement,
+        check_stage_timing,
+        check_probes,
+        check_profile,
+        check_build_config,
+        check_sorted_output,
+        check_indexed_lookup,
+        check_columnar_decode,
+        check_compressed_input,
+    ]
+    for check in checks:
+        passed = check()
+        print(f"{check.__name__}: {'passed' if passed == 0 else 'FAILED'}")
+        result += passed
+
     return result
 
 
 
 if __name__ == "__main__":
-    main()
+    exit(main())
@@ -0,0 +1,38 @@
+#!/bin/bash
+# Profile guided Release build into build/: builds instrumented binaries,
+# trains them on a generated equation corpus through threadcalc and
+# netcalc, then rebuilds every project from the profiles.
+# Usage: ./pgo.sh (optional <files>) (optional <equations per file>)
+
+FILES=${1:-64}
+EQUATIONS=${2:-4096}
+BUILD=${BUILD:-$PWD/build}
+CORPUS=$BUILD/pgo_corpus
+PORT=31399
+
+set -e
+
+cmake -S . -B $BUILD -DCMAKE_BUILD_TYPE=Release -DCALC_PGO=GENERATE
+rm -rf $BUILD/pgo
+cmake --build $BUILD -j$(nproc)
+
+echo "Generating ${FILES} files with ${EQUATIONS} equations"
+python3 -c "import sys; sys.path.insert(0, 'Tests'); import EquGrader; EquGrader.setup('$CORPUS', $FILES, $EQUATIONS)"
+
+echo "Training threadcalc"
+$BUILD/4_ThreadCalc/threadcalc $CORPUS/unsolved $CORPUS/solved
+
+echo "Training netcalc"
+$BUILD/5_NetCalc/netcalc -p $PORT &
+SERVER=$!
+sleep 1
+$BUILD/5_NetCalc/netcalc_loadgen -p $PORT -c 4 -t 5 -N 0 || true
+$BUILD/5_NetCalc/netcalc_loadgen -p $PORT -c 4 -t 5 -N 0 -k batch || true
+# profiles are written when the server exits normally
+kill -INT $SERVER
+wait $SERVER || true
+
+rm -rf $CORPUS
+cmake -S . -B $BUILD -DCALC_PGO=USE
+cmake --build $BUILD -j$(nproc)
+echo "Profile guided build in $BUILD, profiles in $BUILD/pgo"